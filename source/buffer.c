@@ -0,0 +1,103 @@
+/*
+    buffer.c - growable byte buffer implementation
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "buffer.h"
+
+#define _RRC_BUFFER_MIN_CAPACITY 1024
+
+void rrc_buffer_init(struct rrc_buffer *buffer)
+{
+    buffer->data = NULL;
+    buffer->len = 0;
+    buffer->capacity = 0;
+}
+
+struct rrc_result rrc_buffer_reserve(struct rrc_buffer *buffer, size_t capacity)
+{
+    if (capacity <= buffer->capacity)
+    {
+        return rrc_result_success;
+    }
+
+    u8 *data = realloc(buffer->data, capacity);
+    if (data == NULL)
+    {
+        return rrc_result_create_error_errno(ENOMEM, "Failed to grow buffer");
+    }
+
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return rrc_result_success;
+}
+
+struct rrc_result rrc_buffer_append(struct rrc_buffer *buffer, const void *data, size_t len)
+{
+    /* An empty buffer has no data to copy to yet, not even zero bytes. */
+    if (len == 0)
+    {
+        return rrc_result_success;
+    }
+
+    if (len > SIZE_MAX - buffer->len)
+    {
+        return rrc_result_create_error_errno(ENOMEM, "Buffer size overflow");
+    }
+    size_t needed = buffer->len + len;
+
+    if (needed > buffer->capacity)
+    {
+        size_t capacity = buffer->capacity > 0 ? buffer->capacity : _RRC_BUFFER_MIN_CAPACITY;
+        while (capacity < needed)
+        {
+            /* Doubling would wrap around, so grow to exactly what's needed instead. */
+            capacity = capacity > SIZE_MAX / 2 ? needed : capacity * 2;
+        }
+
+        TRY(rrc_buffer_reserve(buffer, capacity));
+    }
+
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len = needed;
+    return rrc_result_success;
+}
+
+char *rrc_buffer_take_string(struct rrc_buffer *buffer)
+{
+    const char terminator = '\0';
+    struct rrc_result res = rrc_buffer_append(buffer, &terminator, 1);
+    if (rrc_result_is_error(res))
+    {
+        rrc_result_free(res);
+        return NULL;
+    }
+
+    char *str = (char *)buffer->data;
+    rrc_buffer_init(buffer);
+    return str;
+}
+
+void rrc_buffer_free(struct rrc_buffer *buffer)
+{
+    free(buffer->data);
+    rrc_buffer_init(buffer);
+}
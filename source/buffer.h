@@ -0,0 +1,59 @@
+/*
+    buffer.h - growable byte buffer headers
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RRC_BUFFER_H
+#define RRC_BUFFER_H
+
+#include <stddef.h>
+#include <gctypes.h>
+
+#include "result.h"
+
+/*
+    A heap allocated byte buffer that grows geometrically, so appending many small chunks
+    only takes a logarithmic amount of reallocations.
+*/
+struct rrc_buffer
+{
+    u8 *data;
+    size_t len;
+    size_t capacity;
+};
+
+/*
+    Initialises an empty buffer. Doesn't allocate anything until data is added or reserved.
+*/
+void rrc_buffer_init(struct rrc_buffer *buffer);
+
+/*
+    Makes sure the buffer can hold at least `capacity' bytes without growing.
+    Useful when the final size is known up front, e.g. from a Content-Length header.
+*/
+struct rrc_result rrc_buffer_reserve(struct rrc_buffer *buffer, size_t capacity);
+
+struct rrc_result rrc_buffer_append(struct rrc_buffer *buffer, const void *data, size_t len);
+
+/*
+    NULL-terminates the buffer's contents and hands them over to the caller, who must `free' them.
+    The buffer is empty afterwards. Returns NULL if there was no memory for the terminator.
+*/
+char *rrc_buffer_take_string(struct rrc_buffer *buffer);
+
+void rrc_buffer_free(struct rrc_buffer *buffer);
+
+#endif
@@ -27,12 +27,22 @@
     regardless happen through this file due to the fact that it all shares the same
     global di_fd variable.
 */
+#include <gccore.h>
 #include <di/di.h>
 
 #include "string.h"
 #include "di.h"
 #include "util.h"
 
+#define RRC_DI_CMD_READ 0x71
+
+/* Woken up whenever a read finishes. */
+static lwpq_t _rrc_di_queue = LWP_TQUEUE_NULL;
+/* Reads submitted to IOS that haven't finished yet. Only changed with interrupts disabled, or from the IPC callback. */
+static volatile u32 _rrc_di_inflight = 0;
+/* Reads that haven't been waited on yet, newest first. */
+static struct rrc_di_request *_rrc_di_pending = NULL;
+
 int rrc_di_getfd()
 {
     // defined in di/di.h
@@ -118,3 +128,130 @@ int rrc_di_open_partition(u32 offset)
 {
     return DI_OpenPartition(offset);
 }
+
+static s32 _rrc_di_read_callback(s32 result, void *usrdata)
+{
+    // This runs in interrupt context.
+    struct rrc_di_request *req = usrdata;
+    req->ret = result;
+    req->done = true;
+    _rrc_di_inflight--;
+    LWP_ThreadBroadcast(_rrc_di_queue);
+    return 0;
+}
+
+int rrc_di_read_async(struct rrc_di_request *req, void *buf, u32 size, u32 offset)
+{
+    if (((u32)buf & 31) != 0)
+    {
+        RRC_FATAL("rrc_di_read_async() buffer must be aligned to 32 bytes, but is at address %p", buf);
+    }
+
+    if (_rrc_di_queue == LWP_TQUEUE_NULL && LWP_InitQueue(&_rrc_di_queue) != RRC_LWP_OK)
+    {
+        RRC_FATAL("Failed to create the DI request queue");
+    }
+
+    memset(req->dic, 0, sizeof(req->dic));
+    req->dic[0] = RRC_DI_CMD_READ << 24;
+    req->dic[1] = size;
+    req->dic[2] = offset;
+    req->buf = buf;
+    req->size = size;
+    req->ret = 0;
+    req->done = false;
+
+    // Same as the synchronous IPC functions do: sleep with interrupts disabled so that the wakeup can't be missed.
+    u32 level = IRQ_Disable();
+    while (_rrc_di_inflight >= RRC_DI_MAX_INFLIGHT)
+    {
+        LWP_ThreadSleep(_rrc_di_queue);
+    }
+    _rrc_di_inflight++;
+
+    s32 res = IOS_IoctlAsync(rrc_di_getfd(), RRC_DI_CMD_READ, req->dic, sizeof(req->dic), buf, size, _rrc_di_read_callback, req);
+    if (res < 0)
+    {
+        // The callback never runs for this one, so complete it here. Waiting on it then returns the error.
+        _rrc_di_inflight--;
+        req->ret = res;
+        req->done = true;
+        IRQ_Restore(level);
+        memset(buf, 0, size);
+        return res;
+    }
+
+    req->next = _rrc_di_pending;
+    _rrc_di_pending = req;
+    IRQ_Restore(level);
+
+    return RRC_DI_LIBDI_OK;
+}
+
+int rrc_di_read_wait(struct rrc_di_request *req)
+{
+    u32 level = IRQ_Disable();
+    struct rrc_di_request **link = &_rrc_di_pending;
+    while (*link != NULL && *link != req)
+    {
+        link = &(*link)->next;
+    }
+
+    // Only requests that are pending will ever be completed by the callback.
+    if (*link == NULL && !req->done)
+    {
+        IRQ_Restore(level);
+        return IPC_EINVAL;
+    }
+
+    while (!req->done)
+    {
+        LWP_ThreadSleep(_rrc_di_queue);
+    }
+
+    // Requests may have been submitted while we slept, so look for it again before unlinking it.
+    for (struct rrc_di_request **cur = &_rrc_di_pending; *cur != NULL; cur = &(*cur)->next)
+    {
+        if (*cur == req)
+        {
+            *cur = req->next;
+            break;
+        }
+    }
+    IRQ_Restore(level);
+
+    // Mirrors how libdi's `DI_Read' translates the result of the ioctl.
+    int status;
+    if (req->ret == RRC_DI_RET_OK)
+    {
+        status = RRC_DI_LIBDI_OK;
+    }
+    else if (req->ret == 2)
+    {
+        status = RRC_DI_LIBDI_EIO;
+    }
+    else
+    {
+        status = req->ret;
+    }
+
+    if (status != RRC_DI_LIBDI_OK)
+    {
+        memset(req->buf, 0, req->size);
+    }
+    return status;
+}
+
+int rrc_di_read_wait_all()
+{
+    int first_error = RRC_DI_LIBDI_OK;
+    while (_rrc_di_pending != NULL)
+    {
+        int status = rrc_di_read_wait(_rrc_di_pending);
+        if (status != RRC_DI_LIBDI_OK && first_error == RRC_DI_LIBDI_OK)
+        {
+            first_error = status;
+        }
+    }
+    return first_error;
+}
@@ -27,6 +27,15 @@
 #define RRC_DI_PART_GROUPS_OFFSET 0x40000
 #define RRC_DI_DATA_PART_HEADER 0x420
 
+/*
+ * how many reads may be submitted to IOS at once, further ones wait for one of them to finish.
+ * The drive serves one read at a time no matter how many are queued, so this only needs to be enough to always
+ * have the next one ready (the game DOL needs up to 20). How deep IOS queues requests for /dev/di isn't documented,
+ * so this stays well below that of any IOS resource manager we know of, and leaves room in libogc's IPC request
+ * heap for the launcher's other IPC traffic while the reads are in flight.
+ */
+#define RRC_DI_MAX_INFLIGHT 8
+
 /* used for raw ioctls */
 enum rrc_di_ret
 {
@@ -95,6 +104,21 @@ struct rrc_di_data_part_header
     u32 fst_size;
 };
 
+/**
+ * A read submitted with `rrc_di_read_async'. It must stay alive until it has been waited on.
+ */
+struct rrc_di_request
+{
+    /* the command block sent to /dev/di, needs to be 32 byte aligned */
+    u32 dic[8] __attribute__((aligned(32)));
+    void *buf;
+    u32 size;
+    /* set by the IPC callback */
+    volatile s32 ret;
+    volatile bool done;
+    struct rrc_di_request *next;
+};
+
 int rrc_di_getfd();
 
 int rrc_di_init();
@@ -109,6 +133,25 @@ int rrc_di_unencrypted_read(void *buf, u32 size, u32 offset);
 
 int rrc_di_read(void *buf, u32 size, u32 offset);
 
+/*
+ * Like `rrc_di_read', but only submits the read to IOS and returns immediately.
+ * Requests are queued in IOS and handled in order, so the CPU is free to do other work in the meantime.
+ * Returns RRC_DI_LIBDI_OK if the read was submitted. `buf' must not be touched until the request has been waited on.
+ * If it couldn't be submitted, the error is returned and `req' is completed with it right away.
+ */
+int rrc_di_read_async(struct rrc_di_request *req, void *buf, u32 size, u32 offset);
+
+/*
+ * Waits for a single read submitted with `rrc_di_read_async' and returns its status, like `rrc_di_read' would.
+ * Returns IPC_EINVAL for a request that was never submitted, rather than waiting for it forever.
+ */
+int rrc_di_read_wait(struct rrc_di_request *req);
+
+/*
+ * Waits for every read that is still pending and returns the status of the first one that failed, or RRC_DI_LIBDI_OK.
+ */
+int rrc_di_read_wait_all();
+
 int rrc_di_open_partition(u32 offset);
 
 #endif
@@ -22,14 +22,21 @@
 #include "../util.h"
 #include "binary_loader.h"
 
-bool rrc_binary_find_section_by_addr(struct rrc_dol *dol, u32 addr, void **virt_addr, u32 *section_index)
+bool rrc_binary_find_section_by_addr(struct rrc_dol *dol, u32 in_place, u32 addr, void **virt_addr, u32 *section_index)
 {
     for (int i = 0; i < RRC_DOL_SECTION_COUNT; i++)
     {
         if (addr >= dol->section_addr[i] && addr < dol->section_addr[i] + dol->section_size[i])
         {
-            u32 section_addr_offset = addr - dol->section_addr[i];
-            *virt_addr = (void *)((u32)dol + dol->section[i] + section_addr_offset);
+            if (in_place & (1 << i))
+            {
+                *virt_addr = (void *)addr;
+            }
+            else
+            {
+                u32 section_addr_offset = addr - dol->section_addr[i];
+                *virt_addr = (void *)((u32)dol + dol->section[i] + section_addr_offset);
+            }
             *section_index = i;
             return true;
         }
@@ -37,11 +44,29 @@ bool rrc_binary_find_section_by_addr(struct rrc_dol *dol, u32 addr, void **virt_
     return false;
 }
 
-struct rrc_result rrc_binary_load_pulsar_loader(struct rrc_dol *dol, void *real_loader_addr)
+bool rrc_binary_section_fits_in_place(struct rrc_dol *dol, u32 section_index, u32 free_lo, u32 free_hi)
+{
+    u32 addr = dol->section_addr[section_index];
+    u32 size = dol->section_size[section_index];
+
+    if ((addr & 31) != 0 || (size & 31) != 0)
+    {
+        return false;
+    }
+
+    if (addr < free_lo || addr + size > free_hi)
+    {
+        return false;
+    }
+
+    return addr >= dol->bss_addr + dol->bss_size || addr + size <= dol->bss_addr;
+}
+
+struct rrc_result rrc_binary_load_pulsar_loader(struct rrc_dol *dol, u32 in_place, void *real_loader_addr)
 {
     void *virt_loader_addr;
     u32 _section_index;
-    if (!rrc_binary_find_section_by_addr(dol, (u32)real_loader_addr, &virt_loader_addr, &_section_index))
+    if (!rrc_binary_find_section_by_addr(dol, in_place, (u32)real_loader_addr, &virt_loader_addr, &_section_index))
     {
         RRC_FATAL("Pulsar loader address %x is not part of any game section", (u32)real_loader_addr);
     }
@@ -65,6 +90,35 @@ struct rrc_result rrc_binary_load_pulsar_loader(struct rrc_dol *dol, void *real_
     return rrc_result_success;
 }
 
+struct rrc_result rrc_binary_apply_memory_patches(struct rrc_dol *dol, u32 in_place, struct rrc_riivo_memory_patch *mem_patches, int mem_patch_count)
+{
+    for (int i = 0; i < mem_patch_count; i++)
+    {
+        struct rrc_riivo_memory_patch *patch = &mem_patches[i];
+
+        void *virt_addr;
+        u32 section_index;
+        if (!rrc_binary_find_section_by_addr(dol, in_place, patch->addr, &virt_addr, &section_index) ||
+            patch->addr + sizeof(u32) > dol->section_addr[section_index] + dol->section_size[section_index])
+        {
+            char err[96];
+            bool in_bss = patch->addr >= dol->bss_addr && patch->addr < dol->bss_addr + dol->bss_size;
+            snprintf(err, sizeof(err), "Memory patch at %x is %s", patch->addr, in_bss ? "in the BSS" : "not part of any game section");
+            return rrc_result_create_error_corrupted_rr_xml(err);
+        }
+
+        u32 *dest = virt_addr;
+        if (patch->original_init && patch->original != *dest)
+        {
+            // Original doesn't match, skip the patch.
+            continue;
+        }
+        *dest = patch->value;
+    }
+
+    return rrc_result_success;
+}
+
 static void get_runtime_ext_path(char region, char *out)
 {
     snprintf(out, 64, RRC_RUNTIME_EXT_BASE_PATH "-%c.dol", region);
@@ -21,6 +21,7 @@
 #define BINARY_LOADER_H
 
 #include <dol.h>
+#include <riivo.h>
 #include "../result.h"
 
 #define RRC_LOADER_PUL_PATH "RetroRewind6/Binaries/Loader.pul"
@@ -34,12 +35,29 @@
 
 /**
  * Finds a game section that contains the given address.
- * Sets `virt_addr` to the address of `addr` within the section in the DOL in safe space,
+ * Sets `virt_addr` to the address of `addr` within the section in the DOL in safe space, or at its final address
+ * if the section is one of the ones read in place (bit `i` set in `in_place` for section `i`),
  * and sets `section_index` to the index of the section.
  */
-bool rrc_binary_find_section_by_addr(struct rrc_dol *dol, u32 addr, void **virt_addr, u32 *section_index);
+bool rrc_binary_find_section_by_addr(struct rrc_dol *dol, u32 in_place, u32 addr, void **virt_addr, u32 *section_index);
 
-struct rrc_result rrc_binary_load_pulsar_loader(struct rrc_dol *dol, void *real_loader_addr);
+/**
+ * Checks whether a game section can be read from the disc straight to its final address instead of the safe space,
+ * because it lies entirely within `free_lo`-`free_hi`, which the launcher doesn't use.
+ * Sections overlapping the BSS don't qualify, since `patch_dol` zeroes the BSS after the fact, and neither do
+ * sections that can't be DMA'd in whole 32 byte blocks.
+ */
+bool rrc_binary_section_fits_in_place(struct rrc_dol *dol, u32 section_index, u32 free_lo, u32 free_hi);
+
+struct rrc_result rrc_binary_load_pulsar_loader(struct rrc_dol *dol, u32 in_place, void *real_loader_addr);
+
+/**
+ * Applies Riivolution memory patches to the sections in safe space, so that `patch_dol` copies them along with the rest of the section.
+ * A patch whose `original` doesn't match what is there is skipped, like Riivolution does.
+ * Patches that aren't fully contained in a section (e.g. ones to the BSS, which `patch_dol` zeroes) are an error.
+ * This must happen after everything else has been written to the sections, since the patches are meant to be applied last.
+ */
+struct rrc_result rrc_binary_apply_memory_patches(struct rrc_dol *dol, u32 in_place, struct rrc_riivo_memory_patch *mem_patches, int mem_patch_count);
 
 void rrc_binary_load_runtime_ext(char region);
 
@@ -31,12 +31,18 @@
  * - You cannot reference any symbols (this includes calling functions, although function pointers are fine),
  *   as they are compiled to branching to relative offsets, which won't be correct anymore when the function machine code is copied elsewhere.
  * - This file needs to be compiled with -f-nobuiltin so that memset/memcpy loops aren't compiled to memset calls and run into point 1.
+ *   The copy and zero loops below are written in assembly for the same reason, and their helpers are always inlined into `patch_dol`
+ *   so that the function (whose length is PATCH_DOL_LEN) contains everything that gets copied.
  * - When calling patch_dol, you need to also set the stack pointer to the safe space so that local variables are not overwritten.
  *   (Ideally we would use __attribute__((naked)) so that the function can manage its own stack space but that's not available for PPC...)
  * - You must make sure that no other threads are running that share the address space.
  *
  * We also need to call `DCFlushRange()` to invalidate the data cache after copying sections, however since we cannot reference symbols,
  * we require the caller to pass it as a function pointer.
+ * Everything that was written is collected in a sorted list of ranges first, so that each cache line is flushed once at the very end.
+ *
+ * Memory patches are already applied to the sections in safe space before getting here (see `rrc_binary_apply_memory_patches`),
+ * so they're copied along with the sections.
  *
  * This file is compiled separately to a .o file and linked together with the main code again so that we can know the function length ahead of time.
  */
@@ -44,20 +50,284 @@
 #include <stdint.h>
 #include "game_dol_loader.h"
 
-void patch_dol(struct rrc_dol *dol, struct rrc_riivo_memory_patch *mem_patches, int mem_patch_count, void (*ic_invalidate_range)(void *, u32), void (*dc_flush_range)(void *, u32))
+#define RRC_DOL_INLINE static inline __attribute__((always_inline))
+#define RRC_DOL_CACHE_LINE 32
+
+RRC_DOL_INLINE void rrc_dol_copy_bytes(u8 *to, const u8 *from, u32 len)
 {
-    // First, zero BSS.
-    u64 *bss8 = (u64 *)dol->bss_addr;
-    u8 *start = (u8 *)bss8;
-    u8 *end = start + dol->bss_size;
+    if (len == 0)
+    {
+        return;
+    }
+
+    u32 tmp;
+    asm volatile("mtctr %3\n"
+                 "1:\n"
+                 "lbz %2, 0(%1)\n"
+                 "stb %2, 0(%0)\n"
+                 "addi %0, %0, 1\n"
+                 "addi %1, %1, 1\n"
+                 "bdnz 1b\n"
+                 : "+b"(to), "+b"(from), "=&r"(tmp)
+                 : "r"(len)
+                 : "ctr", "memory");
+}
+
+/**
+ * Copies `len` bytes starting with the last one, for when `to` lies inside `from`-`from + len`
+ * and copying forwards would overwrite source bytes before they are read.
+ */
+RRC_DOL_INLINE void rrc_dol_copy_bytes_backward(u8 *to, const u8 *from, u32 len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+
+    u32 tmp;
+    to += len;
+    from += len;
+    asm volatile("mtctr %3\n"
+                 "1:\n"
+                 "lbzu %2, -1(%1)\n"
+                 "stbu %2, -1(%0)\n"
+                 "bdnz 1b\n"
+                 : "+b"(to), "+b"(from), "=&r"(tmp)
+                 : "r"(len)
+                 : "ctr", "memory");
+}
+
+RRC_DOL_INLINE void rrc_dol_zero_bytes(u8 *to, u32 len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+
+    asm volatile("mtctr %2\n"
+                 "1:\n"
+                 "stb %1, 0(%0)\n"
+                 "addi %0, %0, 1\n"
+                 "bdnz 1b\n"
+                 : "+b"(to)
+                 : "r"(0), "r"(len)
+                 : "ctr", "memory");
+}
+
+/**
+ * Zeroes `lines` whole cache lines at `to`, which must be 32 byte aligned.
+ * `dcbz` establishes each line in the cache as zeroes without reading it from memory first.
+ */
+RRC_DOL_INLINE void rrc_dol_zero_lines(u8 *to, u32 lines)
+{
+    if (lines == 0)
+    {
+        return;
+    }
+
+    asm volatile("mtctr %1\n"
+                 "1:\n"
+                 "dcbz 0, %0\n"
+                 "addi %0, %0, 32\n"
+                 "bdnz 1b\n"
+                 : "+b"(to)
+                 : "r"(lines)
+                 : "ctr", "memory");
+}
 
-    for (u8 *bss = (u8 *)bss8; bss < end; bss++)
+/**
+ * Sets MSR[FP] so that the float registers can be used by `rrc_dol_copy_lines`. libogc enables it at startup,
+ * but without it every `lfd` would raise a program exception, which nothing could handle anymore at this point.
+ */
+RRC_DOL_INLINE void rrc_dol_enable_fp()
+{
+    u32 msr;
+    asm volatile("mfmsr %0\n"
+                 "ori %0, %0, 0x2000\n"
+                 "mtmsr %0\n"
+                 "isync\n"
+                 : "=&r"(msr));
+}
+
+/**
+ * Copies `lines` whole cache lines from `from` to `to`, 8 bytes at a time through the float registers.
+ * `to` must be 32 byte aligned and `from` 8 byte aligned, and MSR[FP] must be set (see `rrc_dol_enable_fp`).
+ * If `zero_first` is set, each destination line is established with `dcbz` instead of being read from memory
+ * only to be overwritten. This must not be done if the line may still hold source bytes that haven't been read yet.
+ */
+RRC_DOL_INLINE void rrc_dol_copy_lines(u8 *to, const u8 *from, u32 lines, bool zero_first)
+{
+    if (lines == 0)
     {
-        *bss = 0;
+        return;
     }
 
-    dc_flush_range((void *)dol->bss_addr, dol->bss_size);
-    ic_invalidate_range((void *)dol->bss_addr, dol->bss_size);
+    if (zero_first)
+    {
+        asm volatile("mtctr %2\n"
+                     "1:\n"
+                     "dcbz 0, %0\n"
+                     "lfd 0, 0(%1)\n"
+                     "lfd 1, 8(%1)\n"
+                     "lfd 2, 16(%1)\n"
+                     "lfd 3, 24(%1)\n"
+                     "stfd 0, 0(%0)\n"
+                     "stfd 1, 8(%0)\n"
+                     "stfd 2, 16(%0)\n"
+                     "stfd 3, 24(%0)\n"
+                     "addi %0, %0, 32\n"
+                     "addi %1, %1, 32\n"
+                     "bdnz 1b\n"
+                     : "+b"(to), "+b"(from)
+                     : "r"(lines)
+                     : "ctr", "memory", "fr0", "fr1", "fr2", "fr3");
+    }
+    else
+    {
+        asm volatile("mtctr %2\n"
+                     "1:\n"
+                     "lfd 0, 0(%1)\n"
+                     "lfd 1, 8(%1)\n"
+                     "lfd 2, 16(%1)\n"
+                     "lfd 3, 24(%1)\n"
+                     "stfd 0, 0(%0)\n"
+                     "stfd 1, 8(%0)\n"
+                     "stfd 2, 16(%0)\n"
+                     "stfd 3, 24(%0)\n"
+                     "addi %0, %0, 32\n"
+                     "addi %1, %1, 32\n"
+                     "bdnz 1b\n"
+                     : "+b"(to), "+b"(from)
+                     : "r"(lines)
+                     : "ctr", "memory", "fr0", "fr1", "fr2", "fr3");
+    }
+}
+
+/**
+ * Range of memory that was written to and needs to be flushed, in whole cache lines.
+ */
+struct rrc_dol_range
+{
+    u32 start;
+    u32 end;
+};
+
+// BSS and every section.
+#define RRC_DOL_MAX_DIRTY_RANGES (1 + RRC_DOL_SECTION_COUNT)
+
+/**
+ * Adds `start`-`start + len` to `ranges`, which is kept sorted by start address.
+ */
+RRC_DOL_INLINE void rrc_dol_add_dirty_range(struct rrc_dol_range *ranges, u32 *count, u32 start, u32 len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+
+    u32 n = *count;
+    ranges[n].start = start & ~(RRC_DOL_CACHE_LINE - 1);
+    ranges[n].end = (start + len + RRC_DOL_CACHE_LINE - 1) & ~(RRC_DOL_CACHE_LINE - 1);
+
+    // Swap it into place rather than shifting the others up, which could be compiled to a memmove call.
+    for (u32 i = n; i > 0 && ranges[i - 1].start > ranges[i].start; i--)
+    {
+        struct rrc_dol_range tmp = ranges[i - 1];
+        ranges[i - 1] = ranges[i];
+        ranges[i] = tmp;
+    }
+
+    *count = n + 1;
+}
+
+/**
+ * Flushes every range in `ranges`, merging overlapping and adjacent ones so that each cache line is only flushed once.
+ */
+RRC_DOL_INLINE void rrc_dol_flush_dirty_ranges(struct rrc_dol_range *ranges, u32 count, void (*ic_invalidate_range)(void *, u32), void (*dc_flush_range)(void *, u32))
+{
+    u32 i = 0;
+    while (i < count)
+    {
+        u32 start = ranges[i].start;
+        u32 end = ranges[i].end;
+        for (i++; i < count && ranges[i].start <= end; i++)
+        {
+            if (ranges[i].end > end)
+            {
+                end = ranges[i].end;
+            }
+        }
+
+        dc_flush_range((void *)start, end - start);
+        ic_invalidate_range((void *)start, end - start);
+    }
+}
+
+RRC_DOL_INLINE void rrc_dol_zero(u8 *to, u32 len)
+{
+    u32 head = -(u32)to & (RRC_DOL_CACHE_LINE - 1);
+    if (head > len)
+    {
+        head = len;
+    }
+
+    rrc_dol_zero_bytes(to, head);
+    to += head;
+    len -= head;
+
+    rrc_dol_zero_lines(to, len / RRC_DOL_CACHE_LINE);
+    to += len & ~(RRC_DOL_CACHE_LINE - 1);
+
+    rrc_dol_zero_bytes(to, len & (RRC_DOL_CACHE_LINE - 1));
+}
+
+RRC_DOL_INLINE void rrc_dol_copy(u8 *to, const u8 *from, u32 len)
+{
+    // Sections are staged above the launcher and normally copied down, but nothing stops a DOL from placing
+    // one just above where it was staged. Copying that forwards would overwrite its own unread bytes.
+    if (to > from && to < from + len)
+    {
+        rrc_dol_copy_bytes_backward(to, from, len);
+        return;
+    }
+
+    // The float registers can only be used if both sides can be 8 byte aligned at the same time,
+    // which is always the case for regular DOLs. Anything else is copied byte by byte.
+    if ((((u32)to ^ (u32)from) & 7) == 0)
+    {
+        u32 head = -(u32)to & (RRC_DOL_CACHE_LINE - 1);
+        if (head > len)
+        {
+            head = len;
+        }
+
+        rrc_dol_copy_bytes(to, from, head);
+        to += head;
+        from += head;
+        len -= head;
+
+        u32 lines = len / RRC_DOL_CACHE_LINE;
+        bool overlaps = to < from + len && from < to + len;
+        rrc_dol_copy_lines(to, from, lines, !overlaps);
+        to += lines * RRC_DOL_CACHE_LINE;
+        from += lines * RRC_DOL_CACHE_LINE;
+        len -= lines * RRC_DOL_CACHE_LINE;
+    }
+
+    rrc_dol_copy_bytes(to, from, len);
+}
+
+void patch_dol(struct rrc_dol *dol, u32 in_place, void (*ic_invalidate_range)(void *, u32), void (*dc_flush_range)(void *, u32))
+{
+    // Lives on the stack set up by `patch_dol_helper`, which has plenty of room for it.
+    struct rrc_dol_range dirty[RRC_DOL_MAX_DIRTY_RANGES];
+    u32 dirty_count = 0;
+
+    rrc_dol_enable_fp();
+
+    // First, zero BSS.
+    rrc_dol_zero((u8 *)dol->bss_addr, dol->bss_size);
+    rrc_dol_add_dirty_range(dirty, &dirty_count, dol->bss_addr, dol->bss_size);
 
     // Next, copy all sections to where they need to be.
     for (u8 section_index = 0; section_index < RRC_DOL_SECTION_COUNT; section_index++)
@@ -66,29 +336,16 @@ void patch_dol(struct rrc_dol *dol, struct rrc_riivo_memory_patch *mem_patches,
         u8 *to = (u8 *)dol->section_addr[section_index];
         u32 size = dol->section_size[section_index];
 
-        for (u32 i = 0; i < size; i++)
+        // Sections that were read in place already are where they need to be.
+        if ((in_place & (1 << section_index)) == 0)
         {
-            to[i] = from[i];
+            rrc_dol_copy(to, from, size);
         }
 
-        dc_flush_range((void *)to, size);
-        ic_invalidate_range((void *)to, size);
+        rrc_dol_add_dirty_range(dirty, &dirty_count, (u32)to, size);
     }
 
-    for (int i = 0; i < mem_patch_count; i++)
-    {
-        struct rrc_riivo_memory_patch *patch = &mem_patches[i];
-        u32 *dest = (u32 *)patch->addr;
-        u32 value = *dest;
-        if (patch->original_init && patch->original != value)
-        {
-            // Original doesn't match, skip the patch.
-            continue;
-        }
-        *dest = patch->value;
-        dc_flush_range(dest, 32);
-        ic_invalidate_range(dest, 32);
-    }
+    rrc_dol_flush_dirty_ranges(dirty, dirty_count, ic_invalidate_range, dc_flush_range);
 
     ((void (*)())dol->entry_point)();
 
@@ -22,12 +22,13 @@
 
 #include <gctypes.h>
 #include <dol.h>
-#include <riivo.h>
 
+/*
+    `in_place` has bit `i` set if section `i` was read straight to its final address instead of the safe space.
+*/
 void patch_dol(
     struct rrc_dol *dol,
-    struct rrc_riivo_memory_patch *mem_patches,
-    int mem_patch_count,
+    u32 in_place,
     void (*ic_invalidate_range)(void *, u32),
     void (*dc_flush_range)(void *, u32));
 
@@ -45,7 +45,7 @@
  * Also allocates trampolines containing the first 4 overwritten instructions + backjump to the original function,
  * which is called when the custom function wants to call the original DVD function.
  */
-static void patch_dvd_functions(struct rrc_dol *dol, char region)
+static void patch_dvd_functions(struct rrc_dol *dol, u32 in_place, char region)
 {
     struct function_patch_entry
     {
@@ -93,7 +93,7 @@ static void patch_dvd_functions(struct rrc_dol *dol, char region)
 
         u32 section_index;
         void *virt_addr;
-        if (!rrc_binary_find_section_by_addr(dol, entry.addr, &virt_addr, &section_index))
+        if (!rrc_binary_find_section_by_addr(dol, in_place, entry.addr, &virt_addr, &section_index))
         {
             RRC_FATAL("Address to patch %x is not part of any game section", entry.addr);
         }
@@ -117,30 +117,29 @@ static void patch_dvd_functions(struct rrc_dol *dol, char region)
 
 typedef void (*ic_invalidate_range_t)(void *, u32);
 typedef ic_invalidate_range_t dc_flush_range_t;
-typedef void (*patch_dol_func_t)(struct rrc_dol *, struct rrc_riivo_memory_patch *, int, ic_invalidate_range_t, dc_flush_range_t);
+typedef void (*patch_dol_func_t)(struct rrc_dol *, u32, ic_invalidate_range_t, dc_flush_range_t);
 
 /**
  * Wrapper function around `patch_dol` that sets up the stack pointer to a safe location (workaround for missing support for __attribute__((naked))).
  */
 void patch_dol_helper(
     /* r3 */ struct rrc_dol *dol,
-    /* r4 */ struct rrc_riivo_memory_patch *mem_patches,
-    /* r5 */ int mem_patch_count,
-    /* r6 */ void (*ic_invalidate_range)(void *, u32),
-    /* r7 */ void (*dc_flush_range)(void *, u32),
-    /* r8 */ patch_dol_func_t);
+    /* r4 */ u32 in_place,
+    /* r5 */ void (*ic_invalidate_range)(void *, u32),
+    /* r6 */ void (*dc_flush_range)(void *, u32),
+    /* r7 */ patch_dol_func_t);
 
 asm("patch_dol_helper:\n"
-    // Adjust the stack pointer to 0x808ffa00 (arbitrary, temporary, random safe address not used by game sections)
+    // Adjust the stack pointer to RRC_PATCH_STACK_TOP (temporary safe address not used by game sections)
     // so we don't overwrite local variables while copying sections.
-    "lis 9, -32625\n"
-    "ori 9, 9, 64000\n"
+    "lis 9, " RRC_STRINGIFY(RRC_PATCH_STACK_TOP) "@h\n"
+    "ori 9, 9, " RRC_STRINGIFY(RRC_PATCH_STACK_TOP) "@l\n"
     "mr 1,9\n"
-    // Jump to the function in r8 (patch_dol). All other arguments are already in the right registers (r3-r7).
-    "mtctr 8\n"
+    // Jump to the function in r7 (patch_dol). All other arguments are already in the right registers (r3-r6).
+    "mtctr 7\n"
     "bctrl\n");
 
-void rrc_loader_load(struct rrc_dol *dol, struct rrc_settingsfile *settings, void *bi2_dest, u32 mem1_hi, u32 mem2_hi, char region)
+void rrc_loader_load(struct rrc_dol *dol, u32 in_place, struct rrc_settingsfile *settings, void *bi2_dest, u32 mem1_hi, u32 mem2_hi, char region)
 {
     struct rrc_result res;
 
@@ -154,10 +153,21 @@ void rrc_loader_load(struct rrc_dol *dol, struct rrc_settingsfile *settings, voi
     res = rrc_riivo_patch_loader_parse(settings, &mem1_hi, &mem2_hi, &riivo_out);
     rrc_result_error_check_error_fatal(res);
 
+    // The game's sections, FST and BI2 were read from the disc in the background until now, and everything below needs them.
+    rrc_con_update("Initialise DVD: Finish Reading Game", 82);
+    int di_res = rrc_di_read_wait_all();
+    RRC_ASSERTEQ(di_res, RRC_DI_LIBDI_OK, "rrc_di_read_wait_all for game");
+    DCStoreRange(bi2_dest, RRC_BI2_SIZE);
+
     rrc_con_update("Patch DVD Functions", 85);
-    patch_dvd_functions(dol, region);
-    res = rrc_binary_load_pulsar_loader(dol, riivo_out.loader_pul_dest);
+    patch_dvd_functions(dol, in_place, region);
+    res = rrc_binary_load_pulsar_loader(dol, in_place, riivo_out.loader_pul_dest);
+    rrc_result_error_check_error_fatal(res);
+
+    // Memory patches go last so that they apply on top of everything else written to the sections.
+    res = rrc_binary_apply_memory_patches(dol, in_place, riivo_out.mem_patches, riivo_out.mem_patches_count);
     rrc_result_error_check_error_fatal(res);
+    free(riivo_out.mem_patches);
 
     rrc_gui_video_fix(region);
 
@@ -233,8 +243,7 @@ void rrc_loader_load(struct rrc_dol *dol, struct rrc_settingsfile *settings, voi
 
     patch_dol_helper(
         dol,
-        riivo_out.mem_patches,
-        riivo_out.mem_patches_count,
+        in_place,
         ic_invalidate_range,
         dc_flush_range,
         patch_copy);
@@ -27,6 +27,11 @@
 
 #define RRC_BI2_SIZE 0x2000
 #define RRC_PATCH_COPY_ADDRESS 0x80900000
+// Stack `patch_dol` runs on (set up by `patch_dol_helper`), between the game's sections and the copy of `patch_dol` itself.
+// It only needs a few hundred bytes, the rest is headroom. Nothing may be loaded in place above its bottom.
+#define RRC_PATCH_STACK_TOP 0x808ffa00
+#define RRC_PATCH_STACK_SIZE 0xfa00
+#define RRC_PATCH_STACK_BOTTOM (RRC_PATCH_STACK_TOP - RRC_PATCH_STACK_SIZE)
 #define RRC_SIGNATURE_ADDRESS 0x93400100
 #define RRC_RR_BITFLAGS 0x93400104
 // Must be kept in sync with the .riivo_disc_ptr section address in runtime-ext's linker script
@@ -42,9 +47,11 @@ void rrc_loader_get_runtime_ext_path(char region, char *out);
 /*
  * This routine applies all patches from code.pul as well as setting key memory addresses
  * appropriately before fully loading the DOL and launching Mario Kart Wii.
+ * The DOL sections, FST and `bi2_dest` may still be being read with `rrc_di_read_async`; they are waited on before first use.
+ * `in_place` has bit `i` set if section `i` is read straight to its final address instead of the safe space.
  *
  * This function should always return a status code on failure and NEVER CRASH. On success, it never returns.
  */
-void rrc_loader_load(struct rrc_dol *dol, struct rrc_settingsfile *settings, void *bi2_dest, u32 mem1_hi, u32 mem2_hi, char region);
+void rrc_loader_load(struct rrc_dol *dol, u32 in_place, struct rrc_settingsfile *settings, void *bi2_dest, u32 mem1_hi, u32 mem2_hi, char region);
 
 #endif
@@ -121,10 +121,12 @@ struct rrc_result rrc_riivo_patch_loader_parse(struct rrc_settingsfile *settings
     *mem1 -= sizeof(struct rrc_riivo_disc_replacement) * MAX_FILE_PATCHES;
     *mem1 -= sizeof(struct rrc_riivo_disc);
     struct rrc_riivo_disc *riivo_disc = (void *)*mem1;
-    // Reserve space for memory patches. Note: they don't actually need to be reserved in MEM1,
-    // because it's only shortly needed in patch.c and never again at runtime.
-    *mem1 -= sizeof(struct rrc_riivo_memory_patch) * MAX_MEMORY_PATCHES;
-    out->mem_patches = (void *)*mem1;
+    // Memory patches are applied to the sections before launching and never needed at runtime, so they don't need to be in MEM1.
+    out->mem_patches = malloc(sizeof(struct rrc_riivo_memory_patch) * MAX_MEMORY_PATCHES);
+    if (!out->mem_patches)
+    {
+        return rrc_result_create_error_errno(ENOMEM, "Failed to allocate memory patches");
+    }
     out->mem_patches_count = 0;
 
     // Read the XML to extract all possible options for the entries.
@@ -237,6 +239,11 @@ struct rrc_result rrc_riivo_patch_loader_parse(struct rrc_settingsfile *settings
             PARSE_REQUIRED_ATTR(memory, value_mxml, "value");
             const char *original_mxml = mxmlElementGetAttr(memory, "original");
 
+            if (out->mem_patches_count >= MAX_MEMORY_PATCHES)
+            {
+                return rrc_result_create_error_corrupted_rr_xml("Attempted to enable more than " RRC_STRINGIFY(MAX_MEMORY_PATCHES) " memory patches!");
+            }
+
             struct rrc_riivo_memory_patch *patch_dist = &out->mem_patches[out->mem_patches_count];
             out->mem_patches_count++;
             patch_dist->addr = strtoul(addr_mxml, NULL, 16);
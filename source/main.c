@@ -37,12 +37,15 @@
 #include "di.h"
 #include "time.h"
 #include "loader/loader.h"
+#include "loader/binary_loader.h"
 #include <dol.h>
 #include <riivo.h>
 #include "console.h"
 #include "settings.h"
 #include "update/versionsfile.h"
 #include "update/update.h"
+#include "update/prefetch.h"
+#include "update/txn.h"
 #include "prompt.h"
 #include "gui.h"
 #include "res.h"
@@ -145,6 +148,19 @@ int main(int argc, char **argv)
         fclose(afd);
     }
 
+    // Finish an update that was interrupted while its files were being moved into place, so the game never sees a half-applied one.
+    struct rrc_result txn_res = rrc_txn_recover();
+    rrc_result_error_check_error_normal(txn_res, xfb);
+
+    // Bring up the network and fetch the version lists while the disc spins up, if we're going to check for updates anyway.
+    // Any error is ignored here; the settings are loaded again (and errors reported) further down.
+    struct rrc_settingsfile early_settings;
+    rrc_result_free(rrc_settingsfile_parse(&early_settings));
+    if (early_settings.auto_update)
+    {
+        rrc_update_prefetch_start();
+    }
+
     rrc_con_update("Initialise DVD", 10);
     int fd = rrc_di_init();
     RRC_ASSERT(fd != 0, "rrc_di_init");
@@ -155,6 +171,7 @@ int main(int argc, char **argv)
     res = rrc_disc_loader_await_mkw(xfb, &region);
     if (res == RRC_RES_SHUTDOWN_INTERRUPT)
     {
+        rrc_update_prefetch_discard();
         exit(0);
     }
 
@@ -248,6 +265,7 @@ int main(int argc, char **argv)
 
         if (rrc_pad_home_pressed(pad))
         {
+            rrc_update_prefetch_discard();
             return 0;
         }
         else if (rrc_pad_a_pressed(pad))
@@ -265,6 +283,7 @@ int main(int argc, char **argv)
             case RRC_SETTINGS_LAUNCH:
                 goto interrupt_loop_end;
             case RRC_SETTINGS_EXIT:
+                rrc_update_prefetch_discard();
                 return 0;
             }
         }
@@ -273,6 +292,9 @@ int main(int argc, char **argv)
     }
 interrupt_loop_end:
 
+    // Only still running if the update check was skipped, e.g. because the settings file changed since boot.
+    rrc_update_prefetch_discard();
+
     rrc_con_clear(true);
 
     rrc_con_update("Initialise DVD: Read Game DOL", 25);
@@ -285,24 +307,65 @@ interrupt_loop_end:
     rrc_dbg_printf("Entrypoint at %x\n", dol->entry_point);
     rrc_dbg_printf("BSS Addr: %x\n", dol->bss_addr);
     rrc_dbg_printf("BSS size: %d\n", dol->bss_size);
+
+    // Sections between the top of our heap and the stack `patch_dol` runs on don't overlap anything the launcher still uses,
+    // so they are read straight to their final address. The heap is moved past them first so that it can't grow into them.
+    u32 in_place = 0;
+    u32 level = IRQ_Disable();
+    u32 free_lo = align_up((u32)SYS_GetArena1Lo(), 32);
+    u32 in_place_end = free_lo;
+    for (u32 i = 0; i < RRC_DOL_SECTION_COUNT; i++)
+    {
+        if (dol->section_size[i] != 0 && rrc_binary_section_fits_in_place(dol, i, free_lo, RRC_PATCH_STACK_BOTTOM))
+        {
+            in_place |= 1 << i;
+            if (dol->section_addr[i] + dol->section_size[i] > in_place_end)
+            {
+                in_place_end = dol->section_addr[i] + dol->section_size[i];
+            }
+        }
+    }
+    if (in_place != 0)
+    {
+        SYS_SetArena1Lo((void *)in_place_end);
+    }
+    IRQ_Restore(level);
+
+    // The sections, FST and BI2 are only queued here. They're read while the patches are loaded, and waited on in `rrc_loader_load`.
+    static struct rrc_di_request section_reqs[RRC_DOL_SECTION_COUNT];
+    static struct rrc_di_request fst_req, bi2_req;
+
     for (u32 i = 0; i < RRC_DOL_SECTION_COUNT; i++)
     {
         if (dol->section_size[i] == 0)
         {
             continue;
         }
-        rrc_dbg_printf("%x at %x-%x (%d b)\n", dol->section[i], dol->section_addr[i], dol->section_addr[i] + dol->section_size[i], dol->section_size[i]);
+        rrc_dbg_printf("%x at %x-%x (%d b)%s\n", dol->section[i], dol->section_addr[i], dol->section_addr[i] + dol->section_size[i], dol->section_size[i], (in_place & (1 << i)) ? " in place" : "");
         if ((dol->section_addr[i] < 0x80000000) || (dol->section_addr[i] + dol->section_size[i] > 0x90000000))
         {
             RRC_FATAL("Invalid section address: %x", dol->section_addr[i]);
         }
 
+        u32 disc_offset = data_header->dol_offset + (dol->section[i] >> 2);
+        if (in_place & (1 << i))
+        {
+            // Whatever used this memory before may have left dirty cache lines that would overwrite the section once evicted.
+            DCInvalidateRange((void *)dol->section_addr[i], dol->section_size[i]);
+            res = rrc_di_read_async(&section_reqs[i], (void *)dol->section_addr[i], dol->section_size[i], disc_offset);
+            RRC_ASSERTEQ(res, RRC_DI_LIBDI_OK, "rrc_di_read_async section in place");
+
+            // `in_place` is passed on, so that patches are applied at the final address and `patch_dol` leaves the section alone.
+            continue;
+        }
+
         // See patch.c comment for why we first copy them to `dol + dol->section[i]` rather than to `section_addr[i]` directly.
-        res = rrc_di_read(
+        res = rrc_di_read_async(
+            &section_reqs[i],
             (void *)((u32)dol + dol->section[i]),
             dol->section_size[i],
-            data_header->dol_offset + (dol->section[i] >> 2));
-        RRC_ASSERTEQ(res, RRC_DI_LIBDI_OK, "rrc_di_read section");
+            disc_offset);
+        RRC_ASSERTEQ(res, RRC_DI_LIBDI_OK, "rrc_di_read_async section");
     }
 
     rrc_con_update("Initialise DVD: Read Filesystem Table", 50);
@@ -318,17 +381,16 @@ interrupt_loop_end:
 
     mem1_hi = fst_dest;
     rrc_dbg_printf("FST at %x, size: %d, aligned: %d\n", fst_dest, fst_size, align_up(fst_size, 32));
-    res = rrc_di_read((void *)fst_dest, align_up(fst_size, 32), data_header->fst_offset);
-    RRC_ASSERTEQ(res, RRC_DI_LIBDI_OK, "rrc_di_read fst");
+    res = rrc_di_read_async(&fst_req, (void *)fst_dest, align_up(fst_size, 32), data_header->fst_offset);
+    RRC_ASSERTEQ(res, RRC_DI_LIBDI_OK, "rrc_di_read_async fst");
 
     *((u32 *)0x80000038) = fst_dest; // start of FST
 
     // read BI2
     mem1_hi = align_down(mem1_hi - RRC_BI2_SIZE, 32);
     void *bi2 = (void *)(mem1_hi);
-    res = rrc_di_read(bi2, RRC_BI2_SIZE, 0x440 >> 2);
-    RRC_ASSERTEQ(res, RRC_DI_LIBDI_OK, "rrc_di_read for bi2");
-    DCStoreRange(bi2, RRC_BI2_SIZE);
+    res = rrc_di_read_async(&bi2_req, bi2, RRC_BI2_SIZE, 0x440 >> 2);
+    RRC_ASSERTEQ(res, RRC_DI_LIBDI_OK, "rrc_di_read_async for bi2");
 
     rrc_con_update("Prepare For Patching", 60);
 
@@ -343,7 +405,7 @@ interrupt_loop_end:
     {
         mem2_hi = 0x93400000;
     }
-    rrc_loader_load(dol, &stored_settings, bi2, mem1_hi, mem2_hi, region);
+    rrc_loader_load(dol, in_place, &stored_settings, bi2, mem1_hi, mem2_hi, region);
 
     return 0;
 }
@@ -48,6 +48,11 @@ void rrc_shutdown_register_callbacks()
     SYS_SetResetCallback(reset_callback);
 }
 
+bool rrc_shutdown_pending()
+{
+    return _shutdown_state != -1 && diff_msec(_shutdown_time, gettime()) < RRC_SHUTDOWN_CHECK_TIME_MS;
+}
+
 void rrc_shutdown_check()
 {
     int time_since_trigger = diff_msec(_shutdown_time, gettime());
@@ -20,8 +20,16 @@
 #ifndef RRC_SHUTDOWN_H
 #define RRC_SHUTDOWN_H
 
+#include <gctypes.h>
+
 void rrc_shutdown_register_callbacks();
 
 void rrc_shutdown_check();
 
+/*
+    Whether a shutdown was requested that `rrc_shutdown_check' would carry out right now.
+    Lets code that can't stop at any point (e.g. a transfer writing a file) wind down first.
+*/
+bool rrc_shutdown_pending();
+
 #endif
\ No newline at end of file
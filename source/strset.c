@@ -0,0 +1,158 @@
+/*
+    strset.c - hash set of strings implementation
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "strset.h"
+
+#define _RRC_STRSET_INITIAL_CAPACITY 64
+
+/* 32-bit FNV-1a */
+static u32 _rrc_strset_hash(const char *str)
+{
+    u32 hash = 2166136261u;
+    for (; *str != '\0'; str++)
+    {
+        hash ^= (u8)*str;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+    Returns the slot holding `str', or the empty slot where it would go.
+*/
+static u32 _rrc_strset_find(char **slots, u32 capacity, const char *str)
+{
+    u32 mask = capacity - 1;
+    u32 idx = _rrc_strset_hash(str) & mask;
+    while (slots[idx] != NULL && strcmp(slots[idx], str) != 0)
+    {
+        idx = (idx + 1) & mask;
+    }
+    return idx;
+}
+
+static struct rrc_result _rrc_strset_grow(struct rrc_strset *set)
+{
+    u32 capacity = set->capacity > 0 ? set->capacity * 2 : _RRC_STRSET_INITIAL_CAPACITY;
+    char **slots = calloc(capacity, sizeof(char *));
+    if (slots == NULL)
+    {
+        return rrc_result_create_error_errno(ENOMEM, "Failed to grow string set");
+    }
+
+    for (u32 i = 0; i < set->capacity; i++)
+    {
+        if (set->slots[i] != NULL)
+        {
+            slots[_rrc_strset_find(slots, capacity, set->slots[i])] = set->slots[i];
+        }
+    }
+
+    free(set->slots);
+    set->slots = slots;
+    set->capacity = capacity;
+    return rrc_result_success;
+}
+
+void rrc_strset_init(struct rrc_strset *set)
+{
+    set->slots = NULL;
+    set->capacity = 0;
+    set->count = 0;
+}
+
+bool rrc_strset_contains(struct rrc_strset *set, const char *str)
+{
+    if (set->count == 0)
+    {
+        return false;
+    }
+
+    return set->slots[_rrc_strset_find(set->slots, set->capacity, str)] != NULL;
+}
+
+struct rrc_result rrc_strset_add(struct rrc_strset *set, const char *str)
+{
+    /* Keep the load factor at most 3/4 so that probe sequences stay short. */
+    if ((set->count + 1) * 4 > set->capacity * 3)
+    {
+        TRY(_rrc_strset_grow(set));
+    }
+
+    u32 idx = _rrc_strset_find(set->slots, set->capacity, str);
+    if (set->slots[idx] != NULL)
+    {
+        return rrc_result_success;
+    }
+
+    set->slots[idx] = strdup(str);
+    if (set->slots[idx] == NULL)
+    {
+        return rrc_result_create_error_errno(ENOMEM, "Failed to add to string set");
+    }
+
+    set->count++;
+    return rrc_result_success;
+}
+
+void rrc_strset_remove(struct rrc_strset *set, const char *str)
+{
+    if (set->count == 0)
+    {
+        return;
+    }
+
+    u32 mask = set->capacity - 1;
+    u32 gap = _rrc_strset_find(set->slots, set->capacity, str);
+    if (set->slots[gap] == NULL)
+    {
+        return;
+    }
+
+    free(set->slots[gap]);
+    set->slots[gap] = NULL;
+    set->count--;
+
+    /* Move later strings of the same probe sequence back into the gap, so that lookups don't stop early
+       at it. A string can only move if the gap isn't before the slot it hashes to. */
+    for (u32 idx = (gap + 1) & mask; set->slots[idx] != NULL; idx = (idx + 1) & mask)
+    {
+        u32 home = _rrc_strset_hash(set->slots[idx]) & mask;
+        if (((idx - home) & mask) >= ((idx - gap) & mask))
+        {
+            set->slots[gap] = set->slots[idx];
+            set->slots[idx] = NULL;
+            gap = idx;
+        }
+    }
+}
+
+void rrc_strset_free(struct rrc_strset *set)
+{
+    for (u32 i = 0; i < set->capacity; i++)
+    {
+        free(set->slots[i]);
+    }
+
+    free(set->slots);
+    rrc_strset_init(set);
+}
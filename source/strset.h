@@ -0,0 +1,60 @@
+/*
+    strset.h - hash set of strings headers
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RRC_STRSET_H
+#define RRC_STRSET_H
+
+#include <gctypes.h>
+
+#include "result.h"
+
+/*
+    A set of strings, using open addressing with linear probing.
+    Strings are copied when they are added, so callers can pass temporary buffers.
+*/
+struct rrc_strset
+{
+    /* NULL for empty slots. The amount of slots is always a power of two. */
+    char **slots;
+    u32 capacity;
+    u32 count;
+};
+
+/*
+    Initialises an empty set. Doesn't allocate anything until the first string is added.
+*/
+void rrc_strset_init(struct rrc_strset *set);
+
+bool rrc_strset_contains(struct rrc_strset *set, const char *str);
+
+/*
+    Adds a copy of `str' to the set. Adding a string that is already in the set does nothing.
+*/
+struct rrc_result rrc_strset_add(struct rrc_strset *set, const char *str);
+
+/*
+    Removes `str' from the set if it is there.
+*/
+void rrc_strset_remove(struct rrc_strset *set, const char *str);
+
+/*
+    Removes all strings and frees the set's memory. The set can be used again afterwards.
+*/
+void rrc_strset_free(struct rrc_strset *set);
+
+#endif
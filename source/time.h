@@ -29,6 +29,11 @@ typedef s64 rrc_time_tick;
  */
 u32 diff_msec(rrc_time_tick start, rrc_time_tick end);
 
+/**
+ * Returns the difference of two ticks in microseconds.
+ */
+u32 diff_usec(rrc_time_tick start, rrc_time_tick end);
+
 /**
  * Gets the time in ticks.
  * The return value is usually only meaningful when comparing it to another tick, e.g. using one of the `diff_*` functions.
@@ -0,0 +1,621 @@
+/*
+    delta.c - manifest-driven delta update implementation
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    The delta manifest is a text file with one changed file per line:
+
+        path base_crc new_crc new_size patch_url full_url
+
+    `base_crc' and `new_crc' are CRC32s in hex. `base_crc' and `patch_url' are `-' for files that
+    have no base to patch (e.g. newly added files). Empty lines and lines starting with `#' are ignored.
+
+    A patch is a sequence of operations rebuilding the new file from the installed one:
+
+    | Name              | Size in bytes |
+    |-------------------|---------------|
+    | Format Magic      | 4             | (always the value of `_RRC_DELTA_PATCH_MAGIC`)
+    | Format Version    | 4             |
+    | New File Size     | 4             |
+    | Operations        | Variable      |
+
+    Each operation starts with a one byte type:
+
+    | Type              | Arguments                                                   |
+    |-------------------|-------------------------------------------------------------|
+    | 0 (Copy)          | Base Offset (4), Length (4): copies a range of the base     |
+    | 1 (Add)           | Length (4), Data (Length): appends bytes from the patch     |
+
+    All integers are big-endian. Patches are applied while they are being downloaded, so they
+    never have to fit in memory. tools/mkdelta.c generates them, along with the CRCs and size for the manifest.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <ctype.h>
+#include <zlib.h>
+
+#include "delta.h"
+#include "update.h"
+#include "versionsfile.h"
+#include "stats.h"
+#include "../util.h"
+#include "../console.h"
+#include "../shutdown.h"
+
+#define _RRC_DELTA_PATCH_MAGIC 0x52524450 /* RRDP */
+#define _RRC_DELTA_PATCH_VERSION 0
+#define _RRC_DELTA_PATCH_HEADER_SIZE 12
+
+#define _RRC_DELTA_OP_COPY 0
+#define _RRC_DELTA_OP_ADD 1
+
+/* Seconds without any received data after which a transfer is considered dropped */
+#define _RRC_DELTA_LOW_SPEED_TIME 30L
+
+enum _rrc_delta_patch_state
+{
+    /* Reading the patch header */
+    _RRC_DELTA_STATE_HEADER,
+    /* Reading an operation and its arguments */
+    _RRC_DELTA_STATE_OP,
+    /* Reading the data of an add operation */
+    _RRC_DELTA_STATE_ADD_DATA,
+};
+
+struct _rrc_delta_write_ctx
+{
+    /* If set, the response is the new file itself rather than a patch. */
+    bool raw;
+    /* Installed file the patch applies to. NULL if `raw'. */
+    FILE *base;
+    FILE *out;
+
+    enum _rrc_delta_patch_state state;
+    /* Fixed-size records (header, operation + arguments), which may straddle two received chunks */
+    u8 record[_RRC_DELTA_PATCH_HEADER_SIZE];
+    u32 record_len;
+    u32 add_remaining;
+    /* Size of the file according to the manifest, which the patch must announce and produce */
+    u32 new_size;
+
+    /* Running CRC32 and size of what we wrote out. */
+    u32 crc;
+    u32 written;
+
+    /* Error that made us abort the transfer, if any */
+    struct rrc_result res;
+};
+
+static u32 _rrc_delta_rd32(const u8 *p)
+{
+    return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | p[3];
+}
+
+static bool _rrc_delta_write(struct _rrc_delta_write_ctx *ctx, const u8 *data, u32 len)
+{
+    if (len > ctx->new_size - ctx->written)
+    {
+        ctx->res = rrc_result_create_error_misc_update("Delta update produces more data than announced");
+        return false;
+    }
+
+    if (fwrite(data, 1, len, ctx->out) != len)
+    {
+        ctx->res = rrc_result_create_error_errno(errno, "Failed to write updated file");
+        return false;
+    }
+
+    ctx->crc = crc32(ctx->crc, data, len);
+    ctx->written += len;
+    return true;
+}
+
+static bool _rrc_delta_copy_from_base(struct _rrc_delta_write_ctx *ctx, u32 offset, u32 len)
+{
+    u8 buf[4096];
+
+    if (fseek(ctx->base, offset, SEEK_SET) != 0)
+    {
+        ctx->res = rrc_result_create_error_misc_update("Delta patch refers to data outside the installed file");
+        return false;
+    }
+
+    while (len > 0)
+    {
+        u32 chunk = len < sizeof(buf) ? len : sizeof(buf);
+        if (fread(buf, 1, chunk, ctx->base) != chunk)
+        {
+            ctx->res = rrc_result_create_error_misc_update("Delta patch refers to data outside the installed file");
+            return false;
+        }
+
+        if (!_rrc_delta_write(ctx, buf, chunk))
+        {
+            return false;
+        }
+        len -= chunk;
+    }
+
+    return true;
+}
+
+/* Collects bytes into the record buffer until it holds `need' bytes. Returns the amount of input used. */
+static u32 _rrc_delta_collect(struct _rrc_delta_write_ctx *ctx, const u8 *data, u32 len, u32 need)
+{
+    if (ctx->record_len >= need)
+    {
+        return 0;
+    }
+
+    u32 take = need - ctx->record_len;
+    if (take > len)
+    {
+        take = len;
+    }
+
+    memcpy(ctx->record + ctx->record_len, data, take);
+    ctx->record_len += take;
+    return take;
+}
+
+static bool _rrc_delta_feed_patch(struct _rrc_delta_write_ctx *ctx, const u8 *data, u32 len)
+{
+    while (len > 0)
+    {
+        u32 used = 0;
+        switch (ctx->state)
+        {
+        case _RRC_DELTA_STATE_HEADER:
+            used = _rrc_delta_collect(ctx, data, len, _RRC_DELTA_PATCH_HEADER_SIZE);
+            if (ctx->record_len == _RRC_DELTA_PATCH_HEADER_SIZE)
+            {
+                if (_rrc_delta_rd32(ctx->record) != _RRC_DELTA_PATCH_MAGIC || _rrc_delta_rd32(ctx->record + 4) != _RRC_DELTA_PATCH_VERSION)
+                {
+                    ctx->res = rrc_result_create_error_misc_update("Invalid delta patch header");
+                    return false;
+                }
+
+                if (_rrc_delta_rd32(ctx->record + 8) != ctx->new_size)
+                {
+                    ctx->res = rrc_result_create_error_misc_update("Delta patch does not match the size in the manifest");
+                    return false;
+                }
+
+                ctx->record_len = 0;
+                ctx->state = _RRC_DELTA_STATE_OP;
+            }
+            break;
+
+        case _RRC_DELTA_STATE_OP:
+            /* The type byte decides how many argument bytes follow. */
+            used = _rrc_delta_collect(ctx, data, len, 1);
+            if (ctx->record[0] == _RRC_DELTA_OP_COPY)
+            {
+                used += _rrc_delta_collect(ctx, data + used, len - used, 9);
+                if (ctx->record_len == 9)
+                {
+                    ctx->record_len = 0;
+                    u32 copy_len = _rrc_delta_rd32(ctx->record + 5);
+                    /* Checked up front, so that an oversized copy isn't read from the base first */
+                    if (copy_len > ctx->new_size - ctx->written)
+                    {
+                        ctx->res = rrc_result_create_error_misc_update("Delta update produces more data than announced");
+                        return false;
+                    }
+
+                    if (!_rrc_delta_copy_from_base(ctx, _rrc_delta_rd32(ctx->record + 1), copy_len))
+                    {
+                        return false;
+                    }
+                }
+            }
+            else if (ctx->record[0] == _RRC_DELTA_OP_ADD)
+            {
+                used += _rrc_delta_collect(ctx, data + used, len - used, 5);
+                if (ctx->record_len == 5)
+                {
+                    ctx->record_len = 0;
+                    ctx->add_remaining = _rrc_delta_rd32(ctx->record + 1);
+                    if (ctx->add_remaining > 0)
+                    {
+                        ctx->state = _RRC_DELTA_STATE_ADD_DATA;
+                    }
+                }
+            }
+            else
+            {
+                ctx->res = rrc_result_create_error_misc_update("Unknown delta patch operation");
+                return false;
+            }
+            break;
+
+        case _RRC_DELTA_STATE_ADD_DATA:
+            used = len < ctx->add_remaining ? len : ctx->add_remaining;
+            if (!_rrc_delta_write(ctx, data, used))
+            {
+                return false;
+            }
+
+            ctx->add_remaining -= used;
+            if (ctx->add_remaining == 0)
+            {
+                ctx->state = _RRC_DELTA_STATE_OP;
+            }
+            break;
+        }
+
+        data += used;
+        len -= used;
+    }
+
+    return true;
+}
+
+/* Whether the patch fed so far ends after a whole operation. */
+static bool _rrc_delta_patch_complete(struct _rrc_delta_write_ctx *ctx)
+{
+    return ctx->state == _RRC_DELTA_STATE_OP && ctx->record_len == 0;
+}
+
+size_t _rrc_delta_write_data_callback(char *ptr, size_t size, size_t nmemb, struct _rrc_delta_write_ctx *ctx)
+{
+    bool ok = ctx->raw
+                  ? _rrc_delta_write(ctx, (const u8 *)ptr, size * nmemb)
+                  : _rrc_delta_feed_patch(ctx, (const u8 *)ptr, size * nmemb);
+
+    /* Returning anything other than the chunk size aborts the transfer with CURLE_WRITE_ERROR */
+    return ok ? size * nmemb : 0;
+}
+
+int _rrc_delta_progress_callback(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+    /* Abort rather than shutting down with the output file still open, `_rrc_delta_fetch_into' shuts down once it's closed. */
+    return rrc_shutdown_pending() ? 1 : 0;
+}
+
+/*
+    Computes the CRC32 of an installed file. `exists' is false if there is no such file.
+*/
+static struct rrc_result _rrc_delta_file_crc(const char *path, bool *exists, u32 *crc)
+{
+    *crc = crc32(0, Z_NULL, 0);
+    *exists = false;
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        if (errno == ENOENT)
+        {
+            return rrc_result_success;
+        }
+
+        return rrc_result_create_error_errno(errno, "Failed to open installed file for delta update");
+    }
+
+    u8 buf[4096];
+    size_t read;
+    while ((read = fread(buf, 1, sizeof(buf), file)) > 0)
+    {
+        *crc = crc32(*crc, buf, read);
+    }
+
+    bool failed = ferror(file);
+    fclose(file);
+    if (failed)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to read installed file for delta update");
+    }
+
+    *exists = true;
+    return rrc_result_success;
+}
+
+/*
+    Downloads either a patch against `path' or (if `raw') the new file in full into `tmp_path',
+    and checks that the result is what the manifest says it should be.
+*/
+static struct rrc_result _rrc_delta_fetch_into(struct rrc_update_session *session, const char *url, bool raw, const char *path, const char *tmp_path, u32 new_crc, u32 new_size)
+{
+    struct _rrc_delta_write_ctx ctx = {
+        .raw = raw,
+        .state = _RRC_DELTA_STATE_HEADER,
+        .crc = crc32(0, Z_NULL, 0),
+        .new_size = new_size,
+        .res = rrc_result_success,
+    };
+
+    if (!raw)
+    {
+        ctx.base = fopen(path, "rb");
+        if (ctx.base == NULL)
+        {
+            return rrc_result_create_error_errno(errno, "Failed to open installed file for delta update");
+        }
+    }
+
+    struct rrc_result res = rrc_update_open_extract_file(tmp_path, &ctx.out);
+    if (rrc_result_is_error(res))
+    {
+        if (ctx.base != NULL)
+        {
+            fclose(ctx.base);
+        }
+        return res;
+    }
+
+    CURL *curl = rrc_update_session_handle(session);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    /* Otherwise an error page would be taken for the file or patch */
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, _rrc_delta_progress_callback);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, _RRC_DELTA_LOW_SPEED_TIME);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _rrc_delta_write_data_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &ctx);
+
+    CURLcode cres = curl_easy_perform(curl);
+    rrc_update_stats_add_transfer(curl);
+
+    if (ctx.base != NULL)
+    {
+        fclose(ctx.base);
+    }
+
+    bool close_failed = rrc_update_close_extract_file(ctx.out) != 0;
+
+    if (rrc_result_is_error(ctx.res))
+    {
+        res = ctx.res;
+    }
+    else if (cres != CURLE_OK)
+    {
+        res = rrc_result_create_error_curl(cres, "Failed to download delta update file");
+    }
+    else if (close_failed)
+    {
+        res = rrc_result_create_error_errno(errno, "Failed to close updated file");
+    }
+    else if (!raw && !_rrc_delta_patch_complete(&ctx))
+    {
+        res = rrc_result_create_error_misc_update("Delta patch is truncated");
+    }
+    else if (ctx.written != new_size || ctx.crc != new_crc)
+    {
+        res = rrc_result_create_error_misc_update("Updated file does not match the delta manifest");
+    }
+
+    if (rrc_result_is_error(res))
+    {
+        remove(tmp_path);
+    }
+
+    if (cres == CURLE_ABORTED_BY_CALLBACK)
+    {
+        rrc_shutdown_check();
+    }
+
+    return res;
+}
+
+/* A file listed in the delta manifest. The strings point into the manifest. */
+struct _rrc_delta_entry
+{
+    char *path;
+    /* Whether there is a patch, made against an installed file with the CRC32 `base_crc' */
+    bool has_patch;
+    u32 base_crc;
+    u32 new_crc;
+    u32 new_size;
+    char *patch_url;
+    char *full_url;
+    /* Whether the installed files manifest says the file is up to date already */
+    bool installed;
+};
+
+/* Parses a whole field as an unsigned 32 bit number. */
+static bool _rrc_delta_parse_u32(const char *str, int base, u32 *out)
+{
+    /* strtoul would accept leading whitespace and a sign, neither of which belongs in the manifest. */
+    if (!isxdigit((unsigned char)str[0]))
+    {
+        return false;
+    }
+
+    errno = 0;
+    char *end;
+    unsigned long value = strtoul(str, &end, base);
+    if (*end != '\0' || errno != 0 || value > 0xffffffffUL)
+    {
+        return false;
+    }
+
+    *out = value;
+    return true;
+}
+
+/* Fills `entry' from the six fields of a manifest line. Returns false if any of them is malformed. */
+static bool _rrc_delta_parse_entry(char **fields, struct _rrc_delta_entry *entry)
+{
+    entry->path = fields[0];
+    entry->patch_url = fields[4];
+    entry->full_url = fields[5];
+    entry->installed = false;
+
+    if (!_rrc_delta_parse_u32(fields[2], 16, &entry->new_crc) || !_rrc_delta_parse_u32(fields[3], 10, &entry->new_size))
+    {
+        return false;
+    }
+
+    entry->base_crc = 0;
+    if (strcmp(fields[1], "-") != 0 && !_rrc_delta_parse_u32(fields[1], 16, &entry->base_crc))
+    {
+        return false;
+    }
+
+    entry->has_patch = strcmp(fields[1], "-") != 0 && strcmp(entry->patch_url, "-") != 0;
+    return true;
+}
+
+static struct rrc_result _rrc_delta_apply_entry(struct rrc_update_session *session, struct rrc_txn *txn, struct _rrc_delta_entry *entry)
+{
+    if (entry->installed)
+    {
+        return rrc_result_success;
+    }
+
+    bool exists;
+    u32 installed_crc;
+    TRY(_rrc_delta_file_crc(entry->path, &exists, &installed_crc));
+
+    if (exists && installed_crc == entry->new_crc)
+    {
+        /* Already up to date, e.g. because it was modified to match. Only recorded as installed once the update is committed. */
+        return rrc_txn_add_verified(txn, entry->path, entry->new_crc, entry->new_size);
+    }
+
+    /* The patch is applied against the installed file, which stays untouched until the update is committed. */
+    char tmp_path[PATH_MAX];
+    rrc_txn_stage_path(entry->path, tmp_path, sizeof(tmp_path));
+
+    bool patched = false;
+    if (exists && entry->has_patch && installed_crc == entry->base_crc)
+    {
+        struct rrc_result res = _rrc_delta_fetch_into(session, entry->patch_url, false, entry->path, tmp_path, entry->new_crc, entry->new_size);
+        patched = !rrc_result_is_error(res);
+        rrc_result_free(res);
+    }
+
+    if (!patched)
+    {
+        /* The installed file isn't the one the patch was made against (or the patch failed), so replace it outright. */
+        TRY(_rrc_delta_fetch_into(session, entry->full_url, true, entry->path, tmp_path, entry->new_crc, entry->new_size));
+    }
+
+    return rrc_txn_add_staged(txn, entry->path, true, entry->new_crc, entry->new_size);
+}
+
+/*
+    Splits the manifest into its entries and marks the ones that are installed already.
+    `entries' must be freed by the caller, even on failure.
+*/
+static struct rrc_result _rrc_delta_parse_manifest(char *manifest, struct rrc_installed_manifest *installed, struct _rrc_delta_entry **entries, u32 *count)
+{
+    /* Every entry takes a line, so this is enough for all of them. */
+    u32 capacity = 1;
+    for (char *c = manifest; *c != '\0'; c++)
+    {
+        capacity += *c == '\n';
+    }
+
+    *count = 0;
+    *entries = malloc(sizeof(struct _rrc_delta_entry) * capacity);
+    if (*entries == NULL)
+    {
+        return rrc_result_create_error_errno(ENOMEM, "Failed to allocate delta update manifest");
+    }
+
+    char *cursor = manifest;
+    char *line;
+    while ((line = rrc_versionsfile_next_line(&cursor)) != NULL)
+    {
+        if (line[0] == '#')
+        {
+            continue;
+        }
+
+        char *fields[6];
+        int num_fields = 0;
+        char *field;
+        while ((field = rrc_versionsfile_next_field(&line)) != NULL && num_fields < 6)
+        {
+            fields[num_fields++] = field;
+        }
+
+        struct _rrc_delta_entry *entry = &(*entries)[*count];
+        if (num_fields != 6 || field != NULL || !_rrc_delta_parse_entry(fields, entry))
+        {
+            return rrc_result_create_error_misc_update("Invalid line in delta update manifest");
+        }
+
+        entry->installed = rrc_installed_matches(installed, entry->path, entry->new_crc, entry->new_size);
+        (*count)++;
+    }
+
+    return rrc_result_success;
+}
+
+/* Like with a ZIP, an update is only started if all the files it may write fit on the SD card. */
+static struct rrc_result _rrc_delta_check_space(struct _rrc_delta_entry *entries, u32 count)
+{
+    u64 needed = 0;
+    for (u32 i = 0; i < count; i++)
+    {
+        if (!entries[i].installed)
+        {
+            needed += entries[i].new_size;
+        }
+    }
+
+    unsigned long sd_free;
+    rrc_time_tick space_check_start = gettime();
+    TRY(sd_get_free_space(&sd_free));
+    rrc_update_stats_add_time(RRC_UPDATE_STATS_SPACE_CHECK, space_check_start);
+
+    if (needed > sd_free)
+    {
+        return rrc_result_create_error_misc_update("Not enough free space on SD card for update");
+    }
+
+    return rrc_result_success;
+}
+
+struct rrc_result rrc_delta_apply_manifest(struct rrc_update_session *session, const char *manifest_url, int current_update, int max_updates, struct rrc_installed_manifest *installed, struct rrc_txn *txn)
+{
+    char *manifest;
+    CURLcode cres = rrc_update_session_fetch(session, manifest_url, "Fetching Update Manifest", &manifest);
+    if (cres != CURLE_OK)
+    {
+        return rrc_result_create_error_curl(cres, "Failed to get delta update manifest");
+    }
+
+    struct _rrc_delta_entry *entries;
+    u32 count;
+    struct rrc_result res = _rrc_delta_parse_manifest(manifest, installed, &entries, &count);
+    if (!rrc_result_is_error(res))
+    {
+        res = _rrc_delta_check_space(entries, count);
+    }
+
+    for (u32 i = 0; i < count && !rrc_result_is_error(res); i++)
+    {
+        char message[128];
+        snprintf(message, sizeof(message), "Updating %s (update %d of %d)", entries[i].path, current_update + 1, max_updates);
+        rrc_con_update(message, ((f64)(i + 1) / (f64)count) * 100);
+
+        res = _rrc_delta_apply_entry(session, txn, &entries[i]);
+    }
+
+    free(entries);
+    free(manifest);
+    return res;
+}
@@ -0,0 +1,46 @@
+/*
+    delta.h - manifest-driven delta update headers
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RRC_DELTA_H
+#define RRC_DELTA_H
+
+#include "../result.h"
+#include "session.h"
+#include "installed.h"
+#include "txn.h"
+
+/* Key in a versions file entry holding the URL of the delta manifest for that version. */
+#define RRC_DELTA_EXTRA_KEY "delta"
+
+/*
+    Applies an update described by a delta manifest instead of extracting the full ZIP.
+
+    The manifest lists every file changed by the update together with the CRC32 it has before
+    and after. Files whose installed copy matches the expected base are patched with a small binary
+    diff, and everything else (new files, or files that were modified locally) is downloaded in full.
+    Files that already have the new contents are left alone. Every file that is written goes to the
+    staging directory and is recorded in `txn', so it only replaces the installed one when that is committed.
+    `installed' is only read; files that are up to date are recorded in `txn' as well.
+
+    Nothing is downloaded if a line of the manifest is malformed or the files don't fit on the SD card.
+    Otherwise, an error is only returned if a file could be neither patched nor downloaded in full. `txn' may
+    then hold some of the files already, see `rrc_txn_reset'.
+*/
+struct rrc_result rrc_delta_apply_manifest(struct rrc_update_session *session, const char *manifest_url, int current_update, int max_updates, struct rrc_installed_manifest *installed, struct rrc_txn *txn);
+
+#endif
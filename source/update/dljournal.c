@@ -0,0 +1,233 @@
+/*
+    dljournal.c - update download progress journal implementation
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    The journal file format is defined as follows:
+
+    | Name              | Size in bytes |
+    |-------------------|---------------|
+    | Format Magic      | 4             | (always the value of `RRC_DLJOURNAL_MAGIC`)
+    | Format Version    | 4             |
+    | Mode              | 4             |
+    | Expected Length   | 8             |
+    | Committed Bytes   | 8             |
+    | Committed CRC32   | 4             | (CRC32 of the committed bytes, 0 in segmented mode)
+    | URL Length        | 4             |
+    | URL               | Variable      |
+    | Segment Count     | 4             |
+    | Segment Committed | 8 * count     | (committed bytes of each segment, relative to its start)
+    | Segment CRC32     | 4 * count     | (CRC32 of the committed bytes of each segment)
+    | Checksum          | 4             | (CRC32 of everything before it)
+
+    Like the installed files manifest, the journal is written to a temporary file that is then
+    renamed over the old one, and the temporary file is loaded if we're interrupted in between.
+    A journal that is still damaged fails the checksum, in which case the download simply starts over.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include "dljournal.h"
+
+#define RRC_DLJOURNAL_MAGIC 0x52524a4c /* RRJL */
+#define RRC_DLJOURNAL_VERSION 3
+
+/* Reads `len' bytes and folds them into the running checksum. */
+static bool _rrc_dljournal_read(FILE *file, void *data, u32 len, u32 *crc)
+{
+    if (fread(data, 1, len, file) != len)
+    {
+        return false;
+    }
+
+    *crc = crc32(*crc, data, len);
+    return true;
+}
+
+/* Writes `len' bytes and folds them into the running checksum. */
+static bool _rrc_dljournal_write(FILE *file, const void *data, u32 len, u32 *crc)
+{
+    *crc = crc32(*crc, data, len);
+    return fwrite(data, 1, len, file) == len;
+}
+
+/* Reads the journal at `path' into `stored'. Returns false if there is none or it is damaged. */
+static bool _rrc_dljournal_load_from(const char *path, struct rrc_dljournal *stored)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+    {
+        return false;
+    }
+
+    u32 magic, version, mode, crc, url_len, num_segments, checksum;
+    u64 length, committed;
+    u64 segments[RRC_DLJOURNAL_MAX_SEGMENTS];
+    u32 running = crc32(0, Z_NULL, 0);
+
+    bool ok = _rrc_dljournal_read(file, &magic, sizeof(magic), &running) && magic == RRC_DLJOURNAL_MAGIC &&
+              _rrc_dljournal_read(file, &version, sizeof(version), &running) && version == RRC_DLJOURNAL_VERSION &&
+              _rrc_dljournal_read(file, &mode, sizeof(mode), &running) &&
+              _rrc_dljournal_read(file, &length, sizeof(length), &running) &&
+              _rrc_dljournal_read(file, &committed, sizeof(committed), &running) &&
+              _rrc_dljournal_read(file, &crc, sizeof(crc), &running) &&
+              _rrc_dljournal_read(file, &url_len, sizeof(url_len), &running) && url_len < sizeof(stored->url) &&
+              _rrc_dljournal_read(file, stored->url, url_len, &running) &&
+              _rrc_dljournal_read(file, &num_segments, sizeof(num_segments), &running) && num_segments <= RRC_DLJOURNAL_MAX_SEGMENTS &&
+              _rrc_dljournal_read(file, segments, sizeof(u64) * num_segments, &running) &&
+              _rrc_dljournal_read(file, stored->segment_crcs, sizeof(u32) * num_segments, &running) &&
+              fread(&checksum, sizeof(checksum), 1, file) == 1 && checksum == running;
+    fclose(file);
+
+    if (!ok)
+    {
+        return false;
+    }
+
+    stored->mode = mode;
+    stored->expected_length = length;
+    stored->committed = committed;
+    stored->crc = crc;
+    stored->url[url_len] = '\0';
+    stored->num_segments = num_segments;
+    for (u32 i = 0; i < num_segments; i++)
+    {
+        stored->segments[i] = segments[i];
+    }
+
+    return true;
+}
+
+void rrc_dljournal_load(const char *url, curl_off_t expected_length, enum rrc_dljournal_mode mode, struct rrc_dljournal *journal)
+{
+    journal->mode = mode;
+    journal->expected_length = expected_length;
+    journal->committed = 0;
+    journal->stored = 0;
+    journal->crc = crc32(0, Z_NULL, 0);
+    journal->num_segments = 0;
+    memset(journal->segments, 0, sizeof(journal->segments));
+    for (u32 i = 0; i < RRC_DLJOURNAL_MAX_SEGMENTS; i++)
+    {
+        journal->segment_crcs[i] = journal->crc;
+    }
+    snprintf(journal->url, sizeof(journal->url), "%s", url);
+
+    struct rrc_dljournal stored;
+    if (!_rrc_dljournal_load_from(RRC_DLJOURNAL_PATH, &stored) && !_rrc_dljournal_load_from(RRC_DLJOURNAL_TMP_PATH, &stored))
+    {
+        return;
+    }
+
+    if (stored.mode != mode || stored.expected_length != expected_length || stored.committed > stored.expected_length || strcmp(stored.url, url) != 0)
+    {
+        // Journal of some other download, maybe the file on the server was replaced since.
+        return;
+    }
+
+    journal->committed = stored.committed;
+    journal->stored = stored.committed;
+    journal->crc = stored.crc;
+    journal->num_segments = stored.num_segments;
+    for (u32 i = 0; i < stored.num_segments; i++)
+    {
+        journal->segments[i] = stored.segments[i];
+        journal->segment_crcs[i] = stored.segment_crcs[i];
+    }
+}
+
+struct rrc_result rrc_dljournal_commit(struct rrc_dljournal *journal, curl_off_t committed)
+{
+    journal->committed = committed;
+    if (committed - journal->stored < RRC_DLJOURNAL_COMMIT_INTERVAL)
+    {
+        return rrc_result_success;
+    }
+
+    return rrc_dljournal_store(journal);
+}
+
+struct rrc_result rrc_dljournal_store(struct rrc_dljournal *journal)
+{
+    FILE *file = fopen(RRC_DLJOURNAL_TMP_PATH, "wb");
+    if (!file)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to open update download journal");
+    }
+
+    u32 magic = RRC_DLJOURNAL_MAGIC;
+    u32 version = RRC_DLJOURNAL_VERSION;
+    u32 mode = journal->mode;
+    u64 length = journal->expected_length;
+    u64 committed = journal->committed;
+    u32 crc = journal->crc;
+    u32 url_len = strlen(journal->url);
+    u32 num_segments = journal->num_segments;
+    u64 segments[RRC_DLJOURNAL_MAX_SEGMENTS];
+    for (u32 i = 0; i < num_segments; i++)
+    {
+        segments[i] = journal->segments[i];
+    }
+
+    u32 checksum = crc32(0, Z_NULL, 0);
+    bool ok = _rrc_dljournal_write(file, &magic, sizeof(magic), &checksum) &&
+              _rrc_dljournal_write(file, &version, sizeof(version), &checksum) &&
+              _rrc_dljournal_write(file, &mode, sizeof(mode), &checksum) &&
+              _rrc_dljournal_write(file, &length, sizeof(length), &checksum) &&
+              _rrc_dljournal_write(file, &committed, sizeof(committed), &checksum) &&
+              _rrc_dljournal_write(file, &crc, sizeof(crc), &checksum) &&
+              _rrc_dljournal_write(file, &url_len, sizeof(url_len), &checksum) &&
+              _rrc_dljournal_write(file, journal->url, url_len, &checksum) &&
+              _rrc_dljournal_write(file, &num_segments, sizeof(num_segments), &checksum) &&
+              _rrc_dljournal_write(file, segments, sizeof(u64) * num_segments, &checksum) &&
+              _rrc_dljournal_write(file, journal->segment_crcs, sizeof(u32) * num_segments, &checksum) &&
+              fwrite(&checksum, sizeof(checksum), 1, file) == 1 && fflush(file) == 0 && fsync(fileno(file)) == 0;
+
+    if (fclose(file) != 0 || !ok)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to write update download journal");
+    }
+
+    /* FAT can't rename over an existing file. */
+    if (remove(RRC_DLJOURNAL_PATH) != 0 && errno != ENOENT)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to replace update download journal");
+    }
+
+    if (rename(RRC_DLJOURNAL_TMP_PATH, RRC_DLJOURNAL_PATH) != 0)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to replace update download journal");
+    }
+
+    journal->stored = journal->committed;
+    return rrc_result_success;
+}
+
+struct rrc_result rrc_dljournal_remove()
+{
+    if ((remove(RRC_DLJOURNAL_PATH) != 0 && errno != ENOENT) ||
+        (remove(RRC_DLJOURNAL_TMP_PATH) != 0 && errno != ENOENT))
+    {
+        return rrc_result_create_error_errno(errno, "Failed to remove update download journal");
+    }
+
+    return rrc_result_success;
+}
@@ -0,0 +1,96 @@
+/*
+    dljournal.h - update download progress journal headers
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RRC_DLJOURNAL_H
+#define RRC_DLJOURNAL_H
+
+#include <gctypes.h>
+#include <curl/curl.h>
+
+#include "../result.h"
+
+#define RRC_DLJOURNAL_PATH "update.zip.journal"
+#define RRC_DLJOURNAL_TMP_PATH "update.zip.journal.tmp"
+#define RRC_DLJOURNAL_URL_MAX 512
+/* How many bytes need to be committed before the journal is rewritten. */
+#define RRC_DLJOURNAL_COMMIT_INTERVAL (1000 * 1000) /* 1MB */
+/* Most segments a download can be split into. */
+#define RRC_DLJOURNAL_MAX_SEGMENTS 8
+
+enum rrc_dljournal_mode
+{
+    /* The archive is downloaded as-is into the temporary update ZIP.
+       `committed' is the amount of bytes of it that are synced to the SD card. */
+    RRC_DLJOURNAL_MODE_FILE = 0,
+    /* The archive is extracted while being downloaded.
+       `committed' is the archive offset right after the last fully extracted entry. */
+    RRC_DLJOURNAL_MODE_STREAM = 1,
+    /* The archive is downloaded into the temporary update ZIP over several connections at once,
+       each filling its own region of the file. `segments' holds the synced bytes of each region
+       and `committed' their sum. */
+    RRC_DLJOURNAL_MODE_SEGMENTED = 2,
+};
+
+/*
+    Records how far the download of an update ZIP got, so that it can be continued with a
+    range request after the console was turned off or the connection dropped.
+*/
+struct rrc_dljournal
+{
+    enum rrc_dljournal_mode mode;
+    /* Content-Length of the whole archive, used to detect that the file on the server changed. */
+    curl_off_t expected_length;
+    curl_off_t committed;
+    /* Bytes committed when the journal was last written to the SD card. */
+    curl_off_t stored;
+    /* CRC32 of the first `committed' bytes of the archive, so verifying a continued download doesn't
+       need to read back what was already received. Unused in segmented mode. */
+    u32 crc;
+    char url[RRC_DLJOURNAL_URL_MAX];
+    /* Only used in segmented mode, 0 otherwise. */
+    u32 num_segments;
+    curl_off_t segments[RRC_DLJOURNAL_MAX_SEGMENTS];
+    /* CRC32 of the committed bytes of each segment. */
+    u32 segment_crcs[RRC_DLJOURNAL_MAX_SEGMENTS];
+};
+
+/*
+    Loads the journal for a download of `url' in the given mode.
+
+    If there is no journal, or it belongs to a different download, `journal' is initialised
+    with nothing committed so that the download starts from the beginning.
+*/
+void rrc_dljournal_load(const char *url, curl_off_t expected_length, enum rrc_dljournal_mode mode, struct rrc_dljournal *journal);
+
+/*
+    Writes the journal to the SD card if enough progress was made since it was last stored.
+    Callers must make sure that everything up to `committed' is synced to the SD card first.
+*/
+struct rrc_result rrc_dljournal_commit(struct rrc_dljournal *journal, curl_off_t committed);
+
+/*
+    Unconditionally writes the journal to the SD card.
+*/
+struct rrc_result rrc_dljournal_store(struct rrc_dljournal *journal);
+
+/*
+    Removes the journal once the download it describes is no longer needed.
+*/
+struct rrc_result rrc_dljournal_remove();
+
+#endif
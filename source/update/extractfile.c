@@ -0,0 +1,137 @@
+/*
+    extractfile.c - files that extracted updates are written to implementation
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <malloc.h>
+#include <sys/stat.h>
+
+#include "extractfile.h"
+#include "../strset.h"
+#include "../util.h"
+
+/* Directories known to exist, so that each one is only created once during an update. */
+static struct rrc_strset _rrc_update_known_dirs = {NULL, 0, 0};
+
+/*
+    Shared stdio buffer of the extracted file that is currently open. Allocated on first use and kept around,
+    since there is only ever one such file open at a time.
+*/
+static u8 *_rrc_update_extract_file_buffer = NULL;
+
+/* How many files opened by `rrc_update_open_extract_file' aren't closed yet, which must never be more than one. */
+static int _rrc_update_extract_files_open = 0;
+
+/**
+ * Creates any directories for a given path like "a/b/c/d.txt", one at a time, starting with the outermost dir.
+ * Directories that were already created before are skipped without touching the file system.
+ */
+static struct rrc_result mkdir_recursive(const char *fp)
+{
+    char tmp_path[PATH_MAX];
+    RRC_ASSERT(strlen(fp) < PATH_MAX, "path should never be longer than PATH_MAX");
+
+    // fast path: the file's own directory is known, so all of its parents are too
+    const char *last_slash = strrchr(fp, '/');
+    if (last_slash == NULL || last_slash == fp)
+    {
+        return rrc_result_success;
+    }
+
+    int dir_len = last_slash - fp;
+    memcpy(tmp_path, fp, dir_len);
+    tmp_path[dir_len] = '\0';
+    if (rrc_strset_contains(&_rrc_update_known_dirs, tmp_path))
+    {
+        return rrc_result_success;
+    }
+
+    // start at 1 to skip any leading slash
+    for (int i = 1; i <= dir_len; i++)
+    {
+        if (fp[i] == '/')
+        {
+            memcpy(tmp_path, fp, i);
+            tmp_path[i] = '\0';
+            if (rrc_strset_contains(&_rrc_update_known_dirs, tmp_path))
+            {
+                continue;
+            }
+
+            int err = mkdir(tmp_path, 0777);
+            if (err != 0 && errno != EEXIST)
+            {
+                return rrc_result_create_error_errno(errno, "Failed to create recursive directories for path");
+            }
+
+            TRY(rrc_strset_add(&_rrc_update_known_dirs, tmp_path));
+        }
+    }
+
+    return rrc_result_success;
+}
+
+struct rrc_result rrc_update_create_parent_dirs(const char *filepath)
+{
+    return mkdir_recursive(filepath);
+}
+
+struct rrc_result rrc_update_open_extract_file(const char *filepath, FILE **outfile)
+{
+    // The buffer would be written to by two files at once.
+    RRC_ASSERT(_rrc_update_extract_files_open == 0, "only one extracted file may be open at a time");
+
+    // Make sure the directories exist first rather than retrying after a failed open. Thanks to the
+    // directory cache this only costs a lookup for all but the first file in a directory.
+    TRY(mkdir_recursive(filepath));
+
+    *outfile = fopen(filepath, "w");
+    if (!*outfile)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to create output file for extracting ZIP entry");
+    }
+
+    if (_rrc_update_extract_file_buffer == NULL)
+    {
+        _rrc_update_extract_file_buffer = memalign(32, RRC_UPDATE_IO_BUFFER_SIZE);
+    }
+
+    /* Small writes are collected until a whole buffer can go to libfat at once, which then skips
+       its sector cache. Without a buffer we simply get stdio's small default one. */
+    if (_rrc_update_extract_file_buffer != NULL)
+    {
+        setvbuf(*outfile, (char *)_rrc_update_extract_file_buffer, _IOFBF, RRC_UPDATE_IO_BUFFER_SIZE);
+    }
+
+    _rrc_update_extract_files_open++;
+    return rrc_result_success;
+}
+
+int rrc_update_close_extract_file(FILE *file)
+{
+    RRC_ASSERT(_rrc_update_extract_files_open == 1, "closing a file that isn't an open extracted file");
+    _rrc_update_extract_files_open--;
+    return fclose(file);
+}
+
+void rrc_update_forget_parent_dirs()
+{
+    rrc_strset_free(&_rrc_update_known_dirs);
+}
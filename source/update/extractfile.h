@@ -0,0 +1,56 @@
+/*
+    extractfile.h - files that extracted updates are written to headers
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RRC_UPDATE_EXTRACTFILE_H
+#define RRC_UPDATE_EXTRACTFILE_H
+
+#include <stdio.h>
+
+#include "../result.h"
+
+/* Size of the buffers used for writing extracted files. Large writes go to the SD card in whole clusters. */
+#define RRC_UPDATE_IO_BUFFER_SIZE (256 * 1024)
+
+/*
+    Opens `filepath' for writing an extracted ZIP entry, creating any missing parent directories.
+
+    The file gets a RRC_UPDATE_IO_BUFFER_SIZE buffer that is shared with all other files opened
+    this way, so only one of them may be open at a time: every file is extracted completely and
+    closed with `rrc_update_close_extract_file' before the next one is opened, including on errors.
+    Opening a second one while another is still open is a bug, and stops the launcher.
+*/
+struct rrc_result rrc_update_open_extract_file(const char *filepath, FILE **outfile);
+
+/*
+    Closes a file opened with `rrc_update_open_extract_file', which writes out what is left in its
+    buffer. Returns what fclose returns, i.e. nonzero with errno set if the file couldn't be written.
+*/
+int rrc_update_close_extract_file(FILE *file);
+
+/*
+    Creates any missing parent directories of `filepath'. Directories created this way are remembered
+    for the rest of the update, so asking again for the same directory is cheap.
+*/
+struct rrc_result rrc_update_create_parent_dirs(const char *filepath);
+
+/*
+    Forgets the directories `rrc_update_create_parent_dirs' remembered, once the update is over.
+*/
+void rrc_update_forget_parent_dirs();
+
+#endif
@@ -0,0 +1,130 @@
+/*
+    fetchcache.c - on-SD cache of small HTTP responses implementation
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    The cache file format is defined as follows:
+
+    | Name                 | Size in bytes |
+    |----------------------|---------------|
+    | Format Magic         | 4             | (always the value of `RRC_FETCHCACHE_MAGIC`)
+    | Format Version       | 4             |
+    | ETag Length          | 2             |
+    | ETag                 | Variable      |
+    | Last-Modified Length | 2             |
+    | Last-Modified        | Variable      |
+    | Body Length          | 4             |
+    | Body                 | Variable      |
+    | Checksum             | 4             | (CRC32 of the body)
+
+    A damaged cache file is simply ignored, and the response is downloaded in full again.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <zlib.h>
+
+#include "fetchcache.h"
+
+#define RRC_FETCHCACHE_MAGIC 0x52524643 /* RRFC */
+#define RRC_FETCHCACHE_VERSION 0
+
+static bool _rrc_fetchcache_read_validator(FILE *file, char *out)
+{
+    u16 len;
+    if (fread(&len, sizeof(len), 1, file) != 1 || len >= RRC_FETCHCACHE_VALIDATOR_MAX || fread(out, 1, len, file) != len)
+    {
+        return false;
+    }
+
+    out[len] = '\0';
+    return true;
+}
+
+static bool _rrc_fetchcache_write_validator(FILE *file, const char *validator)
+{
+    u16 len = strlen(validator);
+    return fwrite(&len, sizeof(len), 1, file) == 1 && fwrite(validator, 1, len, file) == len;
+}
+
+bool rrc_fetchcache_load(const char *path, struct rrc_fetchcache_entry *entry)
+{
+    memset(entry, 0, sizeof(*entry));
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    u32 magic, version, checksum;
+    bool ok = fread(&magic, sizeof(magic), 1, file) == 1 && magic == RRC_FETCHCACHE_MAGIC &&
+              fread(&version, sizeof(version), 1, file) == 1 && version == RRC_FETCHCACHE_VERSION &&
+              _rrc_fetchcache_read_validator(file, entry->etag) &&
+              _rrc_fetchcache_read_validator(file, entry->last_modified) &&
+              fread(&entry->body_len, sizeof(entry->body_len), 1, file) == 1 &&
+              (entry->body = malloc(entry->body_len + 1)) != NULL &&
+              fread(entry->body, 1, entry->body_len, file) == entry->body_len &&
+              fread(&checksum, sizeof(checksum), 1, file) == 1 &&
+              checksum == crc32(crc32(0, Z_NULL, 0), (const Bytef *)entry->body, entry->body_len);
+    fclose(file);
+
+    if (!ok)
+    {
+        rrc_fetchcache_free(entry);
+        return false;
+    }
+
+    entry->body[entry->body_len] = '\0';
+    return true;
+}
+
+struct rrc_result rrc_fetchcache_store(const char *path, const struct rrc_fetchcache_entry *entry)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to open response cache for writing");
+    }
+
+    u32 magic = RRC_FETCHCACHE_MAGIC;
+    u32 version = RRC_FETCHCACHE_VERSION;
+    u32 checksum = crc32(crc32(0, Z_NULL, 0), (const Bytef *)entry->body, entry->body_len);
+
+    bool ok = fwrite(&magic, sizeof(magic), 1, file) == 1 &&
+              fwrite(&version, sizeof(version), 1, file) == 1 &&
+              _rrc_fetchcache_write_validator(file, entry->etag) &&
+              _rrc_fetchcache_write_validator(file, entry->last_modified) &&
+              fwrite(&entry->body_len, sizeof(entry->body_len), 1, file) == 1 &&
+              fwrite(entry->body, 1, entry->body_len, file) == entry->body_len &&
+              fwrite(&checksum, sizeof(checksum), 1, file) == 1;
+
+    if (fclose(file) != 0 || !ok)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to write response cache");
+    }
+
+    return rrc_result_success;
+}
+
+void rrc_fetchcache_free(struct rrc_fetchcache_entry *entry)
+{
+    free(entry->body);
+    memset(entry, 0, sizeof(*entry));
+}
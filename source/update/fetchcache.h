@@ -0,0 +1,56 @@
+/*
+    fetchcache.h - on-SD cache of small HTTP responses headers
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RRC_FETCHCACHE_H
+#define RRC_FETCHCACHE_H
+
+#include <gctypes.h>
+
+#include "../result.h"
+
+/* Longest ETag or Last-Modified value we keep. Longer ones just aren't cached. */
+#define RRC_FETCHCACHE_VALIDATOR_MAX 128
+
+/*
+    A previously downloaded response body along with the validators the server sent for it,
+    which let us ask the server whether it changed instead of downloading it again.
+*/
+struct rrc_fetchcache_entry
+{
+    /* Empty if the server didn't send one. */
+    char etag[RRC_FETCHCACHE_VALIDATOR_MAX];
+    char last_modified[RRC_FETCHCACHE_VALIDATOR_MAX];
+    /* NULL-terminated. */
+    char *body;
+    u32 body_len;
+};
+
+/*
+    Loads the cached response at `path'. Returns false if there is none or it is damaged,
+    in which case `entry' is empty.
+*/
+bool rrc_fetchcache_load(const char *path, struct rrc_fetchcache_entry *entry);
+
+/*
+    Writes `entry' to `path', replacing any previously cached response.
+*/
+struct rrc_result rrc_fetchcache_store(const char *path, const struct rrc_fetchcache_entry *entry);
+
+void rrc_fetchcache_free(struct rrc_fetchcache_entry *entry);
+
+#endif
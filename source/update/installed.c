@@ -0,0 +1,329 @@
+/*
+    installed.c - manifest of installed distribution files implementation
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    The manifest file format is defined as follows:
+
+    | Name              | Size in bytes |
+    |-------------------|---------------|
+    | Format Magic      | 4             | (always the value of `RRC_INSTALLED_MAGIC`)
+    | Format Version    | 4             |
+    | Entry Count       | 4             |
+    | Entries           | Variable      |
+    | Checksum          | 4             | (CRC32 of everything before it)
+
+    Each entry, sorted by path:
+
+    | Name              | Size in bytes |
+    |-------------------|---------------|
+    | Path Length       | 2             |
+    | Path              | Variable      |
+    | CRC32             | 4             |
+    | Size              | 4             |
+    | Modification Time | 4             |
+
+    The manifest is written to a temporary file that is then renamed over the old one. If we're
+    interrupted between removing the old one and the rename, the temporary file is loaded instead.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "installed.h"
+
+#define RRC_INSTALLED_MAGIC 0x5252494d /* RRIM */
+#define RRC_INSTALLED_VERSION 0
+#define RRC_INSTALLED_HEADER_SIZE 12
+
+/*
+    Finds the index of `path', or where it would have to be inserted if it's not there.
+*/
+static u32 _rrc_installed_find(struct rrc_installed_manifest *manifest, const char *path, bool *found)
+{
+    u32 lo = 0, hi = manifest->count;
+    while (lo < hi)
+    {
+        u32 mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(manifest->entries[mid].path, path);
+        if (cmp == 0)
+        {
+            *found = true;
+            return mid;
+        }
+        else if (cmp < 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    *found = false;
+    return lo;
+}
+
+static u32 _rrc_installed_rd32(const u8 *p)
+{
+    u32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* Parses a manifest file that was read into memory. Returns false if it is damaged. */
+static bool _rrc_installed_parse(struct rrc_installed_manifest *manifest, const u8 *data, u32 len)
+{
+    if (len < RRC_INSTALLED_HEADER_SIZE + 4 ||
+        _rrc_installed_rd32(data) != RRC_INSTALLED_MAGIC ||
+        _rrc_installed_rd32(data + 4) != RRC_INSTALLED_VERSION ||
+        _rrc_installed_rd32(data + len - 4) != crc32(crc32(0, Z_NULL, 0), data, len - 4))
+    {
+        return false;
+    }
+
+    u32 count = _rrc_installed_rd32(data + 8);
+    u32 off = RRC_INSTALLED_HEADER_SIZE;
+    len -= 4;
+
+    manifest->entries = malloc(sizeof(struct rrc_installed_entry) * (count > 0 ? count : 1));
+    if (manifest->entries == NULL)
+    {
+        return false;
+    }
+    manifest->capacity = count;
+
+    for (u32 i = 0; i < count; i++)
+    {
+        u16 path_len;
+        if (off + sizeof(path_len) > len)
+        {
+            return false;
+        }
+        memcpy(&path_len, data + off, sizeof(path_len));
+        off += sizeof(path_len);
+
+        if (off + path_len + 12 > len)
+        {
+            return false;
+        }
+
+        struct rrc_installed_entry *entry = &manifest->entries[i];
+        entry->path = malloc(path_len + 1);
+        if (entry->path == NULL)
+        {
+            return false;
+        }
+        memcpy(entry->path, data + off, path_len);
+        entry->path[path_len] = '\0';
+        off += path_len;
+
+        entry->crc = _rrc_installed_rd32(data + off);
+        entry->size = _rrc_installed_rd32(data + off + 4);
+        entry->mtime = _rrc_installed_rd32(data + off + 8);
+        off += 12;
+
+        manifest->count++;
+    }
+
+    return off == len;
+}
+
+static bool _rrc_installed_load_from(struct rrc_installed_manifest *manifest, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    struct stat sb;
+    u8 *data = NULL;
+    bool ok = fstat(fileno(file), &sb) == 0 &&
+              (data = malloc(sb.st_size > 0 ? sb.st_size : 1)) != NULL &&
+              fread(data, 1, sb.st_size, file) == sb.st_size &&
+              _rrc_installed_parse(manifest, data, sb.st_size);
+
+    free(data);
+    fclose(file);
+
+    if (!ok)
+    {
+        rrc_installed_free(manifest);
+    }
+
+    return ok;
+}
+
+void rrc_installed_load(struct rrc_installed_manifest *manifest)
+{
+    manifest->entries = NULL;
+    manifest->count = 0;
+    manifest->capacity = 0;
+
+    if (_rrc_installed_load_from(manifest, RRC_INSTALLED_PATH))
+    {
+        return;
+    }
+
+    _rrc_installed_load_from(manifest, RRC_INSTALLED_TMP_PATH);
+}
+
+bool rrc_installed_matches(struct rrc_installed_manifest *manifest, const char *path, u32 crc, u32 size)
+{
+    bool found;
+    u32 idx = _rrc_installed_find(manifest, path, &found);
+    if (!found)
+    {
+        return false;
+    }
+
+    struct rrc_installed_entry *entry = &manifest->entries[idx];
+    if (entry->crc != crc || entry->size != size)
+    {
+        return false;
+    }
+
+    /* The file might have been deleted or replaced since we wrote it. */
+    struct stat sb;
+    return stat(path, &sb) == 0 && sb.st_size == size && (u32)sb.st_mtime == entry->mtime;
+}
+
+struct rrc_result rrc_installed_set(struct rrc_installed_manifest *manifest, const char *path, u32 crc, u32 size)
+{
+    struct stat sb;
+    if (stat(path, &sb) != 0)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to stat installed file");
+    }
+
+    bool found;
+    u32 idx = _rrc_installed_find(manifest, path, &found);
+    if (!found)
+    {
+        if (manifest->count == manifest->capacity)
+        {
+            u32 capacity = manifest->capacity > 0 ? manifest->capacity * 2 : 64;
+            struct rrc_installed_entry *entries = realloc(manifest->entries, sizeof(struct rrc_installed_entry) * capacity);
+            if (entries == NULL)
+            {
+                return rrc_result_create_error_errno(ENOMEM, "Failed to grow installed files manifest");
+            }
+            manifest->entries = entries;
+            manifest->capacity = capacity;
+        }
+
+        char *copy = strdup(path);
+        if (copy == NULL)
+        {
+            return rrc_result_create_error_errno(ENOMEM, "Failed to grow installed files manifest");
+        }
+
+        memmove(&manifest->entries[idx + 1], &manifest->entries[idx], sizeof(struct rrc_installed_entry) * (manifest->count - idx));
+        manifest->entries[idx].path = copy;
+        manifest->count++;
+    }
+
+    struct rrc_installed_entry *entry = &manifest->entries[idx];
+    entry->crc = crc;
+    entry->size = size;
+    entry->mtime = sb.st_mtime;
+    return rrc_result_success;
+}
+
+void rrc_installed_remove(struct rrc_installed_manifest *manifest, const char *path)
+{
+    bool found;
+    u32 idx = _rrc_installed_find(manifest, path, &found);
+    if (!found)
+    {
+        return;
+    }
+
+    free(manifest->entries[idx].path);
+    memmove(&manifest->entries[idx], &manifest->entries[idx + 1], sizeof(struct rrc_installed_entry) * (manifest->count - idx - 1));
+    manifest->count--;
+}
+
+/* Writes `len' bytes and folds them into the running checksum. */
+static bool _rrc_installed_write(FILE *file, const void *data, u32 len, u32 *crc)
+{
+    *crc = crc32(*crc, data, len);
+    return fwrite(data, 1, len, file) == len;
+}
+
+struct rrc_result rrc_installed_store(struct rrc_installed_manifest *manifest)
+{
+    FILE *file = fopen(RRC_INSTALLED_TMP_PATH, "wb");
+    if (file == NULL)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to open installed files manifest for writing");
+    }
+
+    u32 crc = crc32(0, Z_NULL, 0);
+    u32 header[3] = {RRC_INSTALLED_MAGIC, RRC_INSTALLED_VERSION, manifest->count};
+    bool ok = _rrc_installed_write(file, header, sizeof(header), &crc);
+
+    for (u32 i = 0; i < manifest->count && ok; i++)
+    {
+        struct rrc_installed_entry *entry = &manifest->entries[i];
+        u16 path_len = strlen(entry->path);
+        u32 fields[3] = {entry->crc, entry->size, entry->mtime};
+
+        ok = _rrc_installed_write(file, &path_len, sizeof(path_len), &crc) &&
+             _rrc_installed_write(file, entry->path, path_len, &crc) &&
+             _rrc_installed_write(file, fields, sizeof(fields), &crc);
+    }
+
+    ok = ok && fwrite(&crc, sizeof(crc), 1, file) == 1 && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0 || !ok)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to write installed files manifest");
+    }
+
+    /* FAT can't rename over an existing file. */
+    if (remove(RRC_INSTALLED_PATH) != 0 && errno != ENOENT)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to replace installed files manifest");
+    }
+
+    if (rename(RRC_INSTALLED_TMP_PATH, RRC_INSTALLED_PATH) != 0)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to replace installed files manifest");
+    }
+
+    return rrc_result_success;
+}
+
+void rrc_installed_free(struct rrc_installed_manifest *manifest)
+{
+    for (u32 i = 0; i < manifest->count; i++)
+    {
+        free(manifest->entries[i].path);
+    }
+
+    free(manifest->entries);
+    manifest->entries = NULL;
+    manifest->count = 0;
+    manifest->capacity = 0;
+}
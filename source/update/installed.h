@@ -0,0 +1,80 @@
+/*
+    installed.h - manifest of installed distribution files headers
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RRC_INSTALLED_H
+#define RRC_INSTALLED_H
+
+#include <gctypes.h>
+
+#include "../result.h"
+
+#define RRC_INSTALLED_PATH "RetroRewindChannel/.installed"
+/* The manifest is written here first and then renamed over the real one. */
+#define RRC_INSTALLED_TMP_PATH "RetroRewindChannel/.installed.tmp"
+
+struct rrc_installed_entry
+{
+    char *path;
+    u32 crc;
+    u32 size;
+    /* Modification time of the file when it was written by the updater, so that files
+       the user replaced by hand since don't count as installed. */
+    u32 mtime;
+};
+
+/*
+    Remembers the CRC32 and size of every file the updater wrote, so that extracting an update
+    can skip entries that are already installed instead of rewriting them.
+    Entries are kept sorted by path.
+*/
+struct rrc_installed_manifest
+{
+    struct rrc_installed_entry *entries;
+    u32 count;
+    u32 capacity;
+};
+
+/*
+    Loads the manifest from the SD card. A missing or damaged manifest just yields an empty one,
+    in which case every file is written as if nothing was installed.
+*/
+void rrc_installed_load(struct rrc_installed_manifest *manifest);
+
+/*
+    Checks whether `path' is installed with the given CRC32 and size, and hasn't been touched since.
+*/
+bool rrc_installed_matches(struct rrc_installed_manifest *manifest, const char *path, u32 crc, u32 size);
+
+/*
+    Records that `path' was just written with the given CRC32 and size.
+*/
+struct rrc_result rrc_installed_set(struct rrc_installed_manifest *manifest, const char *path, u32 crc, u32 size);
+
+/*
+    Forgets about `path', e.g. because it was deleted or is about to be overwritten.
+*/
+void rrc_installed_remove(struct rrc_installed_manifest *manifest, const char *path);
+
+/*
+    Atomically replaces the manifest on the SD card with `manifest'.
+*/
+struct rrc_result rrc_installed_store(struct rrc_installed_manifest *manifest);
+
+void rrc_installed_free(struct rrc_installed_manifest *manifest);
+
+#endif
@@ -0,0 +1,428 @@
+/*
+    planner.c - planning of multi-version updates implementation
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Only two records at the end of a ZIP archive are needed to know which files it contains:
+
+    | End of central directory | Size in bytes |
+    |--------------------------|---------------|
+    | Signature                | 4             | (0x06054b50)
+    | Disk numbers             | 4             |
+    | Entries on this disk     | 2             |
+    | Total entries            | 2             | (0xffff for ZIP64)
+    | Central directory size   | 4             |
+    | Central directory offset | 4             | (0xffffffff for ZIP64)
+    | Comment length           | 2             |
+    | Comment                  | Variable      |
+
+    which points to the central directory, a header per entry:
+
+    | Central header           | Size in bytes |
+    |--------------------------|---------------|
+    | Signature                | 4             | (0x02014b50)
+    | Various fields           | 12            |
+    | CRC32                    | 4             |
+    | Compressed size          | 4             |
+    | Uncompressed size        | 4             |
+    | File name length         | 2             |
+    | Extra field length       | 2             |
+    | Comment length           | 2             |
+    | Various fields           | 12            |
+    | File name                | Variable      |
+    | Extra field              | Variable      |
+    | Comment                  | Variable      |
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "planner.h"
+#include "session.h"
+#include "versionsfile.h"
+#include "../buffer.h"
+#include "../console.h"
+
+#define _RRC_PLAN_EOCD_SIG 0x06054b50
+#define _RRC_PLAN_EOCD_SIZE 22
+#define _RRC_PLAN_CENTRAL_HEADER_SIG 0x02014b50
+#define _RRC_PLAN_CENTRAL_HEADER_SIZE 46
+
+/* Central directory of one update ZIP. */
+struct _rrc_plan_cd
+{
+    struct rrc_buffer buffer;
+    /* Points into `buffer' */
+    const u8 *data;
+    u32 len;
+};
+
+static u16 _rrc_plan_rd16(const u8 *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static u32 _rrc_plan_rd32(const u8 *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+/* The files an interrupted attempt at the update already staged, sorted by path. */
+struct _rrc_plan_staged
+{
+    const struct rrc_txn_record **records;
+    u32 count;
+};
+
+/*
+    Reads the central directory header at `*cursor' and advances past it. Returns false at the end of
+    the central directory or if the header is damaged. `name' gets the file name, or an empty string for directories,
+    `crc' and `size' the CRC32 and uncompressed size of the file.
+*/
+static bool _rrc_plan_next_entry(const u8 **cursor, const u8 *end, char name[PATH_MAX], u32 *crc, u32 *size)
+{
+    const u8 *p = *cursor;
+    if (end - p < _RRC_PLAN_CENTRAL_HEADER_SIZE || _rrc_plan_rd32(p) != _RRC_PLAN_CENTRAL_HEADER_SIG)
+    {
+        return false;
+    }
+
+    u32 name_len = _rrc_plan_rd16(p + 28);
+    u32 total = _RRC_PLAN_CENTRAL_HEADER_SIZE + name_len + _rrc_plan_rd16(p + 30) + _rrc_plan_rd16(p + 32);
+    if (end - p < total || name_len >= PATH_MAX)
+    {
+        return false;
+    }
+
+    memcpy(name, p + _RRC_PLAN_CENTRAL_HEADER_SIZE, name_len);
+    name[name_len] = '\0';
+    if (name_len == 0 || name[name_len - 1] == '/')
+    {
+        name[0] = '\0';
+    }
+
+    *crc = _rrc_plan_rd32(p + 16);
+    *size = _rrc_plan_rd32(p + 24);
+    *cursor = p + total;
+    return true;
+}
+
+static struct rrc_result _rrc_plan_fetch_cd(struct rrc_update_session *session, const char *url, curl_off_t size, struct _rrc_plan_cd *cd)
+{
+    curl_off_t tail_len = size < RRC_UPDATE_PLAN_TAIL_SIZE ? size : RRC_UPDATE_PLAN_TAIL_SIZE;
+    curl_off_t tail_start = size - tail_len;
+    if (tail_len < _RRC_PLAN_EOCD_SIZE)
+    {
+        return rrc_result_create_error_misc_update("Update ZIP is too small");
+    }
+
+    CURLcode cres = rrc_update_session_fetch_range(session, url, tail_start, tail_len, &cd->buffer);
+    if (cres != CURLE_OK)
+    {
+        return rrc_result_create_error_curl(cres, "Failed to get end of update ZIP");
+    }
+
+    /* The record is right at the end, unless the archive has a comment. */
+    const u8 *tail = cd->buffer.data;
+    const u8 *eocd = NULL;
+    for (s32 off = tail_len - _RRC_PLAN_EOCD_SIZE; off >= 0 && eocd == NULL; off--)
+    {
+        if (_rrc_plan_rd32(tail + off) == _RRC_PLAN_EOCD_SIG && off + _RRC_PLAN_EOCD_SIZE + _rrc_plan_rd16(tail + off + 20) == tail_len)
+        {
+            eocd = tail + off;
+        }
+    }
+
+    if (eocd == NULL)
+    {
+        return rrc_result_create_error_misc_update("Failed to find central directory of update ZIP");
+    }
+
+    u32 cd_size = _rrc_plan_rd32(eocd + 12);
+    u32 cd_offset = _rrc_plan_rd32(eocd + 16);
+    if (_rrc_plan_rd16(eocd + 10) == 0xffff || cd_size == 0xffffffff || cd_offset == 0xffffffff)
+    {
+        return rrc_result_create_error_misc_update("ZIP64 update archives can't be planned");
+    }
+
+    if ((curl_off_t)cd_offset + cd_size > size)
+    {
+        return rrc_result_create_error_misc_update("Update ZIP has an invalid central directory");
+    }
+
+    if (cd_offset >= tail_start)
+    {
+        cd->data = tail + (cd_offset - tail_start);
+    }
+    else
+    {
+        // Too large to fit in the tail, fetch it on its own.
+        rrc_buffer_free(&cd->buffer);
+        cres = rrc_update_session_fetch_range(session, url, cd_offset, cd_size, &cd->buffer);
+        if (cres != CURLE_OK)
+        {
+            return rrc_result_create_error_curl(cres, "Failed to get central directory of update ZIP");
+        }
+        cd->data = cd->buffer.data;
+    }
+    cd->len = cd_size;
+
+    // Make sure it's intact, so that walking it later can't fail.
+    char name[PATH_MAX];
+    u32 entry_crc, entry_size;
+    const u8 *cursor = cd->data;
+    while (_rrc_plan_next_entry(&cursor, cd->data + cd->len, name, &entry_crc, &entry_size))
+    {
+    }
+
+    if (cursor != cd->data + cd->len)
+    {
+        return rrc_result_create_error_misc_update("Update ZIP has an invalid central directory");
+    }
+
+    return rrc_result_success;
+}
+
+/* Orders by path, and records of the same path in the order they were logged. */
+static int _rrc_plan_compare_records(const void *a, const void *b)
+{
+    const struct rrc_txn_record *ra = *(const struct rrc_txn_record **)a;
+    const struct rrc_txn_record *rb = *(const struct rrc_txn_record **)b;
+    int cmp = strcmp(ra->path, rb->path);
+    if (cmp != 0)
+    {
+        return cmp;
+    }
+    return ra < rb ? -1 : ra > rb;
+}
+
+static int _rrc_plan_compare_path(const void *key, const void *elem)
+{
+    return strcmp(key, (*(const struct rrc_txn_record **)elem)->path);
+}
+
+static struct rrc_result _rrc_plan_collect_staged(struct rrc_txn *txn, struct _rrc_plan_staged *staged)
+{
+    staged->records = malloc(sizeof(struct rrc_txn_record *) * (txn->count > 0 ? txn->count : 1));
+    staged->count = 0;
+    if (staged->records == NULL)
+    {
+        return rrc_result_create_error_errno(ENOMEM, "Failed to allocate update plan");
+    }
+
+    for (u32 i = 0; i < txn->count; i++)
+    {
+        if (txn->records[i].type == RRC_TXN_RECORD_STAGED && txn->records[i].tracked)
+        {
+            staged->records[staged->count++] = &txn->records[i];
+        }
+    }
+
+    qsort(staged->records, staged->count, sizeof(struct rrc_txn_record *), _rrc_plan_compare_records);
+    return rrc_result_success;
+}
+
+/*
+    Whether an interrupted attempt already staged `name' with this CRC32 and size, so it doesn't have
+    to be extracted again. The staged file itself is checked too, in case its data never made it to the SD card.
+*/
+static bool _rrc_plan_is_staged(struct _rrc_plan_staged *staged, const char *name, u32 crc, u32 size)
+{
+    const struct rrc_txn_record **found = bsearch(name, staged->records, staged->count, sizeof(struct rrc_txn_record *), _rrc_plan_compare_path);
+    if (found == NULL)
+    {
+        return false;
+    }
+
+    /* Only the last copy that was staged counts. */
+    const struct rrc_txn_record **last = staged->records + staged->count - 1;
+    while (found < last && strcmp(found[1]->path, name) == 0)
+    {
+        found++;
+    }
+
+    if ((*found)->crc != crc || (*found)->size != size)
+    {
+        return false;
+    }
+
+    char path[PATH_MAX];
+    struct stat sb;
+    rrc_txn_stage_path(name, path, sizeof(path));
+    return stat(path, &sb) == 0 && sb.st_size == size;
+}
+
+/*
+    Walks the updates from newest to oldest. A file is only extracted from an update if no later
+    update (and no deletion of the same update) touches it and it isn't staged already, and a deletion only
+    happens if no later update writes the file again.
+*/
+static struct rrc_result _rrc_plan_compute(struct rrc_update_state *state, struct rrc_update_plan *plan, struct _rrc_plan_cd *cds, struct _rrc_plan_staged *staged)
+{
+    /* Files written or deleted by the updates after the current one, and only those written by them */
+    struct rrc_strset touched_later, written_later;
+    rrc_strset_init(&touched_later);
+    rrc_strset_init(&written_later);
+
+    char name[PATH_MAX];
+    u32 crc, size;
+    struct rrc_result res = rrc_result_success;
+    /* The deleted files are sorted by version, so they are walked backwards alongside the updates. */
+    int deleted = state->num_deleted_files - 1;
+    for (int i = state->num_updates - 1; i >= state->current_update_num && !rrc_result_is_error(res); i--)
+    {
+        int version = state->update_versions[i];
+        for (; deleted >= 0 && state->deleted_files[deleted].version >= version && !rrc_result_is_error(res); deleted--)
+        {
+            if (state->deleted_files[deleted].version == version)
+            {
+                plan->delete_needed[deleted] = !rrc_strset_contains(&written_later, state->deleted_files[deleted].path);
+                res = rrc_strset_add(&touched_later, state->deleted_files[deleted].path);
+            }
+        }
+
+        const u8 *end = cds[i].data + cds[i].len;
+        const u8 *cursor = cds[i].data;
+        while (!rrc_result_is_error(res) && _rrc_plan_next_entry(&cursor, end, name, &crc, &size))
+        {
+            if (name[0] == '\0')
+            {
+                continue;
+            }
+
+            if (rrc_strset_contains(&touched_later, name) || _rrc_plan_is_staged(staged, name, crc, size))
+            {
+                res = rrc_strset_add(&plan->superseded[i], name);
+            }
+            else
+            {
+                plan->num_needed[i]++;
+            }
+        }
+
+        cursor = cds[i].data;
+        while (!rrc_result_is_error(res) && _rrc_plan_next_entry(&cursor, end, name, &crc, &size))
+        {
+            if (name[0] != '\0')
+            {
+                res = rrc_strset_add(&touched_later, name);
+                if (!rrc_result_is_error(res))
+                {
+                    res = rrc_strset_add(&written_later, name);
+                }
+            }
+        }
+    }
+
+    rrc_strset_free(&touched_later);
+    rrc_strset_free(&written_later);
+    return res;
+}
+
+struct rrc_result rrc_update_plan_create(struct rrc_update_state *state, struct rrc_txn *txn, struct rrc_update_plan *plan)
+{
+    int n = state->num_updates;
+    plan->num_updates = n;
+    plan->superseded = calloc(n, sizeof(struct rrc_strset));
+    plan->num_needed = calloc(n, sizeof(u32));
+    plan->delete_needed = malloc(sizeof(bool) * (state->num_deleted_files > 0 ? state->num_deleted_files : 1));
+    struct _rrc_plan_cd *cds = calloc(n, sizeof(struct _rrc_plan_cd));
+
+    struct rrc_result res = rrc_result_success;
+    if (plan->superseded == NULL || plan->num_needed == NULL || plan->delete_needed == NULL || cds == NULL)
+    {
+        res = rrc_result_create_error_errno(ENOMEM, "Failed to allocate update plan");
+    }
+    else if (state->update_sizes == NULL)
+    {
+        res = rrc_result_create_error_misc_update("Update ZIP sizes are needed to plan updates");
+    }
+
+    if (!rrc_result_is_error(res))
+    {
+        for (int i = 0; i < n; i++)
+        {
+            rrc_strset_init(&plan->superseded[i]);
+        }
+        for (int i = 0; i < state->num_deleted_files; i++)
+        {
+            plan->delete_needed[i] = false;
+        }
+    }
+
+    for (int i = state->current_update_num; i < n && !rrc_result_is_error(res); i++)
+    {
+        rrc_buffer_init(&cds[i].buffer);
+        if (state->update_sizes[i] < 0)
+        {
+            res = rrc_result_create_error_misc_update("Update ZIP sizes are needed to plan updates");
+            break;
+        }
+
+        rrc_con_update("Planning Update", ((i + 1) * 100) / n);
+        res = _rrc_plan_fetch_cd(state->session, state->update_urls[i], state->update_sizes[i], &cds[i]);
+    }
+
+    struct _rrc_plan_staged staged = {NULL, 0};
+    if (!rrc_result_is_error(res))
+    {
+        res = _rrc_plan_collect_staged(txn, &staged);
+    }
+
+    if (!rrc_result_is_error(res))
+    {
+        res = _rrc_plan_compute(state, plan, cds, &staged);
+    }
+    free(staged.records);
+
+    if (cds != NULL)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            rrc_buffer_free(&cds[i].buffer);
+        }
+        free(cds);
+    }
+
+    if (rrc_result_is_error(res))
+    {
+        rrc_update_plan_free(plan);
+    }
+
+    return res;
+}
+
+void rrc_update_plan_free(struct rrc_update_plan *plan)
+{
+    if (plan->superseded != NULL)
+    {
+        for (int i = 0; i < plan->num_updates; i++)
+        {
+            rrc_strset_free(&plan->superseded[i]);
+        }
+    }
+
+    free(plan->superseded);
+    free(plan->num_needed);
+    free(plan->delete_needed);
+    plan->superseded = NULL;
+    plan->num_needed = NULL;
+    plan->delete_needed = NULL;
+}
@@ -0,0 +1,62 @@
+/*
+    planner.h - planning of multi-version updates headers
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RRC_UPDATE_PLANNER_H
+#define RRC_UPDATE_PLANNER_H
+
+#include <gctypes.h>
+
+#include "../result.h"
+#include "../strset.h"
+#include "txn.h"
+#include "update.h"
+
+/* How much of the end of each ZIP is requested to find its central directory, which usually fits in there completely. */
+#define RRC_UPDATE_PLAN_TAIL_SIZE (64 * 1024)
+
+/*
+    Describes how to get from the current version to the newest one in a single go, writing
+    every file only once: when a file is changed by several updates, only the copy from the last
+    of them is extracted, and files that a later update deletes aren't extracted at all.
+*/
+struct rrc_update_plan
+{
+    int num_updates;
+    /* For each update, the files in its ZIP that aren't extracted because a later update replaces or deletes them, or because they are staged already. */
+    struct rrc_strset *superseded;
+    /* For each update, how many files of its ZIP still have to be extracted. Updates without any aren't downloaded at all. */
+    u32 *num_needed;
+    /* Same length as the state's deleted files: whether the file has to be deleted, i.e. it belongs to a remaining update and no later update brings it back. */
+    bool *delete_needed;
+};
+
+/*
+    Plans the remaining updates of `state' by looking at the central directory of every ZIP,
+    which is fetched with range requests on the end of the archive.
+    The deleted files of `state' must be sorted by version (see `rrc_update_do_updates_with_state').
+    `txn' is the transaction to the newest version the plan is applied in. Files it already staged
+    with the right CRC32 and size, when resuming an interrupted attempt, aren't extracted again.
+
+    Fails if the sizes of the ZIPs aren't known yet, if the server doesn't support range requests,
+    or if an archive uses ZIP64; the updates then have to be applied one by one.
+*/
+struct rrc_result rrc_update_plan_create(struct rrc_update_state *state, struct rrc_txn *txn, struct rrc_update_plan *plan);
+
+void rrc_update_plan_free(struct rrc_update_plan *plan);
+
+#endif
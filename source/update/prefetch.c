@@ -0,0 +1,112 @@
+/*
+    prefetch.c - background update check implementation
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <ogc/lwp.h>
+#include <wiisocket.h>
+
+#include "prefetch.h"
+#include "versionsfile.h"
+#include "../util.h"
+
+static lwp_t _rrc_update_prefetch_thread = LWP_THREAD_NULL;
+static struct rrc_update_prefetch _rrc_update_prefetch;
+/* Set when the results won't be used, the thread then skips whatever it hasn't started yet. */
+static volatile bool _rrc_update_prefetch_cancelled = false;
+
+/*
+    Must not touch the console, since the main thread keeps drawing progress while this runs.
+*/
+static void *_rrc_update_prefetch_main(void *arg)
+{
+    struct rrc_update_prefetch *prefetch = arg;
+
+    prefetch->net_res = wiisocket_init();
+    if (prefetch->net_res < 0 || _rrc_update_prefetch_cancelled)
+    {
+        return NULL;
+    }
+
+    struct rrc_result res = rrc_update_session_init(&prefetch->session);
+    if (rrc_result_is_error(res))
+    {
+        rrc_result_free(res);
+        return NULL;
+    }
+    prefetch->have_session = true;
+
+    if (_rrc_update_prefetch_cancelled)
+    {
+        return NULL;
+    }
+    prefetch->versions_res = rrc_versionsfile_get_versionsfile(&prefetch->session, false, &prefetch->versionsfile);
+
+    if (_rrc_update_prefetch_cancelled)
+    {
+        return NULL;
+    }
+    prefetch->deleted_res = rrc_versionsfile_get_removed_files(&prefetch->session, false, &prefetch->deleted_versionsfile);
+    return NULL;
+}
+
+void rrc_update_prefetch_start()
+{
+    memset(&_rrc_update_prefetch, 0, sizeof(_rrc_update_prefetch));
+    /* Anything that doesn't get done in the background is simply done again when joining. */
+    _rrc_update_prefetch.versions_res = -1;
+    _rrc_update_prefetch.deleted_res = -1;
+    _rrc_update_prefetch_cancelled = false;
+
+    if (LWP_CreateThread(&_rrc_update_prefetch_thread, _rrc_update_prefetch_main, &_rrc_update_prefetch, NULL, RRC_UPDATE_PREFETCH_STACK_SIZE, RRC_UPDATE_PREFETCH_PRIO) != RRC_LWP_OK)
+    {
+        _rrc_update_prefetch_thread = LWP_THREAD_NULL;
+    }
+}
+
+bool rrc_update_prefetch_join(struct rrc_update_prefetch *prefetch)
+{
+    if (_rrc_update_prefetch_thread == LWP_THREAD_NULL)
+    {
+        return false;
+    }
+
+    LWP_JoinThread(_rrc_update_prefetch_thread, NULL);
+    _rrc_update_prefetch_thread = LWP_THREAD_NULL;
+
+    *prefetch = _rrc_update_prefetch;
+    return true;
+}
+
+void rrc_update_prefetch_discard()
+{
+    _rrc_update_prefetch_cancelled = true;
+
+    struct rrc_update_prefetch prefetch;
+    if (!rrc_update_prefetch_join(&prefetch))
+    {
+        return;
+    }
+
+    free(prefetch.versionsfile);
+    free(prefetch.deleted_versionsfile);
+    if (prefetch.have_session)
+    {
+        rrc_update_session_cleanup(&prefetch.session);
+    }
+}
@@ -0,0 +1,67 @@
+/*
+    prefetch.h - background update check headers
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RRC_UPDATE_PREFETCH_H
+#define RRC_UPDATE_PREFETCH_H
+
+#include <gctypes.h>
+
+#include "session.h"
+
+/* Below the main thread, so that the prefetch only runs while the main thread waits (e.g. on the disc drive). */
+#define RRC_UPDATE_PREFETCH_PRIO 48
+#define RRC_UPDATE_PREFETCH_STACK_SIZE (64 * 1024)
+
+/*
+    What the background update check got done.
+*/
+struct rrc_update_prefetch
+{
+    /* Result of `wiisocket_init'. Nothing else is valid if this is negative. */
+    int net_res;
+    /* Whether `session' was created and is now owned by whoever joined the prefetch. */
+    bool have_session;
+    struct rrc_update_session session;
+    /* Results of `rrc_versionsfile_get_versionsfile' and `rrc_versionsfile_get_removed_files'. */
+    int versions_res;
+    char *versionsfile;
+    int deleted_res;
+    char *deleted_versionsfile;
+};
+
+/*
+    Starts bringing up the network and fetching the version lists on a separate thread,
+    so that this overlaps with the disc spinning up. The SD card must be mounted.
+*/
+void rrc_update_prefetch_start();
+
+/*
+    Waits for the background update check to finish and hands over its results.
+    Returns false if no background check was started, in which case `prefetch' is untouched.
+*/
+bool rrc_update_prefetch_join(struct rrc_update_prefetch *prefetch);
+
+/*
+    Stops the background update check on paths that never get to the update (e.g. exiting the
+    launcher) and frees whatever it got done. The thread is asked to stop at its next step and
+    joined, since it may be writing the cached version lists to the SD card. Does nothing if
+    there is no background check, or it was already joined.
+*/
+void rrc_update_prefetch_discard();
+
+#endif
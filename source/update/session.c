@@ -0,0 +1,358 @@
+/*
+    session.c - shared network state for the updater implementation
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../console.h"
+#include "../buffer.h"
+#include "session.h"
+#include "fetchcache.h"
+
+struct _rrc_session_fetch_ctx
+{
+    CURL *curl;
+    struct rrc_buffer buffer;
+    /* Whether we already sized the buffer from the Content-Length */
+    bool reserved;
+    /* Error that made us abort the transfer, if any */
+    struct rrc_result res;
+    /* Validators sent with the response, for caching it. Only collected if `validators' is set. */
+    bool validators;
+    char etag[RRC_FETCHCACHE_VALIDATOR_MAX];
+    char last_modified[RRC_FETCHCACHE_VALIDATOR_MAX];
+    /* Byte range to request, or NULL for the whole file */
+    const char *range;
+    /* Set if we asked for a range but the server sent something else */
+    bool range_ignored;
+};
+
+static int _rrc_session_progress_callback(char *update,
+                                          curl_off_t dltotal,
+                                          curl_off_t dlnow,
+                                          curl_off_t ultotal,
+                                          curl_off_t ulnow)
+{
+    static int lp = -1;
+    if (dltotal <= 0)
+    {
+        return 0;
+    }
+
+    int progress = (dlnow * 100) / dltotal;
+    if (progress != lp)
+    {
+        lp = progress;
+        rrc_con_update(update, progress);
+    }
+    return 0;
+}
+
+static size_t _rrc_session_write_callback(char *ptr, size_t size, size_t nmemb, struct _rrc_session_fetch_ctx *ctx)
+{
+    if (!ctx->reserved)
+    {
+        ctx->reserved = true;
+
+        long code = 0;
+        if (ctx->range != NULL && (curl_easy_getinfo(ctx->curl, CURLINFO_RESPONSE_CODE, &code) != CURLE_OK || code != 206))
+        {
+            /* Don't download the whole file just to throw it away */
+            ctx->range_ignored = true;
+            return 0;
+        }
+
+        /* Allocate everything at once if the server tells us the size, +1 for the NULL terminator */
+        curl_off_t length = -1;
+        if (curl_easy_getinfo(ctx->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) == CURLE_OK && length > 0)
+        {
+            ctx->res = rrc_buffer_reserve(&ctx->buffer, length + 1);
+            if (rrc_result_is_error(ctx->res))
+            {
+                return 0;
+            }
+        }
+    }
+
+    ctx->res = rrc_buffer_append(&ctx->buffer, ptr, size * nmemb);
+    if (rrc_result_is_error(ctx->res))
+    {
+        /* Aborts the transfer with CURLE_WRITE_ERROR */
+        return 0;
+    }
+
+    return size * nmemb;
+}
+
+struct rrc_result rrc_update_session_init(struct rrc_update_session *session)
+{
+    session->share = curl_share_init();
+    if (session->share == NULL)
+    {
+        return rrc_result_create_error_curl(CURLE_FAILED_INIT, "Failed to init curl share");
+    }
+
+    curl_share_setopt(session->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(session->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+    session->curl = curl_easy_init();
+    if (session->curl == NULL)
+    {
+        curl_share_cleanup(session->share);
+        session->share = NULL;
+        return rrc_result_create_error_curl(CURLE_FAILED_INIT, "Failed to init curl");
+    }
+
+    return rrc_result_success;
+}
+
+CURL *rrc_update_session_handle(struct rrc_update_session *session)
+{
+    curl_easy_reset(session->curl);
+    curl_easy_setopt(session->curl, CURLOPT_SHARE, session->share);
+    return session->curl;
+}
+
+CURL *rrc_update_session_new_handle(struct rrc_update_session *session)
+{
+    CURL *curl = curl_easy_init();
+    if (curl != NULL)
+    {
+        curl_easy_setopt(curl, CURLOPT_SHARE, session->share);
+    }
+    return curl;
+}
+
+/*
+    Copies the value of a header line into `out' if it is the header `name'. Values that don't fit are dropped.
+*/
+static void _rrc_session_match_header(const char *line, size_t len, const char *name, char *out)
+{
+    size_t name_len = strlen(name);
+    if (len <= name_len || strncasecmp(line, name, name_len) != 0 || line[name_len] != ':')
+    {
+        return;
+    }
+
+    const char *value = line + name_len + 1;
+    const char *end = line + len;
+    while (value < end && (*value == ' ' || *value == '\t'))
+    {
+        value++;
+    }
+    while (end > value && (end[-1] == '\r' || end[-1] == '\n' || end[-1] == ' '))
+    {
+        end--;
+    }
+
+    size_t value_len = end - value;
+    if (value_len >= RRC_FETCHCACHE_VALIDATOR_MAX)
+    {
+        out[0] = '\0';
+        return;
+    }
+
+    memcpy(out, value, value_len);
+    out[value_len] = '\0';
+}
+
+static size_t _rrc_session_header_callback(char *line, size_t size, size_t nitems, struct _rrc_session_fetch_ctx *ctx)
+{
+    size_t len = size * nitems;
+
+    /* Each response of a redirect chain comes with its own headers, only the last one counts. */
+    if (len >= 5 && strncmp(line, "HTTP/", 5) == 0)
+    {
+        ctx->etag[0] = '\0';
+        ctx->last_modified[0] = '\0';
+    }
+
+    _rrc_session_match_header(line, len, "ETag", ctx->etag);
+    _rrc_session_match_header(line, len, "Last-Modified", ctx->last_modified);
+    return len;
+}
+
+/*
+    Downloads `url' into `ctx->buffer', sending `headers' along with the request.
+*/
+static CURLcode _rrc_session_perform_fetch(struct rrc_update_session *session, const char *url, const char *progress, struct curl_slist *headers, struct _rrc_session_fetch_ctx *ctx)
+{
+    CURL *curl = rrc_update_session_handle(session);
+    ctx->curl = curl;
+    ctx->reserved = false;
+    ctx->range_ignored = false;
+    ctx->res = rrc_result_success;
+    rrc_buffer_init(&ctx->buffer);
+
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    if (progress != NULL)
+    {
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, _rrc_session_progress_callback);
+        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, (void *)progress);
+    }
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, ctx);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _rrc_session_write_callback);
+    if (ctx->validators)
+    {
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, ctx);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, _rrc_session_header_callback);
+    }
+    if (headers != NULL)
+    {
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+    }
+    if (ctx->range != NULL)
+    {
+        curl_easy_setopt(curl, CURLOPT_RANGE, ctx->range);
+    }
+
+    CURLcode res = curl_easy_perform(curl);
+    if (ctx->range_ignored)
+    {
+        return CURLE_RANGE_ERROR;
+    }
+    if (rrc_result_is_error(ctx->res))
+    {
+        /* The only way the buffer can fail is running out of memory */
+        rrc_result_free(ctx->res);
+        res = CURLE_OUT_OF_MEMORY;
+    }
+
+    return res;
+}
+
+CURLcode rrc_update_session_fetch(struct rrc_update_session *session, const char *url, const char *progress, char **result)
+{
+    *result = NULL;
+
+    struct _rrc_session_fetch_ctx ctx = {.validators = false};
+    CURLcode res = _rrc_session_perform_fetch(session, url, progress, NULL, &ctx);
+    if (res == CURLE_OK)
+    {
+        *result = rrc_buffer_take_string(&ctx.buffer);
+        if (*result == NULL)
+        {
+            res = CURLE_OUT_OF_MEMORY;
+        }
+    }
+
+    rrc_buffer_free(&ctx.buffer);
+    return res;
+}
+
+CURLcode rrc_update_session_fetch_range(struct rrc_update_session *session, const char *url, curl_off_t offset, curl_off_t len, struct rrc_buffer *result)
+{
+    char range[64];
+    snprintf(range, sizeof(range), "%lld-%lld", (long long)offset, (long long)(offset + len - 1));
+
+    struct _rrc_session_fetch_ctx ctx = {.validators = false, .range = range};
+    CURLcode res = _rrc_session_perform_fetch(session, url, NULL, NULL, &ctx);
+    if (res == CURLE_OK && ctx.buffer.len != len)
+    {
+        res = CURLE_PARTIAL_FILE;
+    }
+
+    if (res != CURLE_OK)
+    {
+        rrc_buffer_free(&ctx.buffer);
+        rrc_buffer_init(result);
+        return res;
+    }
+
+    *result = ctx.buffer;
+    return CURLE_OK;
+}
+
+CURLcode rrc_update_session_fetch_cached(struct rrc_update_session *session, const char *url, const char *cache_path, const char *progress, char **result)
+{
+    *result = NULL;
+
+    struct rrc_fetchcache_entry cached;
+    bool have_cache = rrc_fetchcache_load(cache_path, &cached);
+
+    /* Only ask whether the file changed if we still have the old one to fall back to. */
+    struct curl_slist *headers = NULL;
+    char header[RRC_FETCHCACHE_VALIDATOR_MAX + 32];
+    if (have_cache && cached.etag[0] != '\0')
+    {
+        snprintf(header, sizeof(header), "If-None-Match: %s", cached.etag);
+        headers = curl_slist_append(headers, header);
+    }
+    if (have_cache && cached.last_modified[0] != '\0')
+    {
+        snprintf(header, sizeof(header), "If-Modified-Since: %s", cached.last_modified);
+        headers = curl_slist_append(headers, header);
+    }
+
+    struct _rrc_session_fetch_ctx ctx = {.validators = true};
+    CURLcode res = _rrc_session_perform_fetch(session, url, progress, headers, &ctx);
+    curl_slist_free_all(headers);
+
+    long code = 0;
+    curl_easy_getinfo(ctx.curl, CURLINFO_RESPONSE_CODE, &code);
+
+    if (res == CURLE_OK && code == 304 && have_cache)
+    {
+        /* Not modified, so the cached copy is still current. */
+        *result = cached.body;
+        cached.body = NULL;
+    }
+    else if (res == CURLE_OK)
+    {
+        struct rrc_fetchcache_entry fresh = {0};
+        snprintf(fresh.etag, sizeof(fresh.etag), "%s", ctx.etag);
+        snprintf(fresh.last_modified, sizeof(fresh.last_modified), "%s", ctx.last_modified);
+        fresh.body_len = ctx.buffer.len;
+
+        *result = rrc_buffer_take_string(&ctx.buffer);
+        if (*result == NULL)
+        {
+            res = CURLE_OUT_OF_MEMORY;
+        }
+        else if (code == 200 && (fresh.etag[0] != '\0' || fresh.last_modified[0] != '\0'))
+        {
+            /* Caching is only an optimisation, so failing to store it isn't an error. */
+            fresh.body = *result;
+            rrc_result_free(rrc_fetchcache_store(cache_path, &fresh));
+        }
+    }
+
+    rrc_buffer_free(&ctx.buffer);
+    rrc_fetchcache_free(&cached);
+    return res;
+}
+
+void rrc_update_session_cleanup(struct rrc_update_session *session)
+{
+    /* Handles using the share have to be gone before the share can be cleaned up. */
+    if (session->curl != NULL)
+    {
+        curl_easy_cleanup(session->curl);
+        session->curl = NULL;
+    }
+
+    if (session->share != NULL)
+    {
+        curl_share_cleanup(session->share);
+        session->share = NULL;
+    }
+}
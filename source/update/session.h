@@ -0,0 +1,81 @@
+/*
+    session.h - shared network state for the updater headers
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RRC_UPDATE_SESSION_H
+#define RRC_UPDATE_SESSION_H
+
+#include <curl/curl.h>
+
+#include "../result.h"
+#include "../buffer.h"
+
+/*
+    All requests made by the updater go through a session so that TCP connections and
+    DNS lookups are reused instead of being set up again for every request, which is
+    particularly slow with the Wii's network stack.
+*/
+struct rrc_update_session
+{
+    /* Handle used for all sequential requests. Its connection stays alive between requests. */
+    CURL *curl;
+    /* Shares the DNS cache and connection pool with any extra handles used for concurrent requests. */
+    CURLSH *share;
+};
+
+/*
+    Creates a session. Network must be initialised already.
+*/
+struct rrc_result rrc_update_session_init(struct rrc_update_session *session);
+
+/*
+    Returns the session's handle with all options reset, ready for the next request.
+    Live connections and the DNS cache are kept. The handle must not be cleaned up by the caller.
+*/
+CURL *rrc_update_session_handle(struct rrc_update_session *session);
+
+/*
+    Creates an additional handle sharing connections and DNS cache with the session, for requests that
+    run concurrently with others. Returns NULL on failure; must be freed with `curl_easy_cleanup'.
+*/
+CURL *rrc_update_session_new_handle(struct rrc_update_session *session);
+
+/*
+    Downloads `url' into memory.
+    If `progress' is not NULL, it is shown on the console as the action while downloading.
+
+    On success, returns CURLE_OK and `result' is populated with a NULL-terminated heap allocated string.
+    On failure, `result' is NULL.
+*/
+CURLcode rrc_update_session_fetch(struct rrc_update_session *session, const char *url, const char *progress, char **result);
+
+/*
+    Like `rrc_update_session_fetch', but keeps a copy of the response in `cache_path' along with its
+    ETag and Last-Modified validators. Subsequent fetches ask the server whether the file changed
+    since, and use the cached copy if it didn't, so unchanged files cost only a tiny response.
+*/
+CURLcode rrc_update_session_fetch_cached(struct rrc_update_session *session, const char *url, const char *cache_path, const char *progress, char **result);
+
+/*
+    Downloads `len' bytes of `url' starting at `offset' into `result', which must be freed with `rrc_buffer_free'.
+    Fails with CURLE_RANGE_ERROR if the server doesn't support range requests.
+*/
+CURLcode rrc_update_session_fetch_range(struct rrc_update_session *session, const char *url, curl_off_t offset, curl_off_t len, struct rrc_buffer *result);
+
+void rrc_update_session_cleanup(struct rrc_update_session *session);
+
+#endif
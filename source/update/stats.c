@@ -0,0 +1,200 @@
+/*
+    stats.c - update timing report implementation
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <gccore.h>
+
+#include "stats.h"
+
+struct _rrc_update_stats_transfer
+{
+    curl_off_t bytes;
+    curl_off_t dns;
+    curl_off_t connect;
+    curl_off_t tls;
+    curl_off_t first_byte;
+    curl_off_t total;
+};
+
+struct _rrc_update_stats
+{
+    int version;
+    const char *mode;
+    rrc_time_tick started;
+    rrc_time_tick elapsed;
+    u32 num_transfers;
+    struct _rrc_update_stats_transfer transfers[RRC_UPDATE_STATS_MAX_TRANSFERS];
+    u32 entries;
+    /* Indexed by `enum rrc_update_stats_phase' */
+    rrc_time_tick phases[3];
+};
+
+/* Every update of this session, the last one is the one being recorded. */
+static struct _rrc_update_stats *_rrc_update_stats = NULL;
+static u32 _rrc_update_stats_count = 0;
+static u32 _rrc_update_stats_capacity = 0;
+
+static struct _rrc_update_stats *_rrc_update_stats_current()
+{
+    return _rrc_update_stats_count > 0 ? &_rrc_update_stats[_rrc_update_stats_count - 1] : NULL;
+}
+
+void rrc_update_stats_begin(int version)
+{
+    if (_rrc_update_stats_count == _rrc_update_stats_capacity)
+    {
+        u32 capacity = _rrc_update_stats_capacity > 0 ? _rrc_update_stats_capacity * 2 : 4;
+        struct _rrc_update_stats *stats = realloc(_rrc_update_stats, capacity * sizeof(struct _rrc_update_stats));
+        if (stats == NULL)
+        {
+            return;
+        }
+        _rrc_update_stats = stats;
+        _rrc_update_stats_capacity = capacity;
+    }
+
+    struct _rrc_update_stats *stats = &_rrc_update_stats[_rrc_update_stats_count++];
+    memset(stats, 0, sizeof(*stats));
+    stats->version = version;
+    stats->mode = "none";
+    stats->started = gettime();
+}
+
+void rrc_update_stats_set_mode(const char *mode)
+{
+    struct _rrc_update_stats *stats = _rrc_update_stats_current();
+    if (stats != NULL)
+    {
+        stats->mode = mode;
+    }
+}
+
+void rrc_update_stats_add_transfer(CURL *curl)
+{
+    struct _rrc_update_stats *stats = _rrc_update_stats_current();
+    if (stats == NULL || stats->num_transfers++ >= RRC_UPDATE_STATS_MAX_TRANSFERS)
+    {
+        return;
+    }
+
+    /* Anything cURL doesn't know (e.g. TLS on a plain connection) stays 0. */
+    struct _rrc_update_stats_transfer *t = &stats->transfers[stats->num_transfers - 1];
+    memset(t, 0, sizeof(*t));
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &t->bytes);
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &t->dns);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &t->connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &t->tls);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &t->first_byte);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &t->total);
+}
+
+void rrc_update_stats_add_time(enum rrc_update_stats_phase phase, rrc_time_tick start)
+{
+    struct _rrc_update_stats *stats = _rrc_update_stats_current();
+    if (stats != NULL)
+    {
+        stats->phases[phase] += gettime() - start;
+    }
+}
+
+void rrc_update_stats_add_entry()
+{
+    struct _rrc_update_stats *stats = _rrc_update_stats_current();
+    if (stats != NULL)
+    {
+        stats->entries++;
+    }
+}
+
+/* Not `diff_usec', whose u32 result wraps after about 71 minutes, which a slow update of several versions can take. */
+static unsigned long long _rrc_update_stats_usec(rrc_time_tick ticks)
+{
+    return ticks_to_microsecs((u64)ticks);
+}
+
+static void _rrc_update_stats_write_update(FILE *file, struct _rrc_update_stats *stats)
+{
+    fprintf(file, "    {\n");
+    fprintf(file, "      \"version\": %d,\n", stats->version);
+    fprintf(file, "      \"mode\": \"%s\",\n", stats->mode);
+    fprintf(file, "      \"elapsed_us\": %llu,\n", _rrc_update_stats_usec(stats->elapsed));
+    fprintf(file, "      \"transfers\": [");
+
+    u32 reported = stats->num_transfers < RRC_UPDATE_STATS_MAX_TRANSFERS ? stats->num_transfers : RRC_UPDATE_STATS_MAX_TRANSFERS;
+    for (u32 i = 0; i < reported; i++)
+    {
+        struct _rrc_update_stats_transfer *t = &stats->transfers[i];
+        fprintf(file,
+                "%s\n        { \"bytes\": %lld, \"dns_us\": %lld, \"connect_us\": %lld, \"tls_us\": %lld, \"first_byte_us\": %lld, \"total_us\": %lld }",
+                i > 0 ? "," : "",
+                (long long)t->bytes,
+                (long long)t->dns,
+                (long long)t->connect,
+                (long long)t->tls,
+                (long long)t->first_byte,
+                (long long)t->total);
+    }
+
+    fprintf(file, "%s],\n", reported > 0 ? "\n      " : "");
+    fprintf(file, "      \"num_transfers\": %lu,\n", (unsigned long)stats->num_transfers);
+    fprintf(file, "      \"entries\": %lu,\n", (unsigned long)stats->entries);
+    fprintf(file, "      \"inflate_us\": %llu,\n", _rrc_update_stats_usec(stats->phases[RRC_UPDATE_STATS_INFLATE]));
+    fprintf(file, "      \"write_us\": %llu,\n", _rrc_update_stats_usec(stats->phases[RRC_UPDATE_STATS_WRITE]));
+    fprintf(file, "      \"space_check_us\": %llu\n", _rrc_update_stats_usec(stats->phases[RRC_UPDATE_STATS_SPACE_CHECK]));
+    fprintf(file, "    }");
+}
+
+struct rrc_result rrc_update_stats_finish()
+{
+    struct _rrc_update_stats *current = _rrc_update_stats_current();
+    if (current == NULL)
+    {
+        return rrc_result_success;
+    }
+    current->elapsed = gettime() - current->started;
+
+    FILE *file = fopen(RRC_UPDATE_STATS_PATH, "w");
+    if (file == NULL)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to open " RRC_UPDATE_STATS_PATH " for writing");
+    }
+
+    fprintf(file, "{\n  \"updates\": [\n");
+    for (u32 i = 0; i < _rrc_update_stats_count; i++)
+    {
+        _rrc_update_stats_write_update(file, &_rrc_update_stats[i]);
+        fprintf(file, "%s\n", i + 1 < _rrc_update_stats_count ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+
+    if (ferror(file))
+    {
+        fclose(file);
+        return rrc_result_create_error_errno(EIO, "Failed to write " RRC_UPDATE_STATS_PATH);
+    }
+
+    if (fclose(file) != 0)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to close " RRC_UPDATE_STATS_PATH);
+    }
+
+    return rrc_result_success;
+}
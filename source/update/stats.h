@@ -0,0 +1,99 @@
+/*
+    stats.h - update timing report headers
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RRC_UPDATE_STATS_H
+#define RRC_UPDATE_STATS_H
+
+#include <gctypes.h>
+#include <curl/curl.h>
+
+#include "../result.h"
+#include "../time.h"
+
+#define RRC_UPDATE_STATS_PATH "RetroRewindChannel/update-stats.json"
+/* Transfers of a single update beyond this are counted, but not reported individually */
+#define RRC_UPDATE_STATS_MAX_TRANSFERS 16
+
+/*
+    Records how long each phase of an update takes, so that a slow update can be attributed to
+    the network, inflating or writing to the SD card. The timings of every update of this session
+    are written to RRC_UPDATE_STATS_PATH as JSON each time an update finishes:
+
+    {
+        "updates": [
+            {
+                "version": 420,
+                "mode": "stream",
+                "elapsed_us": 0,
+                "transfers": [
+                    { "bytes": 0, "dns_us": 0, "connect_us": 0, "tls_us": 0, "first_byte_us": 0, "total_us": 0 }
+                ],
+                "num_transfers": 1,
+                "entries": 0,
+                "inflate_us": 0,
+                "write_us": 0,
+                "space_check_us": 0
+            }
+        ]
+    }
+
+    Transfer times are the ones cURL reports, counted from the start of that transfer.
+    Collecting them never fails an update; if memory runs out, the report just stops growing.
+*/
+
+enum rrc_update_stats_phase
+{
+    /* Decompressing ZIP entries (for libzip, this includes reading the archive) */
+    RRC_UPDATE_STATS_INFLATE,
+    /* Writing extracted files, including flushing them on close */
+    RRC_UPDATE_STATS_WRITE,
+    /* Querying the free space of the SD card */
+    RRC_UPDATE_STATS_SPACE_CHECK,
+};
+
+/*
+    Starts recording the update to `version'. Everything recorded until the next call belongs to it.
+*/
+void rrc_update_stats_begin(int version);
+
+/*
+    Sets how the update was installed, e.g. "stream", "memory", "file" or "delta". `mode' must be a string literal.
+*/
+void rrc_update_stats_set_mode(const char *mode);
+
+/*
+    Records the timings of a transfer `curl' just finished, whether it succeeded or not.
+*/
+void rrc_update_stats_add_transfer(CURL *curl);
+
+/*
+    Adds the time since `start' to `phase'.
+*/
+void rrc_update_stats_add_time(enum rrc_update_stats_phase phase, rrc_time_tick start);
+
+/*
+    Counts an extracted ZIP entry.
+*/
+void rrc_update_stats_add_entry();
+
+/*
+    Ends the current update and writes the report of all updates so far to the SD card.
+*/
+struct rrc_result rrc_update_stats_finish();
+
+#endif
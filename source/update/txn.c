@@ -0,0 +1,467 @@
+/*
+    txn.c - crash-safe application of updates implementation
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    The log file format is defined as follows:
+
+    | Name              | Size in bytes |
+    |-------------------|---------------|
+    | Format Magic      | 4             | (always the value of `RRC_TXN_MAGIC`)
+    | Format Version    | 4             |
+    | Target Version    | 4             | (version the update installs)
+    | Records           | Variable      |
+
+    Version 0 logs are read as well; they are the same, except that they never contain verified records.
+
+    Records are only ever appended, and each one is synced to the SD card before the step it
+    describes is considered done:
+
+    | Name              | Size in bytes |
+    |-------------------|---------------|
+    | Type              | 1             | (see `enum rrc_txn_record_type`)
+    | Tracked           | 1             |
+    | Path Length       | 2             |
+    | Path              | Variable      |
+    | CRC32             | 4             |
+    | Size              | 4             |
+    | Checksum          | 4             | (CRC32 of everything in the record before it)
+
+    A record that was torn by a power loss fails its checksum, and it and anything after it is ignored.
+
+    Replaying a commit is safe no matter where it was interrupted: a staged file that is gone has
+    already been moved into place, and removing a file that is gone already is not an error.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "txn.h"
+#include "dljournal.h"
+#include "update.h"
+#include "../console.h"
+
+#define RRC_TXN_MAGIC 0x52525458 /* RRTX */
+#define RRC_TXN_VERSION 1
+#define RRC_TXN_HEADER_SIZE 12
+/* Type, tracked flag and path length */
+#define RRC_TXN_RECORD_HEAD_SIZE 4
+
+void rrc_txn_stage_path(const char *path, char *out, int out_len)
+{
+    snprintf(out, out_len, RRC_TXN_STAGING_DIR "%s", path);
+}
+
+static struct rrc_result _rrc_txn_push(struct rrc_txn *txn, enum rrc_txn_record_type type, bool tracked, const char *path, u32 crc, u32 size)
+{
+    if (txn->count == txn->capacity)
+    {
+        u32 capacity = txn->capacity > 0 ? txn->capacity * 2 : 64;
+        struct rrc_txn_record *records = realloc(txn->records, sizeof(struct rrc_txn_record) * capacity);
+        if (records == NULL)
+        {
+            return rrc_result_create_error_errno(ENOMEM, "Failed to grow update transaction");
+        }
+        txn->records = records;
+        txn->capacity = capacity;
+    }
+
+    char *copy = strdup(path);
+    if (copy == NULL)
+    {
+        return rrc_result_create_error_errno(ENOMEM, "Failed to grow update transaction");
+    }
+
+    struct rrc_txn_record *record = &txn->records[txn->count++];
+    record->type = type;
+    record->tracked = tracked;
+    record->path = copy;
+    record->crc = crc;
+    record->size = size;
+
+    if (type == RRC_TXN_RECORD_COMMIT)
+    {
+        txn->committing = true;
+    }
+
+    return rrc_result_success;
+}
+
+/* Appends a record to the log and syncs it, then keeps it in memory. */
+static struct rrc_result _rrc_txn_append(struct rrc_txn *txn, enum rrc_txn_record_type type, bool tracked, const char *path, u32 crc, u32 size)
+{
+    u16 path_len = strlen(path);
+    u8 head[RRC_TXN_RECORD_HEAD_SIZE] = {type, tracked};
+    memcpy(head + 2, &path_len, sizeof(path_len));
+    u32 fields[2] = {crc, size};
+
+    u32 checksum = crc32(0, Z_NULL, 0);
+    checksum = crc32(checksum, head, sizeof(head));
+    checksum = crc32(checksum, (const Bytef *)path, path_len);
+    checksum = crc32(checksum, (const Bytef *)fields, sizeof(fields));
+
+    bool ok = fwrite(head, sizeof(head), 1, txn->log) == 1 &&
+              fwrite(path, 1, path_len, txn->log) == path_len &&
+              fwrite(fields, sizeof(fields), 1, txn->log) == 1 &&
+              fwrite(&checksum, sizeof(checksum), 1, txn->log) == 1 &&
+              fflush(txn->log) == 0 && fsync(fileno(txn->log)) == 0;
+    if (!ok)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to write update transaction log");
+    }
+
+    return _rrc_txn_push(txn, type, tracked, path, crc, size);
+}
+
+/*
+    Parses a log that was read into memory. Returns false if it isn't a log at all.
+    `valid_len' is set to the length of the log up to the first damaged record.
+*/
+static bool _rrc_txn_parse(struct rrc_txn *txn, const u8 *data, u32 len, u32 *valid_len)
+{
+    u32 header[3];
+    if (len < RRC_TXN_HEADER_SIZE)
+    {
+        return false;
+    }
+    memcpy(header, data, sizeof(header));
+    if (header[0] != RRC_TXN_MAGIC || header[1] > RRC_TXN_VERSION)
+    {
+        return false;
+    }
+    txn->version = header[2];
+
+    char path[PATH_MAX];
+    u32 off = RRC_TXN_HEADER_SIZE;
+    while (off + RRC_TXN_RECORD_HEAD_SIZE <= len)
+    {
+        const u8 *head = data + off;
+        u16 path_len;
+        memcpy(&path_len, head + 2, sizeof(path_len));
+
+        u32 record_len = RRC_TXN_RECORD_HEAD_SIZE + path_len + 12;
+        if (off + record_len > len || path_len >= sizeof(path))
+        {
+            break;
+        }
+
+        u32 fields[3];
+        memcpy(fields, head + RRC_TXN_RECORD_HEAD_SIZE + path_len, sizeof(fields));
+        if (fields[2] != crc32(crc32(0, Z_NULL, 0), head, record_len - 4) || head[0] > RRC_TXN_RECORD_VERIFIED)
+        {
+            break;
+        }
+
+        memcpy(path, head + RRC_TXN_RECORD_HEAD_SIZE, path_len);
+        path[path_len] = '\0';
+        if (rrc_result_is_error(_rrc_txn_push(txn, head[0], head[1], path, fields[0], fields[1])))
+        {
+            break;
+        }
+
+        off += record_len;
+    }
+
+    *valid_len = off;
+    return true;
+}
+
+/* Loads the log from the SD card. Returns false if there is none. */
+static bool _rrc_txn_load(struct rrc_txn *txn, u32 *valid_len)
+{
+    memset(txn, 0, sizeof(*txn));
+
+    FILE *file = fopen(RRC_TXN_PATH, "rb");
+    if (file == NULL)
+    {
+        return false;
+    }
+
+    struct stat sb;
+    u8 *data = NULL;
+    bool ok = fstat(fileno(file), &sb) == 0 &&
+              (data = malloc(sb.st_size > 0 ? sb.st_size : 1)) != NULL &&
+              fread(data, 1, sb.st_size, file) == sb.st_size &&
+              _rrc_txn_parse(txn, data, sb.st_size, valid_len);
+
+    free(data);
+    fclose(file);
+
+    if (!ok)
+    {
+        rrc_txn_free(txn);
+    }
+
+    return ok;
+}
+
+static struct rrc_result _rrc_txn_remove_log()
+{
+    if (remove(RRC_TXN_PATH) != 0 && errno != ENOENT)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to remove update transaction log");
+    }
+
+    return rrc_result_success;
+}
+
+/* Moves a staged file into place. Does nothing if that already happened. */
+static struct rrc_result _rrc_txn_move_into_place(struct rrc_txn_record *record, bool *moved)
+{
+    char staged[PATH_MAX];
+    rrc_txn_stage_path(record->path, staged, sizeof(staged));
+
+    struct stat sb;
+    *moved = stat(staged, &sb) == 0;
+    if (!*moved)
+    {
+        return rrc_result_success;
+    }
+
+    TRY(rrc_update_create_parent_dirs(record->path));
+
+    /* FAT can't rename over an existing file. */
+    if (remove(record->path) != 0 && errno != ENOENT)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to remove outdated file while committing update");
+    }
+
+    if (rename(staged, record->path) != 0)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to move updated file into place");
+    }
+
+    return rrc_result_success;
+}
+
+/*
+    Applies a transaction that has its commit record: moves everything into place, then removes the deleted files
+    (which is the order extracting straight into place used to have), and updates `installed' accordingly.
+*/
+static struct rrc_result _rrc_txn_apply(struct rrc_txn *txn, struct rrc_installed_manifest *installed)
+{
+    for (u32 i = 0; i < txn->count; i++)
+    {
+        struct rrc_txn_record *record = &txn->records[i];
+        if (record->type == RRC_TXN_RECORD_VERIFIED)
+        {
+            /* Gone if a replayed commit already got to deleting it. */
+            struct stat sb;
+            if (stat(record->path, &sb) == 0)
+            {
+                TRY(rrc_installed_set(installed, record->path, record->crc, record->size));
+            }
+            continue;
+        }
+
+        if (record->type != RRC_TXN_RECORD_STAGED)
+        {
+            continue;
+        }
+
+        bool moved;
+        TRY(_rrc_txn_move_into_place(record, &moved));
+        if (moved && record->tracked)
+        {
+            TRY(rrc_installed_set(installed, record->path, record->crc, record->size));
+        }
+    }
+
+    for (u32 i = 0; i < txn->count; i++)
+    {
+        struct rrc_txn_record *record = &txn->records[i];
+        if (record->type != RRC_TXN_RECORD_DELETE)
+        {
+            continue;
+        }
+
+        char out[100];
+        snprintf(out, 100, "Removing deleted file %s\n", record->path);
+        rrc_con_update(out, 100);
+        if (remove(record->path) != 0 && errno != ENOENT)
+        {
+            return rrc_result_create_error_errno(errno, "Failed to remove deleted file for update");
+        }
+        rrc_installed_remove(installed, record->path);
+    }
+
+    TRY(rrc_installed_store(installed));
+    TRY(rrc_update_set_current_version(txn->version));
+    return _rrc_txn_remove_log();
+}
+
+/* Removes the staged files of an update that is abandoned. */
+static void _rrc_txn_discard(struct rrc_txn *txn)
+{
+    char staged[PATH_MAX];
+    for (u32 i = 0; i < txn->count; i++)
+    {
+        if (txn->records[i].type == RRC_TXN_RECORD_STAGED)
+        {
+            rrc_txn_stage_path(txn->records[i].path, staged, sizeof(staged));
+            remove(staged);
+        }
+    }
+}
+
+struct rrc_result rrc_txn_recover()
+{
+    struct rrc_txn txn;
+    u32 valid_len;
+    if (!_rrc_txn_load(&txn, &valid_len))
+    {
+        return rrc_result_success;
+    }
+
+    /* Not committed yet, so the old install is still intact. The staged files are picked up again by the next update. */
+    if (!txn.committing)
+    {
+        rrc_txn_free(&txn);
+        return rrc_result_success;
+    }
+
+    rrc_con_update("Finishing Interrupted Update", 0);
+
+    struct rrc_installed_manifest installed;
+    rrc_installed_load(&installed);
+    struct rrc_result res = _rrc_txn_apply(&txn, &installed);
+    rrc_installed_free(&installed);
+    rrc_txn_free(&txn);
+    return res;
+}
+
+struct rrc_result rrc_txn_begin(struct rrc_txn *txn, int version)
+{
+    TRY(rrc_txn_recover());
+
+    u32 valid_len;
+    if (_rrc_txn_load(txn, &valid_len))
+    {
+        if (txn->version == version)
+        {
+            /* Cut off a torn record, so that new records don't end up behind it. */
+            txn->log = fopen(RRC_TXN_PATH, "r+b");
+            if (txn->log == NULL || ftruncate(fileno(txn->log), valid_len) != 0 || fseek(txn->log, valid_len, SEEK_SET) != 0)
+            {
+                rrc_txn_free(txn);
+                return rrc_result_create_error_errno(errno, "Failed to open update transaction log");
+            }
+            return rrc_result_success;
+        }
+
+        // Left over from an update to some other version.
+        _rrc_txn_discard(txn);
+        rrc_txn_free(txn);
+    }
+
+    /* A download journal in stream mode skips the entries it says were extracted, but those only
+       exist in the staging directory of the log they were recorded in. It is dropped before the new
+       log exists, so that the two can never belong to different transactions. */
+    TRY(rrc_dljournal_remove());
+
+    txn->version = version;
+    txn->log = fopen(RRC_TXN_PATH, "wb");
+    if (txn->log == NULL)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to create update transaction log");
+    }
+
+    u32 header[3] = {RRC_TXN_MAGIC, RRC_TXN_VERSION, version};
+    if (fwrite(header, sizeof(header), 1, txn->log) != 1 || fflush(txn->log) != 0 || fsync(fileno(txn->log)) != 0)
+    {
+        rrc_txn_free(txn);
+        return rrc_result_create_error_errno(errno, "Failed to write update transaction log");
+    }
+
+    return rrc_result_success;
+}
+
+struct rrc_result rrc_txn_add_staged(struct rrc_txn *txn, const char *path, bool tracked, u32 crc, u32 size)
+{
+    return _rrc_txn_append(txn, RRC_TXN_RECORD_STAGED, tracked, path, crc, size);
+}
+
+struct rrc_result rrc_txn_add_deleted(struct rrc_txn *txn, const char *path)
+{
+    return _rrc_txn_append(txn, RRC_TXN_RECORD_DELETE, false, path, 0, 0);
+}
+
+struct rrc_result rrc_txn_add_verified(struct rrc_txn *txn, const char *path, u32 crc, u32 size)
+{
+    return _rrc_txn_append(txn, RRC_TXN_RECORD_VERIFIED, true, path, crc, size);
+}
+
+struct rrc_result rrc_txn_reset(struct rrc_txn *txn)
+{
+    /* Same as in `rrc_txn_begin': the journal may describe files that are about to be discarded. */
+    TRY(rrc_dljournal_remove());
+
+    /* The records go first, so that an interruption can't leave any behind whose staged file is gone,
+       which would look like it was already moved into place. */
+    if (fflush(txn->log) != 0 || ftruncate(fileno(txn->log), RRC_TXN_HEADER_SIZE) != 0 ||
+        fseek(txn->log, RRC_TXN_HEADER_SIZE, SEEK_SET) != 0 || fsync(fileno(txn->log)) != 0)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to reset update transaction log");
+    }
+
+    _rrc_txn_discard(txn);
+    for (u32 i = 0; i < txn->count; i++)
+    {
+        free(txn->records[i].path);
+    }
+    txn->count = 0;
+
+    return rrc_result_success;
+}
+
+struct rrc_result rrc_txn_commit(struct rrc_txn *txn, struct rrc_installed_manifest *installed)
+{
+    rrc_con_update("Committing Update", 100);
+
+    TRY(_rrc_txn_append(txn, RRC_TXN_RECORD_COMMIT, false, "", 0, 0));
+
+    fclose(txn->log);
+    txn->log = NULL;
+
+    return _rrc_txn_apply(txn, installed);
+}
+
+void rrc_txn_free(struct rrc_txn *txn)
+{
+    if (txn->log != NULL)
+    {
+        fclose(txn->log);
+        txn->log = NULL;
+    }
+
+    for (u32 i = 0; i < txn->count; i++)
+    {
+        free(txn->records[i].path);
+    }
+
+    free(txn->records);
+    txn->records = NULL;
+    txn->count = 0;
+    txn->capacity = 0;
+    txn->committing = false;
+}
@@ -0,0 +1,123 @@
+/*
+    txn.h - crash-safe application of updates headers
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RRC_TXN_H
+#define RRC_TXN_H
+
+#include <stdio.h>
+#include <gctypes.h>
+
+#include "../result.h"
+#include "installed.h"
+
+#define RRC_TXN_PATH "RetroRewindChannel/update.txn"
+/* Files of an update are written below this directory first, under their final path. */
+#define RRC_TXN_STAGING_DIR "RetroRewindChannel/.staging/"
+
+enum rrc_txn_record_type
+{
+    /* A file was written to the staging directory and is moved into place on commit. */
+    RRC_TXN_RECORD_STAGED = 0,
+    /* A file is removed on commit. */
+    RRC_TXN_RECORD_DELETE = 1,
+    /* Everything is staged. From here on the update is rolled forward, never back. */
+    RRC_TXN_RECORD_COMMIT = 2,
+    /* A file already has the contents of the update and is only recorded in the installed files manifest on commit. */
+    RRC_TXN_RECORD_VERIFIED = 3,
+};
+
+struct rrc_txn_record
+{
+    enum rrc_txn_record_type type;
+    /* Whether `crc' and `size' are known and the file should be recorded in the installed files manifest. */
+    bool tracked;
+    char *path;
+    u32 crc;
+    u32 size;
+};
+
+/*
+    An update of a single version that is being applied.
+
+    All files of the update are written to the staging directory while the old install is left
+    untouched. Only once everything is there, the files are renamed into place, the deleted files
+    removed and the version file updated. Every step is recorded in a log on the SD card first,
+    so that an interrupted commit is finished at the next launch (see `rrc_txn_recover').
+    An interrupted update that wasn't committed yet just leaves the old install as it was.
+*/
+struct rrc_txn
+{
+    /* Version this update installs. */
+    int version;
+    bool committing;
+    struct rrc_txn_record *records;
+    u32 count;
+    u32 capacity;
+    FILE *log;
+};
+
+/*
+    Writes the path `path' is staged at into `out'.
+*/
+void rrc_txn_stage_path(const char *path, char *out, int out_len);
+
+/*
+    Finishes an update that was interrupted while being committed. Must be called at boot,
+    before anything else touches the files of the distribution.
+*/
+struct rrc_result rrc_txn_recover();
+
+/*
+    Starts applying the update to `version'. If an earlier attempt at the same update was
+    interrupted, the files it already staged are kept, otherwise any leftovers are discarded
+    together with the download journal, which may describe files staged by the discarded attempt.
+*/
+struct rrc_result rrc_txn_begin(struct rrc_txn *txn, int version);
+
+/*
+    Records that `path' was written to its staging path. If `tracked' is set, it ends up in the
+    installed files manifest with the given CRC32 and size once it is committed.
+*/
+struct rrc_result rrc_txn_add_staged(struct rrc_txn *txn, const char *path, bool tracked, u32 crc, u32 size);
+
+/*
+    Records that `path' is to be removed when the update is committed.
+*/
+struct rrc_result rrc_txn_add_deleted(struct rrc_txn *txn, const char *path);
+
+/*
+    Records that the installed `path' already has the given CRC32 and size, so that it ends up in
+    the installed files manifest once the update is committed, just like a staged file would.
+*/
+struct rrc_result rrc_txn_add_verified(struct rrc_txn *txn, const char *path, u32 crc, u32 size);
+
+/*
+    Forgets everything recorded so far and removes the staged files, as if `rrc_txn_begin' had just
+    started the update. Used when a way of applying the update failed halfway and another one is tried.
+*/
+struct rrc_result rrc_txn_reset(struct rrc_txn *txn);
+
+/*
+    Moves all staged files into place, removes the deleted files, stores `installed' and
+    finally sets the current version.
+*/
+struct rrc_result rrc_txn_commit(struct rrc_txn *txn, struct rrc_installed_manifest *installed);
+
+void rrc_txn_free(struct rrc_txn *txn);
+
+#endif
@@ -22,20 +22,35 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <stdlib.h>
-#include <gctypes.h>
+#include <malloc.h>
+#include <gccore.h>
 #include <zip.h>
+#include <zlib.h>
 #include <errno.h>
 #include <wiisocket.h>
 
 #include "versionsfile.h"
 #include "update.h"
+#include "zipstream.h"
+#include "dljournal.h"
+#include "session.h"
+#include "prefetch.h"
+#include "delta.h"
+#include "installed.h"
+#include "txn.h"
+#include "planner.h"
+#include "stats.h"
+#include "zipdl.h"
 #include "../util.h"
+#include "../strset.h"
 #include "../console.h"
 #include "../time.h"
 #include "../prompt.h"
 #include "../shutdown.h"
 
 #define _RRC_UPDATE_ZIP_NAME "update.zip"
+/* Upper bound of parallel connections used for the update size check */
+#define _RRC_UPDATE_MAX_HEAD_CONNECTIONS 4L
 
 struct rrc_result rrc_update_get_current_version(int *version)
 {
@@ -102,59 +117,6 @@ struct rrc_result rrc_update_set_current_version(int version)
     }
 }
 
-int lp = -1;
-rrc_time_tick last_measurement_from = -1;
-curl_off_t last_dlnow = 0;
-int last_second_dl_amount = 0;
-
-int _rrc_zipdl_progress_callback(int *numinfo,
-                                 curl_off_t dltotal,
-                                 curl_off_t dlnow,
-                                 curl_off_t ultotal,
-                                 curl_off_t ulnow)
-{
-    /* 100kB chunks */
-#define _RRC_PROGRESS_UPD_CHUNKSIZE 100000
-
-    /* update download speed every second */
-#define _RRC_PROGRESS_UPD_SPEED_INC 1000
-    int progress = (dlnow * 100) / dltotal;
-
-    if (diff_msec(last_measurement_from, gettime()) > _RRC_PROGRESS_UPD_SPEED_INC || last_measurement_from < 0)
-    {
-        last_measurement_from = gettime();
-
-        last_second_dl_amount = dlnow - last_dlnow;
-        last_dlnow = dlnow;
-    }
-
-    int chunk = dlnow / _RRC_PROGRESS_UPD_CHUNKSIZE;
-    if (chunk != lp)
-    {
-        lp = chunk;
-        char msg[100];
-        snprintf(
-            msg,
-            100,
-            "Downloading update %i of %i - %i kB/s (%i/%i kB)",
-            ((*numinfo) / 100) + 1,
-            (*numinfo) % 100,
-            (int)(last_second_dl_amount / 1000),
-            (int)(dlnow / (curl_off_t)1000),
-            (int)(dltotal / (curl_off_t)1000));
-
-        rrc_con_update(msg, progress);
-    }
-    return 0;
-#undef _RRC_PROGRESS_UPD_CHUNKSIZE
-}
-
-size_t _rrc_zipdl_write_data_callback(char *ptr, size_t size, size_t nmemb, FILE *stream)
-{
-    size_t written = fwrite(ptr, size, nmemb, stream);
-    return written;
-}
-
 size_t _rrc_update_writefunction_empty(char *ptr, size_t size, size_t nmemb, void *userdata)
 {
     return size * nmemb;
@@ -163,73 +125,22 @@ size_t _rrc_update_writefunction_empty(char *ptr, size_t size, size_t nmemb, voi
 /*
     Get the content-length of a ZIP download in bytes.
 */
-CURLcode _rrc_update_get_zip_size(char *url, curl_off_t *size)
+CURLcode _rrc_update_get_zip_size(struct rrc_update_session *session, char *url, curl_off_t *size)
 {
-    CURLcode cres;
-    CURL *curl = curl_easy_init();
-    if (curl)
+    CURL *curl = rrc_update_session_handle(session);
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _rrc_update_writefunction_empty);
+
+    CURLcode cres = curl_easy_perform(curl);
+    if (cres != CURLE_OK)
     {
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
-        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _rrc_update_writefunction_empty);
-        cres = curl_easy_perform(curl);
-        if (cres != CURLE_OK)
-        {
-            return cres;
-        }
-        cres = curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, size);
-        curl_easy_cleanup(curl);
         return cres;
     }
 
-    return CURLE_FAILED_INIT;
-}
-
-struct rrc_result rrc_update_download_zip(char *url, char *filename, int current_zip, int max_zips)
-{
-    CURLcode cres;
-    CURL *curl = curl_easy_init();
-    FILE *fp;
-    int numinfo = (current_zip * 100) + max_zips;
-    if (curl)
-    {
-        fp = fopen(filename, "wb");
-        if (fp == NULL)
-        {
-            return rrc_result_create_error_errno(errno, "Failed to create temporary ZIP file for update download");
-        }
-
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
-        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &numinfo);
-        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, _rrc_zipdl_progress_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _rrc_zipdl_write_data_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
-
-        /* Perform the request, cres gets the return code */
-        cres = curl_easy_perform(curl);
-
-        /* Check for errors */
-        if (cres != CURLE_OK)
-        {
-            // TODO: report error better
-            printf("curl_easy_perform() failed: %s\n",
-                   curl_easy_strerror(cres));
-
-            fclose(fp);
-            curl_easy_cleanup(curl);
-            return rrc_result_create_error_curl(cres, "Failed to download update ZIP");
-        }
-
-        fclose(fp);
-        curl_easy_cleanup(curl);
-        return rrc_result_success;
-    }
-
-    return rrc_result_create_error_curl(CURLE_FAILED_INIT, "Failed to init curl");
+    return curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, size);
 }
 
 #define RETURN_IO_ERR(err)            \
@@ -240,45 +151,51 @@ struct rrc_result rrc_update_download_zip(char *url, char *filename, int current
         return;                       \
     } while (0);
 
-/**
- * Creates any directories for a given path like "a/b/c/d.txt", one at a time, starting with the outermost dir.
- */
-static struct rrc_result mkdir_recursive(const char *fp)
+/*
+    Checks whether a ZIP entry has to be extracted, i.e. it is a file that isn't installed yet
+    and isn't replaced by a later update (if `skip' is given).
+*/
+static bool _rrc_update_entry_needed(zip_stat_t *stat, struct rrc_installed_manifest *installed, struct rrc_strset *skip)
 {
-    char tmp_path[PATH_MAX];
-    RRC_ASSERT(strlen(fp) < PATH_MAX, "path should never be longer than PATH_MAX");
+    // Ignore directories. They are automatically created when processing files.
+    if (stat->name[strlen(stat->name) - 1] == '/')
+    {
+        return false;
+    }
 
-    // start at 1 to skip any leading slash
-    for (int i = 1; i < strlen(fp); i++)
+    if (skip != NULL && rrc_strset_contains(skip, stat->name))
     {
-        if (fp[i] == '/')
-        {
-            strncpy(tmp_path, fp, i);
-            tmp_path[i] = '\0';
-            int err = mkdir(tmp_path, 0777);
-            if (err != 0 && errno != EEXIST)
-            {
-                return rrc_result_create_error_errno(errno, "Failed to create recursive directories for path");
-            }
-        }
+        return false;
     }
 
-    return rrc_result_success;
+    // Already installed, no need to write it again.
+    return !((stat->valid & ZIP_STAT_CRC) && rrc_installed_matches(installed, stat->name, stat->crc, stat->size));
 }
 
-struct rrc_result rrc_update_extract_zip_archive()
+static bool _rrc_update_bitmap_get(const u8 *bitmap, u32 i)
 {
-    int zip_err;
-    struct zip *archive = zip_open(_RRC_UPDATE_ZIP_NAME, ZIP_CHECKCONS | ZIP_RDONLY, &zip_err);
-    if (archive == NULL)
-    {
-        return rrc_result_create_error_zip(zip_err, "Failed to open downloaded ZIP archive");
-    }
+    return (bitmap[i / 8] >> (i % 8)) & 1;
+}
 
-    u32 zip_entries = zip_get_num_entries(archive, 0);
+static void _rrc_update_bitmap_set(u8 *bitmap, u32 i)
+{
+    bitmap[i / 8] |= 1 << (i % 8);
+}
 
-    char buf[4096];
+static int _rrc_update_compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(const char **)a, *(const char **)b);
+}
 
+/*
+    Checks the attributes of every entry of `archive' and sets the bit of each one that has to be extracted in `needed'.
+    `size' is set to the total size of those.
+*/
+static struct rrc_result _rrc_update_select_zip_entries(struct zip *archive, struct rrc_installed_manifest *installed, struct rrc_strset *skip, u8 *needed, u64 *size)
+{
+    u32 zip_entries = zip_get_num_entries(archive, 0);
+
+    *size = 0;
     for (int i = 0; i < zip_entries; i++)
     {
         zip_stat_t stat;
@@ -298,20 +215,81 @@ struct rrc_result rrc_update_extract_zip_archive()
             return rrc_result_create_error_misc_update("Empty file name in ZIP archive");
         }
 
-        unsigned long sd_free;
-        TRY(sd_get_free_space(&sd_free));
+        if (_rrc_update_entry_needed(&stat, installed, skip))
+        {
+            _rrc_update_bitmap_set(needed, i);
+            *size += stat.size;
+        }
+    }
+
+    return rrc_result_success;
+}
 
-        if (stat.size > sd_free)
+/*
+    Creates the staging directories of all entries that are going to be extracted in one go, in sorted order
+    so that every directory is created right after its parent.
+*/
+static struct rrc_result _rrc_update_create_zip_dirs(struct zip *archive, const u8 *needed)
+{
+    u32 zip_entries = zip_get_num_entries(archive, 0);
+    const char **names = malloc(sizeof(char *) * (zip_entries > 0 ? zip_entries : 1));
+    if (names == NULL)
+    {
+        return rrc_result_create_error_errno(ENOMEM, "Failed to allocate ZIP directory list");
+    }
+
+    u32 count = 0;
+    for (int i = 0; i < zip_entries; i++)
+    {
+        zip_stat_t stat;
+        if (_rrc_update_bitmap_get(needed, i) && zip_stat_index(archive, i, 0, &stat) == 0)
         {
-            return rrc_result_create_error_misc_update("Not enough free space on SD card for update");
+            names[count++] = stat.name;
         }
+    }
+
+    qsort(names, count, sizeof(char *), _rrc_update_compare_strings);
 
-        if (stat.name[strlen(stat.name) - 1] == '/')
+    struct rrc_result res = rrc_result_success;
+    char staged[PATH_MAX];
+    for (u32 i = 0; i < count && !rrc_result_is_error(res); i++)
+    {
+        rrc_txn_stage_path(names[i], staged, sizeof(staged));
+        res = rrc_update_create_parent_dirs(staged);
+    }
+
+    free(names);
+    return res;
+}
+
+/*
+    Extracts the entries of `archive' whose bit is set in `needed' to the staging directory.
+    `budget' is the free space on the SD card.
+*/
+static struct rrc_result _rrc_update_write_zip_entries(struct zip *archive, const u8 *needed, u64 budget, struct rrc_txn *txn, u8 *buf)
+{
+    u32 zip_entries = zip_get_num_entries(archive, 0);
+
+    for (int i = 0; i < zip_entries; i++)
+    {
+        if (!_rrc_update_bitmap_get(needed, i))
         {
-            // Ignore directories. They are automatically created when processing files.
             continue;
         }
 
+        zip_stat_t stat;
+        int err = zip_stat_index(archive, i, 0, &stat);
+        if (err != 0)
+        {
+            return rrc_result_create_error_zip(err, "Failed to stat file in archive");
+        }
+
+        if (stat.size > budget)
+        {
+            return rrc_result_create_error_misc_update("Not enough free space on SD card for update");
+        }
+        budget -= stat.size;
+
         zip_file_t *zip_file = zip_fopen_index(archive, i, ZIP_FL_ENC_UTF_8);
         if (!zip_file)
         {
@@ -324,69 +302,411 @@ struct rrc_result rrc_update_extract_zip_archive()
         snprintf(message, sizeof(message), "Extracting %s (%d/%d)", filepath, i + 1, zip_entries);
         rrc_con_update(message, ((f64)(i + 1) / (f64)zip_entries) * 100);
 
-        FILE *outfile = fopen(filepath, "w");
-        if (!outfile)
-        {
-            // We couldn't create the file. This can happen if we have a file path like "a/b.txt" and directory "a" doesn't exist.
-            // At least this ENOENT case is recoverable by recursively creating the missing directories, so only return error for all other errors.
-            if (errno != ENOENT)
-            {
-                return rrc_result_create_error_errno(errno, "Failed to create output file for extracting ZIP entry");
-            }
+        char staged[PATH_MAX];
+        rrc_txn_stage_path(filepath, staged, sizeof(staged));
 
-            TRY(mkdir_recursive(filepath));
-
-            outfile = fopen(filepath, "w");
-            if (!outfile)
-            {
-                // We're still getting errors when opening the file even after creating missing directories. Nothing more we can do.
-                return rrc_result_create_error_errno(errno, "Failed to open output file for extracting ZIP entry after creating directories");
-            }
+        FILE *outfile;
+        struct rrc_result res = rrc_update_open_extract_file(staged, &outfile);
+        if (rrc_result_is_error(res))
+        {
+            zip_fclose(zip_file);
+            return res;
         }
 
+        /* zip_fread only returns less than asked for at the end of the entry, so every write but the last is a full buffer. */
         int read;
-        while ((read = zip_fread(zip_file, buf, sizeof(buf))) > 0)
+        rrc_time_tick start = gettime();
+        while ((read = zip_fread(zip_file, buf, RRC_UPDATE_IO_BUFFER_SIZE)) > 0)
         {
+            rrc_update_stats_add_time(RRC_UPDATE_STATS_INFLATE, start);
+            start = gettime();
             int written = fwrite(buf, 1, read, outfile);
+            rrc_update_stats_add_time(RRC_UPDATE_STATS_WRITE, start);
             if (written != read)
             {
-                return rrc_result_create_error_errno(errno, "Failed to fully write ZIP chunk");
+                res = rrc_result_create_error_errno(errno, "Failed to fully write ZIP chunk");
+                break;
             }
+            start = gettime();
         }
+        rrc_update_stats_add_time(RRC_UPDATE_STATS_INFLATE, start);
 
         if (read < 0)
         {
-            return rrc_result_create_error_errno(errno, "Failed to write ZIP chunk");
+            res = rrc_result_create_error_errno(errno, "Failed to write ZIP chunk");
         }
 
-        fclose(outfile);
+        /* With buffered writes, this is where the last chunk actually gets written. The file is
+           closed on errors too, since the next one can't be opened before (see `rrc_update_open_extract_file'). */
+        start = gettime();
+        if (rrc_update_close_extract_file(outfile) != 0 && !rrc_result_is_error(res))
+        {
+            res = rrc_result_create_error_errno(errno, "Failed to write ZIP chunk");
+        }
+        rrc_update_stats_add_time(RRC_UPDATE_STATS_WRITE, start);
         zip_fclose(zip_file);
+        TRY(res);
+        rrc_update_stats_add_entry();
+
+        TRY(rrc_txn_add_staged(txn, filepath, (stat.valid & ZIP_STAT_CRC) != 0, stat.crc, stat.size));
     }
 
-    zip_close(archive);
     return rrc_result_success;
 }
 
+static struct rrc_result _rrc_update_extract_zip_entries(struct zip *archive, struct rrc_installed_manifest *installed, struct rrc_txn *txn, struct rrc_strset *skip, u8 *buf)
+{
+    /* Whether an entry is needed is looked up once per archive, since it stats the installed file,
+       which walks the whole directory on FAT. */
+    u32 zip_entries = zip_get_num_entries(archive, 0);
+    u8 *needed = calloc(zip_entries / 8 + 1, 1);
+    if (needed == NULL)
+    {
+        return rrc_result_create_error_errno(ENOMEM, "Failed to allocate ZIP entry list");
+    }
+
+    u64 size;
+    struct rrc_result res = _rrc_update_select_zip_entries(archive, installed, skip, needed, &size);
+
+    /* Querying the free space scans the whole FAT, so do it once for the entire archive. */
+    unsigned long sd_free = 0;
+    if (!rrc_result_is_error(res))
+    {
+        rrc_time_tick space_check_start = gettime();
+        res = sd_get_free_space(&sd_free);
+        rrc_update_stats_add_time(RRC_UPDATE_STATS_SPACE_CHECK, space_check_start);
+    }
+
+    if (!rrc_result_is_error(res) && size > sd_free)
+    {
+        res = rrc_result_create_error_misc_update("Not enough free space on SD card for update");
+    }
+
+    if (!rrc_result_is_error(res))
+    {
+        res = _rrc_update_create_zip_dirs(archive, needed);
+    }
+
+    if (!rrc_result_is_error(res))
+    {
+        res = _rrc_update_write_zip_entries(archive, needed, sd_free, txn, buf);
+    }
+
+    free(needed);
+    return res;
+}
+
+/*
+    Extracts all entries of `archive' and closes it.
+*/
+static struct rrc_result _rrc_update_extract_opened_zip(struct zip *archive, struct rrc_installed_manifest *installed, struct rrc_txn *txn, struct rrc_strset *skip)
+{
+    /* As large as the file buffer, so that full chunks are written straight through without being copied. */
+    u8 *buf = memalign(32, RRC_UPDATE_IO_BUFFER_SIZE);
+    if (buf == NULL)
+    {
+        zip_close(archive);
+        return rrc_result_create_error_errno(ENOMEM, "Failed to allocate ZIP extraction buffer");
+    }
+
+    struct rrc_result res = _rrc_update_extract_zip_entries(archive, installed, txn, skip, buf);
+
+    free(buf);
+    zip_close(archive);
+    return res;
+}
+
+struct rrc_result rrc_update_extract_zip_archive(struct rrc_installed_manifest *installed, struct rrc_txn *txn, struct rrc_strset *skip)
+{
+    int zip_err;
+    struct zip *archive = zip_open(_RRC_UPDATE_ZIP_NAME, ZIP_CHECKCONS | ZIP_RDONLY, &zip_err);
+    if (archive == NULL)
+    {
+        return rrc_result_create_error_zip(zip_err, "Failed to open downloaded ZIP archive");
+    }
+
+    return _rrc_update_extract_opened_zip(archive, installed, txn, skip);
+}
+
+/*
+    Like `rrc_update_extract_zip_archive', but for an archive of `len' bytes that is held in memory.
+*/
+static struct rrc_result _rrc_update_extract_zip_buffer(const u8 *data, u64 len, struct rrc_installed_manifest *installed, struct rrc_txn *txn, struct rrc_strset *skip)
+{
+    zip_error_t error;
+    zip_error_init(&error);
+
+    zip_source_t *source = zip_source_buffer_create(data, len, 0, &error);
+    struct zip *archive = source != NULL ? zip_open_from_source(source, ZIP_CHECKCONS | ZIP_RDONLY, &error) : NULL;
+    if (archive == NULL)
+    {
+        int zip_err = zip_error_code_zip(&error);
+        if (source != NULL)
+        {
+            zip_source_free(source);
+        }
+        zip_error_fini(&error);
+        return rrc_result_create_error_zip(zip_err, "Failed to open downloaded ZIP archive");
+    }
+    zip_error_fini(&error);
+
+    /* The archive owns the source now and frees it when it is closed. */
+    return _rrc_update_extract_opened_zip(archive, installed, txn, skip);
+}
+
+struct _rrc_zipstream_write_ctx
+{
+    CURL *curl;
+    struct rrc_zipstream zs;
+    struct rrc_dljournal *journal;
+    /* Offset we asked the server to start at */
+    curl_off_t resume_from;
+    /* Offset in the archive of the next byte to be received */
+    curl_off_t offset;
+    /* CRC32 of everything up to `offset', and of everything up to the last fully extracted entry */
+    u32 crc;
+    u32 committed_crc;
+    bool checked_response;
+    /* Error that made us abort the transfer, if any */
+    struct rrc_result res;
+};
+
+size_t _rrc_zipstream_write_data_callback(char *ptr, size_t size, size_t nmemb, struct _rrc_zipstream_write_ctx *ctx)
+{
+    if (!ctx->checked_response)
+    {
+        ctx->checked_response = true;
+        if (rrc_zipdl_range_ignored(ctx->curl, ctx->resume_from))
+        {
+            rrc_zipstream_free(&ctx->zs);
+            rrc_zipstream_init(&ctx->zs, 0, ctx->zs.installed, ctx->zs.txn, ctx->zs.skip, ctx->zs.space_left);
+            ctx->offset = 0;
+            ctx->crc = ctx->committed_crc = crc32(0, Z_NULL, 0);
+        }
+    }
+
+    size_t len = size * nmemb;
+    struct rrc_result res = rrc_zipstream_feed(&ctx->zs, (const u8 *)ptr, len);
+    if (rrc_result_is_error(res))
+    {
+        /* Returning anything other than the chunk size aborts the transfer with CURLE_WRITE_ERROR */
+        ctx->res = res;
+        return 0;
+    }
+
+    /* Split the checksum where the last extracted entry ends, so that it can be stored in the journal. */
+    if (ctx->zs.committed > ctx->offset)
+    {
+        u32 head = ctx->zs.committed - ctx->offset;
+        ctx->committed_crc = crc32(ctx->crc, (const Bytef *)ptr, head);
+        ctx->crc = crc32(ctx->committed_crc, (const Bytef *)ptr + head, len - head);
+    }
+    else
+    {
+        ctx->crc = crc32(ctx->crc, (const Bytef *)ptr, len);
+    }
+    ctx->offset += len;
+
+    /* Extracted entries are closed and thereby synced to the SD card, so they can be committed right away. */
+    ctx->journal->crc = ctx->committed_crc;
+    res = rrc_dljournal_commit(ctx->journal, ctx->zs.committed);
+    if (rrc_result_is_error(res))
+    {
+        ctx->res = res;
+        return 0;
+    }
+
+    return len;
+}
+
+struct rrc_result rrc_update_download_and_extract_zip(struct rrc_update_session *session, char *url, curl_off_t expected_length, const u32 *expected_crc, int current_zip, int max_zips, struct rrc_installed_manifest *installed, struct rrc_txn *txn, struct rrc_strset *skip, u64 *space_left, bool *streamed)
+{
+    *streamed = false;
+
+    struct _rrc_zipstream_write_ctx *ctx = malloc(sizeof(struct _rrc_zipstream_write_ctx));
+    if (ctx == NULL)
+    {
+        return rrc_result_create_error_errno(ENOMEM, "Failed to allocate ZIP stream state");
+    }
+    CURL *curl = rrc_update_session_handle(session);
+
+    struct rrc_dljournal journal;
+    rrc_dljournal_load(url, expected_length, RRC_DLJOURNAL_MODE_STREAM, &journal);
+
+    ctx->curl = curl;
+    ctx->journal = &journal;
+
+    int numinfo = (current_zip * 100) + max_zips;
+    struct rrc_result res = rrc_result_success;
+    CURLcode cres = CURLE_OK;
+    for (int attempt = 0;; attempt++)
+    {
+        rrc_zipstream_init(&ctx->zs, journal.committed, installed, txn, skip, space_left);
+        ctx->resume_from = journal.committed;
+        ctx->offset = journal.committed;
+        ctx->crc = ctx->committed_crc = journal.crc;
+        ctx->checked_response = false;
+        ctx->res = rrc_result_success;
+
+        rrc_zipdl_setopt_transfer(curl, url, &numinfo, ctx->resume_from);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _rrc_zipstream_write_data_callback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, ctx);
+
+        cres = curl_easy_perform(curl);
+        rrc_update_stats_add_transfer(curl);
+
+        if (ctx->zs.unsupported)
+        {
+            /* Not an error: the caller falls back to downloading the whole archive first. */
+            rrc_result_free(ctx->res);
+            break;
+        }
+        else if (rrc_result_is_error(ctx->res))
+        {
+            res = ctx->res;
+            break;
+        }
+        else if (cres == CURLE_OK)
+        {
+            res = rrc_zipstream_finish(&ctx->zs);
+            if (!rrc_result_is_error(res))
+            {
+                res = rrc_zipdl_verify(expected_crc, ctx->crc);
+            }
+            *streamed = !rrc_result_is_error(res);
+            break;
+        }
+        else if (!rrc_zipdl_is_transient_error(cres) || attempt + 1 >= RRC_UPDATE_DOWNLOAD_ATTEMPTS)
+        {
+            res = rrc_result_create_error_curl(cres, "Failed to download update ZIP");
+            break;
+        }
+
+        /* Start over at the first entry that wasn't fully extracted yet. */
+        journal.committed = ctx->zs.committed;
+        journal.crc = ctx->committed_crc;
+        rrc_zipstream_free(&ctx->zs);
+    }
+
+    rrc_zipstream_free(&ctx->zs);
+    free(ctx);
+    rrc_zipdl_shutdown_if_aborted(cres);
+    return res;
+}
+
 int rrc_update_get_total_update_size(struct rrc_update_state *state, curl_off_t *size)
 {
     *size = 0;
 
+    if (state->num_updates == 0)
+    {
+        return 0;
+    }
+
+    if (state->update_sizes == NULL)
+    {
+        state->update_sizes = malloc(sizeof(curl_off_t) * state->num_updates);
+        if (state->update_sizes == NULL)
+        {
+            return -CURLE_OUT_OF_MEMORY;
+        }
+    }
+
+    /* All HEAD requests go out at once through one multi handle. The session's connection pool lets them share connections. */
+    CURLM *multi = curl_multi_init();
+    CURL **handles = calloc(state->num_updates, sizeof(CURL *));
+    if (multi == NULL || handles == NULL)
+    {
+        curl_multi_cleanup(multi);
+        free(handles);
+        return -CURLE_FAILED_INIT;
+    }
+
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, _RRC_UPDATE_MAX_HEAD_CONNECTIONS);
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+    int ret = 0;
+    for (int i = 0; i < state->num_updates; i++)
+    {
+        state->update_sizes[i] = -1;
+
+        CURL *curl = rrc_update_session_new_handle(state->session);
+        if (!curl)
+        {
+            ret = -CURLE_FAILED_INIT;
+            goto cleanup;
+        }
+        handles[i] = curl;
+
+        curl_easy_setopt(curl, CURLOPT_URL, state->update_urls[i]);
+        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _rrc_update_writefunction_empty);
+        curl_multi_add_handle(multi, curl);
+    }
+
+    int running = 1;
+    while (running > 0)
+    {
+        CURLMcode mres = curl_multi_perform(multi, &running);
+        if (mres == CURLM_OK && running > 0)
+        {
+            mres = curl_multi_poll(multi, NULL, 0, 1000, NULL);
+        }
+
+        if (mres != CURLM_OK)
+        {
+            ret = -CURLE_RECV_ERROR;
+            goto cleanup;
+        }
+    }
+
+    CURLMsg *msg;
+    int msgs_left;
+    while ((msg = curl_multi_info_read(multi, &msgs_left)) != NULL)
+    {
+        if (msg->msg == CURLMSG_DONE && msg->data.result != CURLE_OK)
+        {
+            ret = -msg->data.result;
+            goto cleanup;
+        }
+    }
+
     for (int i = 0; i < state->num_updates; i++)
     {
-        int ret;
-        curl_off_t this_size;
+        CURLcode cres = curl_easy_getinfo(handles[i], CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &state->update_sizes[i]);
+        if (cres != CURLE_OK)
+        {
+            ret = -cres;
+            goto cleanup;
+        }
+
+        *size += state->update_sizes[i];
+    }
 
-        ret = _rrc_update_get_zip_size(state->update_urls[i], &this_size);
-        if (ret != 0)
+cleanup:
+    for (int i = 0; i < state->num_updates; i++)
+    {
+        if (handles[i] != NULL)
         {
-            *size = 0;
-            return -ret;
+            curl_multi_remove_handle(multi, handles[i]);
+            curl_easy_cleanup(handles[i]);
         }
+    }
+    free(handles);
+    curl_multi_cleanup(multi);
 
-        *size += this_size;
+    if (ret != 0)
+    {
+        *size = 0;
+        for (int i = 0; i < state->num_updates; i++)
+        {
+            state->update_sizes[i] = -1;
+        }
     }
 
-    return 0;
+    return ret;
 }
 
 int rrc_update_is_large(struct rrc_update_state *state, curl_off_t *size)
@@ -401,31 +721,111 @@ int rrc_update_is_large(struct rrc_update_state *state, curl_off_t *size)
     return (*size > RRC_UPDATE_LARGE_THRESHOLD);
 }
 
-struct rrc_result rrc_update_do_updates_with_state(struct rrc_update_state *state)
+/*
+    Reads the CRC32 published for an update ZIP from its versions file entry.
+*/
+static bool _rrc_update_get_published_crc(const char *extras, u32 *crc)
 {
-    while (state->current_update_num < state->num_updates)
+    char value[16];
+    if (!rrc_versionsfile_get_extra(extras, RRC_UPDATE_CRC_EXTRA_KEY, value, sizeof(value)) || value[0] == '\0')
     {
-        /* We can check for this between updates since we have no in-flight information */
-        rrc_shutdown_check();
+        return false;
+    }
+
+    char *end;
+    *crc = strtoul(value, &end, 16);
+    return *end == '\0';
+}
+
+/*
+    Allocates the buffer an update ZIP is downloaded into. libogc has no separate MEM2 heap, but the regular one
+    continues in MEM2 once MEM1 is used up, which is where a buffer this large normally lands. One that would take
+    up MEM1 instead is refused, since curl and libzip need what's left of it during the update.
+    Returns NULL if there is no suitable buffer.
+*/
+static u8 *_rrc_update_alloc_zip_buffer(curl_off_t size)
+{
+    u8 *mem = memalign(32, size);
+    if (mem != NULL && MEM_VIRTUAL_TO_PHYSICAL(mem) < 0x10000000)
+    {
+        free(mem);
+        return NULL;
+    }
 
-        char *url = state->update_urls[state->current_update_num];
+    return mem;
+}
 
-        curl_off_t zipsz;
-        CURLcode szres = _rrc_update_get_zip_size(url, &zipsz);
+/*
+    Downloads the full ZIP of the current update and extracts it into the staging directory of `txn'.
+    Entries in `skip' (may be NULL) are left out.
+*/
+static struct rrc_result _rrc_update_install_zip(struct rrc_update_state *state, struct rrc_txn *txn, struct rrc_strset *skip)
+{
+    char *url = state->update_urls[state->current_update_num];
+
+    // Reuse the size from the update size check if we have it.
+    curl_off_t zipsz = state->update_sizes != NULL ? state->update_sizes[state->current_update_num] : -1;
+    if (zipsz < 0)
+    {
+        CURLcode szres = _rrc_update_get_zip_size(state->session, url, &zipsz);
         if (szres != CURLE_OK)
         {
             return rrc_result_create_error_curl(szres, "Failed to get update ZIP size");
         }
+    }
+
+    // Checksum published for the archive in the versions file, if any.
+    u32 crc;
+    const u32 *expected_crc = _rrc_update_get_published_crc(state->update_extras[state->current_update_num], &crc) ? &crc : NULL;
 
-        unsigned long sd_free;
-        TRY(sd_get_free_space(&sd_free));
+    unsigned long sd_free;
+    rrc_time_tick space_check_start = gettime();
+    TRY(sd_get_free_space(&sd_free));
+    rrc_update_stats_add_time(RRC_UPDATE_STATS_SPACE_CHECK, space_check_start);
 
-        if (zipsz > sd_free)
+    if (zipsz > sd_free)
+    {
+        return rrc_result_create_error_misc_update("Not enough free space on SD card for update");
+    }
+
+    /* Large archives download a lot faster over several connections than extraction could keep up with
+       over one, so they skip streaming and are downloaded in segments first.
+       A streamed archive can only be checked against its published checksum after its entries were already
+       extracted, so archives that have one are downloaded first as well and only extracted once they passed. */
+    bool extracted = false;
+    if (zipsz < RRC_ZIPDL_SEGMENTED_THRESHOLD && expected_crc == NULL)
+    {
+        rrc_update_stats_set_mode("stream");
+        u64 space_left = sd_free;
+        TRY(rrc_update_download_and_extract_zip(state->session, url, zipsz, expected_crc, state->current_update_num, state->num_updates, state->installed, txn, skip, &space_left, &extracted));
+    }
+
+    // Archives that fit in memory don't need the round trip through a temporary file on the SD card.
+    if (!extracted && zipsz > 0 && zipsz <= RRC_UPDATE_RAM_ZIP_BUDGET)
+    {
+        u8 *mem = _rrc_update_alloc_zip_buffer(zipsz);
+        if (mem != NULL)
         {
-            return rrc_result_create_error_misc_update("Not enough free space on SD card for update");
+            rrc_update_stats_set_mode("memory");
+            struct rrc_result res = rrc_update_download_zip_to_memory(state->session, url, mem, zipsz, expected_crc, state->current_update_num, state->num_updates);
+            if (!rrc_result_is_error(res))
+            {
+                res = _rrc_update_extract_zip_buffer(mem, zipsz, state->installed, txn, skip);
+            }
+            free(mem);
+
+            /* Entries that did get extracted are simply extracted again by the file path. */
+            extracted = !rrc_result_is_error(res);
+            rrc_result_free(res);
         }
+    }
 
-        TRY(rrc_update_download_zip(url, _RRC_UPDATE_ZIP_NAME, state->current_update_num, state->num_updates));
+    if (!extracted)
+    {
+        rrc_update_stats_set_mode("file");
+
+        // The archive can't be extracted while it is being downloaded, so go the long way round via the SD card.
+        TRY(rrc_update_download_zip(state->session, url, _RRC_UPDATE_ZIP_NAME, zipsz, expected_crc, state->current_update_num, state->num_updates));
 
         struct stat sb;
         int s = stat(_RRC_UPDATE_ZIP_NAME, &sb);
@@ -434,33 +834,149 @@ struct rrc_result rrc_update_do_updates_with_state(struct rrc_update_state *stat
             return rrc_result_create_error_errno(errno, "Failed to stat update ZIP file");
         }
 
-        TRY(rrc_update_extract_zip_archive());
+        TRY(rrc_update_extract_zip_archive(state->installed, txn, skip));
 
         int rres = remove(_RRC_UPDATE_ZIP_NAME);
         if (rres == -1)
         {
             return rrc_result_create_error_errno(errno, "Failed to remove temporary update file");
         }
+    }
+
+    return rrc_result_success;
+}
+
+/*
+    Orders deleted files by version and then by directory, so that the deletions of each version are one
+    contiguous run and files in the same directory are removed one after another.
+*/
+static int _rrc_update_compare_deleted_files(const void *a, const void *b)
+{
+    const struct rrc_versionsfile_deleted_file *fa = a;
+    const struct rrc_versionsfile_deleted_file *fb = b;
+    if (fa->version != fb->version)
+    {
+        return fa->version < fb->version ? -1 : 1;
+    }
+
+    const char *slash_a = strrchr(fa->path, '/');
+    const char *slash_b = strrchr(fb->path, '/');
+    int dir_len_a = slash_a != NULL ? slash_a - fa->path : 0;
+    int dir_len_b = slash_b != NULL ? slash_b - fb->path : 0;
+
+    int cmp = strncmp(fa->path, fb->path, dir_len_a < dir_len_b ? dir_len_a : dir_len_b);
+    if (cmp != 0)
+    {
+        return cmp;
+    }
+    if (dir_len_a != dir_len_b)
+    {
+        return dir_len_a - dir_len_b;
+    }
 
-        // Now remove any deleted files.
-        for (int i = 0; i < state->num_deleted_files; i++)
+    return strcmp(fa->path + dir_len_a, fb->path + dir_len_b);
+}
+
+/*
+    Returns the index of the first deleted file of `version' or a later one. The deleted files must be sorted.
+*/
+static int _rrc_update_find_deleted_files(struct rrc_update_state *state, int version)
+{
+    int lo = 0, hi = state->num_deleted_files;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (state->deleted_files[mid].version < version)
         {
-            struct rrc_versionsfile_deleted_file *file = &state->deleted_files[i];
-            if (file->version == state->update_versions[state->current_update_num])
-            {
-                char out[100];
-                snprintf(out, 100, "Removing deleted file %s\n", file->path);
-                rrc_con_update(out, 100);
-                int rmres = remove(file->path);
-                if (rmres != 0 && errno != ENOENT)
-                {
-                    return rrc_result_create_error_errno(errno, "Failed to remove deleted file for update");
-                }
-            }
+            lo = mid + 1;
         }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
 
-        // Update the version.txt file
-        TRY(rrc_update_set_current_version(state->update_versions[state->current_update_num]));
+/*
+    Stages all files of the current update in `txn', along with the files it deletes.
+    `removed' holds the files that earlier updates of this session removed, which don't have to be removed again.
+*/
+static struct rrc_result _rrc_update_stage_version(struct rrc_update_state *state, struct rrc_txn *txn, struct rrc_strset *removed)
+{
+    // Prefer patching only the changed files if the server offers a delta for this update.
+    bool applied_delta = false;
+    char delta_url[RRC_DLJOURNAL_URL_MAX];
+    if (rrc_versionsfile_get_extra(state->update_extras[state->current_update_num], RRC_DELTA_EXTRA_KEY, delta_url, sizeof(delta_url)))
+    {
+        rrc_update_stats_set_mode("delta");
+        struct rrc_result res = rrc_delta_apply_manifest(state->session, delta_url, state->current_update_num, state->num_updates, state->installed, txn);
+        applied_delta = !rrc_result_is_error(res);
+        rrc_result_free(res);
+
+        // Whatever the delta staged before failing is superseded by the ZIP.
+        if (!applied_delta)
+        {
+            TRY(rrc_txn_reset(txn));
+        }
+    }
+
+    if (!applied_delta)
+    {
+        TRY(_rrc_update_install_zip(state, txn, NULL));
+    }
+
+    // Files written or found up to date by this update exist again, whatever earlier updates did to them.
+    for (u32 i = 0; i < txn->count; i++)
+    {
+        if (txn->records[i].type == RRC_TXN_RECORD_STAGED || txn->records[i].type == RRC_TXN_RECORD_VERIFIED)
+        {
+            rrc_strset_remove(removed, txn->records[i].path);
+        }
+    }
+
+    int version = state->update_versions[state->current_update_num];
+    for (int i = _rrc_update_find_deleted_files(state, version); i < state->num_deleted_files && state->deleted_files[i].version == version; i++)
+    {
+        const char *path = state->deleted_files[i].path;
+        if (rrc_strset_contains(removed, path))
+        {
+            continue;
+        }
+
+        TRY(rrc_txn_add_deleted(txn, path));
+        TRY(rrc_strset_add(removed, path));
+    }
+
+    return rrc_result_success;
+}
+
+static struct rrc_result _rrc_update_apply_versions(struct rrc_update_state *state, struct rrc_strset *removed)
+{
+    while (state->current_update_num < state->num_updates)
+    {
+        /* We can check for this between updates since we have no in-flight information */
+        rrc_shutdown_check();
+
+        // Everything is written to the staging directory first and only moved into place once it's all there.
+        struct rrc_txn txn;
+        TRY(rrc_txn_begin(&txn, state->update_versions[state->current_update_num]));
+        rrc_update_stats_begin(state->update_versions[state->current_update_num]);
+
+        struct rrc_result res = _rrc_update_stage_version(state, &txn, removed);
+        if (!rrc_result_is_error(res))
+        {
+            // Moves the files into place, removes deleted files, remembers what this version
+            // installed and finally updates the version.txt file.
+            res = rrc_txn_commit(&txn, state->installed);
+        }
+        rrc_txn_free(&txn);
+        TRY(res);
+
+        TRY(rrc_dljournal_remove());
+
+        // Only for diagnosing slow updates, so failing to write it is no reason to stop.
+        rrc_result_free(rrc_update_stats_finish());
 
         state->current_update_num++;
     }
@@ -468,26 +984,147 @@ struct rrc_result rrc_update_do_updates_with_state(struct rrc_update_state *stat
     return rrc_result_success;
 }
 
-struct rrc_result rrc_update_do_updates(void *xfb, int *count, bool *updates_installed)
+/*
+    Applies all remaining updates as a single transaction `txn' to the newest version, following `plan'.
+*/
+static struct rrc_result _rrc_update_apply_plan(struct rrc_update_state *state, struct rrc_update_plan *plan, struct rrc_txn *txn)
 {
-    rrc_con_clear(true);
+    struct rrc_strset deleted;
+    rrc_strset_init(&deleted);
 
-    rrc_con_update("Prepare Network", 0);
-    int res = wiisocket_init();
-    if (res < 0)
+    struct rrc_result res = rrc_result_success;
+    for (int i = state->current_update_num; i < state->num_updates && !rrc_result_is_error(res); i++)
     {
-        return rrc_result_create_error_misc_update("Failed to connect to the internet. Please check your connection and internet settings.");
+        rrc_shutdown_check();
+
+        // Everything in this ZIP is replaced by later updates, don't even download it.
+        if (plan->num_needed[i] == 0)
+        {
+            continue;
+        }
+
+        state->current_update_num = i;
+        rrc_update_stats_begin(state->update_versions[i]);
+        res = _rrc_update_install_zip(state, txn, &plan->superseded[i]);
+        if (!rrc_result_is_error(res))
+        {
+            res = rrc_dljournal_remove();
+        }
+        if (!rrc_result_is_error(res))
+        {
+            rrc_result_free(rrc_update_stats_finish());
+        }
     }
 
-    *updates_installed = false;
+    for (int i = 0; i < state->num_deleted_files && !rrc_result_is_error(res); i++)
+    {
+        const char *path = state->deleted_files[i].path;
+        if (plan->delete_needed[i] && !rrc_strset_contains(&deleted, path))
+        {
+            res = rrc_txn_add_deleted(txn, path);
+            if (!rrc_result_is_error(res))
+            {
+                res = rrc_strset_add(&deleted, path);
+            }
+        }
+    }
+
+    if (!rrc_result_is_error(res))
+    {
+        res = rrc_txn_commit(txn, state->installed);
+    }
+
+    rrc_strset_free(&deleted);
+    TRY(res);
+
+    state->current_update_num = state->num_updates;
+    return rrc_result_success;
+}
+
+/*
+    Whether the remaining updates can be applied in one go. Deltas patch the files of the version
+    before them, so they need every version in between to be installed.
+*/
+static bool _rrc_update_can_plan(struct rrc_update_state *state)
+{
+    if (state->num_updates - state->current_update_num < 2)
+    {
+        return false;
+    }
+
+    char delta_url[RRC_DLJOURNAL_URL_MAX];
+    for (int i = state->current_update_num; i < state->num_updates; i++)
+    {
+        if (rrc_versionsfile_get_extra(state->update_extras[i], RRC_DELTA_EXTRA_KEY, delta_url, sizeof(delta_url)))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+struct rrc_result rrc_update_do_updates_with_state(struct rrc_update_state *state)
+{
+    // Bucket the deleted files by version once, instead of scanning all of them for every update.
+    if (state->num_deleted_files > 0)
+    {
+        qsort(state->deleted_files, state->num_deleted_files, sizeof(struct rrc_versionsfile_deleted_file), _rrc_update_compare_deleted_files);
+    }
+
+    // Skipping several versions at once only writes the newest copy of every file.
+    if (_rrc_update_can_plan(state))
+    {
+        // Begun before planning, so that whatever an interrupted attempt already staged isn't extracted again.
+        struct rrc_txn txn;
+        TRY(rrc_txn_begin(&txn, state->update_versions[state->num_updates - 1]));
+
+        struct rrc_update_plan plan;
+        struct rrc_result res = rrc_update_plan_create(state, &txn, &plan);
+        if (!rrc_result_is_error(res))
+        {
+            res = _rrc_update_apply_plan(state, &plan, &txn);
+            rrc_update_plan_free(&plan);
+            rrc_txn_free(&txn);
+            return res;
+        }
+
+        // Planning is only an optimisation, the updates can still be applied one by one.
+        rrc_txn_free(&txn);
+        rrc_result_free(res);
+    }
+
+    struct rrc_strset removed;
+    rrc_strset_init(&removed);
+    struct rrc_result res = _rrc_update_apply_versions(state, &removed);
+    rrc_strset_free(&removed);
+    return res;
+}
+
+/*
+    `prefetch' holds whatever the background update check already fetched, or is NULL.
+    Anything it failed to fetch is fetched again here, so errors are reported as usual.
+*/
+static struct rrc_result _rrc_update_do_updates_in_session(struct rrc_update_session *session, struct rrc_update_prefetch *prefetch, void *xfb, int *count, bool *updates_installed)
+{
+    int res;
     char *versionsfile = NULL;
     char *deleted_versionsfile = NULL;
     int num_deleted_files = 0;
     struct rrc_versionsfile_deleted_file *deleted_files = NULL;
     char **zip_urls = NULL;
     int *update_versions = NULL;
+    char **update_extras = NULL;
     rrc_con_update("Get Versions", 10);
-    res = rrc_versionsfile_get_versionsfile(&versionsfile);
+    if (prefetch != NULL && prefetch->versions_res == 0)
+    {
+        res = 0;
+        versionsfile = prefetch->versionsfile;
+    }
+    else
+    {
+        res = rrc_versionsfile_get_versionsfile(session, true, &versionsfile);
+    }
     if (res < 0)
     {
         return rrc_result_create_error_curl(-res, "Failed to get version information.");
@@ -500,7 +1137,7 @@ struct rrc_result rrc_update_do_updates(void *xfb, int *count, bool *updates_ins
     rrc_dbg_printf("Current version: %i\n", current);
 
     rrc_con_update("Get Download URLs", 20);
-    TRY(rrc_versionsfile_get_necessary_urls_and_versions(versionsfile, current, count, &zip_urls, &update_versions));
+    TRY(rrc_versionsfile_get_necessary_urls_and_versions(versionsfile, current, count, &zip_urls, &update_versions, &update_extras));
 
     if (*count > 0)
     {
@@ -514,7 +1151,15 @@ struct rrc_result rrc_update_do_updates(void *xfb, int *count, bool *updates_ins
     }
 
     rrc_con_update("Get Files to Remove", 30);
-    res = rrc_versionsfile_get_removed_files(&deleted_versionsfile);
+    if (prefetch != NULL && prefetch->deleted_res == 0)
+    {
+        res = 0;
+        deleted_versionsfile = prefetch->deleted_versionsfile;
+    }
+    else
+    {
+        res = rrc_versionsfile_get_removed_files(session, true, &deleted_versionsfile);
+    }
     if (res < 0)
     {
         RRC_FATAL("couldnt get files to remove! res: %i\n", res);
@@ -522,6 +1167,9 @@ struct rrc_result rrc_update_do_updates(void *xfb, int *count, bool *updates_ins
 
     TRY(rrc_versionsfile_parse_deleted_files(deleted_versionsfile, current, &deleted_files, &num_deleted_files));
 
+    struct rrc_installed_manifest installed;
+    rrc_installed_load(&installed);
+
     rrc_dbg_printf("%i updates\n", *count);
     struct rrc_update_state state =
         {
@@ -530,6 +1178,10 @@ struct rrc_result rrc_update_do_updates(void *xfb, int *count, bool *updates_ins
             .num_updates = *count,
             .update_urls = zip_urls,
             .update_versions = update_versions,
+            .update_extras = update_extras,
+            .update_sizes = NULL,
+            .session = session,
+            .installed = &installed,
             .current_version = current,
             .num_deleted_files = num_deleted_files,
             .deleted_files = deleted_files};
@@ -537,7 +1189,12 @@ struct rrc_result rrc_update_do_updates(void *xfb, int *count, bool *updates_ins
     rrc_con_update("Check Update Size", 40);
     curl_off_t updates_size;
     int is_large = rrc_update_is_large(&state, &updates_size);
-    RRC_ASSERT(is_large >= 0, "failed to get update size");
+    if (is_large < 0)
+    {
+        /* Not worth failing the update over: the sizes are requested again before each download. */
+        rrc_dbg_printf("Failed to get update size: %i\n", is_large);
+        is_large = 0;
+    }
 
     if (is_large == 1)
     {
@@ -557,12 +1214,51 @@ struct rrc_result rrc_update_do_updates(void *xfb, int *count, bool *updates_ins
         RRC_ASSERT(result != RRC_PROMPT_RESULT_ERROR, "failed to generate prompt");
         if (result == RRC_PROMPT_RESULT_NO)
         {
+            rrc_installed_free(&installed);
+            free(state.update_sizes);
             return rrc_result_success;
         }
     }
 
-    TRY(rrc_update_do_updates_with_state(&state));
+    struct rrc_result update_res = rrc_update_do_updates_with_state(&state);
+    rrc_installed_free(&installed);
+    free(state.update_sizes);
+    TRY(update_res);
 
     *updates_installed = true;
     return rrc_result_success;
 }
+
+struct rrc_result rrc_update_do_updates(void *xfb, int *count, bool *updates_installed)
+{
+    rrc_con_clear(true);
+
+    rrc_con_update("Prepare Network", 0);
+
+    // The network and version lists may already have been brought up in the background during boot.
+    struct rrc_update_prefetch prefetch;
+    bool prefetched = rrc_update_prefetch_join(&prefetch);
+
+    int res = prefetched ? prefetch.net_res : wiisocket_init();
+    if (res < 0)
+    {
+        return rrc_result_create_error_misc_update("Failed to connect to the internet. Please check your connection and internet settings.");
+    }
+
+    *updates_installed = false;
+
+    struct rrc_update_session session;
+    if (prefetched && prefetch.have_session)
+    {
+        session = prefetch.session;
+    }
+    else
+    {
+        TRY(rrc_update_session_init(&session));
+    }
+
+    struct rrc_result result = _rrc_update_do_updates_in_session(&session, prefetched ? &prefetch : NULL, xfb, count, updates_installed);
+    rrc_update_session_cleanup(&session);
+    rrc_update_forget_parent_dirs();
+    return result;
+}
@@ -19,11 +19,24 @@
 #ifndef RRC_UPDATE_H
 #define RRC_UPDATE_H
 
+#include <stdio.h>
+#include <gctypes.h>
 #include <curl/curl.h>
 #include "../result.h"
+#include "session.h"
+#include "installed.h"
+#include "txn.h"
+#include "../strset.h"
+#include "extractfile.h"
 
 #define RRC_UPDATE_LARGE_THRESHOLD (long)(1000 * 1000 * 100) /* 100MB */
+/* ZIPs up to this size that can't be streamed are downloaded into memory instead of a temporary file, if there's room for them */
+#define RRC_UPDATE_RAM_ZIP_BUDGET (curl_off_t)(1000 * 1000 * 32) /* 32MB */
+/* How often a ZIP transfer is continued after a dropped connection before giving up */
+#define RRC_UPDATE_DOWNLOAD_ATTEMPTS 3
 #define RRC_VERSIONFILE "RetroRewind6/version.txt"
+/* Key in a versions file entry holding the CRC32 of the update ZIP, as hex. Updates without it aren't verified. */
+#define RRC_UPDATE_CRC_EXTRA_KEY "crc32"
 
 /* Holds all info related to an update or sequence of updates */
 struct rrc_update_state
@@ -38,12 +51,20 @@ struct rrc_update_state
     char **update_urls;
     /* Version of each update. Has the same length as `update_urls` and each index into update_urls is also valid for update_versions */
     int *update_versions;
+    /* Optional key=value pairs of each update from the versions file (see `rrc_versionsfile_get_extra`). Same length as `update_urls`, entries may be NULL. */
+    char **update_extras;
+    /* Size in bytes of each update ZIP, as found by `rrc_update_get_total_update_size`. NULL until then, and an entry is -1 if unknown. */
+    curl_off_t *update_sizes;
     /* The current version. */
     int current_version;
     /* Amount of files to delete. */
     int num_deleted_files;
-    /* Files to delete. */
+    /* Files to delete. Sorted by version and then directory by `rrc_update_do_updates_with_state'. */
     struct rrc_versionsfile_deleted_file *deleted_files;
+    /* Network session all requests go through. */
+    struct rrc_update_session *session;
+    /* Files that are already installed and don't need to be written again. */
+    struct rrc_installed_manifest *installed;
 };
 
 /*
@@ -62,8 +83,49 @@ struct rrc_result rrc_update_set_current_version(int version);
 /*
     Downloads a Retro Rewind ZIP. Uses the console to display progress.
     Stores on SD in the file given by `filename'.
+
+    Progress is recorded in the download journal (see dljournal.h), so a download that was interrupted
+    by a power-off or a dropped connection continues where it stopped instead of starting over.
+    The journal is left in place on success and should be removed once the ZIP has been extracted.
+
+    Large ZIPs are split into segments that are downloaded concurrently over separate connections,
+    each writing to its own region of the preallocated file, if the server supports range requests.
+
+    If `expected_crc' is given, the CRC32 of the archive is computed as it is received and the
+    download fails if it doesn't match, so a damaged archive is never extracted.
 */
-struct rrc_result rrc_update_download_zip(char *url, char *filename, int current_zip, int max_zips);
+struct rrc_result rrc_update_download_zip(struct rrc_update_session *session, char *url, char *filename, curl_off_t expected_length, const u32 *expected_crc, int current_zip, int max_zips);
+
+/*
+    Downloads a Retro Rewind ZIP of `expected_length' bytes into `mem'. Uses the console to display progress.
+
+    Like `rrc_update_download_zip', large ZIPs are downloaded over several connections and the archive is
+    checked against `expected_crc' if given. Nothing is written to the SD card, so a dropped connection is
+    only continued within this call, and an interrupted download starts over at the next launch.
+*/
+struct rrc_result rrc_update_download_zip_to_memory(struct rrc_update_session *session, char *url, u8 *mem, curl_off_t expected_length, const u32 *expected_crc, int current_zip, int max_zips);
+
+/*
+    Downloads a Retro Rewind ZIP and extracts it while it is being received, so the archive
+    never has to be stored on the SD card. Uses the console to display progress.
+
+    If the archive uses features that can't be extracted from a stream, `streamed' is set to false
+    and the caller should fall back to `rrc_update_download_zip' + `rrc_update_extract_zip_archive'.
+    Entries that were already extracted at that point are simply extracted again.
+    Entries that `installed' says are already on the SD card are skipped, everything else is
+    written to the staging directory and recorded in `txn'. Entries named in `skip' (may be NULL) aren't written at all.
+    `space_left' is the free space on the SD card, which is counted down as entries are extracted
+    instead of querying the file system for every entry.
+
+    Like `rrc_update_download_zip', this resumes from the download journal, starting at the
+    first entry that wasn't fully extracted yet.
+
+    Every entry is checked against its own CRC32 before it counts as extracted. If `expected_crc' is given,
+    the whole archive is checked against it as well once it has been received, which is only after its
+    entries were written. Callers that want the archive verified before anything is extracted from it
+    shouldn't stream it.
+*/
+struct rrc_result rrc_update_download_and_extract_zip(struct rrc_update_session *session, char *url, curl_off_t expected_length, const u32 *expected_crc, int current_zip, int max_zips, struct rrc_installed_manifest *installed, struct rrc_txn *txn, struct rrc_strset *skip, u64 *space_left, bool *streamed);
 
 /*
     Get the total size of all update ZIPs in bytes. This can be used to determine whether
@@ -71,6 +133,9 @@ struct rrc_result rrc_update_download_zip(char *url, char *filename, int current
 
     On success, returns 0 and `size' is populated with the total download size. On failure,
     the return code is negative (usually a cURL error code), and `size' is zero.
+
+    The HEAD requests for all ZIPs are issued concurrently, and the individual sizes are kept in
+    `state->update_sizes' so that they don't have to be requested again before each download.
 */
 int rrc_update_get_total_update_size(struct rrc_update_state *state, curl_off_t *size);
 
@@ -86,7 +151,11 @@ int rrc_update_is_large(struct rrc_update_state *state, curl_off_t *size);
 
 /*
     Does all updates specified in update_urls, in order.
-    This involves sequentially donloading, unzipping, and applying each one
+    This involves sequentially donloading, unzipping, and applying each one.
+    Each update is staged and committed as a transaction (see txn.h), so an interruption never
+    leaves a mix of old and new files behind.
+    When several versions are skipped at once, they are planned up front (see planner.h) and applied
+    as a single transaction, so that files changed by more than one of them are only written once.
     TODO: maybe make this threaded so if we have multiple updates we can download
     one and apply one at the same time?
 
@@ -21,15 +21,22 @@
 #include <unistd.h>
 #include <curl/curl.h>
 #include <string.h>
+#include <errno.h>
 
 #include "../console.h"
 #include "../util.h"
 #include "versionsfile.h"
+#include "session.h"
 
 #define _RRC_VERSIONSFILE_URL "http://update.rwfc.net:8000/RetroRewind/RetroRewindVersion.txt"
 #define _RRC_VERSIONS_FILE_REMOVED_URL "http://update.rwfc.net:8000/RetroRewind/RetroRewindDelete.txt"
-// max array size
-#define _RRC_SPLIT_LIM 4096
+/* Last downloaded copies of the above, which are reused as long as the server says they're unchanged. */
+#define _RRC_VERSIONSFILE_CACHE_PATH "RetroRewindChannel/.versions.cache"
+#define _RRC_VERSIONS_FILE_REMOVED_CACHE_PATH "RetroRewindChannel/.deleted.cache"
+/* Characters that separate the fields of a line, and the key=value pairs after them. */
+#define _RRC_VERSIONSFILE_SEPARATORS " \t"
+/* Largest value of a single part of a verstring. */
+#define _RRC_VERSIONSFILE_MAX_PART 999999
 
 struct rrc_result rrc_versionsfile_parse_verstring(char *verstring, int *version)
 {
@@ -59,7 +66,12 @@ struct rrc_result rrc_versionsfile_parse_verstring(char *verstring, int *version
             }
             section[sect_len] = '\0';
 
-            int section_l = strtol(section, NULL, 10);
+            long section_l = strtol(section, NULL, 10);
+            if (section_l < 0 || section_l > _RRC_VERSIONSFILE_MAX_PART)
+            {
+                /* would overflow when combined below */
+                return rrc_result_create_error_corrupted_versionfile("Version number out of range");
+            }
             parts[current] = section_l;
             current++;
             if (current > 2)
@@ -81,260 +93,163 @@ struct rrc_result rrc_versionsfile_parse_verstring(char *verstring, int *version
     return rrc_result_success;
 }
 
-struct ptr_len_pair
-{
-    int len;
-    char *ptr;
-};
-
-int _rrc_versionsfile_progress_callback(char *update,
-                                        curl_off_t dltotal,
-                                        curl_off_t dlnow,
-                                        curl_off_t ultotal,
-                                        curl_off_t ulnow)
+int rrc_versionsfile_get_versionsfile(struct rrc_update_session *session, bool show_progress, char **result)
 {
-    static int lp = -1;
-    int progress = (dlnow * 100) / dltotal;
-    if (progress != lp)
+    CURLcode res = rrc_update_session_fetch_cached(session, _RRC_VERSIONSFILE_URL, _RRC_VERSIONSFILE_CACHE_PATH, show_progress ? "Fetching Version Info" : NULL, result);
+    if (res != CURLE_OK)
     {
-        lp = progress;
-        rrc_con_update(update, progress);
+        // TODO: report error better
+        return -res;
     }
+
     return 0;
 }
 
-size_t _rrc_versionsfile_write_callback(char *ptr, size_t size, size_t nmemb, void *ss)
+int rrc_versionsfile_get_removed_files(struct rrc_update_session *session, bool show_progress, char **result)
 {
-    struct ptr_len_pair *s = (struct ptr_len_pair *)ss;
-    size_t new_len = s->len + size * nmemb;
-    s->ptr = realloc(s->ptr, new_len + 1);
-    if (s->ptr == NULL)
+    CURLcode res = rrc_update_session_fetch_cached(session, _RRC_VERSIONS_FILE_REMOVED_URL, _RRC_VERSIONS_FILE_REMOVED_CACHE_PATH, show_progress ? "Fetching Removed Files" : NULL, result);
+    if (res != CURLE_OK)
     {
-        // TODO: maybe make a proper place to put error info?
-        printf("realloc failed!");
-        return -1;
+        // TODO: report error better
+        if (show_progress)
+        {
+            printf("curl_easy_perform() failed: %s\n",
+                   curl_easy_strerror(res));
+        }
+        return -res;
     }
-    memcpy(s->ptr + s->len, ptr, size * nmemb);
-    s->ptr[new_len] = '\0';
-    s->len = new_len;
 
-    return size * nmemb;
+    return 0;
 }
 
-int rrc_versionsfile_get_versionsfile(char **result)
+char *rrc_versionsfile_next_line(char **cursor)
 {
-    struct ptr_len_pair s;
-    s.len = 0;
-    s.ptr = malloc(s.len + 1);
-    if (s.ptr == NULL)
+    char *p = *cursor;
+    while (*p == '\n' || *p == '\r')
     {
-        printf("malloc failed!");
-        return -1;
+        p++;
     }
-    s.ptr[0] = '\0';
-
-    CURL *curl;
-    CURLcode res;
 
-    curl = curl_easy_init();
-    if (curl)
+    if (*p == '\0')
     {
-        curl_easy_setopt(curl, CURLOPT_URL, _RRC_VERSIONSFILE_URL);
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
-        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, _rrc_versionsfile_progress_callback);
-        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, (void *)"Fetching Version Info");
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &s);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _rrc_versionsfile_write_callback);
-        res = curl_easy_perform(curl);
-
-        if (res != CURLE_OK)
-        {
-            // TODO: report error better
-            return -res;
-        }
-
-        /* always cleanup */
-        curl_easy_cleanup(curl);
+        *cursor = p;
+        return NULL;
     }
 
-    if (result != NULL)
+    /* a lone \r ends a line too, so files saved with windows line endings don't leave one behind in the last field */
+    char *line = p;
+    p += strcspn(p, "\r\n");
+
+    if (*p != '\0')
     {
-        *result = s.ptr;
+        *p = '\0';
+        p++;
     }
+    *cursor = p;
 
-    return 0;
+    return line;
 }
 
-int rrc_versionsfile_get_removed_files(char **result)
+char *rrc_versionsfile_next_field(char **cursor)
 {
-    struct ptr_len_pair s;
-    s.len = 0;
-    s.ptr = malloc(s.len + 1);
-    if (s.ptr == NULL)
+    char *p = *cursor + strspn(*cursor, _RRC_VERSIONSFILE_SEPARATORS);
+    if (*p == '\0')
     {
-        printf("malloc failed!");
-        return -1;
+        *cursor = p;
+        return NULL;
     }
-    s.ptr[0] = '\0';
 
-    CURL *curl = curl_easy_init();
-    if (curl)
-    {
-        curl_easy_setopt(curl, CURLOPT_URL, _RRC_VERSIONS_FILE_REMOVED_URL);
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
-        curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, _rrc_versionsfile_progress_callback);
-        curl_easy_setopt(curl, CURLOPT_XFERINFODATA, (void *)"Fetching Removed Files");
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &s);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _rrc_versionsfile_write_callback);
-        CURLcode res = curl_easy_perform(curl);
-        if (res != CURLE_OK)
-        {
-            // TODO: report error better
-            printf("curl_easy_perform() failed: %s\n",
-                   curl_easy_strerror(res));
-            return -res;
-        }
+    char *field = p;
+    p += strcspn(p, _RRC_VERSIONSFILE_SEPARATORS);
 
-        curl_easy_cleanup(curl);
+    if (*p != '\0')
+    {
+        *p = '\0';
+        p++;
     }
+    *cursor = p;
 
-    *result = s.ptr;
-    return 0;
+    return field;
 }
 
-int rrc_versionsfile_split_by(char *in, char by, char ***out, int *amt)
+/*
+    Makes sure `*array' has room for at least `needed' elements, growing it geometrically.
+*/
+static bool _rrc_versionsfile_reserve(void **array, int *capacity, int needed, size_t elem_size)
 {
-    int len = strlen(in), i = 0, count = 0, current_len = 0, start_idx = 0;
-    *out = malloc(_RRC_SPLIT_LIM);
-    if (*out == NULL)
+    if (needed <= *capacity)
     {
-        return -2;
+        return true;
     }
 
-    for (; i < len; i++)
+    int new_capacity = *capacity > 0 ? *capacity * 2 : 16;
+    void *grown = realloc(*array, new_capacity * elem_size);
+    if (grown == NULL)
     {
-        if (in[i] == by || i == (len - 1))
-        {
-            /* handle last element */
-            if (i == (len - 1) && in[i] != by)
-            {
-                current_len++;
-            }
-            /* +1 for NULL termination */
-            char *this = malloc(current_len + 1);
-            if (this == NULL)
-            {
-                rrc_versionsfile_free_split(*out, count);
-                return -1;
-            }
-
-            /* copy from offset to new array */
-            memcpy(this, in + start_idx, current_len);
-            this[current_len] = '\0';
-            (*out)[count] = this;
-
-            start_idx = i + 1;
-            count++;
-            if (amt != NULL)
-                *amt = count;
-            if (count > _RRC_SPLIT_LIM)
-            {
-                return 2;
-            }
-
-            current_len = 0;
-        }
-        else
-        {
-            current_len++;
-        }
+        return false;
     }
 
-    if (amt != NULL)
-        *amt = count;
-    return 0;
+    *array = grown;
+    *capacity = new_capacity;
+    return true;
 }
 
-void rrc_versionsfile_free_split(char **array, int count)
-{
-    for (int i = 0; i < count; i++)
-    {
-        free(array[i]);
-    }
-    free(array);
-}
-
-struct rrc_result rrc_versionsfile_get_necessary_urls_and_versions(char *versionsfile, int current_version, int *uamt, char ***urls, int **versions)
+struct rrc_result rrc_versionsfile_get_necessary_urls_and_versions(char *versionsfile, int current_version, int *uamt, char ***urls, int **versions, char ***extras)
 {
     /*
         We need to read the file line-wise and also space-wise.
         The format of the file is each line has one entry. An entry is of the form:
 
-        version url
+        version url [key=value ...]
 
         Where version is a normal verstring we can parse to an int, and url is the zip
-        url for that version.
+        url for that version. Any optional key=value pairs after the url are kept as-is in `extras'
+        (see `rrc_versionsfile_get_extra'), which lets the server describe an update further without
+        breaking older launchers that only read the first two fields.
         We parse each verstring, and if it yields a greater absolute value than our current version,
         we parse the url associated with it and add it to the list of updates.
-    */
-    *urls = malloc(_RRC_SPLIT_LIM);
-    *versions = malloc(_RRC_SPLIT_LIM);
-
-    char **lines;
-    int count;
-    int res = rrc_versionsfile_split_by(versionsfile, '\n', &lines, &count);
-    if (res < 0)
-    {
-        return rrc_result_create_error_corrupted_versionfile("Failed to split versionfile");
-    }
-    else if (res == 2)
-    {
-        rrc_versionsfile_free_split(lines, count);
-        return rrc_result_create_error_corrupted_versionfile("Versionfile had more than 4096 entries");
-    }
 
+        The file is tokenized in place, so the returned strings point into `versionsfile'.
+    */
+    *urls = NULL;
+    *versions = NULL;
+    *extras = NULL;
+    int capacity[3] = {0, 0, 0};
     int update_idx = 0;
 
-    /* This is where we go through each line until we find the first one we care about and set it to first_update_idx */
-    for (int i = 0; i < count; i++)
+    char *cursor = versionsfile;
+    char *line;
+    while ((line = rrc_versionsfile_next_line(&cursor)) != NULL)
     {
-        char *line = lines[i];
-        char **parts;
-        /* this is only here if we fail to parse it all and need to free this amount */
-        int num_parts;
-        int res = rrc_versionsfile_split_by(line, ' ', &parts, &num_parts);
-        /* dont bother checking for 2 because it really should never ever happen */
-
-        if (res < 0)
+        char *verstring = rrc_versionsfile_next_field(&line);
+        char *url = rrc_versionsfile_next_field(&line);
+        if (url == NULL)
         {
-            rrc_versionsfile_free_split(lines, count);
-            return rrc_result_create_error_corrupted_versionfile("Failed to split versionfile");
+            return rrc_result_create_error_corrupted_versionfile("Versionfile entry is missing its URL");
         }
 
         int verint;
-        struct rrc_result verstring_res = rrc_versionsfile_parse_verstring(parts[0], &verint);
+        TRY(rrc_versionsfile_parse_verstring(verstring, &verint));
 
-        if (rrc_result_is_error(verstring_res))
+        if (verint <= current_version)
         {
-            rrc_versionsfile_free_split(lines, count);
-            return verstring_res;
+            continue;
         }
 
-        if (verint > current_version)
+        if (!_rrc_versionsfile_reserve((void **)urls, &capacity[0], update_idx + 1, sizeof(char *)) ||
+            !_rrc_versionsfile_reserve((void **)versions, &capacity[1], update_idx + 1, sizeof(int)) ||
+            !_rrc_versionsfile_reserve((void **)extras, &capacity[2], update_idx + 1, sizeof(char *)))
         {
-            (*versions)[update_idx] = verint;
-            (*urls)[update_idx] = parts[1];
-            update_idx++;
-        }
-        else
-        {
-            free(parts[1]);
+            return rrc_result_create_error_errno(ENOMEM, "Failed to allocate update list");
         }
 
-        free(parts[0]);
-        free(parts);
+        /* whatever is left of the line are the key=value pairs */
+        line += strspn(line, _RRC_VERSIONSFILE_SEPARATORS);
+
+        (*versions)[update_idx] = verint;
+        (*urls)[update_idx] = url;
+        (*extras)[update_idx] = *line != '\0' ? line : NULL;
+        update_idx++;
     }
 
     if (update_idx == 0) /* no updates needed */
@@ -343,67 +258,81 @@ struct rrc_result rrc_versionsfile_get_necessary_urls_and_versions(char *version
     }
 
     *uamt = update_idx;
-
-    rrc_versionsfile_free_split(lines, count);
     return rrc_result_success;
 }
 
-struct rrc_result rrc_versionsfile_parse_deleted_files(char *input, int current_version, struct rrc_versionsfile_deleted_file **output, int *amt)
+bool rrc_versionsfile_get_extra(const char *extras, const char *key, char *out, int out_len)
 {
-    *output = malloc(sizeof(struct rrc_versionsfile_deleted_file) * _RRC_SPLIT_LIM);
-    int output_idx = 0;
-
-    char **lines;
-    int count;
-    int res = rrc_versionsfile_split_by(input, '\n', &lines, &count);
-    if (res < 0)
+    if (extras == NULL)
     {
-        return rrc_result_create_error_corrupted_versionfile("Failed to split deleted versionfile");
+        return false;
     }
-    else if (res == 2)
+
+    int key_len = strlen(key);
+    const char *p = extras + strspn(extras, _RRC_VERSIONSFILE_SEPARATORS);
+    while (*p != '\0')
     {
-        rrc_versionsfile_free_split(lines, count);
-        return rrc_result_create_error_corrupted_versionfile("Deleted versionfile had more than 4096 entries");
+        int len = strcspn(p, _RRC_VERSIONSFILE_SEPARATORS);
+
+        if (len > key_len && strncmp(p, key, key_len) == 0 && p[key_len] == '=')
+        {
+            int value_len = len - key_len - 1;
+            if (value_len >= out_len)
+            {
+                return false;
+            }
+
+            memcpy(out, p + key_len + 1, value_len);
+            out[value_len] = '\0';
+            return true;
+        }
+
+        p += len;
+        p += strspn(p, _RRC_VERSIONSFILE_SEPARATORS);
     }
 
-    for (int i = 0; i < count; i++)
+    return false;
+}
+
+struct rrc_result rrc_versionsfile_parse_deleted_files(char *input, int current_version, struct rrc_versionsfile_deleted_file **output, int *amt)
+{
+    *output = NULL;
+    int capacity = 0;
+    int output_idx = 0;
+
+    /* Tokenized in place like the versions file, so the paths point into `input'. */
+    char *cursor = input;
+    char *line;
+    while ((line = rrc_versionsfile_next_line(&cursor)) != NULL)
     {
-        char **parts;
-        int parts_count;
-        res = rrc_versionsfile_split_by(lines[i], ' ', &parts, &parts_count);
-        if (res < 0)
+        char *verstring = rrc_versionsfile_next_field(&line);
+        char *path = rrc_versionsfile_next_field(&line);
+        if (path == NULL)
         {
-            return rrc_result_create_error_corrupted_versionfile("Failed to split deleted versionfile");
+            return rrc_result_create_error_corrupted_versionfile("Deleted versionfile entry is missing its path");
         }
 
         int verint;
-        struct rrc_result verstring_res = rrc_versionsfile_parse_verstring(parts[0], &verint);
+        TRY(rrc_versionsfile_parse_verstring(verstring, &verint));
 
-        if (rrc_result_is_error(verstring_res))
+        if (verint <= current_version)
         {
-            rrc_versionsfile_free_split(lines, count);
-            return verstring_res;
+            continue;
         }
 
-        if (verint > current_version)
+        if (!_rrc_versionsfile_reserve((void **)output, &capacity, output_idx + 1, sizeof(struct rrc_versionsfile_deleted_file)))
         {
-            struct rrc_versionsfile_deleted_file file = {
-                .version = verint,
-                .path = parts[1]};
-
-            (*output)[output_idx] = file;
-            output_idx++;
-        }
-        else
-        {
-            free(parts[1]);
+            return rrc_result_create_error_errno(ENOMEM, "Failed to allocate deleted file list");
         }
 
-        free(parts[0]);
-        free(parts);
+        struct rrc_versionsfile_deleted_file file = {
+            .version = verint,
+            .path = path};
+
+        (*output)[output_idx] = file;
+        output_idx++;
     }
 
     *amt = output_idx;
-    rrc_versionsfile_free_split(lines, count);
     return rrc_result_success;
 }
@@ -19,7 +19,10 @@
 #ifndef RRC_VERSIONSFILE_H
 #define RRC_VERSIONSFILE_H
 
+#include <gctypes.h>
+
 #include "../result.h"
+#include "session.h"
 
 struct rrc_versionsfile_deleted_file
 {
@@ -28,18 +31,17 @@ struct rrc_versionsfile_deleted_file
 };
 
 /*
-    in: input string
-    by: char to split by
-    out: pointer to array of output
-    count: amount of elements
-
-    for convenience this will ignore trailing characters of `by'
-    this is limited to 4096 entries, if it exceeds this the return code will be 2
+    Returns the next non-empty line at `cursor' and advances `cursor' past it, or NULL if there are no lines left.
+    Lines end at either \n or \r, so \r\n line endings work as well.
+    The line ending is overwritten with a NULL terminator, so this modifies the buffer instead of allocating.
+*/
+char *rrc_versionsfile_next_line(char **cursor);
 
-    **REMEMBER TO FREE EVERYTHING WHEN DONE - USE `_rrc_versionfile_free_split'**
+/*
+    Returns the next field at `cursor', separated by spaces or tabs, and advances `cursor' past it, or NULL if there are
+    no fields left. Like `rrc_versionsfile_next_line', this NULL-terminates the field in place.
 */
-int rrc_versionsfile_split_by(char *in, char by, char ***out, int *amt);
-void rrc_versionsfile_free_split(char **array, int count);
+char *rrc_versionsfile_next_field(char **cursor);
 
 /*
     Returns an int specifying version information from a verstring.
@@ -51,22 +53,37 @@ struct rrc_result rrc_versionsfile_parse_verstring(char *verstring, int *version
     Get version information from Retro Rewind servers.
     On success, return code is 0 and `result' is populated with a NULL-terminated string.
     On failure, return code is negative CURL return code and `result' is NULL.
+    Progress is only drawn to the console if `show_progress' is set.
 */
-int rrc_versionsfile_get_versionsfile(char **result);
+int rrc_versionsfile_get_versionsfile(struct rrc_update_session *session, bool show_progress, char **result);
 
 /*
     Get files that were removed from each version.
     On success, return code is 0.
     On failure, return code is negative CURL return code and `result' is NULL.
+    Progress is only drawn to the console if `show_progress' is set.
 */
-int rrc_versionsfile_get_removed_files(char **result);
+int rrc_versionsfile_get_removed_files(struct rrc_update_session *session, bool show_progress, char **result);
 
 /*
     Get an array of all URLs we need to download, where the first index needs downloading first.
     On success, return code is 0 and `result' is populated with an array of strings and `count' is set to the amount of entries.
+    `extras' gets the optional key=value pairs of each entry, or NULL for entries without any.
+    All strings point into `versionsfile', which therefore must outlive them.
 */
-struct rrc_result rrc_versionsfile_get_necessary_urls_and_versions(char *versionsfile, int current_version, int *count, char ***result, int **versions);
+struct rrc_result rrc_versionsfile_get_necessary_urls_and_versions(char *versionsfile, int current_version, int *count, char ***result, int **versions, char ***extras);
 
+/*
+    Looks up `key' in the key=value pairs of a versions file entry and copies its value into `out'.
+    The pairs are separated like the fields of the entry itself (see `rrc_versionsfile_next_field').
+    Returns false if the key isn't there (or `extras' is NULL), or if the value doesn't fit into `out_len' bytes.
+*/
+bool rrc_versionsfile_get_extra(const char *extras, const char *key, char *out, int out_len);
+
+/*
+    Parses the deleted files list, returning the files deleted by versions newer than `current_version'.
+    The paths point into `input', which therefore must outlive them.
+*/
 struct rrc_result rrc_versionsfile_parse_deleted_files(char *input, int current_version, struct rrc_versionsfile_deleted_file **output, int *amt);
 
 #endif
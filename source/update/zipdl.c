@@ -0,0 +1,742 @@
+/*
+    zipdl.c - update ZIP downloads implementation
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <errno.h>
+
+#include "zipdl.h"
+#include "update.h"
+#include "dljournal.h"
+#include "session.h"
+#include "stats.h"
+#include "../console.h"
+#include "../time.h"
+#include "../shutdown.h"
+
+/* Seconds without any received data after which a ZIP transfer is considered dropped */
+#define _RRC_ZIPDL_LOW_SPEED_TIME 30L
+/* Amount of concurrent connections for a segmented download, at most RRC_DLJOURNAL_MAX_SEGMENTS */
+#define _RRC_ZIPDL_SEGMENTS 4
+
+int lp = -1;
+rrc_time_tick last_measurement_from = -1;
+curl_off_t last_dlnow = 0;
+int last_second_dl_amount = 0;
+
+int rrc_zipdl_progress_callback(int *numinfo,
+                                 curl_off_t dltotal,
+                                 curl_off_t dlnow,
+                                 curl_off_t ultotal,
+                                 curl_off_t ulnow)
+{
+    /* 100kB chunks */
+#define _RRC_PROGRESS_UPD_CHUNKSIZE 100000
+
+    /* update download speed every second */
+#define _RRC_PROGRESS_UPD_SPEED_INC 1000
+
+    /* Don't shut down in the middle of writing a file. Aborting the transfer lets the caller close
+       everything first, after which it shuts down (see `rrc_zipdl_shutdown_if_aborted'). */
+    if (rrc_shutdown_pending())
+    {
+        return 1;
+    }
+
+    /* Nothing to show until the size of the transfer is known */
+    if (dltotal <= 0)
+    {
+        return 0;
+    }
+
+    int progress = (dlnow * 100) / dltotal;
+
+    if (diff_msec(last_measurement_from, gettime()) > _RRC_PROGRESS_UPD_SPEED_INC || last_measurement_from < 0)
+    {
+        last_measurement_from = gettime();
+
+        last_second_dl_amount = dlnow - last_dlnow;
+        last_dlnow = dlnow;
+    }
+
+    int chunk = dlnow / _RRC_PROGRESS_UPD_CHUNKSIZE;
+    if (chunk != lp)
+    {
+        lp = chunk;
+        char msg[100];
+        snprintf(
+            msg,
+            100,
+            "Downloading update %i of %i - %i kB/s (%i/%i kB)",
+            ((*numinfo) / 100) + 1,
+            (*numinfo) % 100,
+            (int)(last_second_dl_amount / 1000),
+            (int)(dlnow / (curl_off_t)1000),
+            (int)(dltotal / (curl_off_t)1000));
+
+        rrc_con_update(msg, progress);
+    }
+    return 0;
+#undef _RRC_PROGRESS_UPD_CHUNKSIZE
+}
+
+bool rrc_zipdl_is_transient_error(CURLcode cres)
+{
+    switch (cres)
+    {
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_GOT_NOTHING:
+        return true;
+    default:
+        return false;
+    }
+}
+
+void rrc_zipdl_shutdown_if_aborted(CURLcode cres)
+{
+    if (cres == CURLE_ABORTED_BY_CALLBACK)
+    {
+        rrc_shutdown_check();
+    }
+}
+
+void rrc_zipdl_setopt_transfer(CURL *curl, char *url, int *numinfo, curl_off_t resume_from)
+{
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, numinfo);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, rrc_zipdl_progress_callback);
+    /* Not CURLOPT_RESUME_FROM_LARGE, which fails the transfer if the server sends the whole file instead,
+       while we'd rather start over with it (see `rrc_zipdl_range_ignored'). */
+    char range[32];
+    snprintf(range, sizeof(range), "%lld-", (long long)resume_from);
+    curl_easy_setopt(curl, CURLOPT_RANGE, resume_from > 0 ? range : NULL);
+    /* A connection that silently went away would otherwise block forever instead of failing and being resumed. */
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, _RRC_ZIPDL_LOW_SPEED_TIME);
+}
+
+bool rrc_zipdl_range_ignored(CURL *curl, curl_off_t resume_from)
+{
+    long code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    return resume_from > 0 && code != 206;
+}
+
+struct _rrc_zipdl_write_ctx
+{
+    CURL *curl;
+    FILE *fp;
+    /* Buffer of `capacity' bytes the archive is downloaded into instead of `fp', if set. There is no journal then. */
+    u8 *mem;
+    curl_off_t capacity;
+    struct rrc_dljournal *journal;
+    /* Offset we asked the server to start at */
+    curl_off_t resume_from;
+    /* Total size of the file on the SD card */
+    curl_off_t written;
+    /* CRC32 of those bytes */
+    u32 crc;
+    bool checked_response;
+    /* Error that made us abort the transfer, if any */
+    struct rrc_result res;
+};
+
+size_t _rrc_zipdl_write_data_callback(char *ptr, size_t size, size_t nmemb, struct _rrc_zipdl_write_ctx *ctx)
+{
+    if (!ctx->checked_response)
+    {
+        ctx->checked_response = true;
+        if (rrc_zipdl_range_ignored(ctx->curl, ctx->resume_from))
+        {
+            if (ctx->fp != NULL && (fflush(ctx->fp) != 0 || ftruncate(fileno(ctx->fp), 0) != 0 || fseek(ctx->fp, 0, SEEK_SET) != 0))
+            {
+                ctx->res = rrc_result_create_error_errno(errno, "Failed to reset temporary ZIP file for update download");
+                return 0;
+            }
+            ctx->written = 0;
+            ctx->crc = crc32(0, Z_NULL, 0);
+        }
+    }
+
+    if (ctx->mem != NULL)
+    {
+        if (size * nmemb > ctx->capacity - ctx->written)
+        {
+            ctx->res = rrc_result_create_error_misc_update("Server sent more data than expected for update ZIP");
+            return 0;
+        }
+        memcpy(ctx->mem + ctx->written, ptr, size * nmemb);
+    }
+    else if (fwrite(ptr, size, nmemb, ctx->fp) != nmemb)
+    {
+        ctx->res = rrc_result_create_error_errno(errno, "Failed to write update ZIP chunk");
+        return 0;
+    }
+    ctx->written += size * nmemb;
+    ctx->crc = crc32(ctx->crc, (const Bytef *)ptr, size * nmemb);
+
+    if (ctx->journal != NULL && ctx->written - ctx->journal->stored >= RRC_DLJOURNAL_COMMIT_INTERVAL)
+    {
+        /* Only bytes that actually made it to the SD card may be recorded as committed. */
+        if (fflush(ctx->fp) != 0 || fsync(fileno(ctx->fp)) != 0)
+        {
+            ctx->res = rrc_result_create_error_errno(errno, "Failed to sync temporary ZIP file for update download");
+            return 0;
+        }
+
+        ctx->journal->crc = ctx->crc;
+        struct rrc_result res = rrc_dljournal_commit(ctx->journal, ctx->written);
+        if (rrc_result_is_error(res))
+        {
+            ctx->res = res;
+            return 0;
+        }
+    }
+
+    return size * nmemb;
+}
+
+struct rrc_result rrc_zipdl_verify(const u32 *expected_crc, u32 crc)
+{
+    if (expected_crc == NULL || *expected_crc == crc)
+    {
+        return rrc_result_success;
+    }
+
+    TRY(rrc_dljournal_remove());
+    return rrc_result_create_error_misc_update("Downloaded update ZIP is corrupted (checksum mismatch)");
+}
+
+/* One region of the temporary ZIP file, filled by its own connection. */
+struct _rrc_zipdl_segment
+{
+    CURL *curl;
+    FILE *fp;
+    /* Buffer the whole archive is downloaded into instead of `fp', if set. */
+    u8 *mem;
+    /* Offsets in the archive of the segment's first byte, the next byte to be written, and one past its last byte */
+    curl_off_t start;
+    curl_off_t pos;
+    curl_off_t end;
+    /* CRC32 of the bytes from `start' to `pos' */
+    u32 crc;
+    int attempts;
+    /* Whether the handle is currently added to the multi handle */
+    bool active;
+    bool checked_response;
+    /* Set if the server answered with the whole file instead of the requested range */
+    bool range_ignored;
+    /* Error that made us abort the transfer, if any */
+    struct rrc_result res;
+};
+
+size_t _rrc_zipdl_segment_write_callback(char *ptr, size_t size, size_t nmemb, struct _rrc_zipdl_segment *seg)
+{
+    size_t len = size * nmemb;
+
+    if (!seg->checked_response)
+    {
+        seg->checked_response = true;
+        long code = 0;
+        curl_easy_getinfo(seg->curl, CURLINFO_RESPONSE_CODE, &code);
+        if (code != 206)
+        {
+            seg->range_ignored = true;
+            return 0;
+        }
+    }
+
+    if (len > seg->end - seg->pos)
+    {
+        seg->res = rrc_result_create_error_misc_update("Server sent more data than requested for update ZIP segment");
+        return 0;
+    }
+
+    /* All segments share one file, so every chunk has to be written at its own offset. */
+    if (seg->mem != NULL)
+    {
+        memcpy(seg->mem + seg->pos, ptr, len);
+    }
+    else if (fseek(seg->fp, seg->pos, SEEK_SET) != 0 || fwrite(ptr, 1, len, seg->fp) != len)
+    {
+        seg->res = rrc_result_create_error_errno(errno, "Failed to write update ZIP segment");
+        return 0;
+    }
+    seg->pos += len;
+    seg->crc = crc32(seg->crc, (const Bytef *)ptr, len);
+
+    return len;
+}
+
+static void _rrc_zipdl_start_segment(CURLM *multi, struct _rrc_zipdl_segment *seg, char *url)
+{
+    char range[64];
+    snprintf(range, sizeof(range), "%lld-%lld", (long long)seg->pos, (long long)(seg->end - 1));
+
+    curl_easy_setopt(seg->curl, CURLOPT_URL, url);
+    curl_easy_setopt(seg->curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(seg->curl, CURLOPT_NOPROGRESS, 1L);
+    curl_easy_setopt(seg->curl, CURLOPT_RANGE, range);
+    curl_easy_setopt(seg->curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(seg->curl, CURLOPT_LOW_SPEED_TIME, _RRC_ZIPDL_LOW_SPEED_TIME);
+    curl_easy_setopt(seg->curl, CURLOPT_WRITEFUNCTION, _rrc_zipdl_segment_write_callback);
+    curl_easy_setopt(seg->curl, CURLOPT_WRITEDATA, seg);
+    curl_easy_setopt(seg->curl, CURLOPT_PRIVATE, seg);
+
+    seg->checked_response = false;
+    seg->active = true;
+    curl_multi_add_handle(multi, seg->curl);
+}
+
+/*
+    Downloads a ZIP over `_RRC_ZIPDL_SEGMENTS' concurrent range requests into a preallocated file,
+    which gets a lot closer to saturating the link than a single connection does.
+    If `mem' is given, the ZIP is downloaded into it instead and no journal is kept.
+    `ranges_supported' is set to false if the server doesn't honour range requests, in which
+    case nothing useful was downloaded and the caller should use a single transfer instead.
+*/
+static struct rrc_result _rrc_zipdl_download_segmented(struct rrc_update_session *session, char *url, char *filename, u8 *mem, curl_off_t expected_length, const u32 *expected_crc, int *numinfo, bool *ranges_supported)
+{
+    *ranges_supported = true;
+
+    struct rrc_dljournal journal;
+    FILE *fp = NULL;
+    if (mem != NULL)
+    {
+        /* Nothing in memory survives a restart, so there is nothing to resume or record. */
+        memset(&journal, 0, sizeof(journal));
+    }
+    else
+    {
+        rrc_dljournal_load(url, expected_length, RRC_DLJOURNAL_MODE_SEGMENTED, &journal);
+    }
+
+    if (mem == NULL && journal.committed > 0 && journal.num_segments == _RRC_ZIPDL_SEGMENTS)
+    {
+        fp = fopen(filename, "r+b");
+
+        /* The file is preallocated, so anything but the full size means it isn't the one the journal describes. */
+        struct stat sb;
+        if (fp != NULL && (fstat(fileno(fp), &sb) != 0 || sb.st_size != expected_length))
+        {
+            fclose(fp);
+            fp = NULL;
+        }
+    }
+
+    if (fp == NULL)
+    {
+        journal.committed = 0;
+        journal.num_segments = _RRC_ZIPDL_SEGMENTS;
+        memset(journal.segments, 0, sizeof(journal.segments));
+        for (int i = 0; i < _RRC_ZIPDL_SEGMENTS; i++)
+        {
+            journal.segment_crcs[i] = crc32(0, Z_NULL, 0);
+        }
+    }
+
+    if (fp == NULL && mem == NULL)
+    {
+        fp = fopen(filename, "wb");
+        if (fp == NULL)
+        {
+            return rrc_result_create_error_errno(errno, "Failed to create temporary ZIP file for update download");
+        }
+
+        if (ftruncate(fileno(fp), expected_length) != 0)
+        {
+            fclose(fp);
+            return rrc_result_create_error_errno(errno, "Failed to preallocate temporary ZIP file for update download");
+        }
+    }
+
+    struct rrc_result res = rrc_result_success;
+    /* Set if the progress callback asked us to stop for a shutdown */
+    CURLcode aborted = CURLE_OK;
+    struct _rrc_zipdl_segment segments[_RRC_ZIPDL_SEGMENTS] = {0};
+    curl_off_t segment_len = expected_length / _RRC_ZIPDL_SEGMENTS;
+
+    CURLM *multi = curl_multi_init();
+    if (multi == NULL)
+    {
+        if (fp != NULL)
+        {
+            fclose(fp);
+        }
+        return rrc_result_create_error_curl(CURLE_FAILED_INIT, "Failed to init curl multi handle");
+    }
+    curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)_RRC_ZIPDL_SEGMENTS);
+
+    int active = 0;
+    for (int i = 0; i < _RRC_ZIPDL_SEGMENTS; i++)
+    {
+        struct _rrc_zipdl_segment *seg = &segments[i];
+        seg->fp = fp;
+        seg->mem = mem;
+        seg->start = i * segment_len;
+        seg->end = i == _RRC_ZIPDL_SEGMENTS - 1 ? expected_length : (i + 1) * segment_len;
+        seg->pos = seg->start + journal.segments[i];
+        seg->crc = journal.segment_crcs[i];
+        if (seg->pos > seg->end)
+        {
+            seg->pos = seg->start;
+            seg->crc = crc32(0, Z_NULL, 0);
+        }
+
+        seg->curl = rrc_update_session_new_handle(session);
+        if (seg->curl == NULL)
+        {
+            res = rrc_result_create_error_curl(CURLE_FAILED_INIT, "Failed to init curl");
+            goto cleanup;
+        }
+
+        if (seg->pos < seg->end)
+        {
+            _rrc_zipdl_start_segment(multi, seg, url);
+            active++;
+        }
+    }
+
+    while (active > 0)
+    {
+        int running;
+        CURLMcode mres = curl_multi_perform(multi, &running);
+        if (mres == CURLM_OK && running > 0)
+        {
+            mres = curl_multi_poll(multi, NULL, 0, 1000, NULL);
+        }
+
+        if (mres != CURLM_OK)
+        {
+            res = rrc_result_create_error_curl(CURLE_RECV_ERROR, "Failed to download update ZIP");
+            goto cleanup;
+        }
+
+        CURLMsg *msg;
+        int msgs_left;
+        while ((msg = curl_multi_info_read(multi, &msgs_left)) != NULL)
+        {
+            if (msg->msg != CURLMSG_DONE)
+            {
+                continue;
+            }
+
+            /* `msg' is invalidated by removing its handle */
+            CURLcode cres = msg->data.result;
+            struct _rrc_zipdl_segment *seg;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&seg);
+            rrc_update_stats_add_transfer(seg->curl);
+
+            curl_multi_remove_handle(multi, seg->curl);
+            seg->active = false;
+            active--;
+
+            if (seg->range_ignored)
+            {
+                *ranges_supported = false;
+                goto cleanup;
+            }
+
+            if (rrc_result_is_error(seg->res))
+            {
+                res = seg->res;
+                goto cleanup;
+            }
+
+            if (cres == CURLE_OK)
+            {
+                if (seg->pos != seg->end)
+                {
+                    res = rrc_result_create_error_misc_update("Update ZIP segment ended early");
+                    goto cleanup;
+                }
+                continue;
+            }
+
+            if (!rrc_zipdl_is_transient_error(cres) || ++seg->attempts >= RRC_UPDATE_DOWNLOAD_ATTEMPTS)
+            {
+                res = rrc_result_create_error_curl(cres, "Failed to download update ZIP");
+                goto cleanup;
+            }
+
+            /* Continue this segment where it stopped, the others carry on undisturbed. */
+            _rrc_zipdl_start_segment(multi, seg, url);
+            active++;
+        }
+
+        curl_off_t received = 0;
+        for (int i = 0; i < _RRC_ZIPDL_SEGMENTS; i++)
+        {
+            received += segments[i].pos - segments[i].start;
+        }
+
+        if (rrc_zipdl_progress_callback(numinfo, expected_length, received, 0, 0) != 0)
+        {
+            aborted = CURLE_ABORTED_BY_CALLBACK;
+            res = rrc_result_create_error_curl(aborted, "Failed to download update ZIP");
+            goto cleanup;
+        }
+
+        if (fp != NULL && received - journal.stored >= RRC_DLJOURNAL_COMMIT_INTERVAL)
+        {
+            /* Only bytes that actually made it to the SD card may be recorded as committed. */
+            if (fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+            {
+                res = rrc_result_create_error_errno(errno, "Failed to sync temporary ZIP file for update download");
+                goto cleanup;
+            }
+
+            for (int i = 0; i < _RRC_ZIPDL_SEGMENTS; i++)
+            {
+                journal.segments[i] = segments[i].pos - segments[i].start;
+                journal.segment_crcs[i] = segments[i].crc;
+            }
+
+            res = rrc_dljournal_commit(&journal, received);
+            if (rrc_result_is_error(res))
+            {
+                goto cleanup;
+            }
+        }
+    }
+
+cleanup:
+    for (int i = 0; i < _RRC_ZIPDL_SEGMENTS; i++)
+    {
+        if (segments[i].active)
+        {
+            curl_multi_remove_handle(multi, segments[i].curl);
+        }
+        if (segments[i].curl != NULL)
+        {
+            curl_easy_cleanup(segments[i].curl);
+        }
+    }
+    curl_multi_cleanup(multi);
+
+    if (fp != NULL && fclose(fp) != 0 && !rrc_result_is_error(res))
+    {
+        res = rrc_result_create_error_errno(errno, "Failed to close temporary ZIP file for update download");
+    }
+    rrc_zipdl_shutdown_if_aborted(aborted);
+
+    if (rrc_result_is_error(res) || !*ranges_supported)
+    {
+        return res;
+    }
+
+    u32 crc = segments[0].crc;
+    for (int i = 0; i < _RRC_ZIPDL_SEGMENTS; i++)
+    {
+        if (segments[i].pos != segments[i].end)
+        {
+            return rrc_result_create_error_misc_update("Downloaded update ZIP has an unexpected size");
+        }
+        journal.segments[i] = segments[i].end - segments[i].start;
+        journal.segment_crcs[i] = segments[i].crc;
+
+        if (i > 0)
+        {
+            crc = crc32_combine(crc, segments[i].crc, segments[i].end - segments[i].start);
+        }
+    }
+
+    TRY(rrc_zipdl_verify(expected_crc, crc));
+    if (mem != NULL)
+    {
+        return rrc_result_success;
+    }
+
+    /* From here on the download only needs to be extracted, even if we're interrupted. */
+    journal.committed = expected_length;
+    return rrc_dljournal_store(&journal);
+}
+
+struct rrc_result rrc_update_download_zip(struct rrc_update_session *session, char *url, char *filename, curl_off_t expected_length, const u32 *expected_crc, int current_zip, int max_zips)
+{
+    int numinfo = (current_zip * 100) + max_zips;
+
+    if (expected_length >= RRC_ZIPDL_SEGMENTED_THRESHOLD)
+    {
+        bool ranges_supported;
+        TRY(_rrc_zipdl_download_segmented(session, url, filename, NULL, expected_length, expected_crc, &numinfo, &ranges_supported));
+        if (ranges_supported)
+        {
+            return rrc_result_success;
+        }
+    }
+
+    struct rrc_dljournal journal;
+    rrc_dljournal_load(url, expected_length, RRC_DLJOURNAL_MODE_FILE, &journal);
+
+    FILE *fp = NULL;
+    if (journal.committed > 0)
+    {
+        fp = fopen(filename, "r+b");
+
+        /* The journal is only useful if the partial download it describes is still there. */
+        struct stat sb;
+        if (fp != NULL && (fstat(fileno(fp), &sb) != 0 || sb.st_size < journal.committed))
+        {
+            fclose(fp);
+            fp = NULL;
+        }
+    }
+
+    if (fp == NULL)
+    {
+        journal.committed = 0;
+        journal.crc = crc32(0, Z_NULL, 0);
+        fp = fopen(filename, "wb");
+        if (fp == NULL)
+        {
+            return rrc_result_create_error_errno(errno, "Failed to create temporary ZIP file for update download");
+        }
+    }
+
+    CURL *curl = rrc_update_session_handle(session);
+    struct _rrc_zipdl_write_ctx ctx = {.curl = curl, .fp = fp, .journal = &journal, .crc = journal.crc};
+
+    for (int attempt = 0; journal.committed != expected_length; attempt++)
+    {
+        /* Anything past the last synced byte may be garbage after a power loss. */
+        if (fflush(fp) != 0 || ftruncate(fileno(fp), journal.committed) != 0 || fseek(fp, journal.committed, SEEK_SET) != 0)
+        {
+            fclose(fp);
+            return rrc_result_create_error_errno(errno, "Failed to prepare temporary ZIP file for update download");
+        }
+
+        ctx.resume_from = journal.committed;
+        ctx.written = journal.committed;
+        ctx.crc = journal.crc;
+        ctx.checked_response = false;
+
+        rrc_zipdl_setopt_transfer(curl, url, &numinfo, ctx.resume_from);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _rrc_zipdl_write_data_callback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &ctx);
+
+        /* Perform the request, cres gets the return code */
+        CURLcode cres = curl_easy_perform(curl);
+        rrc_update_stats_add_transfer(curl);
+
+        if (rrc_result_is_error(ctx.res))
+        {
+            fclose(fp);
+            return ctx.res;
+        }
+
+        if (cres == CURLE_OK)
+        {
+            break;
+        }
+
+        if (!rrc_zipdl_is_transient_error(cres) || attempt + 1 >= RRC_UPDATE_DOWNLOAD_ATTEMPTS || fflush(fp) != 0 || fsync(fileno(fp)) != 0)
+        {
+            fclose(fp);
+            rrc_zipdl_shutdown_if_aborted(cres);
+            return rrc_result_create_error_curl(cres, "Failed to download update ZIP");
+        }
+
+        /* Everything received so far is synced now, continue from there. */
+        journal.committed = ctx.written;
+        journal.crc = ctx.crc;
+    }
+
+    if (fclose(fp) != 0)
+    {
+        return rrc_result_create_error_errno(errno, "Failed to close temporary ZIP file for update download");
+    }
+
+    if (expected_length >= 0 && ctx.written != expected_length && journal.committed != expected_length)
+    {
+        return rrc_result_create_error_misc_update("Downloaded update ZIP has an unexpected size");
+    }
+
+    TRY(rrc_zipdl_verify(expected_crc, ctx.crc));
+
+    /* From here on the download only needs to be extracted, even if we're interrupted. */
+    journal.committed = expected_length;
+    journal.crc = ctx.crc;
+    return rrc_dljournal_store(&journal);
+}
+
+struct rrc_result rrc_update_download_zip_to_memory(struct rrc_update_session *session, char *url, u8 *mem, curl_off_t expected_length, const u32 *expected_crc, int current_zip, int max_zips)
+{
+    int numinfo = (current_zip * 100) + max_zips;
+
+    if (expected_length >= RRC_ZIPDL_SEGMENTED_THRESHOLD)
+    {
+        bool ranges_supported;
+        TRY(_rrc_zipdl_download_segmented(session, url, NULL, mem, expected_length, expected_crc, &numinfo, &ranges_supported));
+        if (ranges_supported)
+        {
+            return rrc_result_success;
+        }
+    }
+
+    CURL *curl = rrc_update_session_handle(session);
+    struct _rrc_zipdl_write_ctx ctx = {.curl = curl, .mem = mem, .capacity = expected_length, .crc = crc32(0, Z_NULL, 0)};
+
+    for (int attempt = 0;; attempt++)
+    {
+        /* Whatever was received before the connection dropped is still in the buffer. */
+        ctx.resume_from = ctx.written;
+        ctx.checked_response = false;
+
+        rrc_zipdl_setopt_transfer(curl, url, &numinfo, ctx.resume_from);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, _rrc_zipdl_write_data_callback);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &ctx);
+
+        CURLcode cres = curl_easy_perform(curl);
+        rrc_update_stats_add_transfer(curl);
+
+        if (rrc_result_is_error(ctx.res))
+        {
+            return ctx.res;
+        }
+
+        if (cres == CURLE_OK)
+        {
+            break;
+        }
+
+        if (!rrc_zipdl_is_transient_error(cres) || attempt + 1 >= RRC_UPDATE_DOWNLOAD_ATTEMPTS)
+        {
+            rrc_zipdl_shutdown_if_aborted(cres);
+            return rrc_result_create_error_curl(cres, "Failed to download update ZIP");
+        }
+    }
+
+    if (ctx.written != expected_length)
+    {
+        return rrc_result_create_error_misc_update("Downloaded update ZIP has an unexpected size");
+    }
+
+    return rrc_zipdl_verify(expected_crc, ctx.crc);
+}
+
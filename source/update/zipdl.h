@@ -0,0 +1,57 @@
+/*
+    zipdl.h - update ZIP downloads headers
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RRC_UPDATE_ZIPDL_H
+#define RRC_UPDATE_ZIPDL_H
+
+#include <gctypes.h>
+#include <curl/curl.h>
+
+#include "../result.h"
+
+/* ZIPs at least this large are downloaded over several connections at once */
+#define RRC_ZIPDL_SEGMENTED_THRESHOLD (curl_off_t)(1000 * 1000 * 16) /* 16MB */
+
+/*
+    Shows the progress of a ZIP transfer on the console. `numinfo' is the number of the ZIP times 100
+    plus the amount of ZIPs. Aborts the transfer if a shutdown was requested.
+*/
+int rrc_zipdl_progress_callback(int *numinfo, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow);
+
+/* Checks whether a failed transfer is worth continuing from where it stopped. */
+bool rrc_zipdl_is_transient_error(CURLcode cres);
+
+/*
+    Carries out the shutdown a transfer was aborted for by the progress callback.
+    Must only be called once the caller closed the files the transfer was writing to.
+*/
+void rrc_zipdl_shutdown_if_aborted(CURLcode cres);
+
+/* Options shared by all update ZIP transfers. */
+void rrc_zipdl_setopt_transfer(CURL *curl, char *url, int *numinfo, curl_off_t resume_from);
+
+/* Returns true if we asked for a range but the server sent the whole file instead. */
+bool rrc_zipdl_range_ignored(CURL *curl, curl_off_t resume_from);
+
+/*
+    Checks the CRC32 of a downloaded archive against the one published for it, if there is one.
+    On a mismatch the download journal is dropped, so that the next attempt starts from scratch.
+*/
+struct rrc_result rrc_zipdl_verify(const u32 *expected_crc, u32 crc);
+
+#endif
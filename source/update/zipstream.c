@@ -0,0 +1,527 @@
+/*
+    zipstream.c - streaming ZIP extraction implementation
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    The ZIP format is documented at https://pkware.cachefly.net/webdocs/casestudies/APPNOTE.TXT
+
+    Every entry in an archive is laid out as:
+
+    | Name              | Size in bytes (LE) |
+    |-------------------|--------------------|
+    | Local file header | 30                 |
+    | File name         | Variable           |
+    | Extra field       | Variable           |
+    | File data         | Variable           |
+    | Data descriptor   | 0, 12 or 16        | (only if general purpose flag bit 3 is set)
+
+    followed by the central directory, which we don't need since the local headers contain
+    everything required to extract an entry.
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "zipstream.h"
+#include "update.h"
+#include "../strset.h"
+#include "../time.h"
+#include "stats.h"
+
+#define _RRC_ZIP_LOCAL_HEADER_SIG 0x04034b50
+#define _RRC_ZIP_CENTRAL_HEADER_SIG 0x02014b50
+#define _RRC_ZIP_END_OF_CENTRAL_DIR_SIG 0x06054b50
+#define _RRC_ZIP_DATA_DESCRIPTOR_SIG 0x08074b50
+
+#define _RRC_ZIP_FLAG_ENCRYPTED (1 << 0)
+#define _RRC_ZIP_FLAG_DATA_DESCRIPTOR (1 << 3)
+
+#define _RRC_ZIP_METHOD_STORE 0
+#define _RRC_ZIP_METHOD_DEFLATE 8
+
+#define _RRC_ZIP_EXTRA_ZIP64 0x0001
+
+/* ZIP is little endian, the Wii is not. */
+static u16 rd16(const u8 *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static u32 rd32(const u8 *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static struct rrc_result unsupported(struct rrc_zipstream *zs, const char *why)
+{
+    zs->unsupported = true;
+    return rrc_result_create_error_misc_update(why);
+}
+
+/*
+    Appends bytes to `record' until it is `want' bytes long. Returns the amount of bytes consumed.
+*/
+static u32 fill_record(struct rrc_zipstream *zs, u32 want, const u8 *data, u32 len)
+{
+    if (zs->record_len >= want)
+    {
+        return 0;
+    }
+
+    u32 n = want - zs->record_len;
+    if (n > len)
+    {
+        n = len;
+    }
+
+    memcpy(zs->record + zs->record_len, data, n);
+    zs->record_len += n;
+    return n;
+}
+
+static struct rrc_result write_out(struct rrc_zipstream *zs, const u8 *data, u32 len)
+{
+    if (len == 0)
+    {
+        return rrc_result_success;
+    }
+
+    zs->written_crc = crc32(zs->written_crc, data, len);
+    zs->written += len;
+
+    if (zs->outfile != NULL)
+    {
+        rrc_time_tick start = gettime();
+        size_t written = fwrite(data, 1, len, zs->outfile);
+        rrc_update_stats_add_time(RRC_UPDATE_STATS_WRITE, start);
+        if (written != len)
+        {
+            return rrc_result_create_error_errno(errno, "Failed to fully write ZIP chunk");
+        }
+    }
+
+    return rrc_result_success;
+}
+
+static struct rrc_result begin_entry(struct rrc_zipstream *zs)
+{
+    memcpy(zs->name, zs->record + RRC_ZIPSTREAM_LOCAL_HEADER_SIZE, zs->name_len);
+    zs->name[zs->name_len] = '\0';
+
+    /* ZIP64 entries have sizes that don't fit in the header and 8 byte sizes in the data descriptor. */
+    const u8 *extra = zs->record + RRC_ZIPSTREAM_LOCAL_HEADER_SIZE + zs->name_len;
+    for (u32 off = 0; off + 4 <= zs->extra_len; off += 4 + rd16(extra + off + 2))
+    {
+        if (rd16(extra + off) == _RRC_ZIP_EXTRA_ZIP64)
+        {
+            return unsupported(zs, "ZIP64 entries can't be streamed");
+        }
+    }
+
+    if (zs->name[0] == '\0')
+    {
+        return rrc_result_create_error_misc_update("Empty file name in ZIP archive");
+    }
+
+    zs->remaining = zs->compressed_size;
+    zs->written_crc = crc32(0, NULL, 0);
+    zs->written = 0;
+    zs->outfile = NULL;
+
+    // Ignore directories. They are automatically created when processing files.
+    bool is_file = zs->name[zs->name_len - 1] != '/';
+    bool superseded = is_file && zs->skip != NULL && rrc_strset_contains(zs->skip, zs->name);
+
+    /* Without a data descriptor, the header tells us up front whether the file is already installed,
+       in which case its data doesn't even need to be inflated. */
+    if (is_file && !(zs->flags & _RRC_ZIP_FLAG_DATA_DESCRIPTOR) &&
+        (superseded || (zs->installed != NULL && rrc_installed_matches(zs->installed, zs->name, zs->crc, zs->uncompressed_size))))
+    {
+        zs->state = zs->remaining > 0 ? RRC_ZIPSTREAM_SKIP : RRC_ZIPSTREAM_HEADER;
+        if (zs->remaining == 0)
+        {
+            zs->entries++;
+            zs->record_len = 0;
+        }
+        return rrc_result_success;
+    }
+
+    /* Nothing to inflate, handle it like an empty stored entry. */
+    if (zs->method == _RRC_ZIP_METHOD_DEFLATE && zs->compressed_size == 0 && !(zs->flags & _RRC_ZIP_FLAG_DATA_DESCRIPTOR))
+    {
+        zs->method = _RRC_ZIP_METHOD_STORE;
+    }
+
+    if (zs->method == _RRC_ZIP_METHOD_DEFLATE)
+    {
+        memset(&zs->z, 0, sizeof(zs->z));
+        /* Negative window bits: raw deflate data without a zlib header. */
+        if (inflateInit2(&zs->z, -MAX_WBITS) != Z_OK)
+        {
+            return rrc_result_create_error_misc_update("Failed to initialise inflate for ZIP entry");
+        }
+        zs->z_init = true;
+    }
+
+    /* A superseded entry with a data descriptor still has to be inflated to find its end, but it isn't written anywhere. */
+    if (is_file && !superseded)
+    {
+        /* Entries with a data descriptor don't know their size yet, they are accounted for once they're done. */
+        if (zs->space_left != NULL && !(zs->flags & _RRC_ZIP_FLAG_DATA_DESCRIPTOR))
+        {
+            if (zs->uncompressed_size > *zs->space_left)
+            {
+                return rrc_result_create_error_misc_update("Not enough free space on SD card for update");
+            }
+            *zs->space_left -= zs->uncompressed_size;
+        }
+
+        if (zs->txn != NULL)
+        {
+            char staged[PATH_MAX];
+            rrc_txn_stage_path(zs->name, staged, sizeof(staged));
+            TRY(rrc_update_open_extract_file(staged, &zs->outfile));
+        }
+        else
+        {
+            TRY(rrc_update_open_extract_file(zs->name, &zs->outfile));
+        }
+    }
+
+    zs->state = RRC_ZIPSTREAM_DATA;
+    return rrc_result_success;
+}
+
+static struct rrc_result finish_entry(struct rrc_zipstream *zs)
+{
+    if (zs->z_init)
+    {
+        inflateEnd(&zs->z);
+        zs->z_init = false;
+    }
+
+    bool is_file = zs->outfile != NULL;
+    if (is_file)
+    {
+        rrc_time_tick start = gettime();
+        int err = rrc_update_close_extract_file(zs->outfile);
+        rrc_update_stats_add_time(RRC_UPDATE_STATS_WRITE, start);
+        zs->outfile = NULL;
+        if (err != 0)
+        {
+            return rrc_result_create_error_errno(errno, "Failed to close extracted ZIP entry");
+        }
+        rrc_update_stats_add_entry();
+    }
+
+    if (zs->written != zs->uncompressed_size || zs->written_crc != zs->crc)
+    {
+        return rrc_result_create_error_misc_update("ZIP entry is corrupted (CRC or size mismatch)");
+    }
+
+    if (is_file && zs->space_left != NULL && (zs->flags & _RRC_ZIP_FLAG_DATA_DESCRIPTOR))
+    {
+        if (zs->written > *zs->space_left)
+        {
+            return rrc_result_create_error_misc_update("Not enough free space on SD card for update");
+        }
+        *zs->space_left -= zs->written;
+    }
+
+    if (is_file && zs->txn != NULL)
+    {
+        TRY(rrc_txn_add_staged(zs->txn, zs->name, true, zs->crc, zs->uncompressed_size));
+    }
+    else if (is_file && zs->installed != NULL)
+    {
+        TRY(rrc_installed_set(zs->installed, zs->name, zs->crc, zs->uncompressed_size));
+    }
+
+    zs->entries++;
+    zs->record_len = 0;
+    zs->state = RRC_ZIPSTREAM_HEADER;
+    return rrc_result_success;
+}
+
+static struct rrc_result read_header(struct rrc_zipstream *zs, const u8 *data, u32 len, u32 *used)
+{
+    *used = 0;
+
+    if (zs->record_len < 4)
+    {
+        *used += fill_record(zs, 4, data, len);
+        if (zs->record_len < 4)
+        {
+            return rrc_result_success;
+        }
+
+        u32 sig = rd32(zs->record);
+        if (sig == _RRC_ZIP_CENTRAL_HEADER_SIG || sig == _RRC_ZIP_END_OF_CENTRAL_DIR_SIG)
+        {
+            zs->state = RRC_ZIPSTREAM_DONE;
+            return rrc_result_success;
+        }
+        else if (sig != _RRC_ZIP_LOCAL_HEADER_SIG)
+        {
+            return rrc_result_create_error_misc_update("Invalid local file header in ZIP archive");
+        }
+    }
+
+    if (zs->record_len < RRC_ZIPSTREAM_LOCAL_HEADER_SIZE)
+    {
+        *used += fill_record(zs, RRC_ZIPSTREAM_LOCAL_HEADER_SIZE, data + *used, len - *used);
+        if (zs->record_len < RRC_ZIPSTREAM_LOCAL_HEADER_SIZE)
+        {
+            return rrc_result_success;
+        }
+
+        zs->flags = rd16(zs->record + 6);
+        zs->method = rd16(zs->record + 8);
+        zs->crc = rd32(zs->record + 14);
+        zs->compressed_size = rd32(zs->record + 18);
+        zs->uncompressed_size = rd32(zs->record + 22);
+        zs->name_len = rd16(zs->record + 26);
+        zs->extra_len = rd16(zs->record + 28);
+
+        if (zs->flags & _RRC_ZIP_FLAG_ENCRYPTED)
+        {
+            return unsupported(zs, "Encrypted ZIP entries can't be streamed");
+        }
+
+        if (zs->method != _RRC_ZIP_METHOD_STORE && zs->method != _RRC_ZIP_METHOD_DEFLATE)
+        {
+            return unsupported(zs, "ZIP entry uses an unsupported compression method");
+        }
+
+        /* Without a compressed size, only deflate knows where the data ends. */
+        if ((zs->flags & _RRC_ZIP_FLAG_DATA_DESCRIPTOR) && zs->method == _RRC_ZIP_METHOD_STORE)
+        {
+            return unsupported(zs, "Stored ZIP entries with data descriptors can't be streamed");
+        }
+
+        if (zs->name_len >= RRC_ZIPSTREAM_NAME_MAX || zs->extra_len > RRC_ZIPSTREAM_EXTRA_MAX)
+        {
+            return unsupported(zs, "ZIP entry header too long to be streamed");
+        }
+    }
+
+    u32 full = RRC_ZIPSTREAM_LOCAL_HEADER_SIZE + zs->name_len + zs->extra_len;
+    *used += fill_record(zs, full, data + *used, len - *used);
+    if (zs->record_len < full)
+    {
+        return rrc_result_success;
+    }
+
+    return begin_entry(zs);
+}
+
+static struct rrc_result read_stored(struct rrc_zipstream *zs, const u8 *data, u32 len, u32 *used)
+{
+    u32 n = len < zs->remaining ? len : zs->remaining;
+    TRY(write_out(zs, data, n));
+
+    zs->remaining -= n;
+    *used = n;
+
+    if (zs->remaining == 0)
+    {
+        return finish_entry(zs);
+    }
+
+    return rrc_result_success;
+}
+
+static struct rrc_result read_skipped(struct rrc_zipstream *zs, const u8 *data, u32 len, u32 *used)
+{
+    *used = len < zs->remaining ? len : zs->remaining;
+    zs->remaining -= *used;
+
+    if (zs->remaining == 0)
+    {
+        zs->entries++;
+        zs->record_len = 0;
+        zs->state = RRC_ZIPSTREAM_HEADER;
+    }
+
+    return rrc_result_success;
+}
+
+static struct rrc_result read_deflated(struct rrc_zipstream *zs, const u8 *data, u32 len, u32 *used)
+{
+    bool has_descriptor = zs->flags & _RRC_ZIP_FLAG_DATA_DESCRIPTOR;
+    u32 avail = (has_descriptor || len < zs->remaining) ? len : zs->remaining;
+
+    zs->z.next_in = (Bytef *)data;
+    zs->z.avail_in = avail;
+
+    int zres;
+    do
+    {
+        zs->z.next_out = zs->out;
+        zs->z.avail_out = sizeof(zs->out);
+
+        rrc_time_tick start = gettime();
+        zres = inflate(&zs->z, Z_NO_FLUSH);
+        rrc_update_stats_add_time(RRC_UPDATE_STATS_INFLATE, start);
+        if (zres != Z_OK && zres != Z_STREAM_END && zres != Z_BUF_ERROR)
+        {
+            return rrc_result_create_error_misc_update("Failed to inflate ZIP entry");
+        }
+
+        TRY(write_out(zs, zs->out, sizeof(zs->out) - zs->z.avail_out));
+    } while (zres != Z_STREAM_END && (zs->z.avail_in > 0 || zs->z.avail_out == 0));
+
+    *used = avail - zs->z.avail_in;
+    if (!has_descriptor)
+    {
+        zs->remaining -= *used;
+    }
+
+    if (zres == Z_STREAM_END)
+    {
+        if (has_descriptor)
+        {
+            zs->record_len = 0;
+            zs->state = RRC_ZIPSTREAM_DESCRIPTOR;
+            return rrc_result_success;
+        }
+
+        if (zs->remaining != 0)
+        {
+            return rrc_result_create_error_misc_update("ZIP entry has trailing data after its deflate stream");
+        }
+
+        return finish_entry(zs);
+    }
+    else if (!has_descriptor && zs->remaining == 0)
+    {
+        return rrc_result_create_error_misc_update("ZIP entry deflate stream is truncated");
+    }
+
+    return rrc_result_success;
+}
+
+static struct rrc_result read_descriptor(struct rrc_zipstream *zs, const u8 *data, u32 len, u32 *used)
+{
+    /* The signature is optional, so we need to look at the first 4 bytes to know the full length. */
+    *used = fill_record(zs, 4, data, len);
+    if (zs->record_len < 4)
+    {
+        return rrc_result_success;
+    }
+
+    u32 off = rd32(zs->record) == _RRC_ZIP_DATA_DESCRIPTOR_SIG ? 4 : 0;
+    *used += fill_record(zs, off + 12, data + *used, len - *used);
+    if (zs->record_len < off + 12)
+    {
+        return rrc_result_success;
+    }
+
+    zs->crc = rd32(zs->record + off);
+    zs->compressed_size = rd32(zs->record + off + 4);
+    zs->uncompressed_size = rd32(zs->record + off + 8);
+    return finish_entry(zs);
+}
+
+void rrc_zipstream_init(struct rrc_zipstream *zs, u64 offset, struct rrc_installed_manifest *installed, struct rrc_txn *txn, struct rrc_strset *skip, u64 *space_left)
+{
+    memset(zs, 0, sizeof(*zs));
+    zs->installed = installed;
+    zs->txn = txn;
+    zs->skip = skip;
+    zs->space_left = space_left;
+    zs->state = RRC_ZIPSTREAM_HEADER;
+    zs->offset = offset;
+    zs->committed = offset;
+}
+
+struct rrc_result rrc_zipstream_feed(struct rrc_zipstream *zs, const u8 *data, u32 len)
+{
+    while (len > 0 && zs->state != RRC_ZIPSTREAM_DONE)
+    {
+        u32 used = 0;
+        switch (zs->state)
+        {
+        case RRC_ZIPSTREAM_HEADER:
+            TRY(read_header(zs, data, len, &used));
+            break;
+        case RRC_ZIPSTREAM_DATA:
+            if (zs->method == _RRC_ZIP_METHOD_STORE)
+            {
+                TRY(read_stored(zs, data, len, &used));
+            }
+            else
+            {
+                TRY(read_deflated(zs, data, len, &used));
+            }
+            break;
+        case RRC_ZIPSTREAM_SKIP:
+            TRY(read_skipped(zs, data, len, &used));
+            break;
+        case RRC_ZIPSTREAM_DESCRIPTOR:
+            TRY(read_descriptor(zs, data, len, &used));
+            break;
+        case RRC_ZIPSTREAM_DONE:
+            break;
+        }
+
+        data += used;
+        len -= used;
+        zs->offset += used;
+
+        /* An entry is only ever finished at the end of a step, so this is exactly where it ends. */
+        if (zs->state == RRC_ZIPSTREAM_HEADER && zs->record_len == 0)
+        {
+            zs->committed = zs->offset;
+        }
+    }
+
+    /* Zero-length stored entries have no data to trigger their completion. */
+    if (zs->state == RRC_ZIPSTREAM_DATA && zs->method == _RRC_ZIP_METHOD_STORE && zs->remaining == 0)
+    {
+        TRY(finish_entry(zs));
+        zs->committed = zs->offset;
+    }
+
+    return rrc_result_success;
+}
+
+struct rrc_result rrc_zipstream_finish(struct rrc_zipstream *zs)
+{
+    if (zs->state != RRC_ZIPSTREAM_DONE)
+    {
+        return rrc_result_create_error_misc_update("Update ZIP ended in the middle of an entry");
+    }
+
+    return rrc_result_success;
+}
+
+void rrc_zipstream_free(struct rrc_zipstream *zs)
+{
+    if (zs->z_init)
+    {
+        inflateEnd(&zs->z);
+        zs->z_init = false;
+    }
+
+    if (zs->outfile != NULL)
+    {
+        rrc_update_close_extract_file(zs->outfile);
+        zs->outfile = NULL;
+    }
+}
@@ -0,0 +1,135 @@
+/*
+    zipstream.h - streaming ZIP extraction headers
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RRC_ZIPSTREAM_H
+#define RRC_ZIPSTREAM_H
+
+#include <stdio.h>
+#include <gctypes.h>
+#include <zlib.h>
+
+#include "../result.h"
+#include "installed.h"
+#include "txn.h"
+#include "../strset.h"
+
+/* Size of the fixed part of a local file header */
+#define RRC_ZIPSTREAM_LOCAL_HEADER_SIZE 30
+/* Longest file name we accept in a streamed entry. Longer names make us fall back to libzip. */
+#define RRC_ZIPSTREAM_NAME_MAX 256
+/* Longest extra field we accept in a streamed entry. Longer fields make us fall back to libzip. */
+#define RRC_ZIPSTREAM_EXTRA_MAX 256
+
+enum rrc_zipstream_state
+{
+    /* Reading a local file header (or the start of the central directory) */
+    RRC_ZIPSTREAM_HEADER,
+    /* Reading (and inflating) the file data of the current entry */
+    RRC_ZIPSTREAM_DATA,
+    /* Skipping over the file data of an entry that is already installed */
+    RRC_ZIPSTREAM_SKIP,
+    /* Reading the data descriptor following the file data of the current entry */
+    RRC_ZIPSTREAM_DESCRIPTOR,
+    /* Reached the central directory, everything after this is ignored */
+    RRC_ZIPSTREAM_DONE
+};
+
+/*
+    Extracts a ZIP archive as it is being received, without it ever being stored as a whole.
+
+    This works by walking the local file headers in order, which is possible for any archive
+    that doesn't use encryption, ZIP64 or stored entries with data descriptors (whose size is
+    only known after the fact). When such an archive is encountered, `unsupported' is set and
+    the caller should fall back to downloading the archive and extracting it with libzip.
+*/
+struct rrc_zipstream
+{
+    enum rrc_zipstream_state state;
+    /* Set if the archive uses a feature we can't handle while streaming. */
+    bool unsupported;
+    /* Number of fully extracted entries so far. */
+    int entries;
+    /* Files that are already installed are skipped. May be NULL. */
+    struct rrc_installed_manifest *installed;
+    /* Update the extracted files are staged for. If NULL, files are written straight to their final path. */
+    struct rrc_txn *txn;
+    /* Files that aren't extracted at all, because a later update replaces them. May be NULL. */
+    struct rrc_strset *skip;
+    /* Free space on the SD card, counted down as entries are extracted. May be NULL. */
+    u64 *space_left;
+    /* Offset in the archive of the next byte to be fed. */
+    u64 offset;
+    /* Offset in the archive right after the last fully extracted entry.
+       Extraction can be resumed from here with a fresh extractor. */
+    u64 committed;
+
+    /* Raw bytes of the local header + name + extra field, or the data descriptor.
+       These records may straddle two received chunks, so they are collected here first. */
+    u8 record[RRC_ZIPSTREAM_LOCAL_HEADER_SIZE + RRC_ZIPSTREAM_NAME_MAX + RRC_ZIPSTREAM_EXTRA_MAX];
+    u32 record_len;
+
+    /* Fields of the entry currently being extracted. */
+    u16 flags;
+    u16 method;
+    u32 crc;
+    u32 compressed_size;
+    u32 uncompressed_size;
+    u16 name_len;
+    u16 extra_len;
+    char name[RRC_ZIPSTREAM_NAME_MAX];
+
+    /* Compressed bytes left for this entry. Unused if the entry has a data descriptor. */
+    u32 remaining;
+    /* Running CRC32 and size of what we wrote out. */
+    u32 written_crc;
+    u32 written;
+    /* NULL for directory entries. */
+    FILE *outfile;
+
+    z_stream z;
+    bool z_init;
+    u8 out[4096];
+};
+
+/*
+    Initialises a streaming extractor. Must be paired with `rrc_zipstream_free'.
+    `offset' is where in the archive the data will start, which must be the start of a local file header.
+    Entries recorded in `installed' with a matching CRC32 and size are skipped. Everything that is
+    extracted is staged in `txn' and gets recorded in `installed' once that is committed.
+    Entries named in `skip' are passed over without being written.
+    If `space_left' is given, extraction fails once the entries would no longer fit on the SD card.
+*/
+void rrc_zipstream_init(struct rrc_zipstream *zs, u64 offset, struct rrc_installed_manifest *installed, struct rrc_txn *txn, struct rrc_strset *skip, u64 *space_left);
+
+/*
+    Feeds the next `len' bytes of the archive into the extractor, extracting any entries
+    that are completed by this chunk.
+*/
+struct rrc_result rrc_zipstream_feed(struct rrc_zipstream *zs, const u8 *data, u32 len);
+
+/*
+    Checks that the whole archive has been processed. Call this after the last chunk has been fed.
+*/
+struct rrc_result rrc_zipstream_finish(struct rrc_zipstream *zs);
+
+/*
+    Releases any open file or inflate state. Safe to call at any point.
+*/
+void rrc_zipstream_free(struct rrc_zipstream *zs);
+
+#endif
@@ -75,7 +75,8 @@
         }                                                                                    \
     } while (0);
 
-#define RRC_STRINGIFY(x) #x
+/* Expands `x' first, so that macros are turned into their value rather than their name. */
+#define RRC_STRINGIFY(x) _RRC_STRING(x)
 
 #if defined(DEBUG) && DEBUG >= 0
 /* define debug macros */
@@ -0,0 +1,108 @@
+/*
+    host.c - stand-ins for the Wii side of the launcher in host builds of the tests
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    The tested sources are linked against the real `result.c', which reports errors through the
+    console and prompts. Those, and the few libogc functions they use, are replaced here by
+    versions that work in a terminal.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <gccore.h>
+
+#include "../source/console.h"
+#include "../source/prompt.h"
+#include "../source/shutdown.h"
+#include "../source/time.h"
+
+void CON_GetMetrics(int *cols, int *rows)
+{
+    *cols = 80;
+    *rows = 25;
+}
+
+void rrc_con_update(char *action, int progress)
+{
+}
+
+void rrc_con_clear(bool keep_progress)
+{
+}
+
+void rrc_con_print_text_centered(int row, char *text)
+{
+    printf("%s\n", text);
+}
+
+void rrc_con_cursor_seek_to(int row, int column)
+{
+}
+
+void rrc_prompt_1_option(void *old_xfb, char **lines, int n, char *button)
+{
+    for (int i = 0; i < n; i++)
+    {
+        printf("%s\n", lines[i]);
+    }
+}
+
+enum rrc_prompt_result rrc_prompt_2_options(void *old_xfb, char **lines, int n, char *option1, char *option2, enum rrc_prompt_result option1_result, enum rrc_prompt_result option2_result)
+{
+    rrc_prompt_1_option(old_xfb, lines, n, option1);
+    return option1_result;
+}
+
+enum rrc_prompt_result rrc_prompt_yes_no(void *old_xfb, char **lines, int n)
+{
+    return rrc_prompt_2_options(old_xfb, lines, n, "Yes", "No", RRC_PROMPT_RESULT_YES, RRC_PROMPT_RESULT_NO);
+}
+
+void rrc_shutdown_check()
+{
+}
+
+bool rrc_shutdown_pending()
+{
+    return false;
+}
+
+/* Ticks are microseconds on the host. */
+rrc_time_tick gettime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (rrc_time_tick)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+u32 diff_msec(rrc_time_tick start, rrc_time_tick end)
+{
+    return (end - start) / 1000;
+}
+
+u32 diff_usec(rrc_time_tick start, rrc_time_tick end)
+{
+    return end - start;
+}
+
+void rrc_usleep(u32 usec)
+{
+    usleep(usec);
+}
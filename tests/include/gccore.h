@@ -0,0 +1,32 @@
+/*
+    gccore.h - the parts of libogc the tested sources use, for host builds
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RRC_TEST_GCCORE_H
+#define RRC_TEST_GCCORE_H
+
+#include <gctypes.h>
+
+/* Everything is "MEM2" on the host, so buffers are never refused for being in MEM1. */
+#define MEM_VIRTUAL_TO_PHYSICAL(x) (((u32)(uintptr_t)(x) & 0x3fffffff) | 0x10000000)
+
+/* The host's ticks are microseconds already (see `gettime' in host.c). */
+#define ticks_to_microsecs(ticks) ((u64)(ticks))
+
+void CON_GetMetrics(int *cols, int *rows);
+
+#endif
@@ -0,0 +1,65 @@
+/*
+    test.h - minimal assertion helpers for the host tests
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RRC_TEST_H
+#define RRC_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../source/result.h"
+
+/* Aborts the test with the failing condition and its location. */
+#define RRC_TEST_ASSERT(cond)                                                        \
+    do                                                                               \
+    {                                                                                \
+        if (!(cond))                                                                 \
+        {                                                                            \
+            fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                                 \
+        }                                                                            \
+    } while (0)
+
+#define RRC_TEST_ASSERT_OK(res)                                                                               \
+    do                                                                                                        \
+    {                                                                                                         \
+        struct rrc_result _res = (res);                                                                       \
+        if (rrc_result_is_error(_res))                                                                        \
+        {                                                                                                     \
+            fprintf(stderr, "%s:%d: unexpected error: %s\n", __FILE__, __LINE__, rrc_result_context(_res)); \
+            exit(1);                                                                                          \
+        }                                                                                                     \
+    } while (0)
+
+/* Asserts that `res' is an error and frees it. */
+#define RRC_TEST_ASSERT_ERR(res)                                                  \
+    do                                                                            \
+    {                                                                             \
+        struct rrc_result _res = (res);                                           \
+        RRC_TEST_ASSERT(rrc_result_is_error(_res));                               \
+        rrc_result_free(_res);                                                    \
+    } while (0)
+
+#define RRC_TEST_RUN(fn)              \
+    do                                \
+    {                                 \
+        printf("  %s\n", #fn);        \
+        fn();                         \
+    } while (0)
+
+#endif
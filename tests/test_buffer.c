@@ -0,0 +1,202 @@
+/*
+    test_buffer.c - tests of the growable byte buffer
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "test.h"
+#include "../source/buffer.h"
+
+/* The overflow tests make allocations no machine can satisfy, which have to fail instead of aborting the test. */
+const char *__asan_default_options()
+{
+    return "allocator_may_return_null=1";
+}
+
+static void test_init_is_empty()
+{
+    struct rrc_buffer buffer;
+    rrc_buffer_init(&buffer);
+    RRC_TEST_ASSERT(buffer.data == NULL && buffer.len == 0 && buffer.capacity == 0);
+    rrc_buffer_free(&buffer);
+}
+
+static void test_append_grows_geometrically()
+{
+    struct rrc_buffer buffer;
+    rrc_buffer_init(&buffer);
+
+    u8 chunk[100];
+    size_t total = 0;
+    int reallocations = 0;
+    size_t capacity = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        memset(chunk, i & 0xff, sizeof(chunk));
+        RRC_TEST_ASSERT_OK(rrc_buffer_append(&buffer, chunk, sizeof(chunk)));
+        total += sizeof(chunk);
+
+        RRC_TEST_ASSERT(buffer.len == total);
+        RRC_TEST_ASSERT(buffer.capacity >= buffer.len);
+        if (buffer.capacity != capacity)
+        {
+            /* Starts at the minimum capacity and then only ever doubles. */
+            RRC_TEST_ASSERT(capacity == 0 ? buffer.capacity == 1024 : buffer.capacity == capacity * 2);
+            capacity = buffer.capacity;
+            reallocations++;
+        }
+    }
+
+    /* 100000 bytes fit in 1024 * 2^7, so that's 8 allocations in total. */
+    RRC_TEST_ASSERT(reallocations == 8);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        for (int j = 0; j < 100; j++)
+        {
+            RRC_TEST_ASSERT(buffer.data[i * 100 + j] == (i & 0xff));
+        }
+    }
+
+    rrc_buffer_free(&buffer);
+    RRC_TEST_ASSERT(buffer.data == NULL && buffer.len == 0 && buffer.capacity == 0);
+}
+
+static void test_append_empty()
+{
+    struct rrc_buffer buffer;
+    rrc_buffer_init(&buffer);
+    RRC_TEST_ASSERT_OK(rrc_buffer_append(&buffer, "", 0));
+    RRC_TEST_ASSERT(buffer.len == 0);
+    rrc_buffer_free(&buffer);
+}
+
+static void test_reserve_avoids_growth()
+{
+    struct rrc_buffer buffer;
+    rrc_buffer_init(&buffer);
+
+    RRC_TEST_ASSERT_OK(rrc_buffer_reserve(&buffer, 5000));
+    RRC_TEST_ASSERT(buffer.capacity == 5000 && buffer.len == 0);
+    u8 *data = buffer.data;
+
+    u8 chunk[1000] = {0};
+    for (int i = 0; i < 5; i++)
+    {
+        RRC_TEST_ASSERT_OK(rrc_buffer_append(&buffer, chunk, sizeof(chunk)));
+    }
+    RRC_TEST_ASSERT(buffer.data == data && buffer.capacity == 5000 && buffer.len == 5000);
+
+    /* Reserving less than there already is never shrinks the buffer. */
+    RRC_TEST_ASSERT_OK(rrc_buffer_reserve(&buffer, 10));
+    RRC_TEST_ASSERT(buffer.capacity == 5000 && buffer.len == 5000);
+
+    /* One more byte doubles the reserved capacity. */
+    RRC_TEST_ASSERT_OK(rrc_buffer_append(&buffer, chunk, 1));
+    RRC_TEST_ASSERT(buffer.capacity == 10000 && buffer.len == 5001);
+
+    rrc_buffer_free(&buffer);
+}
+
+static void test_append_overflow()
+{
+    struct rrc_buffer buffer;
+    rrc_buffer_init(&buffer);
+
+    /* Pretend the buffer is as full as it can get, which must be caught before anything is allocated. */
+    buffer.len = SIZE_MAX;
+    RRC_TEST_ASSERT_ERR(rrc_buffer_append(&buffer, "x", 1));
+    RRC_TEST_ASSERT(buffer.data == NULL && buffer.len == SIZE_MAX);
+
+    rrc_buffer_init(&buffer);
+}
+
+static void test_append_capacity_overflow()
+{
+    struct rrc_buffer buffer;
+    rrc_buffer_init(&buffer);
+
+    /* Doubling this capacity wraps around to 0, which must neither loop forever nor shrink the buffer.
+       The allocation of what's left can't succeed either, so the append fails. */
+    buffer.capacity = SIZE_MAX / 2 + 1;
+    buffer.len = buffer.capacity;
+    RRC_TEST_ASSERT_ERR(rrc_buffer_append(&buffer, "x", 1));
+    RRC_TEST_ASSERT(buffer.data == NULL && buffer.capacity == SIZE_MAX / 2 + 1);
+
+    rrc_buffer_init(&buffer);
+}
+
+static void test_take_string()
+{
+    struct rrc_buffer buffer;
+    rrc_buffer_init(&buffer);
+
+    RRC_TEST_ASSERT_OK(rrc_buffer_append(&buffer, "hello", 5));
+    RRC_TEST_ASSERT_OK(rrc_buffer_append(&buffer, ", world", 7));
+
+    char *str = rrc_buffer_take_string(&buffer);
+    RRC_TEST_ASSERT(str != NULL && strcmp(str, "hello, world") == 0);
+
+    /* The buffer is handed over, so it's empty and can be reused. */
+    RRC_TEST_ASSERT(buffer.data == NULL && buffer.len == 0 && buffer.capacity == 0);
+    RRC_TEST_ASSERT_OK(rrc_buffer_append(&buffer, "again", 5));
+    char *again = rrc_buffer_take_string(&buffer);
+    RRC_TEST_ASSERT(again != NULL && strcmp(again, "again") == 0);
+
+    free(str);
+    free(again);
+}
+
+static void test_take_string_empty()
+{
+    struct rrc_buffer buffer;
+    rrc_buffer_init(&buffer);
+
+    char *str = rrc_buffer_take_string(&buffer);
+    RRC_TEST_ASSERT(str != NULL && str[0] == '\0');
+    free(str);
+}
+
+static void test_take_string_exact_capacity()
+{
+    struct rrc_buffer buffer;
+    rrc_buffer_init(&buffer);
+
+    /* No room left for the terminator, so taking the string has to grow the buffer. */
+    RRC_TEST_ASSERT_OK(rrc_buffer_reserve(&buffer, 4));
+    RRC_TEST_ASSERT_OK(rrc_buffer_append(&buffer, "abcd", 4));
+    RRC_TEST_ASSERT(buffer.capacity == 4);
+
+    char *str = rrc_buffer_take_string(&buffer);
+    RRC_TEST_ASSERT(str != NULL && strcmp(str, "abcd") == 0);
+    free(str);
+}
+
+int main()
+{
+    RRC_TEST_RUN(test_init_is_empty);
+    RRC_TEST_RUN(test_append_grows_geometrically);
+    RRC_TEST_RUN(test_append_empty);
+    RRC_TEST_RUN(test_reserve_avoids_growth);
+    RRC_TEST_RUN(test_append_overflow);
+    RRC_TEST_RUN(test_append_capacity_overflow);
+    RRC_TEST_RUN(test_take_string);
+    RRC_TEST_RUN(test_take_string_empty);
+    RRC_TEST_RUN(test_take_string_exact_capacity);
+    return 0;
+}
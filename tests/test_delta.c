@@ -0,0 +1,539 @@
+/*
+    test_delta.c - tests of delta patches and their update transactions
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "test.h"
+
+/* Included rather than linked, to get at the patch applier. */
+#include "../source/update/delta.c"
+
+/* The tests run in a scratch directory, so this is where the patch generator is found from there. */
+static char _test_mkdelta[PATH_MAX];
+static int _test_current_version;
+static unsigned long _test_sd_free = ULONG_MAX;
+
+struct rrc_result rrc_update_set_current_version(int version)
+{
+    _test_current_version = version;
+    return rrc_result_success;
+}
+
+struct rrc_result sd_get_free_space(unsigned long *res)
+{
+    *res = _test_sd_free;
+    return rrc_result_success;
+}
+
+static void _test_write_file(const char *path, const void *data, u32 len)
+{
+    RRC_TEST_ASSERT_OK(rrc_update_create_parent_dirs(path));
+    FILE *file = fopen(path, "wb");
+    RRC_TEST_ASSERT(file != NULL && fwrite(data, 1, len, file) == len && fclose(file) == 0);
+}
+
+static bool _test_exists(const char *path)
+{
+    struct stat sb;
+    return stat(path, &sb) == 0;
+}
+
+/* A patch being put together by a test. */
+struct _test_patch
+{
+    u8 data[1024];
+    u32 len;
+};
+
+static void _test_patch_put32(struct _test_patch *patch, u32 v)
+{
+    u8 bytes[4] = {v >> 24, v >> 16, v >> 8, v};
+    memcpy(patch->data + patch->len, bytes, 4);
+    patch->len += 4;
+}
+
+static void _test_patch_header(struct _test_patch *patch, u32 magic, u32 version, u32 new_size)
+{
+    patch->len = 0;
+    _test_patch_put32(patch, magic);
+    _test_patch_put32(patch, version);
+    _test_patch_put32(patch, new_size);
+}
+
+static void _test_patch_copy(struct _test_patch *patch, u32 offset, u32 len)
+{
+    patch->data[patch->len++] = _RRC_DELTA_OP_COPY;
+    _test_patch_put32(patch, offset);
+    _test_patch_put32(patch, len);
+}
+
+static void _test_patch_add(struct _test_patch *patch, const char *data)
+{
+    u32 len = strlen(data);
+    patch->data[patch->len++] = _RRC_DELTA_OP_ADD;
+    _test_patch_put32(patch, len);
+    memcpy(patch->data + patch->len, data, len);
+    patch->len += len;
+}
+
+struct _test_applied
+{
+    /* Error the applier stopped with, if any */
+    bool failed;
+    bool complete;
+    u8 *data;
+    u32 len;
+    u32 crc;
+};
+
+/* Applies `patch' to `base' like a download would, handing it over in pieces of `chunk' bytes. */
+static struct _test_applied _test_apply(const void *base, u32 base_len, const u8 *patch, u32 patch_len, u32 chunk, u32 new_size)
+{
+    struct _rrc_delta_write_ctx ctx = {
+        .state = _RRC_DELTA_STATE_HEADER,
+        .crc = crc32(0, Z_NULL, 0),
+        .new_size = new_size,
+        .res = rrc_result_success,
+    };
+    ctx.base = tmpfile();
+    ctx.out = tmpfile();
+    RRC_TEST_ASSERT(ctx.base != NULL && ctx.out != NULL);
+    RRC_TEST_ASSERT(fwrite(base, 1, base_len, ctx.base) == base_len);
+
+    struct _test_applied applied = {0};
+    for (u32 off = 0; off < patch_len && !applied.failed; off += chunk)
+    {
+        u32 len = patch_len - off < chunk ? patch_len - off : chunk;
+        applied.failed = _rrc_delta_write_data_callback((char *)patch + off, 1, len, &ctx) != len;
+    }
+
+    RRC_TEST_ASSERT(applied.failed == rrc_result_is_error(ctx.res));
+    rrc_result_free(ctx.res);
+    applied.complete = _rrc_delta_patch_complete(&ctx);
+    applied.crc = ctx.crc;
+
+    applied.len = ftell(ctx.out);
+    RRC_TEST_ASSERT(applied.len == ctx.written);
+    applied.data = malloc(applied.len + 1);
+    rewind(ctx.out);
+    RRC_TEST_ASSERT(applied.data != NULL && fread(applied.data, 1, applied.len, ctx.out) == applied.len);
+
+    fclose(ctx.base);
+    fclose(ctx.out);
+    return applied;
+}
+
+static const char _test_base[] = "0123456789abcdef";
+
+static void test_copy_and_add()
+{
+    struct _test_patch patch;
+    _test_patch_header(&patch, _RRC_DELTA_PATCH_MAGIC, _RRC_DELTA_PATCH_VERSION, 11);
+    _test_patch_copy(&patch, 4, 6);
+    _test_patch_add(&patch, "XYZ");
+    _test_patch_add(&patch, "");
+    _test_patch_copy(&patch, 0, 2);
+    _test_patch_copy(&patch, 16, 0);
+
+    /* Every record straddles two pieces for some chunk size. */
+    for (u32 chunk = 1; chunk <= patch.len; chunk++)
+    {
+        struct _test_applied applied = _test_apply(_test_base, 16, patch.data, patch.len, chunk, 11);
+        RRC_TEST_ASSERT(!applied.failed && applied.complete);
+        RRC_TEST_ASSERT(applied.len == 11 && memcmp(applied.data, "456789XYZ01", 11) == 0);
+        RRC_TEST_ASSERT(applied.crc == crc32(crc32(0, Z_NULL, 0), applied.data, applied.len));
+        free(applied.data);
+    }
+}
+
+static void test_copy_out_of_bounds()
+{
+    u32 ranges[][2] = {{10, 7}, {16, 1}, {1000, 1}, {0xffffffff, 1}, {8, 0xfffffff8}};
+    for (u32 i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++)
+    {
+        struct _test_patch patch;
+        _test_patch_header(&patch, _RRC_DELTA_PATCH_MAGIC, _RRC_DELTA_PATCH_VERSION, 0xffffffff);
+        _test_patch_copy(&patch, ranges[i][0], ranges[i][1]);
+
+        struct _test_applied applied = _test_apply(_test_base, 16, patch.data, patch.len, patch.len, 0xffffffff);
+        RRC_TEST_ASSERT(applied.failed);
+        free(applied.data);
+    }
+}
+
+static void test_truncated()
+{
+    struct _test_patch patch;
+    _test_patch_header(&patch, _RRC_DELTA_PATCH_MAGIC, _RRC_DELTA_PATCH_VERSION, 8);
+    _test_patch_add(&patch, "abc");
+    _test_patch_copy(&patch, 0, 5);
+
+    /* Cut anywhere, the patch is either incomplete or falls short of the announced size, which `_rrc_delta_fetch_into' rejects. */
+    for (u32 len = 0; len < patch.len; len++)
+    {
+        struct _test_applied applied = _test_apply(_test_base, 16, patch.data, len, 3, 8);
+        RRC_TEST_ASSERT(!applied.failed);
+        RRC_TEST_ASSERT(!applied.complete || applied.len != 8);
+        free(applied.data);
+    }
+}
+
+static void test_invalid()
+{
+    struct _test_patch patch;
+    struct _test_applied applied;
+
+    _test_patch_header(&patch, 0x504b0304, _RRC_DELTA_PATCH_VERSION, 1);
+    _test_patch_add(&patch, "a");
+    applied = _test_apply(_test_base, 16, patch.data, patch.len, 1, 1);
+    RRC_TEST_ASSERT(applied.failed && applied.len == 0);
+    free(applied.data);
+
+    _test_patch_header(&patch, _RRC_DELTA_PATCH_MAGIC, _RRC_DELTA_PATCH_VERSION + 1, 1);
+    _test_patch_add(&patch, "a");
+    applied = _test_apply(_test_base, 16, patch.data, patch.len, patch.len, 1);
+    RRC_TEST_ASSERT(applied.failed && applied.len == 0);
+    free(applied.data);
+
+    _test_patch_header(&patch, _RRC_DELTA_PATCH_MAGIC, _RRC_DELTA_PATCH_VERSION, 1);
+    patch.data[patch.len++] = 2;
+    applied = _test_apply(_test_base, 16, patch.data, patch.len, patch.len, 1);
+    RRC_TEST_ASSERT(applied.failed);
+    free(applied.data);
+
+    /* Produces more than the header announces */
+    _test_patch_header(&patch, _RRC_DELTA_PATCH_MAGIC, _RRC_DELTA_PATCH_VERSION, 4);
+    _test_patch_add(&patch, "abc");
+    _test_patch_copy(&patch, 0, 2);
+    applied = _test_apply(_test_base, 16, patch.data, patch.len, 4, 4);
+    RRC_TEST_ASSERT(applied.failed);
+    free(applied.data);
+
+    /* A copy running past the announced size is refused before anything of it is written */
+    _test_patch_header(&patch, _RRC_DELTA_PATCH_MAGIC, _RRC_DELTA_PATCH_VERSION, 4);
+    _test_patch_copy(&patch, 0, 5);
+    applied = _test_apply(_test_base, 16, patch.data, patch.len, patch.len, 4);
+    RRC_TEST_ASSERT(applied.failed && applied.len == 0);
+    free(applied.data);
+
+    /* The header announces a different size than the manifest */
+    _test_patch_header(&patch, _RRC_DELTA_PATCH_MAGIC, _RRC_DELTA_PATCH_VERSION, 5);
+    _test_patch_add(&patch, "abcd");
+    applied = _test_apply(_test_base, 16, patch.data, patch.len, patch.len, 4);
+    RRC_TEST_ASSERT(applied.failed && applied.len == 0);
+    free(applied.data);
+}
+
+static void test_parse_entry()
+{
+    struct _rrc_delta_entry entry;
+    char *valid[] = {"a.szs", "0badf00d", "DEADBEEF", "12", "http://patch/", "http://full/"};
+    RRC_TEST_ASSERT(_rrc_delta_parse_entry(valid, &entry));
+    RRC_TEST_ASSERT(entry.has_patch && entry.base_crc == 0x0badf00d && entry.new_crc == 0xdeadbeef && entry.new_size == 12);
+
+    char *no_base[] = {"a.szs", "-", "0", "0", "-", "http://full/"};
+    RRC_TEST_ASSERT(_rrc_delta_parse_entry(no_base, &entry));
+    RRC_TEST_ASSERT(!entry.has_patch && entry.new_crc == 0 && entry.new_size == 0);
+
+    /* Anything that isn't entirely a number must not silently become 0 (or some other number) */
+    const char *bad_crcs[] = {"", "-", "xyz", "12g", "-1", "+1", "100000000"};
+    const char *bad_sizes[] = {"", "-", "12x", "0x10", "-1", "4294967296", "1.5"};
+    for (u32 i = 0; i < sizeof(bad_crcs) / sizeof(bad_crcs[0]); i++)
+    {
+        char *fields[] = {"a.szs", "0", (char *)bad_crcs[i], "12", "-", "http://full/"};
+        RRC_TEST_ASSERT(!_rrc_delta_parse_entry(fields, &entry));
+
+        if (strcmp(bad_crcs[i], "-") != 0)
+        {
+            char *base_fields[] = {"a.szs", (char *)bad_crcs[i], "0", "12", "http://patch/", "http://full/"};
+            RRC_TEST_ASSERT(!_rrc_delta_parse_entry(base_fields, &entry));
+        }
+    }
+    for (u32 i = 0; i < sizeof(bad_sizes) / sizeof(bad_sizes[0]); i++)
+    {
+        char *fields[] = {"a.szs", "0", "0", (char *)bad_sizes[i], "-", "http://full/"};
+        RRC_TEST_ASSERT(!_rrc_delta_parse_entry(fields, &entry));
+    }
+}
+
+static u32 _test_rng_state = 0xdeadbeef;
+
+static u32 _test_rand()
+{
+    u32 x = _test_rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return _test_rng_state = x;
+}
+
+static u8 *_test_read_file(const char *path, u32 *len)
+{
+    FILE *file = fopen(path, "rb");
+    RRC_TEST_ASSERT(file != NULL);
+    struct stat sb;
+    RRC_TEST_ASSERT(fstat(fileno(file), &sb) == 0);
+    u8 *data = malloc(sb.st_size + 1);
+    RRC_TEST_ASSERT(data != NULL && fread(data, 1, sb.st_size, file) == (size_t)sb.st_size);
+    fclose(file);
+    *len = sb.st_size;
+    return data;
+}
+
+#define _TEST_GENERATED_PATCHES 40
+
+/* Round trips random edits of random files through tools/mkdelta.c and the applier. */
+static void test_generated_patches()
+{
+    for (int iter = 0; iter < _TEST_GENERATED_PATCHES; iter++)
+    {
+        /* Low entropy data, so that blocks repeat within the file too */
+        u32 base_len = iter == 0 ? 0 : _test_rand() % 200000;
+        u8 *base = malloc(base_len + 1);
+        for (u32 i = 0; i < base_len; i++)
+        {
+            base[i] = _test_rand() % (iter % 2 == 0 ? 256 : 4);
+        }
+
+        /* Some inserted, removed and replaced ranges */
+        u8 *new = malloc(base_len * 2 + 4096);
+        u32 new_len = 0, pos = 0;
+        while (pos < base_len)
+        {
+            u32 keep = _test_rand() % 30000;
+            keep = keep < base_len - pos ? keep : base_len - pos;
+            memcpy(new + new_len, base + pos, keep);
+            new_len += keep;
+            pos += keep;
+
+            switch (_test_rand() % 3)
+            {
+            case 0:
+                for (u32 n = _test_rand() % 100; n > 0; n--)
+                {
+                    new[new_len++] = _test_rand();
+                }
+                break;
+            case 1:
+                pos += _test_rand() % 100;
+                break;
+            case 2:
+                for (u32 n = _test_rand() % 100; n > 0 && pos < base_len; n--, pos++)
+                {
+                    new[new_len++] = base[pos] ^ 0x5a;
+                }
+                break;
+            }
+        }
+
+        _test_write_file("base.bin", base, base_len);
+        _test_write_file("new.bin", new, new_len);
+
+        char command[PATH_MAX + 64];
+        snprintf(command, sizeof(command), "%s base.bin new.bin patch.bin", _test_mkdelta);
+        FILE *pipe = popen(command, "r");
+        RRC_TEST_ASSERT(pipe != NULL);
+        u32 base_crc, new_crc, size;
+        RRC_TEST_ASSERT(fscanf(pipe, "%x %x %u", &base_crc, &new_crc, &size) == 3);
+        RRC_TEST_ASSERT(pclose(pipe) == 0);
+        RRC_TEST_ASSERT(base_crc == crc32(crc32(0, Z_NULL, 0), base, base_len));
+        RRC_TEST_ASSERT(new_crc == crc32(crc32(0, Z_NULL, 0), new, new_len) && size == new_len);
+
+        u32 patch_len;
+        u8 *patch = _test_read_file("patch.bin", &patch_len);
+        struct _test_applied applied = _test_apply(base, base_len, patch, patch_len, 1 + _test_rand() % 20000, new_len);
+        RRC_TEST_ASSERT(!applied.failed && applied.complete);
+        RRC_TEST_ASSERT(applied.len == new_len && memcmp(applied.data, new, new_len) == 0 && applied.crc == new_crc);
+
+        /* Mostly copies of the base, so the patch must be much smaller than the file. */
+        if (iter % 2 == 0 && new_len > 100000)
+        {
+            RRC_TEST_ASSERT(patch_len < new_len / 4);
+        }
+
+        free(applied.data);
+        free(patch);
+        free(new);
+        free(base);
+    }
+
+    remove("base.bin");
+    remove("new.bin");
+    remove("patch.bin");
+}
+
+static void test_txn_reset()
+{
+    struct rrc_txn txn;
+    char staged[PATH_MAX];
+    RRC_TEST_ASSERT_OK(rrc_txn_begin(&txn, 420));
+
+    rrc_txn_stage_path("RetroRewind6/a.szs", staged, sizeof(staged));
+    _test_write_file(staged, "a", 1);
+    RRC_TEST_ASSERT_OK(rrc_txn_add_staged(&txn, "RetroRewind6/a.szs", true, 1, 1));
+    RRC_TEST_ASSERT_OK(rrc_txn_add_deleted(&txn, "RetroRewind6/old.szs"));
+
+    RRC_TEST_ASSERT_OK(rrc_txn_reset(&txn));
+    RRC_TEST_ASSERT(txn.count == 0);
+    RRC_TEST_ASSERT(!_test_exists(staged));
+
+    /* Records after a reset go where the old ones were. */
+    rrc_txn_stage_path("RetroRewind6/b.szs", staged, sizeof(staged));
+    _test_write_file(staged, "b", 1);
+    RRC_TEST_ASSERT_OK(rrc_txn_add_staged(&txn, "RetroRewind6/b.szs", true, 2, 1));
+    rrc_txn_free(&txn);
+
+    RRC_TEST_ASSERT_OK(rrc_txn_begin(&txn, 420));
+    RRC_TEST_ASSERT(txn.count == 1 && strcmp(txn.records[0].path, "RetroRewind6/b.szs") == 0);
+
+    struct rrc_installed_manifest installed;
+    rrc_installed_load(&installed);
+    RRC_TEST_ASSERT_OK(rrc_txn_commit(&txn, &installed));
+    rrc_txn_free(&txn);
+    RRC_TEST_ASSERT(_test_current_version == 420);
+    RRC_TEST_ASSERT(_test_exists("RetroRewind6/b.szs") && !_test_exists("RetroRewind6/a.szs"));
+    rrc_installed_free(&installed);
+}
+
+static void test_up_to_date_goes_through_txn()
+{
+    const char *path = "RetroRewind6/c.szs";
+    _test_write_file(path, "new contents", 12);
+    u32 crc = crc32(crc32(0, Z_NULL, 0), (const Bytef *)"new contents", 12);
+    char crc_str[16];
+    snprintf(crc_str, sizeof(crc_str), "%08x", crc);
+
+    struct rrc_installed_manifest installed;
+    rrc_installed_load(&installed);
+    u32 installed_count = installed.count;
+
+    struct rrc_txn txn;
+    RRC_TEST_ASSERT_OK(rrc_txn_begin(&txn, 430));
+
+    /* No downloads happen, so there's no need for a session. */
+    struct _rrc_delta_entry entry;
+    char *fields[] = {(char *)path, "-", crc_str, "12", "-", "http://invalid/"};
+    RRC_TEST_ASSERT(_rrc_delta_parse_entry(fields, &entry));
+    RRC_TEST_ASSERT_OK(_rrc_delta_apply_entry(NULL, &txn, &entry));
+    RRC_TEST_ASSERT(installed.count == installed_count);
+    RRC_TEST_ASSERT(txn.count == 1 && txn.records[0].type == RRC_TXN_RECORD_VERIFIED);
+
+    /* Throwing the update away leaves both the file and the manifest alone. */
+    RRC_TEST_ASSERT_OK(rrc_txn_reset(&txn));
+    RRC_TEST_ASSERT(_test_exists(path) && installed.count == installed_count);
+
+    RRC_TEST_ASSERT_OK(_rrc_delta_apply_entry(NULL, &txn, &entry));
+    RRC_TEST_ASSERT_OK(rrc_txn_commit(&txn, &installed));
+    rrc_txn_free(&txn);
+    RRC_TEST_ASSERT(_test_current_version == 430);
+    RRC_TEST_ASSERT(rrc_installed_matches(&installed, path, crc, 12));
+    rrc_installed_free(&installed);
+
+    /* and it was stored */
+    rrc_installed_load(&installed);
+    RRC_TEST_ASSERT(rrc_installed_matches(&installed, path, crc, 12));
+    rrc_installed_free(&installed);
+}
+
+/* Runs a whole manifest, served from the scratch directory by file:// URLs, against a fresh transaction. */
+static struct rrc_result _test_apply_manifest(const char *manifest, struct rrc_txn *txn)
+{
+    _test_write_file("manifest.txt", manifest, strlen(manifest));
+
+    char cwd[PATH_MAX], url[PATH_MAX + 32];
+    RRC_TEST_ASSERT(getcwd(cwd, sizeof(cwd)) != NULL);
+    snprintf(url, sizeof(url), "file://%s/manifest.txt", cwd);
+
+    struct rrc_update_session session;
+    RRC_TEST_ASSERT_OK(rrc_update_session_init(&session));
+    struct rrc_installed_manifest installed;
+    rrc_installed_load(&installed);
+    RRC_TEST_ASSERT_OK(rrc_txn_begin(txn, 440));
+
+    struct rrc_result res = rrc_delta_apply_manifest(&session, url, 0, 1, &installed, txn);
+
+    rrc_installed_free(&installed);
+    rrc_update_session_cleanup(&session);
+    return res;
+}
+
+static void test_manifest_checked_before_fetching()
+{
+    char cwd[PATH_MAX];
+    RRC_TEST_ASSERT(getcwd(cwd, sizeof(cwd)) != NULL);
+    _test_write_file("full.bin", "full file", 9);
+    u32 crc = crc32(crc32(0, Z_NULL, 0), (const Bytef *)"full file", 9);
+
+    char manifest[2 * PATH_MAX];
+    char staged[PATH_MAX];
+    rrc_txn_stage_path("RetroRewind6/d.szs", staged, sizeof(staged));
+    struct rrc_txn txn;
+
+    /* A malformed size on a later line stops the update before the first file is downloaded */
+    snprintf(manifest, sizeof(manifest), "RetroRewind6/d.szs - %08x 9 - file://%s/full.bin\nRetroRewind6/e.szs - %08x 9x - file://%s/full.bin\n", crc, cwd, crc, cwd);
+    RRC_TEST_ASSERT_ERR(_test_apply_manifest(manifest, &txn));
+    RRC_TEST_ASSERT(txn.count == 0 && !_test_exists(staged));
+    RRC_TEST_ASSERT_OK(rrc_txn_reset(&txn));
+    rrc_txn_free(&txn);
+
+    /* as does too little space for all the files */
+    snprintf(manifest, sizeof(manifest), "RetroRewind6/d.szs - %08x 9 - file://%s/full.bin\nRetroRewind6/e.szs - %08x 9 - file://%s/full.bin\n", crc, cwd, crc, cwd);
+    _test_sd_free = 17;
+    RRC_TEST_ASSERT_ERR(_test_apply_manifest(manifest, &txn));
+    RRC_TEST_ASSERT(txn.count == 0 && !_test_exists(staged));
+    RRC_TEST_ASSERT_OK(rrc_txn_reset(&txn));
+    rrc_txn_free(&txn);
+
+    /* With enough of it, both are downloaded */
+    _test_sd_free = 18;
+    RRC_TEST_ASSERT_OK(_test_apply_manifest(manifest, &txn));
+    RRC_TEST_ASSERT(txn.count == 2 && _test_exists(staged));
+    RRC_TEST_ASSERT_OK(rrc_txn_reset(&txn));
+    rrc_txn_free(&txn);
+
+    _test_sd_free = ULONG_MAX;
+    remove("full.bin");
+    remove("manifest.txt");
+}
+
+int main()
+{
+    RRC_TEST_ASSERT(realpath("build/mkdelta", _test_mkdelta) != NULL);
+
+    char dir[] = "/tmp/rrc-test-delta-XXXXXX";
+    RRC_TEST_ASSERT(mkdtemp(dir) != NULL && chdir(dir) == 0);
+    RRC_TEST_ASSERT(mkdir("RetroRewindChannel", 0777) == 0);
+
+    RRC_TEST_RUN(test_copy_and_add);
+    RRC_TEST_RUN(test_copy_out_of_bounds);
+    RRC_TEST_RUN(test_truncated);
+    RRC_TEST_RUN(test_invalid);
+    RRC_TEST_RUN(test_parse_entry);
+    RRC_TEST_RUN(test_generated_patches);
+    RRC_TEST_RUN(test_txn_reset);
+    RRC_TEST_RUN(test_up_to_date_goes_through_txn);
+    RRC_TEST_RUN(test_manifest_checked_before_fetching);
+
+    char command[64];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    return system(command);
+}
@@ -0,0 +1,210 @@
+/*
+    test_extractfile.c - tests and benchmark of the files extracted updates are written to
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "test.h"
+#include "../source/update/extractfile.h"
+
+static off_t _test_size(const char *path)
+{
+    struct stat sb;
+    RRC_TEST_ASSERT(stat(path, &sb) == 0);
+    return sb.st_size;
+}
+
+static void test_creates_parent_dirs()
+{
+    FILE *file;
+    RRC_TEST_ASSERT_OK(rrc_update_open_extract_file("a/b/c/file.bin", &file));
+    RRC_TEST_ASSERT(fputs("x", file) >= 0);
+    RRC_TEST_ASSERT(rrc_update_close_extract_file(file) == 0);
+    RRC_TEST_ASSERT(_test_size("a/b/c/file.bin") == 1);
+
+    /* One after another is fine, of course. */
+    RRC_TEST_ASSERT_OK(rrc_update_open_extract_file("a/b/d/file.bin", &file));
+    RRC_TEST_ASSERT(rrc_update_close_extract_file(file) == 0);
+}
+
+static void test_forget_parent_dirs()
+{
+    RRC_TEST_ASSERT(remove("a/b/c/file.bin") == 0 && rmdir("a/b/c") == 0);
+
+    /* Still believed to exist, which is what saves the lookups during an update */
+    FILE *file;
+    RRC_TEST_ASSERT_ERR(rrc_update_open_extract_file("a/b/c/file.bin", &file));
+
+    rrc_update_forget_parent_dirs();
+    RRC_TEST_ASSERT_OK(rrc_update_open_extract_file("a/b/c/file.bin", &file));
+    RRC_TEST_ASSERT(rrc_update_close_extract_file(file) == 0);
+}
+
+static void test_writes_are_buffered()
+{
+    static u8 data[RRC_UPDATE_IO_BUFFER_SIZE + 4096];
+    memset(data, 0xab, sizeof(data));
+
+    FILE *file;
+    RRC_TEST_ASSERT_OK(rrc_update_open_extract_file("buffered.bin", &file));
+    for (u32 off = 0; off < RRC_UPDATE_IO_BUFFER_SIZE - 4096; off += 4096)
+    {
+        RRC_TEST_ASSERT(fwrite(data, 1, 4096, file) == 4096);
+    }
+    /* Nothing reached the file yet, where stdio's default buffer would have written it out already. */
+    RRC_TEST_ASSERT(_test_size("buffered.bin") == 0);
+
+    RRC_TEST_ASSERT(fwrite(data, 1, 8192, file) == 8192);
+    RRC_TEST_ASSERT(_test_size("buffered.bin") >= RRC_UPDATE_IO_BUFFER_SIZE);
+
+    RRC_TEST_ASSERT(rrc_update_close_extract_file(file) == 0);
+    RRC_TEST_ASSERT(_test_size("buffered.bin") == RRC_UPDATE_IO_BUFFER_SIZE + 4096);
+    remove("buffered.bin");
+}
+
+/* Runs `fn' in a child process and returns whether it stopped the launcher like a failed assertion does. */
+static bool _test_is_fatal(void (*fn)())
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    RRC_TEST_ASSERT(pid >= 0);
+    if (pid == 0)
+    {
+        /* The message of the failed assertion isn't interesting here. */
+        RRC_TEST_ASSERT(freopen("/dev/null", "w", stdout) != NULL);
+        fn();
+        _exit(0);
+    }
+
+    int status;
+    RRC_TEST_ASSERT(waitpid(pid, &status, 0) == pid);
+    return WIFEXITED(status) && WEXITSTATUS(status) == 1;
+}
+
+static void _test_open_two()
+{
+    FILE *first, *second;
+    RRC_TEST_ASSERT_OK(rrc_update_open_extract_file("first.bin", &first));
+    rrc_update_open_extract_file("second.bin", &second);
+}
+
+static void _test_close_twice()
+{
+    FILE *file;
+    RRC_TEST_ASSERT_OK(rrc_update_open_extract_file("first.bin", &file));
+    rrc_update_close_extract_file(file);
+    rrc_update_close_extract_file(stdin);
+}
+
+static void test_single_open_file_enforced()
+{
+    RRC_TEST_ASSERT(_test_is_fatal(_test_open_two));
+    RRC_TEST_ASSERT(_test_is_fatal(_test_close_twice));
+    remove("first.bin");
+}
+
+/* About the size of the largest file in a pack update */
+#define _TEST_WRITE_SIZE (8 * 1024 * 1024)
+
+/* Write system calls this process made so far, or 0 if the system doesn't tell. */
+static u64 _test_write_calls()
+{
+    u64 calls = 0;
+    FILE *io = fopen("/proc/self/io", "r");
+    if (io != NULL)
+    {
+        char line[64];
+        while (fgets(line, sizeof(line), io) != NULL)
+        {
+            if (sscanf(line, "syscw: %llu", (unsigned long long *)&calls) == 1)
+            {
+                break;
+            }
+        }
+        fclose(io);
+    }
+
+    return calls;
+}
+
+/* Writes _TEST_WRITE_SIZE bytes in 4 KiB pieces, like streamed and delta updates do, and returns how many writes reached the file. */
+static u64 _test_count_writes(bool extract_file)
+{
+    static u8 data[4096];
+    u64 calls = _test_write_calls();
+
+    FILE *file;
+    if (extract_file)
+    {
+        RRC_TEST_ASSERT_OK(rrc_update_open_extract_file("counted.bin", &file));
+    }
+    else
+    {
+        file = fopen("counted.bin", "w");
+        RRC_TEST_ASSERT(file != NULL);
+    }
+
+    for (u32 off = 0; off < _TEST_WRITE_SIZE; off += sizeof(data))
+    {
+        RRC_TEST_ASSERT(fwrite(data, 1, sizeof(data), file) == sizeof(data));
+    }
+
+    RRC_TEST_ASSERT((extract_file ? rrc_update_close_extract_file(file) : fclose(file)) == 0);
+    calls = _test_write_calls() - calls;
+    RRC_TEST_ASSERT(_test_size("counted.bin") == _TEST_WRITE_SIZE);
+    remove("counted.bin");
+    return calls;
+}
+
+/*
+    What matters on the Wii is the amount of writes, since each one that reaches libfat is far more
+    expensive than on a computer: with the shared buffer, a file is written in whole buffers only.
+    How fast those writes are on an SD card can't be told from here.
+*/
+static void test_write_calls()
+{
+    if (_test_write_calls() == 0)
+    {
+        printf("    write calls aren't counted on this system, skipped\n");
+        return;
+    }
+
+    u64 shared = _test_count_writes(true);
+    u64 stdio = _test_count_writes(false);
+    RRC_TEST_ASSERT(shared <= _TEST_WRITE_SIZE / RRC_UPDATE_IO_BUFFER_SIZE + 1);
+    RRC_TEST_ASSERT(shared * 8 <= stdio);
+}
+
+int main()
+{
+    char dir[] = "/tmp/rrc-test-extractfile-XXXXXX";
+    RRC_TEST_ASSERT(mkdtemp(dir) != NULL && chdir(dir) == 0);
+
+    RRC_TEST_RUN(test_creates_parent_dirs);
+    RRC_TEST_RUN(test_forget_parent_dirs);
+    RRC_TEST_RUN(test_writes_are_buffered);
+    RRC_TEST_RUN(test_single_open_file_enforced);
+    RRC_TEST_RUN(test_write_calls);
+
+    rrc_update_forget_parent_dirs();
+    char command[64];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    return system(command);
+}
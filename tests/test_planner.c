@@ -0,0 +1,582 @@
+/*
+    test_planner.c - tests of update planning over synthetic version chains
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "test.h"
+#include "../source/update/planner.h"
+#include "../source/update/txn.h"
+#include "../source/update/versionsfile.h"
+
+/*
+    The planner only sees the updates through range requests on their ZIPs, so the ZIPs are built
+    in memory here and served by the `rrc_update_session_fetch_range' below. The URL of update `i' is "zip:i".
+*/
+
+#define _TEST_MAX_UPDATES 16
+
+struct _test_zip
+{
+    u8 *data;
+    u32 len;
+};
+
+static struct _test_zip _test_zips[_TEST_MAX_UPDATES];
+static int _test_fetches;
+static bool _test_fetch_fails;
+/* A transaction that hasn't staged anything yet */
+static struct rrc_txn _test_no_txn;
+
+struct rrc_result rrc_update_set_current_version(int version)
+{
+    return rrc_result_success;
+}
+
+CURLcode rrc_update_session_fetch_range(struct rrc_update_session *session, const char *url, curl_off_t offset, curl_off_t len, struct rrc_buffer *result)
+{
+    _test_fetches++;
+    if (_test_fetch_fails)
+    {
+        return CURLE_RANGE_ERROR;
+    }
+
+    int idx = atoi(url + strlen("zip:"));
+    RRC_TEST_ASSERT(strncmp(url, "zip:", 4) == 0 && idx >= 0 && idx < _TEST_MAX_UPDATES);
+    struct _test_zip *zip = &_test_zips[idx];
+    RRC_TEST_ASSERT(offset >= 0 && len >= 0 && offset + len <= zip->len);
+
+    rrc_buffer_init(result);
+    RRC_TEST_ASSERT_OK(rrc_buffer_append(result, zip->data + offset, len));
+    return CURLE_OK;
+}
+
+static void _test_put16(u8 *p, u16 v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void _test_put32(u8 *p, u32 v)
+{
+    _test_put16(p, v);
+    _test_put16(p + 2, v >> 16);
+}
+
+struct _test_zip_options
+{
+    /* Bytes before the central directory, standing in for the compressed files. */
+    u32 data_len;
+    u16 comment_len;
+    bool zip64;
+    /* Added to the central directory size in the end record, to damage it. */
+    s32 cd_size_delta;
+};
+
+/* Every file in the test ZIPs holds its own name. */
+static u32 _test_entry_crc(const char *name)
+{
+    return crc32(crc32(0, Z_NULL, 0), (const u8 *)name, strlen(name));
+}
+
+/* Builds the ZIP of update `idx' out of the NULL-terminated list `names'. Only the central directory and its end record are real. */
+static void _test_zip_build(int idx, const char **names, struct _test_zip_options opts)
+{
+    u32 cd_size = 0;
+    for (const char **name = names; *name != NULL; name++)
+    {
+        cd_size += 46 + strlen(*name) + 4;
+    }
+
+    struct _test_zip *zip = &_test_zips[idx];
+    free(zip->data);
+    zip->len = opts.data_len + cd_size + 22 + opts.comment_len;
+    zip->data = calloc(1, zip->len);
+    RRC_TEST_ASSERT(zip->data != NULL);
+
+    u8 *p = zip->data + opts.data_len;
+    for (const char **name = names; *name != NULL; name++)
+    {
+        u16 name_len = strlen(*name);
+        _test_put32(p, 0x02014b50);
+        _test_put32(p + 16, _test_entry_crc(*name));
+        _test_put32(p + 20, name_len);
+        _test_put32(p + 24, name_len);
+        _test_put16(p + 28, name_len);
+        _test_put16(p + 30, 4);
+        memcpy(p + 46, *name, name_len);
+        /* an empty extra field record */
+        _test_put16(p + 46 + name_len, 0xcafe);
+        p += 46 + name_len + 4;
+    }
+
+    u16 count = 0;
+    while (names[count] != NULL)
+    {
+        count++;
+    }
+
+    _test_put32(p, 0x06054b50);
+    _test_put16(p + 8, opts.zip64 ? 0xffff : count);
+    _test_put16(p + 10, opts.zip64 ? 0xffff : count);
+    _test_put32(p + 12, cd_size + opts.cd_size_delta);
+    _test_put32(p + 16, opts.data_len);
+    _test_put16(p + 20, opts.comment_len);
+    /* a comment that contains a fake end record, which must not be picked up */
+    if (opts.comment_len >= 22)
+    {
+        _test_put32(p + 22, 0x06054b50);
+    }
+}
+
+static struct _test_zip_options _test_plain = {.data_len = 100};
+
+struct _test_chain
+{
+    struct rrc_update_state state;
+    char *urls[_TEST_MAX_UPDATES];
+    int versions[_TEST_MAX_UPDATES];
+    curl_off_t sizes[_TEST_MAX_UPDATES];
+    struct rrc_versionsfile_deleted_file deleted[64];
+};
+
+/* Sets up `num_updates' updates of versions 101, 102, ..., whose ZIPs must already be built. */
+static void _test_chain_init(struct _test_chain *chain, int num_updates)
+{
+    memset(chain, 0, sizeof(*chain));
+    for (int i = 0; i < num_updates; i++)
+    {
+        char url[16];
+        snprintf(url, sizeof(url), "zip:%d", i);
+        chain->urls[i] = strdup(url);
+        chain->versions[i] = 101 + i;
+        chain->sizes[i] = _test_zips[i].len;
+    }
+
+    chain->state.num_updates = num_updates;
+    chain->state.update_urls = chain->urls;
+    chain->state.update_versions = chain->versions;
+    chain->state.update_sizes = chain->sizes;
+    chain->state.current_version = 100;
+    chain->state.deleted_files = chain->deleted;
+}
+
+/* Deletions must be added in order of their version. */
+static void _test_chain_delete(struct _test_chain *chain, int version, const char *path)
+{
+    struct rrc_versionsfile_deleted_file *file = &chain->deleted[chain->state.num_deleted_files++];
+    file->version = version;
+    file->path = (char *)path;
+}
+
+static void _test_chain_free(struct _test_chain *chain)
+{
+    for (int i = 0; i < chain->state.num_updates; i++)
+    {
+        free(chain->urls[i]);
+    }
+}
+
+static void test_single_update()
+{
+    const char *names[] = {"RetroRewind6/a.szs", "RetroRewind6/", "RetroRewind6/b.szs", NULL};
+    _test_zip_build(0, names, _test_plain);
+
+    struct _test_chain chain;
+    _test_chain_init(&chain, 1);
+
+    struct rrc_update_plan plan;
+    RRC_TEST_ASSERT_OK(rrc_update_plan_create(&chain.state, &_test_no_txn, &plan));
+    /* the directory entry doesn't count */
+    RRC_TEST_ASSERT(plan.num_needed[0] == 2);
+    RRC_TEST_ASSERT(plan.superseded[0].count == 0);
+
+    rrc_update_plan_free(&plan);
+    _test_chain_free(&chain);
+}
+
+static void test_later_update_supersedes()
+{
+    const char *v1[] = {"a", "b", "c", NULL};
+    const char *v2[] = {"b", NULL};
+    const char *v3[] = {"c", "d", NULL};
+    _test_zip_build(0, v1, _test_plain);
+    _test_zip_build(1, v2, _test_plain);
+    _test_zip_build(2, v3, _test_plain);
+
+    struct _test_chain chain;
+    _test_chain_init(&chain, 3);
+
+    struct rrc_update_plan plan;
+    RRC_TEST_ASSERT_OK(rrc_update_plan_create(&chain.state, &_test_no_txn, &plan));
+    RRC_TEST_ASSERT(plan.num_needed[0] == 1 && plan.superseded[0].count == 2);
+    RRC_TEST_ASSERT(!rrc_strset_contains(&plan.superseded[0], "a"));
+    RRC_TEST_ASSERT(rrc_strset_contains(&plan.superseded[0], "b") && rrc_strset_contains(&plan.superseded[0], "c"));
+    RRC_TEST_ASSERT(plan.num_needed[1] == 1 && plan.superseded[1].count == 0);
+    RRC_TEST_ASSERT(plan.num_needed[2] == 2 && plan.superseded[2].count == 0);
+
+    rrc_update_plan_free(&plan);
+    _test_chain_free(&chain);
+}
+
+static void test_deletions()
+{
+    const char *v1[] = {"a", "b", NULL};
+    const char *v2[] = {"c", NULL};
+    const char *v3[] = {"a", NULL};
+    _test_zip_build(0, v1, _test_plain);
+    _test_zip_build(1, v2, _test_plain);
+    _test_zip_build(2, v3, _test_plain);
+
+    struct _test_chain chain;
+    _test_chain_init(&chain, 3);
+    /* older than any update, never touched */
+    _test_chain_delete(&chain, 99, "old");
+    /* `a' is brought back by 103, `b' is gone for good */
+    _test_chain_delete(&chain, 102, "a");
+    _test_chain_delete(&chain, 102, "b");
+    /* deleted by the same update that writes it */
+    _test_chain_delete(&chain, 102, "c");
+
+    struct rrc_update_plan plan;
+    RRC_TEST_ASSERT_OK(rrc_update_plan_create(&chain.state, &_test_no_txn, &plan));
+    RRC_TEST_ASSERT(plan.num_needed[0] == 0);
+    RRC_TEST_ASSERT(plan.num_needed[1] == 0 && rrc_strset_contains(&plan.superseded[1], "c"));
+    RRC_TEST_ASSERT(plan.num_needed[2] == 1);
+    RRC_TEST_ASSERT(!plan.delete_needed[0]);
+    RRC_TEST_ASSERT(!plan.delete_needed[1]);
+    RRC_TEST_ASSERT(plan.delete_needed[2]);
+    RRC_TEST_ASSERT(plan.delete_needed[3]);
+
+    rrc_update_plan_free(&plan);
+    _test_chain_free(&chain);
+}
+
+static void test_resumes_at_current_update()
+{
+    const char *v1[] = {"a", NULL};
+    const char *v2[] = {"a", "b", NULL};
+    _test_zip_build(0, v1, _test_plain);
+    _test_zip_build(1, v2, _test_plain);
+
+    struct _test_chain chain;
+    _test_chain_init(&chain, 2);
+    chain.state.current_update_num = 1;
+
+    _test_fetches = 0;
+    struct rrc_update_plan plan;
+    RRC_TEST_ASSERT_OK(rrc_update_plan_create(&chain.state, &_test_no_txn, &plan));
+    RRC_TEST_ASSERT(_test_fetches == 1);
+    RRC_TEST_ASSERT(plan.num_needed[1] == 2);
+
+    rrc_update_plan_free(&plan);
+    _test_chain_free(&chain);
+}
+
+/* Stages `name' the way an earlier attempt would have, with the given CRC32. */
+static void _test_stage(struct rrc_txn *txn, const char *name, u32 crc, bool write_file)
+{
+    if (write_file)
+    {
+        char path[PATH_MAX];
+        rrc_txn_stage_path(name, path, sizeof(path));
+        FILE *file = fopen(path, "wb");
+        RRC_TEST_ASSERT(file != NULL && fputs(name, file) >= 0 && fclose(file) == 0);
+    }
+    RRC_TEST_ASSERT_OK(rrc_txn_add_staged(txn, name, true, crc, strlen(name)));
+}
+
+static void test_skips_already_staged()
+{
+    const char *v1[] = {"a", "b", NULL};
+    const char *v2[] = {"b", "c", "e", NULL};
+    const char *v3[] = {"d", NULL};
+    _test_zip_build(0, v1, _test_plain);
+    _test_zip_build(1, v2, _test_plain);
+    _test_zip_build(2, v3, _test_plain);
+
+    struct _test_chain chain;
+    _test_chain_init(&chain, 3);
+
+    RRC_TEST_ASSERT(mkdir("RetroRewindChannel", 0777) == 0 && mkdir(RRC_TXN_STAGING_DIR, 0777) == 0);
+
+    /* An attempt at the update to 103 that was interrupted */
+    struct rrc_txn txn;
+    RRC_TEST_ASSERT_OK(rrc_txn_begin(&txn, 103));
+    _test_stage(&txn, "a", _test_entry_crc("a"), true);
+    /* staged twice, only the second copy counts */
+    _test_stage(&txn, "b", 0, true);
+    _test_stage(&txn, "b", _test_entry_crc("b"), true);
+    /* a copy that doesn't match */
+    _test_stage(&txn, "c", _test_entry_crc("c") ^ 1, true);
+    /* recorded, but the file didn't make it */
+    _test_stage(&txn, "d", _test_entry_crc("d"), false);
+    /* not tracked, so its CRC isn't known */
+    RRC_TEST_ASSERT_OK(rrc_txn_add_staged(&txn, "e", false, 0, 0));
+    rrc_txn_free(&txn);
+
+    RRC_TEST_ASSERT_OK(rrc_txn_begin(&txn, 103));
+    RRC_TEST_ASSERT(txn.count == 6);
+
+    struct rrc_update_plan plan;
+    RRC_TEST_ASSERT_OK(rrc_update_plan_create(&chain.state, &txn, &plan));
+    /* `a' is staged already and `b' replaced later */
+    RRC_TEST_ASSERT(plan.num_needed[0] == 0);
+    RRC_TEST_ASSERT(plan.num_needed[1] == 2 && plan.superseded[1].count == 1 && rrc_strset_contains(&plan.superseded[1], "b"));
+    RRC_TEST_ASSERT(plan.num_needed[2] == 1);
+    rrc_update_plan_free(&plan);
+
+    /* An attempt at some other version doesn't count */
+    rrc_txn_free(&txn);
+    RRC_TEST_ASSERT_OK(rrc_txn_begin(&txn, 104));
+    RRC_TEST_ASSERT_OK(rrc_update_plan_create(&chain.state, &txn, &plan));
+    RRC_TEST_ASSERT(plan.num_needed[0] == 1 && plan.num_needed[1] == 3 && plan.num_needed[2] == 1);
+    rrc_update_plan_free(&plan);
+
+    rrc_txn_free(&txn);
+    _test_chain_free(&chain);
+}
+
+static void test_archive_layouts()
+{
+    const char *names[] = {"a", "b", NULL};
+
+    /* a comment after the end record */
+    struct _test_zip_options comment = {.data_len = 10, .comment_len = 300};
+    _test_zip_build(0, names, comment);
+    /* a tiny archive, smaller than the tail that is requested */
+    struct _test_zip_options tiny = {.data_len = 0};
+    _test_zip_build(1, names, tiny);
+    /* the central directory doesn't fit in the tail and is fetched separately */
+    struct _test_zip_options large = {.data_len = 3 * RRC_UPDATE_PLAN_TAIL_SIZE};
+    const char *many[2001];
+    char storage[2000][48];
+    for (int i = 0; i < 2000; i++)
+    {
+        snprintf(storage[i], sizeof(storage[i]), "RetroRewind6/Race/Course/%04d.szs", i);
+        many[i] = storage[i];
+    }
+    many[2000] = NULL;
+    _test_zip_build(2, many, large);
+
+    struct _test_chain chain;
+    _test_chain_init(&chain, 3);
+
+    _test_fetches = 0;
+    struct rrc_update_plan plan;
+    RRC_TEST_ASSERT_OK(rrc_update_plan_create(&chain.state, &_test_no_txn, &plan));
+    RRC_TEST_ASSERT(_test_fetches == 4);
+    RRC_TEST_ASSERT(plan.num_needed[0] == 0 && plan.num_needed[1] == 2 && plan.num_needed[2] == 2000);
+
+    rrc_update_plan_free(&plan);
+    _test_chain_free(&chain);
+}
+
+static void test_failures()
+{
+    const char *names[] = {"a", NULL};
+    struct _test_chain chain;
+    struct rrc_update_plan plan;
+
+    struct _test_zip_options zip64 = {.data_len = 100, .zip64 = true};
+    _test_zip_build(0, names, zip64);
+    _test_chain_init(&chain, 1);
+    RRC_TEST_ASSERT_ERR(rrc_update_plan_create(&chain.state, &_test_no_txn, &plan));
+    RRC_TEST_ASSERT(plan.superseded == NULL && plan.num_needed == NULL && plan.delete_needed == NULL);
+    _test_chain_free(&chain);
+
+    struct _test_zip_options short_cd = {.data_len = 100, .cd_size_delta = -4};
+    _test_zip_build(0, names, short_cd);
+    _test_chain_init(&chain, 1);
+    RRC_TEST_ASSERT_ERR(rrc_update_plan_create(&chain.state, &_test_no_txn, &plan));
+    _test_chain_free(&chain);
+
+    struct _test_zip_options past_end = {.data_len = 100, .cd_size_delta = 1000};
+    _test_zip_build(0, names, past_end);
+    _test_chain_init(&chain, 1);
+    RRC_TEST_ASSERT_ERR(rrc_update_plan_create(&chain.state, &_test_no_txn, &plan));
+    _test_chain_free(&chain);
+
+    _test_zip_build(0, names, _test_plain);
+    _test_chain_init(&chain, 1);
+    chain.sizes[0] = -1;
+    RRC_TEST_ASSERT_ERR(rrc_update_plan_create(&chain.state, &_test_no_txn, &plan));
+    chain.state.update_sizes = NULL;
+    RRC_TEST_ASSERT_ERR(rrc_update_plan_create(&chain.state, &_test_no_txn, &plan));
+    _test_chain_free(&chain);
+
+    /* no end record at all */
+    _test_chain_init(&chain, 1);
+    memset(_test_zips[0].data, 0, _test_zips[0].len);
+    RRC_TEST_ASSERT_ERR(rrc_update_plan_create(&chain.state, &_test_no_txn, &plan));
+    _test_chain_free(&chain);
+
+    _test_zip_build(0, names, _test_plain);
+    _test_chain_init(&chain, 1);
+    _test_fetch_fails = true;
+    RRC_TEST_ASSERT_ERR(rrc_update_plan_create(&chain.state, &_test_no_txn, &plan));
+    _test_fetch_fails = false;
+    _test_chain_free(&chain);
+}
+
+static u32 _test_rng_state = 0x9e3779b9;
+
+static u32 _test_rand()
+{
+    u32 x = _test_rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return _test_rng_state = x;
+}
+
+#define _TEST_FILES 12
+#define _TEST_CHAINS 2000
+
+static const char *_test_file_names[_TEST_FILES] = {"f0", "f1", "f2", "f3", "f4", "f5", "f6", "f7", "f8", "f9", "f10", "f11"};
+
+/*
+    Builds random chains of updates and checks that applying the plan leaves the same files
+    behind as applying every update one after another, while writing each file at most once.
+    The contents of a file are identified by the update that wrote it.
+*/
+static void test_random_chains()
+{
+    for (int iter = 0; iter < _TEST_CHAINS; iter++)
+    {
+        int num_updates = 1 + _test_rand() % 6;
+        bool writes[_TEST_MAX_UPDATES][_TEST_FILES];
+        for (int i = 0; i < num_updates; i++)
+        {
+            const char *names[_TEST_FILES + 1];
+            int count = 0;
+            for (int f = 0; f < _TEST_FILES; f++)
+            {
+                writes[i][f] = _test_rand() % 3 == 0;
+                if (writes[i][f])
+                {
+                    names[count++] = _test_file_names[f];
+                }
+            }
+            names[count] = NULL;
+            _test_zip_build(i, names, _test_plain);
+        }
+
+        struct _test_chain chain;
+        _test_chain_init(&chain, num_updates);
+        chain.state.current_update_num = _test_rand() % num_updates;
+        for (int i = 0; i < num_updates; i++)
+        {
+            for (int f = 0; f < _TEST_FILES; f++)
+            {
+                if (_test_rand() % 6 == 0)
+                {
+                    _test_chain_delete(&chain, chain.versions[i], _test_file_names[f]);
+                }
+            }
+        }
+
+        /* -1 for missing files, -2 for files from before the first update */
+        int sequential[_TEST_FILES], planned[_TEST_FILES];
+        for (int f = 0; f < _TEST_FILES; f++)
+        {
+            sequential[f] = planned[f] = -2;
+        }
+
+        /* One by one: the files of each ZIP are written, then the ones it deletes removed. */
+        for (int i = chain.state.current_update_num; i < num_updates; i++)
+        {
+            for (int f = 0; f < _TEST_FILES; f++)
+            {
+                if (writes[i][f])
+                {
+                    sequential[f] = i;
+                }
+            }
+            for (int d = 0; d < chain.state.num_deleted_files; d++)
+            {
+                if (chain.deleted[d].version == chain.versions[i])
+                {
+                    sequential[atoi(chain.deleted[d].path + 1)] = -1;
+                }
+            }
+        }
+
+        struct rrc_update_plan plan;
+        RRC_TEST_ASSERT_OK(rrc_update_plan_create(&chain.state, &_test_no_txn, &plan));
+
+        /* Planned: the needed files of every ZIP are written, and all needed deletions happen at the end. */
+        int times_written[_TEST_FILES] = {0};
+        for (int i = chain.state.current_update_num; i < num_updates; i++)
+        {
+            u32 needed = 0;
+            for (int f = 0; f < _TEST_FILES; f++)
+            {
+                if (writes[i][f] && !rrc_strset_contains(&plan.superseded[i], _test_file_names[f]))
+                {
+                    planned[f] = i;
+                    times_written[f]++;
+                    needed++;
+                }
+            }
+            RRC_TEST_ASSERT(needed == plan.num_needed[i]);
+        }
+        for (int d = 0; d < chain.state.num_deleted_files; d++)
+        {
+            if (plan.delete_needed[d])
+            {
+                planned[atoi(chain.deleted[d].path + 1)] = -1;
+            }
+        }
+
+        for (int f = 0; f < _TEST_FILES; f++)
+        {
+            RRC_TEST_ASSERT(planned[f] == sequential[f]);
+            RRC_TEST_ASSERT(times_written[f] <= 1);
+        }
+
+        rrc_update_plan_free(&plan);
+        _test_chain_free(&chain);
+    }
+}
+
+int main()
+{
+    char dir[] = "/tmp/rrc-test-planner-XXXXXX";
+    RRC_TEST_ASSERT(mkdtemp(dir) != NULL && chdir(dir) == 0);
+
+    RRC_TEST_RUN(test_single_update);
+    RRC_TEST_RUN(test_later_update_supersedes);
+    RRC_TEST_RUN(test_deletions);
+    RRC_TEST_RUN(test_resumes_at_current_update);
+    RRC_TEST_RUN(test_skips_already_staged);
+    RRC_TEST_RUN(test_archive_layouts);
+    RRC_TEST_RUN(test_failures);
+    RRC_TEST_RUN(test_random_chains);
+
+    for (int i = 0; i < _TEST_MAX_UPDATES; i++)
+    {
+        free(_test_zips[i].data);
+    }
+
+    char command[64];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    return system(command);
+}
@@ -0,0 +1,373 @@
+/*
+    test_txn.c - tests of recovering interrupted update transactions
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "test.h"
+#include "../source/update/txn.h"
+#include "../source/update/installed.h"
+#include "../source/update/update.h"
+
+/*
+    Every test starts from the same install of version 100 and the staged files of an update to 101,
+    which replaces `a', adds `b', deletes `gone' and finds `same' already up to date. A power loss is
+    simulated by cutting the log of that update short, and the next launch by `rrc_txn_recover'.
+*/
+
+#define _TEST_OLD_VERSION 100
+#define _TEST_NEW_VERSION 101
+
+#define _TEST_A "RetroRewind6/a.szs"
+#define _TEST_B "RetroRewind6/Sub/b.szs"
+#define _TEST_GONE "RetroRewind6/gone.szs"
+#define _TEST_SAME "RetroRewind6/same.szs"
+
+/* Records in the update's log, without the commit record */
+#define _TEST_RECORDS 4
+
+static int _test_version;
+static bool _test_version_fails;
+
+struct rrc_result rrc_update_set_current_version(int version)
+{
+    if (_test_version_fails)
+    {
+        return rrc_result_create_error_errno(EIO, "Failed to write version file");
+    }
+
+    _test_version = version;
+    return rrc_result_success;
+}
+
+static void _test_write_file(const char *path, const char *contents)
+{
+    RRC_TEST_ASSERT_OK(rrc_update_create_parent_dirs(path));
+    FILE *file = fopen(path, "wb");
+    RRC_TEST_ASSERT(file != NULL && fputs(contents, file) >= 0 && fclose(file) == 0);
+}
+
+static bool _test_exists(const char *path)
+{
+    struct stat sb;
+    return stat(path, &sb) == 0;
+}
+
+static void _test_assert_contents(const char *path, const char *contents)
+{
+    char data[64];
+    FILE *file = fopen(path, "rb");
+    RRC_TEST_ASSERT(file != NULL);
+    size_t len = fread(data, 1, sizeof(data), file);
+    fclose(file);
+    RRC_TEST_ASSERT(len == strlen(contents) && memcmp(data, contents, len) == 0);
+}
+
+static u32 _test_crc(const char *contents)
+{
+    return crc32(crc32(0, Z_NULL, 0), (const u8 *)contents, strlen(contents));
+}
+
+static void _test_stage_file(const char *path, const char *contents)
+{
+    char staged[PATH_MAX];
+    rrc_txn_stage_path(path, staged, sizeof(staged));
+    _test_write_file(staged, contents);
+}
+
+/* Puts back the old install with the staged files of the update next to it, and no log. */
+static void _test_setup()
+{
+    RRC_TEST_ASSERT(system("rm -rf RetroRewind6 RetroRewindChannel") == 0);
+    rrc_update_forget_parent_dirs();
+    _test_write_file(_TEST_A, "old a");
+    _test_write_file(_TEST_GONE, "gone");
+    _test_write_file(_TEST_SAME, "same");
+    _test_stage_file(_TEST_A, "new a");
+    _test_stage_file(_TEST_B, "new b");
+    _test_version = _TEST_OLD_VERSION;
+    _test_version_fails = false;
+}
+
+static void _test_add_records(struct rrc_txn *txn, int from, int to)
+{
+    for (int i = from; i < to; i++)
+    {
+        switch (i)
+        {
+        case 0:
+            RRC_TEST_ASSERT_OK(rrc_txn_add_staged(txn, _TEST_A, true, _test_crc("new a"), 5));
+            break;
+        case 1:
+            RRC_TEST_ASSERT_OK(rrc_txn_add_staged(txn, _TEST_B, true, _test_crc("new b"), 5));
+            break;
+        case 2:
+            RRC_TEST_ASSERT_OK(rrc_txn_add_deleted(txn, _TEST_GONE));
+            break;
+        case 3:
+            RRC_TEST_ASSERT_OK(rrc_txn_add_verified(txn, _TEST_SAME, _test_crc("same"), 4));
+            break;
+        }
+    }
+}
+
+static void _test_write_log(const u8 *log, u32 len)
+{
+    FILE *file = fopen(RRC_TXN_PATH, "wb");
+    RRC_TEST_ASSERT(file != NULL && fwrite(log, 1, len, file) == len && fclose(file) == 0);
+}
+
+static u32 _test_log_size()
+{
+    struct stat sb;
+    RRC_TEST_ASSERT(stat(RRC_TXN_PATH, &sb) == 0);
+    return sb.st_size;
+}
+
+/* The complete log of the update, and where each of its records ends. The first boundary is the end of the header. */
+static u8 *_test_log;
+static u32 _test_log_len;
+static u32 _test_boundaries[_TEST_RECORDS + 2];
+
+/* Writes the whole update, but keeps its log by failing the commit at the very end. */
+static void _test_record_log()
+{
+    _test_setup();
+
+    struct rrc_txn txn;
+    RRC_TEST_ASSERT_OK(rrc_txn_begin(&txn, _TEST_NEW_VERSION));
+    _test_boundaries[0] = ftell(txn.log);
+    for (int i = 0; i < _TEST_RECORDS; i++)
+    {
+        _test_add_records(&txn, i, i + 1);
+        _test_boundaries[i + 1] = ftell(txn.log);
+    }
+
+    struct rrc_installed_manifest installed;
+    rrc_installed_load(&installed);
+    _test_version_fails = true;
+    RRC_TEST_ASSERT_ERR(rrc_txn_commit(&txn, &installed));
+    rrc_installed_free(&installed);
+    rrc_txn_free(&txn);
+
+    _test_log_len = _test_log_size();
+    _test_boundaries[_TEST_RECORDS + 1] = _test_log_len;
+    _test_log = malloc(_test_log_len);
+    FILE *file = fopen(RRC_TXN_PATH, "rb");
+    RRC_TEST_ASSERT(_test_log != NULL && file != NULL && fread(_test_log, 1, _test_log_len, file) == _test_log_len);
+    fclose(file);
+}
+
+/* The old install is exactly as it was, and so are the staged files. */
+static void _test_assert_old()
+{
+    RRC_TEST_ASSERT(_test_version == _TEST_OLD_VERSION);
+    _test_assert_contents(_TEST_A, "old a");
+    _test_assert_contents(_TEST_GONE, "gone");
+    _test_assert_contents(_TEST_SAME, "same");
+    RRC_TEST_ASSERT(!_test_exists(_TEST_B));
+
+    char staged[PATH_MAX];
+    rrc_txn_stage_path(_TEST_A, staged, sizeof(staged));
+    _test_assert_contents(staged, "new a");
+    rrc_txn_stage_path(_TEST_B, staged, sizeof(staged));
+    _test_assert_contents(staged, "new b");
+}
+
+/* The update is installed completely, and recorded as such. */
+static void _test_assert_new()
+{
+    RRC_TEST_ASSERT(_test_version == _TEST_NEW_VERSION);
+    _test_assert_contents(_TEST_A, "new a");
+    _test_assert_contents(_TEST_B, "new b");
+    _test_assert_contents(_TEST_SAME, "same");
+    RRC_TEST_ASSERT(!_test_exists(_TEST_GONE));
+    RRC_TEST_ASSERT(!_test_exists(RRC_TXN_PATH));
+
+    char staged[PATH_MAX];
+    rrc_txn_stage_path(_TEST_A, staged, sizeof(staged));
+    RRC_TEST_ASSERT(!_test_exists(staged));
+
+    struct rrc_installed_manifest installed;
+    rrc_installed_load(&installed);
+    RRC_TEST_ASSERT(rrc_installed_matches(&installed, _TEST_A, _test_crc("new a"), 5));
+    RRC_TEST_ASSERT(rrc_installed_matches(&installed, _TEST_B, _test_crc("new b"), 5));
+    RRC_TEST_ASSERT(rrc_installed_matches(&installed, _TEST_SAME, _test_crc("same"), 4));
+    RRC_TEST_ASSERT(!rrc_installed_matches(&installed, _TEST_GONE, _test_crc("gone"), 4));
+    rrc_installed_free(&installed);
+}
+
+/* How many records of the log are complete within its first `len' bytes. */
+static int _test_complete_records(u32 len)
+{
+    int count = 0;
+    while (count < _TEST_RECORDS + 1 && _test_boundaries[count + 1] <= len)
+    {
+        count++;
+    }
+    return count;
+}
+
+/*
+    Cuts the log after every single byte, which covers every record boundary as well as every
+    place in the middle of a record. Only a log with its whole commit record is rolled forward.
+*/
+static void test_cut_everywhere()
+{
+    for (u32 len = 0; len <= _test_log_len; len++)
+    {
+        _test_setup();
+        _test_write_log(_test_log, len);
+
+        RRC_TEST_ASSERT_OK(rrc_txn_recover());
+        if (len == _test_log_len)
+        {
+            _test_assert_new();
+            continue;
+        }
+
+        _test_assert_old();
+        RRC_TEST_ASSERT(_test_log_size() == len);
+
+        /* Resuming the update keeps every complete record and cuts off the torn one. */
+        struct rrc_txn txn;
+        RRC_TEST_ASSERT_OK(rrc_txn_begin(&txn, _TEST_NEW_VERSION));
+        if (len < _test_boundaries[0])
+        {
+            RRC_TEST_ASSERT(txn.count == 0);
+        }
+        else
+        {
+            int complete = _test_complete_records(len);
+            RRC_TEST_ASSERT(txn.count == complete);
+            RRC_TEST_ASSERT(_test_log_size() == _test_boundaries[complete]);
+        }
+        rrc_txn_free(&txn);
+        _test_assert_old();
+    }
+}
+
+/* A commit that is interrupted again while it is being replayed is still finished by the launch after. */
+static void test_replay_twice()
+{
+    _test_setup();
+    _test_write_log(_test_log, _test_log_len);
+
+    _test_version_fails = true;
+    RRC_TEST_ASSERT_ERR(rrc_txn_recover());
+    RRC_TEST_ASSERT(_test_exists(RRC_TXN_PATH) && !_test_exists(_TEST_GONE));
+
+    _test_version_fails = false;
+    RRC_TEST_ASSERT_OK(rrc_txn_recover());
+    _test_assert_new();
+}
+
+static void test_corrupted_records()
+{
+    u8 *log = malloc(_test_log_len);
+    RRC_TEST_ASSERT(log != NULL);
+
+    /* A commit record whose checksum doesn't match was never written completely. */
+    memcpy(log, _test_log, _test_log_len);
+    log[_test_log_len - 1] ^= 0x01;
+    _test_setup();
+    _test_write_log(log, _test_log_len);
+    RRC_TEST_ASSERT_OK(rrc_txn_recover());
+    _test_assert_old();
+
+    struct rrc_txn txn;
+    RRC_TEST_ASSERT_OK(rrc_txn_begin(&txn, _TEST_NEW_VERSION));
+    RRC_TEST_ASSERT(txn.count == _TEST_RECORDS && !txn.committing);
+    rrc_txn_free(&txn);
+
+    /* Neither is anything after a damaged record, even if it's intact itself. */
+    memcpy(log, _test_log, _test_log_len);
+    log[_test_boundaries[2] + 5] ^= 0x20;
+    _test_setup();
+    _test_write_log(log, _test_log_len);
+    RRC_TEST_ASSERT_OK(rrc_txn_recover());
+    _test_assert_old();
+
+    RRC_TEST_ASSERT_OK(rrc_txn_begin(&txn, _TEST_NEW_VERSION));
+    RRC_TEST_ASSERT(txn.count == 2);
+    rrc_txn_free(&txn);
+
+    free(log);
+}
+
+/* An update interrupted in the middle of a record carries on after the last complete one. */
+static void test_resume_after_torn_record()
+{
+    _test_setup();
+    _test_write_log(_test_log, _test_boundaries[2] + 3);
+
+    struct rrc_txn txn;
+    RRC_TEST_ASSERT_OK(rrc_txn_begin(&txn, _TEST_NEW_VERSION));
+    RRC_TEST_ASSERT(txn.count == 2);
+    _test_add_records(&txn, 2, _TEST_RECORDS);
+
+    struct rrc_installed_manifest installed;
+    rrc_installed_load(&installed);
+    RRC_TEST_ASSERT_OK(rrc_txn_commit(&txn, &installed));
+    rrc_installed_free(&installed);
+    rrc_txn_free(&txn);
+
+    _test_assert_new();
+}
+
+/* A log of another version is dropped together with its staged files. */
+static void test_other_version_discarded()
+{
+    _test_setup();
+    _test_write_log(_test_log, _test_boundaries[_TEST_RECORDS]);
+
+    struct rrc_txn txn;
+    RRC_TEST_ASSERT_OK(rrc_txn_begin(&txn, _TEST_NEW_VERSION + 1));
+    RRC_TEST_ASSERT(txn.count == 0 && _test_log_size() == _test_boundaries[0]);
+    rrc_txn_free(&txn);
+
+    char staged[PATH_MAX];
+    rrc_txn_stage_path(_TEST_A, staged, sizeof(staged));
+    RRC_TEST_ASSERT(!_test_exists(staged));
+    _test_assert_contents(_TEST_A, "old a");
+    RRC_TEST_ASSERT(_test_version == _TEST_OLD_VERSION);
+}
+
+int main()
+{
+    char dir[] = "/tmp/rrc-test-txn-XXXXXX";
+    RRC_TEST_ASSERT(mkdtemp(dir) != NULL && chdir(dir) == 0);
+
+    _test_record_log();
+
+    RRC_TEST_RUN(test_cut_everywhere);
+    RRC_TEST_RUN(test_replay_twice);
+    RRC_TEST_RUN(test_corrupted_records);
+    RRC_TEST_RUN(test_resume_after_torn_record);
+    RRC_TEST_RUN(test_other_version_discarded);
+
+    free(_test_log);
+
+    char command[64];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    return system(command);
+}
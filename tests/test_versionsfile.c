@@ -0,0 +1,323 @@
+/*
+    test_versionsfile.c - tests, fuzzing and benchmark of the versions file parser
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "test.h"
+#include "../source/time.h"
+#include "../source/update/versionsfile.h"
+
+static void test_next_field_separators()
+{
+    char line[] = "  a \t b\tc \t";
+    char *cursor = line;
+    RRC_TEST_ASSERT(strcmp(rrc_versionsfile_next_field(&cursor), "a") == 0);
+    RRC_TEST_ASSERT(strcmp(rrc_versionsfile_next_field(&cursor), "b") == 0);
+    RRC_TEST_ASSERT(strcmp(rrc_versionsfile_next_field(&cursor), "c") == 0);
+    RRC_TEST_ASSERT(rrc_versionsfile_next_field(&cursor) == NULL);
+    RRC_TEST_ASSERT(rrc_versionsfile_next_field(&cursor) == NULL);
+}
+
+static void test_next_line()
+{
+    char file[] = "\n\none\r\n\r\ntwo\rthree\r\r\nfour";
+    char *cursor = file;
+    RRC_TEST_ASSERT(strcmp(rrc_versionsfile_next_line(&cursor), "one") == 0);
+    RRC_TEST_ASSERT(strcmp(rrc_versionsfile_next_line(&cursor), "two") == 0);
+    RRC_TEST_ASSERT(strcmp(rrc_versionsfile_next_line(&cursor), "three") == 0);
+    RRC_TEST_ASSERT(strcmp(rrc_versionsfile_next_line(&cursor), "four") == 0);
+    RRC_TEST_ASSERT(rrc_versionsfile_next_line(&cursor) == NULL);
+}
+
+static void test_parse_verstring()
+{
+    int version;
+    char ok[] = "4.2.1";
+    RRC_TEST_ASSERT_OK(rrc_versionsfile_parse_verstring(ok, &version));
+    RRC_TEST_ASSERT(version == 421);
+
+    char empty_part[] = "4..1";
+    RRC_TEST_ASSERT_ERR(rrc_versionsfile_parse_verstring(empty_part, &version));
+    char too_large[] = "99999999999.0.0";
+    RRC_TEST_ASSERT_ERR(rrc_versionsfile_parse_verstring(too_large, &version));
+    char negative[] = "-4.0.0";
+    RRC_TEST_ASSERT_ERR(rrc_versionsfile_parse_verstring(negative, &version));
+}
+
+static void test_get_extra()
+{
+    char value[16];
+    RRC_TEST_ASSERT(rrc_versionsfile_get_extra("crc32=1234abcd delta=http://x", "crc32", value, sizeof(value)));
+    RRC_TEST_ASSERT(strcmp(value, "1234abcd") == 0);
+
+    /* Separated the same way as the fields, so tabs work too. */
+    RRC_TEST_ASSERT(rrc_versionsfile_get_extra("delta=x\tcrc32=1234abcd", "crc32", value, sizeof(value)));
+    RRC_TEST_ASSERT(strcmp(value, "1234abcd") == 0);
+    RRC_TEST_ASSERT(rrc_versionsfile_get_extra("\t crc32=ab\t \tdelta=x", "delta", value, sizeof(value)));
+    RRC_TEST_ASSERT(strcmp(value, "x") == 0);
+
+    /* Only whole keys match. */
+    RRC_TEST_ASSERT(!rrc_versionsfile_get_extra("crc32x=1 xcrc32=2 crc32", "crc32", value, sizeof(value)));
+    RRC_TEST_ASSERT(rrc_versionsfile_get_extra("crc32=", "crc32", value, sizeof(value)) && value[0] == '\0');
+
+    RRC_TEST_ASSERT(!rrc_versionsfile_get_extra(NULL, "crc32", value, sizeof(value)));
+    RRC_TEST_ASSERT(!rrc_versionsfile_get_extra("crc32=0123456789abcdef", "crc32", value, sizeof(value)));
+}
+
+static void test_necessary_urls()
+{
+    char file[] = "4.0.0 http://a/400.zip\r\n"
+                  "\r\n"
+                  "4.1.0\thttp://a/410.zip\tcrc32=00000001\r\n"
+                  "4.2.0 http://a/420.zip  crc32=00000002 delta=http://a/420.delta\n";
+    int count;
+    char **urls;
+    int *versions;
+    char **extras;
+    RRC_TEST_ASSERT_OK(rrc_versionsfile_get_necessary_urls_and_versions(file, 400, &count, &urls, &versions, &extras));
+
+    RRC_TEST_ASSERT(count == 2);
+    RRC_TEST_ASSERT(versions[0] == 410 && strcmp(urls[0], "http://a/410.zip") == 0 && strcmp(extras[0], "crc32=00000001") == 0);
+    RRC_TEST_ASSERT(versions[1] == 420 && strcmp(urls[1], "http://a/420.zip") == 0);
+
+    char value[64];
+    RRC_TEST_ASSERT(rrc_versionsfile_get_extra(extras[1], "delta", value, sizeof(value)) && strcmp(value, "http://a/420.delta") == 0);
+
+    free(urls);
+    free(versions);
+    free(extras);
+}
+
+static void test_necessary_urls_missing_url()
+{
+    char file[] = "4.0.0 http://a/400.zip\n4.1.0\n";
+    int count;
+    char **urls;
+    int *versions;
+    char **extras;
+    RRC_TEST_ASSERT_ERR(rrc_versionsfile_get_necessary_urls_and_versions(file, 0, &count, &urls, &versions, &extras));
+    free(urls);
+    free(versions);
+    free(extras);
+}
+
+static void test_deleted_files()
+{
+    char file[] = "4.1.0 RetroRewind6/a.szs\n\t4.2.0\tRetroRewind6/b.szs\r\n3.0.0 RetroRewind6/old.szs\n";
+    struct rrc_versionsfile_deleted_file *deleted;
+    int count;
+    RRC_TEST_ASSERT_OK(rrc_versionsfile_parse_deleted_files(file, 400, &deleted, &count));
+
+    RRC_TEST_ASSERT(count == 2);
+    RRC_TEST_ASSERT(deleted[0].version == 410 && strcmp(deleted[0].path, "RetroRewind6/a.szs") == 0);
+    RRC_TEST_ASSERT(deleted[1].version == 420 && strcmp(deleted[1].path, "RetroRewind6/b.szs") == 0);
+    free(deleted);
+}
+
+static u32 _test_rng_state = 0x12345678;
+
+/* xorshift32, so that every run fuzzes the same inputs */
+static u32 _test_rand()
+{
+    u32 x = _test_rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return _test_rng_state = x;
+}
+
+static bool _test_is_separator(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+/* Fills `buf' with `len' characters that are likely to hit the parser's edge cases. */
+static void _test_random_text(char *buf, int len)
+{
+    static const char alphabet[] = "0123456789.. \t\t\r\n\n=crc32=delta=ab/:";
+    for (int i = 0; i < len; i++)
+    {
+        buf[i] = alphabet[_test_rand() % (sizeof(alphabet) - 1)];
+    }
+    buf[len] = '\0';
+}
+
+#define _TEST_FUZZ_ITERATIONS 200000
+#define _TEST_FUZZ_MAX_LEN 96
+
+static void fuzz_fields()
+{
+    for (int iter = 0; iter < _TEST_FUZZ_ITERATIONS; iter++)
+    {
+        char line[_TEST_FUZZ_MAX_LEN + 1];
+        char copy[_TEST_FUZZ_MAX_LEN + 1];
+        _test_random_text(line, _test_rand() % _TEST_FUZZ_MAX_LEN);
+        strcpy(copy, line);
+
+        /* Every field must be exactly what is between two runs of separators. */
+        char *cursor = line;
+        char *field;
+        int pos = 0;
+        while ((field = rrc_versionsfile_next_field(&cursor)) != NULL)
+        {
+            while (_test_is_separator(copy[pos]))
+            {
+                pos++;
+            }
+            int len = strlen(field);
+            RRC_TEST_ASSERT(len > 0);
+            RRC_TEST_ASSERT(field == line + pos);
+            RRC_TEST_ASSERT(strncmp(field, copy + pos, len) == 0);
+            RRC_TEST_ASSERT(copy[pos + len] == '\0' || _test_is_separator(copy[pos + len]));
+            for (int i = 0; i < len; i++)
+            {
+                RRC_TEST_ASSERT(!_test_is_separator(field[i]));
+            }
+            pos += len;
+        }
+        while (_test_is_separator(copy[pos]))
+        {
+            pos++;
+        }
+        RRC_TEST_ASSERT(copy[pos] == '\0');
+
+        /* Whatever `get_extra' finds must be a whole value, without any separators in it. */
+        char value[_TEST_FUZZ_MAX_LEN + 1];
+        const char *keys[] = {"crc32", "delta", "a"};
+        for (int k = 0; k < 3; k++)
+        {
+            if (rrc_versionsfile_get_extra(copy, keys[k], value, sizeof(value)))
+            {
+                RRC_TEST_ASSERT(strcspn(value, " \t") == strlen(value));
+
+                char pair[_TEST_FUZZ_MAX_LEN + 8];
+                snprintf(pair, sizeof(pair), "%s=%s", keys[k], value);
+                const char *found = strstr(copy, pair);
+                RRC_TEST_ASSERT(found != NULL);
+            }
+        }
+    }
+}
+
+static void fuzz_files()
+{
+    for (int iter = 0; iter < _TEST_FUZZ_ITERATIONS; iter++)
+    {
+        char file[_TEST_FUZZ_MAX_LEN * 2 + 1];
+        _test_random_text(file, _test_rand() % (_TEST_FUZZ_MAX_LEN * 2));
+        char copy[sizeof(file)];
+        strcpy(copy, file);
+
+        int current = _test_rand() % 1000;
+        int count;
+        char **urls;
+        int *versions;
+        char **extras;
+        struct rrc_result res = rrc_versionsfile_get_necessary_urls_and_versions(file, current, &count, &urls, &versions, &extras);
+        if (!rrc_result_is_error(res))
+        {
+            for (int i = 0; i < count; i++)
+            {
+                RRC_TEST_ASSERT(versions[i] > current);
+                RRC_TEST_ASSERT(urls[i][0] != '\0' && strcspn(urls[i], " \t\r\n") == strlen(urls[i]));
+                RRC_TEST_ASSERT(extras[i] == NULL || (!_test_is_separator(extras[i][0]) && strcspn(extras[i], "\r\n") == strlen(extras[i])));
+            }
+        }
+        rrc_result_free(res);
+        free(urls);
+        free(versions);
+        free(extras);
+
+        struct rrc_versionsfile_deleted_file *deleted;
+        res = rrc_versionsfile_parse_deleted_files(copy, current, &deleted, &count);
+        if (!rrc_result_is_error(res))
+        {
+            for (int i = 0; i < count; i++)
+            {
+                RRC_TEST_ASSERT(deleted[i].version > current);
+                RRC_TEST_ASSERT(deleted[i].path[0] != '\0' && strcspn(deleted[i].path, " \t\r\n") == strlen(deleted[i].path));
+            }
+        }
+        rrc_result_free(res);
+        free(deleted);
+    }
+}
+
+#define _TEST_BENCH_ENTRIES 5000
+#define _TEST_BENCH_ROUNDS 50
+
+/* Parses a versions file far larger than the real one, to catch anything that doesn't scale linearly. */
+static void bench_parse()
+{
+    int len = 0;
+    char *file = malloc(_TEST_BENCH_ENTRIES * 128);
+    RRC_TEST_ASSERT(file != NULL);
+    for (int i = 0; i < _TEST_BENCH_ENTRIES; i++)
+    {
+        len += sprintf(file + len, "%d.%d.%d\thttp://update.example/%d.zip crc32=%08x delta=http://update.example/%d.manifest\n",
+                       i / 100, i / 10 % 10, i % 10, i, i * 2654435761u, i);
+    }
+
+    char *copy = malloc(len + 1);
+    RRC_TEST_ASSERT(copy != NULL);
+
+    rrc_time_tick start = gettime();
+    for (int round = 0; round < _TEST_BENCH_ROUNDS; round++)
+    {
+        memcpy(copy, file, len + 1);
+
+        int count;
+        char **urls;
+        int *versions;
+        char **extras;
+        RRC_TEST_ASSERT_OK(rrc_versionsfile_get_necessary_urls_and_versions(copy, 0, &count, &urls, &versions, &extras));
+        RRC_TEST_ASSERT(count == _TEST_BENCH_ENTRIES - 1);
+
+        char value[16];
+        for (int i = 0; i < count; i++)
+        {
+            RRC_TEST_ASSERT(rrc_versionsfile_get_extra(extras[i], "crc32", value, sizeof(value)));
+        }
+
+        free(urls);
+        free(versions);
+        free(extras);
+    }
+    u32 usec = diff_usec(start, gettime());
+
+    printf("    %d entries: %u us per parse, %u ns per entry\n", _TEST_BENCH_ENTRIES, usec / _TEST_BENCH_ROUNDS,
+           (u32)((u64)usec * 1000 / _TEST_BENCH_ROUNDS / _TEST_BENCH_ENTRIES));
+
+    free(copy);
+    free(file);
+}
+
+int main()
+{
+    RRC_TEST_RUN(test_next_field_separators);
+    RRC_TEST_RUN(test_next_line);
+    RRC_TEST_RUN(test_parse_verstring);
+    RRC_TEST_RUN(test_get_extra);
+    RRC_TEST_RUN(test_necessary_urls);
+    RRC_TEST_RUN(test_necessary_urls_missing_url);
+    RRC_TEST_RUN(test_deleted_files);
+    RRC_TEST_RUN(fuzz_fields);
+    RRC_TEST_RUN(fuzz_files);
+    RRC_TEST_RUN(bench_parse);
+    return 0;
+}
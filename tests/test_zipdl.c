@@ -0,0 +1,512 @@
+/*
+    test_zipdl.c - tests of update ZIP downloads against a local HTTP server
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "test.h"
+#include "../source/update/update.h"
+#include "../source/update/zipdl.h"
+#include "../source/update/dljournal.h"
+#include "../source/update/session.h"
+
+/* Larger than RRC_ZIPDL_SEGMENTED_THRESHOLD, so it's downloaded over several connections */
+#define _TEST_LARGE_LEN (1000 * 1000 * 17)
+#define _TEST_SMALL_LEN (1000 * 1000 * 3)
+/* Must match the amount of segments zipdl.c splits a download into */
+#define _TEST_SEGMENTS 4
+#define _TEST_MAX_REQUESTS 64
+
+/*
+    A minimal HTTP server on the loopback interface, serving `body' to every request on its own thread
+    so that segments are really downloaded concurrently. Every connection serves a single request.
+*/
+struct _test_request
+{
+    /* Requested range, or -1 if the whole file was asked for */
+    long long start;
+    long long end;
+};
+
+static struct
+{
+    int sock;
+    int port;
+    const u8 *body;
+    long long len;
+    /* Whether range requests are answered with 206 or with the whole file */
+    bool honour_range;
+    /* The next `drops' responses are cut off after `drop_after' bytes of the body */
+    int drops;
+    long long drop_after;
+    /* Closes connections without any response while set */
+    bool broken;
+
+    pthread_mutex_t lock;
+    struct _test_request requests[_TEST_MAX_REQUESTS];
+    int num_requests;
+    /* Connections still being served. A transfer that was given up on may leave one behind for a moment. */
+    int connections;
+    pthread_cond_t idle;
+} _test_server = {.lock = PTHREAD_MUTEX_INITIALIZER, .idle = PTHREAD_COND_INITIALIZER};
+
+static bool _test_send_all(int fd, const void *data, long long len)
+{
+    const u8 *p = data;
+    while (len > 0)
+    {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void *_test_serve_connection(void *arg)
+{
+    int fd = (int)(long)arg;
+
+    char req[4096];
+    int req_len = 0;
+    while (req_len < (int)sizeof(req) - 1)
+    {
+        ssize_t n = recv(fd, req + req_len, sizeof(req) - 1 - req_len, 0);
+        if (n <= 0)
+        {
+            close(fd);
+            return NULL;
+        }
+        req_len += n;
+        req[req_len] = '\0';
+        if (strstr(req, "\r\n\r\n") != NULL)
+        {
+            break;
+        }
+    }
+
+    struct _test_request request = {.start = -1, .end = -1};
+    const char *range = strstr(req, "Range: bytes=");
+    if (range != NULL)
+    {
+        char *endp;
+        request.start = strtoll(range + strlen("Range: bytes="), &endp, 10);
+        request.end = *endp == '-' && endp[1] >= '0' && endp[1] <= '9' ? strtoll(endp + 1, NULL, 10) : _test_server.len - 1;
+    }
+
+    pthread_mutex_lock(&_test_server.lock);
+    if (_test_server.num_requests < _TEST_MAX_REQUESTS)
+    {
+        _test_server.requests[_test_server.num_requests++] = request;
+    }
+    bool broken = _test_server.broken;
+    bool drop = !broken && _test_server.drops > 0;
+    if (drop)
+    {
+        _test_server.drops--;
+    }
+    pthread_mutex_unlock(&_test_server.lock);
+
+    if (!broken)
+    {
+        char header[256];
+        long long start = 0, end = _test_server.len - 1;
+        if (range != NULL && _test_server.honour_range)
+        {
+            start = request.start;
+            end = request.end;
+            snprintf(header, sizeof(header),
+                     "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %lld-%lld/%lld\r\nContent-Length: %lld\r\nConnection: close\r\n\r\n",
+                     start, end, _test_server.len, end - start + 1);
+        }
+        else
+        {
+            snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Length: %lld\r\nConnection: close\r\n\r\n", _test_server.len);
+        }
+
+        long long len = end - start + 1;
+        if (drop && len > _test_server.drop_after)
+        {
+            len = _test_server.drop_after;
+        }
+        if (_test_send_all(fd, header, strlen(header)))
+        {
+            _test_send_all(fd, _test_server.body + start, len);
+        }
+    }
+
+    shutdown(fd, SHUT_RDWR);
+    close(fd);
+
+    pthread_mutex_lock(&_test_server.lock);
+    _test_server.connections--;
+    pthread_cond_broadcast(&_test_server.idle);
+    pthread_mutex_unlock(&_test_server.lock);
+    return NULL;
+}
+
+static void *_test_serve(void *arg)
+{
+    for (;;)
+    {
+        int fd = accept(_test_server.sock, NULL, NULL);
+        if (fd < 0)
+        {
+            continue;
+        }
+
+        pthread_mutex_lock(&_test_server.lock);
+        _test_server.connections++;
+        pthread_mutex_unlock(&_test_server.lock);
+
+        pthread_t thread;
+        RRC_TEST_ASSERT(pthread_create(&thread, NULL, _test_serve_connection, (void *)(long)fd) == 0);
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+static void _test_server_start()
+{
+    _test_server.sock = socket(AF_INET, SOCK_STREAM, 0);
+    RRC_TEST_ASSERT(_test_server.sock >= 0);
+
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t addr_len = sizeof(addr);
+    RRC_TEST_ASSERT(bind(_test_server.sock, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    RRC_TEST_ASSERT(listen(_test_server.sock, 16) == 0);
+    RRC_TEST_ASSERT(getsockname(_test_server.sock, (struct sockaddr *)&addr, &addr_len) == 0);
+    _test_server.port = ntohs(addr.sin_port);
+
+    pthread_t thread;
+    RRC_TEST_ASSERT(pthread_create(&thread, NULL, _test_serve, NULL) == 0);
+    pthread_detach(thread);
+}
+
+/* Waits for every connection to be closed, so that nothing of an earlier test is still being served. Must hold the lock. */
+static void _test_server_wait_idle()
+{
+    while (_test_server.connections > 0)
+    {
+        pthread_cond_wait(&_test_server.idle, &_test_server.lock);
+    }
+}
+
+/* Serves the first `len' bytes of `body' from now on, with every range request honoured and nothing dropped. */
+static void _test_server_reset(const u8 *body, long long len)
+{
+    pthread_mutex_lock(&_test_server.lock);
+    _test_server_wait_idle();
+    _test_server.body = body;
+    _test_server.len = len;
+    _test_server.honour_range = true;
+    _test_server.drops = 0;
+    _test_server.broken = false;
+    _test_server.num_requests = 0;
+    pthread_mutex_unlock(&_test_server.lock);
+}
+
+static struct rrc_update_session _test_session;
+static u8 *_test_body;
+static char _test_url[64];
+
+static u32 _test_crc(const u8 *data, long long len)
+{
+    return crc32(crc32(0, Z_NULL, 0), data, len);
+}
+
+/* Checks that `path' holds exactly the first `len' bytes of the served body. */
+static void _test_assert_file(const char *path, long long len)
+{
+    FILE *file = fopen(path, "rb");
+    RRC_TEST_ASSERT(file != NULL);
+    u8 *data = malloc(len + 1);
+    RRC_TEST_ASSERT(data != NULL);
+    RRC_TEST_ASSERT(fread(data, 1, len + 1, file) == len);
+    RRC_TEST_ASSERT(memcmp(data, _test_body, len) == 0);
+    free(data);
+    fclose(file);
+}
+
+static bool _test_exists(const char *path)
+{
+    struct stat sb;
+    return stat(path, &sb) == 0;
+}
+
+/* Starts every test without a journal or partial download left over from the one before. */
+static void _test_clean()
+{
+    remove("update.zip");
+    remove(RRC_DLJOURNAL_PATH);
+    remove(RRC_DLJOURNAL_TMP_PATH);
+}
+
+/* Whether `start' is where one of the segments of a large download begins. */
+static bool _test_is_segment_start(long long start)
+{
+    return start % (_TEST_LARGE_LEN / _TEST_SEGMENTS) == 0 && start < _TEST_LARGE_LEN;
+}
+
+static void test_segmented()
+{
+    _test_clean();
+    _test_server_reset(_test_body, _TEST_LARGE_LEN);
+
+    u32 crc = _test_crc(_test_body, _TEST_LARGE_LEN);
+    RRC_TEST_ASSERT_OK(rrc_update_download_zip(&_test_session, _test_url, "update.zip", _TEST_LARGE_LEN, &crc, 0, 1));
+    _test_assert_file("update.zip", _TEST_LARGE_LEN);
+
+    /* Each segment is requested once, and together they cover the whole file exactly */
+    RRC_TEST_ASSERT(_test_server.num_requests == _TEST_SEGMENTS);
+    long long covered = 0;
+    for (int i = 0; i < _test_server.num_requests; i++)
+    {
+        struct _test_request *r = &_test_server.requests[i];
+        RRC_TEST_ASSERT(_test_is_segment_start(r->start));
+        covered += r->end - r->start + 1;
+    }
+    RRC_TEST_ASSERT(covered == _TEST_LARGE_LEN);
+
+    /* and the journal says there's nothing left to download */
+    struct rrc_dljournal journal;
+    rrc_dljournal_load(_test_url, _TEST_LARGE_LEN, RRC_DLJOURNAL_MODE_SEGMENTED, &journal);
+    RRC_TEST_ASSERT(journal.committed == _TEST_LARGE_LEN);
+}
+
+static void test_segmented_range_ignored()
+{
+    _test_clean();
+    _test_server_reset(_test_body, _TEST_LARGE_LEN);
+    _test_server.honour_range = false;
+
+    u32 crc = _test_crc(_test_body, _TEST_LARGE_LEN);
+    RRC_TEST_ASSERT_OK(rrc_update_download_zip(&_test_session, _test_url, "update.zip", _TEST_LARGE_LEN, &crc, 0, 1));
+    _test_assert_file("update.zip", _TEST_LARGE_LEN);
+
+    /*
+        The segments were given up on and the whole file was downloaded by a single plain request. A segment
+        that was given up on may be logged after that request, so the order isn't checked.
+    */
+    pthread_mutex_lock(&_test_server.lock);
+    _test_server_wait_idle();
+    pthread_mutex_unlock(&_test_server.lock);
+    RRC_TEST_ASSERT(_test_server.num_requests >= 2);
+    int plain = 0;
+    for (int i = 0; i < _test_server.num_requests; i++)
+    {
+        long long start = _test_server.requests[i].start;
+        if (start == -1)
+        {
+            plain++;
+        }
+        else
+        {
+            RRC_TEST_ASSERT(_test_is_segment_start(start));
+        }
+    }
+    RRC_TEST_ASSERT(plain == 1);
+}
+
+static void test_segmented_drop_resumes_segment()
+{
+    _test_clean();
+    _test_server_reset(_test_body, _TEST_LARGE_LEN);
+    _test_server.drops = 1;
+    _test_server.drop_after = 1000 * 1000;
+
+    u32 crc = _test_crc(_test_body, _TEST_LARGE_LEN);
+    RRC_TEST_ASSERT_OK(rrc_update_download_zip(&_test_session, _test_url, "update.zip", _TEST_LARGE_LEN, &crc, 0, 1));
+    _test_assert_file("update.zip", _TEST_LARGE_LEN);
+
+    /* Only the dropped segment was requested again, starting where it stopped */
+    RRC_TEST_ASSERT(_test_server.num_requests == _TEST_SEGMENTS + 1);
+    int resumed = 0;
+    for (int i = 0; i < _test_server.num_requests; i++)
+    {
+        long long start = _test_server.requests[i].start;
+        if (!_test_is_segment_start(start))
+        {
+            RRC_TEST_ASSERT(_test_is_segment_start(start - _test_server.drop_after));
+            resumed++;
+        }
+    }
+    RRC_TEST_ASSERT(resumed == 1);
+}
+
+static void test_segmented_resumes_from_journal()
+{
+    _test_clean();
+    _test_server_reset(_test_body, _TEST_LARGE_LEN);
+    /* Every response is cut off, so the segments run out of attempts */
+    _test_server.drops = _TEST_MAX_REQUESTS;
+    _test_server.drop_after = 1000 * 1000;
+
+    u32 crc = _test_crc(_test_body, _TEST_LARGE_LEN);
+    RRC_TEST_ASSERT_ERR(rrc_update_download_zip(&_test_session, _test_url, "update.zip", _TEST_LARGE_LEN, &crc, 0, 1));
+
+    struct rrc_dljournal journal;
+    rrc_dljournal_load(_test_url, _TEST_LARGE_LEN, RRC_DLJOURNAL_MODE_SEGMENTED, &journal);
+    RRC_TEST_ASSERT(journal.committed > 0 && journal.committed < _TEST_LARGE_LEN);
+
+    /* The next attempt only asks for what isn't in the journal yet */
+    _test_server_reset(_test_body, _TEST_LARGE_LEN);
+    RRC_TEST_ASSERT_OK(rrc_update_download_zip(&_test_session, _test_url, "update.zip", _TEST_LARGE_LEN, &crc, 0, 1));
+    _test_assert_file("update.zip", _TEST_LARGE_LEN);
+
+    long long requested = 0;
+    for (int i = 0; i < _test_server.num_requests; i++)
+    {
+        struct _test_request *r = &_test_server.requests[i];
+        RRC_TEST_ASSERT(r->start >= 0);
+        requested += r->end - r->start + 1;
+    }
+    RRC_TEST_ASSERT(requested == _TEST_LARGE_LEN - journal.committed);
+}
+
+static void test_crc_mismatch()
+{
+    _test_clean();
+    _test_server_reset(_test_body, _TEST_LARGE_LEN);
+
+    u32 crc = _test_crc(_test_body, _TEST_LARGE_LEN) ^ 1;
+    RRC_TEST_ASSERT_ERR(rrc_update_download_zip(&_test_session, _test_url, "update.zip", _TEST_LARGE_LEN, &crc, 0, 1));
+    /* A broken download must not be resumed */
+    RRC_TEST_ASSERT(!_test_exists(RRC_DLJOURNAL_PATH));
+}
+
+static void test_single_drop_resumes()
+{
+    _test_clean();
+    _test_server_reset(_test_body, _TEST_SMALL_LEN);
+    _test_server.drops = 1;
+    _test_server.drop_after = 1000 * 1000 * 2;
+
+    u32 crc = _test_crc(_test_body, _TEST_SMALL_LEN);
+    RRC_TEST_ASSERT_OK(rrc_update_download_zip(&_test_session, _test_url, "update.zip", _TEST_SMALL_LEN, &crc, 0, 1));
+    _test_assert_file("update.zip", _TEST_SMALL_LEN);
+
+    RRC_TEST_ASSERT(_test_server.num_requests == 2);
+    RRC_TEST_ASSERT(_test_server.requests[0].start == -1);
+    RRC_TEST_ASSERT(_test_server.requests[1].start == _test_server.drop_after);
+}
+
+static void test_single_resume_range_ignored()
+{
+    _test_clean();
+    _test_server_reset(_test_body, _TEST_SMALL_LEN);
+    _test_server.honour_range = false;
+    _test_server.drops = 1;
+    _test_server.drop_after = 1000 * 1000 * 2;
+
+    /* The whole file sent in response to the resume must replace what we had, not be appended to it */
+    u32 crc = _test_crc(_test_body, _TEST_SMALL_LEN);
+    RRC_TEST_ASSERT_OK(rrc_update_download_zip(&_test_session, _test_url, "update.zip", _TEST_SMALL_LEN, &crc, 0, 1));
+    _test_assert_file("update.zip", _TEST_SMALL_LEN);
+
+    RRC_TEST_ASSERT(_test_server.num_requests == 2);
+    RRC_TEST_ASSERT(_test_server.requests[1].start == _test_server.drop_after);
+}
+
+static void test_single_gives_up()
+{
+    _test_clean();
+    _test_server_reset(_test_body, _TEST_SMALL_LEN);
+    _test_server.broken = true;
+
+    RRC_TEST_ASSERT_ERR(rrc_update_download_zip(&_test_session, _test_url, "update.zip", _TEST_SMALL_LEN, NULL, 0, 1));
+    RRC_TEST_ASSERT(_test_server.num_requests == RRC_UPDATE_DOWNLOAD_ATTEMPTS);
+}
+
+static void test_to_memory()
+{
+    _test_clean();
+    u8 *mem = malloc(_TEST_LARGE_LEN);
+    RRC_TEST_ASSERT(mem != NULL);
+
+    /* Segmented, with a dropped segment */
+    _test_server_reset(_test_body, _TEST_LARGE_LEN);
+    _test_server.drops = 1;
+    _test_server.drop_after = 1000 * 1000;
+    u32 crc = _test_crc(_test_body, _TEST_LARGE_LEN);
+    RRC_TEST_ASSERT_OK(rrc_update_download_zip_to_memory(&_test_session, _test_url, mem, _TEST_LARGE_LEN, &crc, 0, 1));
+    RRC_TEST_ASSERT(memcmp(mem, _test_body, _TEST_LARGE_LEN) == 0);
+    RRC_TEST_ASSERT(_test_server.num_requests == _TEST_SEGMENTS + 1);
+
+    /* Single transfer, resumed after a drop */
+    memset(mem, 0, _TEST_SMALL_LEN);
+    _test_server_reset(_test_body, _TEST_SMALL_LEN);
+    _test_server.drops = 1;
+    _test_server.drop_after = 1000 * 1000;
+    crc = _test_crc(_test_body, _TEST_SMALL_LEN);
+    RRC_TEST_ASSERT_OK(rrc_update_download_zip_to_memory(&_test_session, _test_url, mem, _TEST_SMALL_LEN, &crc, 0, 1));
+    RRC_TEST_ASSERT(memcmp(mem, _test_body, _TEST_SMALL_LEN) == 0);
+    RRC_TEST_ASSERT(_test_server.requests[1].start == _test_server.drop_after);
+
+    /* Nothing in memory is journaled */
+    RRC_TEST_ASSERT(!_test_exists(RRC_DLJOURNAL_PATH));
+    free(mem);
+}
+
+int main()
+{
+    _test_body = malloc(_TEST_LARGE_LEN);
+    RRC_TEST_ASSERT(_test_body != NULL);
+    /* Anything but a repeating pattern, so bytes written at the wrong offset are noticed */
+    u32 state = 1;
+    for (long long i = 0; i < _TEST_LARGE_LEN; i++)
+    {
+        state = state * 1103515245 + 12345;
+        _test_body[i] = state >> 16;
+    }
+
+    _test_server_start();
+    snprintf(_test_url, sizeof(_test_url), "http://127.0.0.1:%d/update.zip", _test_server.port);
+    RRC_TEST_ASSERT_OK(rrc_update_session_init(&_test_session));
+
+    char dir[] = "/tmp/rrc-test-zipdl-XXXXXX";
+    RRC_TEST_ASSERT(mkdtemp(dir) != NULL && chdir(dir) == 0);
+
+    RRC_TEST_RUN(test_segmented);
+    RRC_TEST_RUN(test_segmented_range_ignored);
+    RRC_TEST_RUN(test_segmented_drop_resumes_segment);
+    RRC_TEST_RUN(test_segmented_resumes_from_journal);
+    RRC_TEST_RUN(test_crc_mismatch);
+    RRC_TEST_RUN(test_single_drop_resumes);
+    RRC_TEST_RUN(test_single_resume_range_ignored);
+    RRC_TEST_RUN(test_single_gives_up);
+    RRC_TEST_RUN(test_to_memory);
+
+    rrc_update_session_cleanup(&_test_session);
+    pthread_mutex_lock(&_test_server.lock);
+    _test_server_wait_idle();
+    pthread_mutex_unlock(&_test_server.lock);
+    free(_test_body);
+
+    char command[64];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    return system(command);
+}
@@ -0,0 +1,472 @@
+/*
+    test_zipstream.c - tests of extracting ZIP archives while they are received
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "test.h"
+#include "../source/buffer.h"
+#include "../source/update/zipstream.h"
+#include "../source/update/update.h"
+
+/*
+    The archives are written here with real deflate data and CRCs, and are laid out like any
+    zip tool would: local headers and file data, then the central directory and its end record.
+*/
+
+struct _test_entry
+{
+    const char *name;
+    const u8 *data;
+    u32 len;
+    bool deflate;
+    /* The sizes and CRC32 follow the data instead of being in the local header */
+    bool descriptor;
+    /* Whether the data descriptor starts with its optional signature */
+    bool descriptor_sig;
+    bool encrypted;
+    bool zip64;
+};
+
+struct rrc_result rrc_update_set_current_version(int version)
+{
+    return rrc_result_success;
+}
+
+static void _test_put16(struct rrc_buffer *buf, u16 v)
+{
+    u8 b[2] = {v, v >> 8};
+    RRC_TEST_ASSERT_OK(rrc_buffer_append(buf, b, sizeof(b)));
+}
+
+static void _test_put32(struct rrc_buffer *buf, u32 v)
+{
+    _test_put16(buf, v);
+    _test_put16(buf, v >> 16);
+}
+
+static u32 _test_crc(const u8 *data, u32 len)
+{
+    return crc32(crc32(0, Z_NULL, 0), data, len);
+}
+
+/* Appends the entry to `zip' and its central header to `cd'. */
+static void _test_zip_add(struct rrc_buffer *zip, struct rrc_buffer *cd, const struct _test_entry *entry)
+{
+    u8 *packed = (u8 *)entry->data;
+    u32 packed_len = entry->len;
+    if (entry->deflate)
+    {
+        z_stream z = {0};
+        RRC_TEST_ASSERT(deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+        packed_len = deflateBound(&z, entry->len);
+        packed = malloc(packed_len);
+        RRC_TEST_ASSERT(packed != NULL);
+        z.next_in = (Bytef *)entry->data;
+        z.avail_in = entry->len;
+        z.next_out = packed;
+        z.avail_out = packed_len;
+        RRC_TEST_ASSERT(deflate(&z, Z_FINISH) == Z_STREAM_END);
+        packed_len = z.total_out;
+        deflateEnd(&z);
+    }
+
+    u32 crc = _test_crc(entry->data, entry->len);
+    u16 flags = (entry->encrypted ? 1 : 0) | (entry->descriptor ? 8 : 0);
+    u16 method = entry->deflate ? 8 : 0;
+    u16 name_len = strlen(entry->name);
+    u16 extra_len = entry->zip64 ? 20 : 0;
+    u32 offset = zip->len;
+
+    _test_put32(zip, 0x04034b50);
+    _test_put16(zip, 20);
+    _test_put16(zip, flags);
+    _test_put16(zip, method);
+    _test_put32(zip, 0);
+    _test_put32(zip, entry->descriptor ? 0 : crc);
+    _test_put32(zip, entry->descriptor ? 0 : packed_len);
+    _test_put32(zip, entry->descriptor ? 0 : entry->len);
+    _test_put16(zip, name_len);
+    _test_put16(zip, extra_len);
+    RRC_TEST_ASSERT_OK(rrc_buffer_append(zip, entry->name, name_len));
+    if (entry->zip64)
+    {
+        /* Both sizes again, in 8 bytes each */
+        _test_put16(zip, 0x0001);
+        _test_put16(zip, 16);
+        _test_put32(zip, entry->len);
+        _test_put32(zip, 0);
+        _test_put32(zip, packed_len);
+        _test_put32(zip, 0);
+    }
+    RRC_TEST_ASSERT_OK(rrc_buffer_append(zip, packed, packed_len));
+    if (entry->descriptor)
+    {
+        if (entry->descriptor_sig)
+        {
+            _test_put32(zip, 0x08074b50);
+        }
+        _test_put32(zip, crc);
+        _test_put32(zip, packed_len);
+        _test_put32(zip, entry->len);
+    }
+
+    _test_put32(cd, 0x02014b50);
+    _test_put16(cd, 20);
+    _test_put16(cd, 20);
+    _test_put16(cd, flags);
+    _test_put16(cd, method);
+    _test_put32(cd, 0);
+    _test_put32(cd, crc);
+    _test_put32(cd, packed_len);
+    _test_put32(cd, entry->len);
+    _test_put16(cd, name_len);
+    /* extra field, comment, disk number, attributes */
+    _test_put16(cd, 0);
+    _test_put16(cd, 0);
+    _test_put16(cd, 0);
+    _test_put16(cd, 0);
+    _test_put32(cd, 0);
+    _test_put32(cd, offset);
+    RRC_TEST_ASSERT_OK(rrc_buffer_append(cd, entry->name, name_len));
+
+    if (packed != entry->data)
+    {
+        free(packed);
+    }
+}
+
+/* Builds an archive of `count' entries into `zip'. `cd_offset' gets where its central directory starts. */
+static void _test_zip_build(struct rrc_buffer *zip, const struct _test_entry *entries, int count, u32 *cd_offset)
+{
+    struct rrc_buffer cd;
+    rrc_buffer_init(zip);
+    rrc_buffer_init(&cd);
+    for (int i = 0; i < count; i++)
+    {
+        _test_zip_add(zip, &cd, &entries[i]);
+    }
+
+    *cd_offset = zip->len;
+    RRC_TEST_ASSERT_OK(rrc_buffer_append(zip, cd.data, cd.len));
+    _test_put32(zip, 0x06054b50);
+    _test_put32(zip, 0);
+    _test_put16(zip, count);
+    _test_put16(zip, count);
+    _test_put32(zip, cd.len);
+    _test_put32(zip, *cd_offset);
+    _test_put16(zip, 0);
+    rrc_buffer_free(&cd);
+}
+
+#define _TEST_BIG_LEN (300 * 1024)
+#define _TEST_SMALL_LEN 1000
+#define _TEST_NUM_ENTRIES 7
+/* Entries that are files rather than directories */
+#define _TEST_NUM_FILES 6
+
+static u8 _test_big[_TEST_BIG_LEN];
+static u8 _test_small[_TEST_SMALL_LEN];
+
+/* Every kind of entry that can be streamed: a directory, deflated and stored files, empty ones, and both kinds of data descriptor. */
+static const struct _test_entry _test_entries[_TEST_NUM_ENTRIES] = {
+    {.name = "RetroRewind6/"},
+    {.name = "RetroRewind6/Race/big.szs", .data = _test_big, .len = _TEST_BIG_LEN, .deflate = true},
+    {.name = "RetroRewind6/stored.txt", .data = _test_small, .len = _TEST_SMALL_LEN},
+    {.name = "RetroRewind6/empty.txt"},
+    {.name = "RetroRewind6/empty.szs", .deflate = true},
+    {.name = "RetroRewind6/described.szs", .data = _test_big + 1000, .len = 50000, .deflate = true, .descriptor = true, .descriptor_sig = true},
+    {.name = "RetroRewind6/unsigned.szs", .data = _test_small, .len = _TEST_SMALL_LEN, .deflate = true, .descriptor = true},
+};
+
+static struct rrc_buffer _test_zip;
+static u32 _test_cd_offset;
+
+/* Removes everything extracted before and starts with no installed files. */
+static void _test_clean()
+{
+    RRC_TEST_ASSERT(system("rm -rf RetroRewind6 RetroRewindChannel") == 0);
+    rrc_update_forget_parent_dirs();
+}
+
+static bool _test_exists(const char *path)
+{
+    struct stat sb;
+    return stat(path, &sb) == 0;
+}
+
+static void _test_assert_file(const char *path, const u8 *data, u32 len)
+{
+    FILE *file = fopen(path, "rb");
+    RRC_TEST_ASSERT(file != NULL);
+    u8 *contents = malloc(len + 1);
+    RRC_TEST_ASSERT(contents != NULL);
+    RRC_TEST_ASSERT(fread(contents, 1, len + 1, file) == len);
+    RRC_TEST_ASSERT(len == 0 || memcmp(contents, data, len) == 0);
+    free(contents);
+    fclose(file);
+}
+
+/* Checks that every file of the test archive was extracted intact, and recorded with its CRC32. */
+static void _test_assert_extracted(struct rrc_installed_manifest *installed)
+{
+    for (int i = 0; i < _TEST_NUM_ENTRIES; i++)
+    {
+        const struct _test_entry *entry = &_test_entries[i];
+        if (entry->name[strlen(entry->name) - 1] == '/')
+        {
+            continue;
+        }
+
+        _test_assert_file(entry->name, entry->data, entry->len);
+        RRC_TEST_ASSERT(rrc_installed_matches(installed, entry->name, _test_crc(entry->data, entry->len), entry->len));
+    }
+}
+
+/* Feeds `zip' from `from' on in chunks of `chunk' bytes, stopping at `to'. */
+static struct rrc_result _test_feed(struct rrc_zipstream *zs, const struct rrc_buffer *zip, u32 from, u32 to, u32 chunk)
+{
+    for (u32 off = from; off < to; off += chunk)
+    {
+        u32 len = to - off < chunk ? to - off : chunk;
+        TRY(rrc_zipstream_feed(zs, zip->data + off, len));
+    }
+    return rrc_result_success;
+}
+
+/* The same archive fed a byte at a time, in odd chunks that never line up with a record, and all at once. */
+static void test_chunk_sizes()
+{
+    const u32 chunks[] = {1, 7, 4093, 65521, _test_zip.len};
+    for (u32 c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++)
+    {
+        _test_clean();
+        struct rrc_installed_manifest installed;
+        rrc_installed_load(&installed);
+
+        struct rrc_zipstream zs;
+        rrc_zipstream_init(&zs, 0, &installed, NULL, NULL, NULL);
+        RRC_TEST_ASSERT_OK(_test_feed(&zs, &_test_zip, 0, _test_zip.len, chunks[c]));
+        RRC_TEST_ASSERT_OK(rrc_zipstream_finish(&zs));
+        RRC_TEST_ASSERT(zs.entries == _TEST_NUM_ENTRIES && !zs.unsupported);
+        RRC_TEST_ASSERT(zs.committed == _test_cd_offset);
+        rrc_zipstream_free(&zs);
+
+        _test_assert_extracted(&installed);
+        rrc_installed_free(&installed);
+    }
+}
+
+/* Extracted files are staged in the transaction instead, with their CRC32 and size in its records. */
+static void test_staged()
+{
+    _test_clean();
+    RRC_TEST_ASSERT(mkdir("RetroRewindChannel", 0777) == 0);
+    struct rrc_installed_manifest installed;
+    rrc_installed_load(&installed);
+    struct rrc_txn txn;
+    RRC_TEST_ASSERT_OK(rrc_txn_begin(&txn, 101));
+
+    struct rrc_zipstream zs;
+    rrc_zipstream_init(&zs, 0, &installed, &txn, NULL, NULL);
+    RRC_TEST_ASSERT_OK(_test_feed(&zs, &_test_zip, 0, _test_zip.len, 4093));
+    RRC_TEST_ASSERT_OK(rrc_zipstream_finish(&zs));
+    rrc_zipstream_free(&zs);
+
+    RRC_TEST_ASSERT(txn.count == _TEST_NUM_FILES);
+    for (u32 i = 0; i < txn.count; i++)
+    {
+        const struct _test_entry *entry = &_test_entries[i + 1];
+        struct rrc_txn_record *record = &txn.records[i];
+        RRC_TEST_ASSERT(record->type == RRC_TXN_RECORD_STAGED && record->tracked && strcmp(record->path, entry->name) == 0);
+        RRC_TEST_ASSERT(record->crc == _test_crc(entry->data, entry->len) && record->size == entry->len);
+
+        char staged[PATH_MAX];
+        rrc_txn_stage_path(entry->name, staged, sizeof(staged));
+        _test_assert_file(staged, entry->data, entry->len);
+        RRC_TEST_ASSERT(!_test_exists(entry->name));
+    }
+
+    rrc_txn_free(&txn);
+    rrc_installed_free(&installed);
+}
+
+/* Installed files and files a later update replaces are passed over without writing anything. */
+static void test_skipped_entries()
+{
+    _test_clean();
+    struct rrc_installed_manifest installed;
+    rrc_installed_load(&installed);
+    const struct _test_entry *big = &_test_entries[1], *described = &_test_entries[5];
+
+    /* Recorded as installed, with contents that would be overwritten if it was extracted anyway */
+    u8 *placeholder = malloc(big->len);
+    RRC_TEST_ASSERT(placeholder != NULL);
+    memset(placeholder, 'z', big->len);
+    RRC_TEST_ASSERT_OK(rrc_update_create_parent_dirs(big->name));
+    FILE *file = fopen(big->name, "wb");
+    RRC_TEST_ASSERT(file != NULL && fwrite(placeholder, 1, big->len, file) == big->len && fclose(file) == 0);
+    RRC_TEST_ASSERT_OK(rrc_installed_set(&installed, big->name, _test_crc(big->data, big->len), big->len));
+
+    struct rrc_strset skip;
+    rrc_strset_init(&skip);
+    RRC_TEST_ASSERT_OK(rrc_strset_add(&skip, described->name));
+
+    struct rrc_zipstream zs;
+    rrc_zipstream_init(&zs, 0, &installed, NULL, &skip, NULL);
+    RRC_TEST_ASSERT_OK(_test_feed(&zs, &_test_zip, 0, _test_zip.len, 7));
+    RRC_TEST_ASSERT_OK(rrc_zipstream_finish(&zs));
+    RRC_TEST_ASSERT(zs.entries == _TEST_NUM_ENTRIES);
+    rrc_zipstream_free(&zs);
+
+    _test_assert_file(big->name, placeholder, big->len);
+    RRC_TEST_ASSERT(!_test_exists(described->name));
+    free(placeholder);
+    _test_assert_file(_test_entries[2].name, _test_entries[2].data, _test_entries[2].len);
+    _test_assert_file(_test_entries[6].name, _test_entries[6].data, _test_entries[6].len);
+
+    rrc_strset_free(&skip);
+    rrc_installed_free(&installed);
+}
+
+/*
+    An extractor that is stopped anywhere can be replaced by a fresh one starting at the offset
+    the first one committed, which finishes the archive as if nothing happened.
+*/
+static void test_resume_from_committed()
+{
+    for (u32 cut = 0; cut < _test_zip.len; cut += 1237)
+    {
+        _test_clean();
+        struct rrc_installed_manifest installed;
+        rrc_installed_load(&installed);
+
+        struct rrc_zipstream zs;
+        rrc_zipstream_init(&zs, 0, &installed, NULL, NULL, NULL);
+        RRC_TEST_ASSERT_OK(_test_feed(&zs, &_test_zip, 0, cut, 4093));
+        u64 committed = zs.committed;
+        int entries = zs.entries;
+        RRC_TEST_ASSERT(committed <= cut);
+        rrc_zipstream_free(&zs);
+
+        rrc_zipstream_init(&zs, committed, &installed, NULL, NULL, NULL);
+        RRC_TEST_ASSERT_OK(_test_feed(&zs, &_test_zip, committed, _test_zip.len, 4093));
+        RRC_TEST_ASSERT_OK(rrc_zipstream_finish(&zs));
+        RRC_TEST_ASSERT(entries + zs.entries == _TEST_NUM_ENTRIES);
+        RRC_TEST_ASSERT(zs.committed == _test_cd_offset);
+        rrc_zipstream_free(&zs);
+
+        _test_assert_extracted(&installed);
+        rrc_installed_free(&installed);
+    }
+}
+
+/* Feeds a single `entry' followed by an intact one, which must never be reached. */
+static void _test_assert_unsupported(struct _test_entry entry)
+{
+    struct _test_entry entries[2] = {entry, _test_entries[2]};
+    struct rrc_buffer zip;
+    u32 cd_offset;
+    _test_zip_build(&zip, entries, 2, &cd_offset);
+
+    _test_clean();
+    struct rrc_zipstream zs;
+    rrc_zipstream_init(&zs, 0, NULL, NULL, NULL, NULL);
+    RRC_TEST_ASSERT_ERR(_test_feed(&zs, &zip, 0, zip.len, 1));
+    RRC_TEST_ASSERT(zs.unsupported && zs.entries == 0 && zs.committed == 0);
+    rrc_zipstream_free(&zs);
+
+    RRC_TEST_ASSERT(!_test_exists(entry.name) && !_test_exists(_test_entries[2].name));
+    rrc_buffer_free(&zip);
+}
+
+/* Archives that can only be extracted once they're complete make the caller fall back to libzip. */
+static void test_unsupported()
+{
+    _test_assert_unsupported((struct _test_entry){.name = "zip64.szs", .data = _test_small, .len = 100, .deflate = true, .zip64 = true});
+    _test_assert_unsupported((struct _test_entry){.name = "encrypted.szs", .data = _test_small, .len = 100, .encrypted = true});
+    _test_assert_unsupported((struct _test_entry){.name = "stored.szs", .data = _test_small, .len = 100, .descriptor = true, .descriptor_sig = true});
+}
+
+/* Damage that the stream notices itself is an error, but not a reason to fall back. */
+static void test_corrupted()
+{
+    const struct _test_entry *stored = &_test_entries[2];
+    struct rrc_buffer zip;
+    u32 cd_offset;
+    _test_zip_build(&zip, stored, 1, &cd_offset);
+
+    /* A byte of the file data is flipped, which only its CRC32 shows */
+    _test_clean();
+    zip.data[30 + strlen(stored->name) + 10] ^= 0x01;
+    struct rrc_zipstream zs;
+    rrc_zipstream_init(&zs, 0, NULL, NULL, NULL, NULL);
+    RRC_TEST_ASSERT_ERR(_test_feed(&zs, &zip, 0, zip.len, 7));
+    RRC_TEST_ASSERT(!zs.unsupported && zs.entries == 0);
+    rrc_zipstream_free(&zs);
+
+    /* Not a local header at all */
+    zip.data[0] ^= 0x01;
+    rrc_zipstream_init(&zs, 0, NULL, NULL, NULL, NULL);
+    RRC_TEST_ASSERT_ERR(_test_feed(&zs, &zip, 0, zip.len, 7));
+    RRC_TEST_ASSERT(!zs.unsupported);
+    rrc_zipstream_free(&zs);
+    rrc_buffer_free(&zip);
+
+    /* The archive ends in the middle of an entry */
+    _test_clean();
+    rrc_zipstream_init(&zs, 0, NULL, NULL, NULL, NULL);
+    RRC_TEST_ASSERT_OK(_test_feed(&zs, &_test_zip, 0, _test_cd_offset - 5, 4093));
+    RRC_TEST_ASSERT_ERR(rrc_zipstream_finish(&zs));
+    rrc_zipstream_free(&zs);
+}
+
+int main()
+{
+    char dir[] = "/tmp/rrc-test-zipstream-XXXXXX";
+    RRC_TEST_ASSERT(mkdtemp(dir) != NULL && chdir(dir) == 0);
+
+    /* Compressible, but not trivially so */
+    u32 seed = 0x12345678;
+    for (u32 i = 0; i < _TEST_BIG_LEN; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        _test_big[i] = 'a' + ((seed >> 16) % 16);
+    }
+    for (u32 i = 0; i < _TEST_SMALL_LEN; i++)
+    {
+        _test_small[i] = i * 7;
+    }
+    _test_zip_build(&_test_zip, _test_entries, _TEST_NUM_ENTRIES, &_test_cd_offset);
+
+    RRC_TEST_RUN(test_chunk_sizes);
+    RRC_TEST_RUN(test_staged);
+    RRC_TEST_RUN(test_skipped_entries);
+    RRC_TEST_RUN(test_resume_from_committed);
+    RRC_TEST_RUN(test_unsupported);
+    RRC_TEST_RUN(test_corrupted);
+
+    rrc_buffer_free(&_test_zip);
+
+    char command[64];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    return system(command);
+}
@@ -0,0 +1,217 @@
+/*
+    mkdelta.c - generates patches for delta updates
+    Copyright (C) 2025  Retro Rewind Team
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+    Runs on the machine that publishes updates, not on the Wii. Build and run it with
+
+        cc -O2 -o mkdelta tools/mkdelta.c -lz
+        ./mkdelta <old file> <new file> <patch>
+
+    It writes a patch that rebuilds <new file> from <old file> in the format described in
+    source/update/delta.c, and prints the `base_crc new_crc new_size' fields of the file's line in
+    the delta manifest, which only lack the path and the URLs of the patch and of the full file.
+
+    Every block of the old file is indexed by its hash, and the new file is scanned with a rolling
+    hash of the same length. Matches are grown as far as the files agree in both directions and
+    become copy operations; everything in between becomes add operations.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+#define PATCH_MAGIC 0x52524450 /* RRDP */
+#define PATCH_VERSION 0
+
+#define OP_COPY 0
+#define OP_ADD 1
+
+/* Matches shorter than this aren't found, and wouldn't save much over their 9 byte copy operation anyway. */
+#define BLOCK_SIZE 32
+#define HASH_BITS 20
+#define HASH_BASE 257u
+
+static uint8_t *read_file(const char *path, uint32_t *len)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        return NULL;
+    }
+
+    uint8_t *data = NULL;
+    long size;
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0 ||
+        (data = malloc(size > 0 ? size : 1)) == NULL || fread(data, 1, size, file) != (size_t)size)
+    {
+        perror(path);
+        free(data);
+        fclose(file);
+        return NULL;
+    }
+
+    fclose(file);
+    *len = size;
+    return data;
+}
+
+static void put32(FILE *out, uint32_t v)
+{
+    uint8_t bytes[4] = {v >> 24, v >> 16, v >> 8, v};
+    fwrite(bytes, 1, sizeof(bytes), out);
+}
+
+static void emit_add(FILE *out, const uint8_t *data, uint32_t len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+
+    fputc(OP_ADD, out);
+    put32(out, len);
+    fwrite(data, 1, len, out);
+}
+
+static void emit_copy(FILE *out, uint32_t offset, uint32_t len)
+{
+    fputc(OP_COPY, out);
+    put32(out, offset);
+    put32(out, len);
+}
+
+static uint32_t hash_block(const uint8_t *p)
+{
+    uint32_t h = 0;
+    for (int i = 0; i < BLOCK_SIZE; i++)
+    {
+        h = h * HASH_BASE + p[i];
+    }
+    return h;
+}
+
+static uint32_t hash_slot(uint32_t h)
+{
+    return (h * 2654435761u) >> (32 - HASH_BITS);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 4)
+    {
+        fprintf(stderr, "usage: %s <old file> <new file> <patch>\n", argv[0]);
+        return 2;
+    }
+
+    uint32_t base_len, new_len;
+    uint8_t *base = read_file(argv[1], &base_len);
+    uint8_t *new = read_file(argv[2], &new_len);
+    if (base == NULL || new == NULL)
+    {
+        return 1;
+    }
+
+    /* Offset + 1 of the first block of the old file with each hash, 0 for none. */
+    uint32_t *table = calloc(1u << HASH_BITS, sizeof(uint32_t));
+    if (table == NULL)
+    {
+        perror("calloc");
+        return 1;
+    }
+    for (uint32_t off = 0; off + BLOCK_SIZE <= base_len; off += BLOCK_SIZE)
+    {
+        uint32_t *slot = &table[hash_slot(hash_block(base + off))];
+        if (*slot == 0)
+        {
+            *slot = off + 1;
+        }
+    }
+
+    FILE *out = fopen(argv[3], "wb");
+    if (out == NULL)
+    {
+        perror(argv[3]);
+        return 1;
+    }
+    put32(out, PATCH_MAGIC);
+    put32(out, PATCH_VERSION);
+    put32(out, new_len);
+
+    /* HASH_BASE^(BLOCK_SIZE - 1), to take the byte leaving the window out of the rolling hash */
+    uint32_t top = 1;
+    for (int i = 0; i < BLOCK_SIZE - 1; i++)
+    {
+        top *= HASH_BASE;
+    }
+
+    uint32_t pos = 0, add_start = 0;
+    uint32_t h = new_len >= BLOCK_SIZE ? hash_block(new) : 0;
+    while (pos + BLOCK_SIZE <= new_len)
+    {
+        uint32_t candidate = table[hash_slot(h)];
+        if (candidate != 0 && memcmp(base + candidate - 1, new + pos, BLOCK_SIZE) == 0)
+        {
+            uint32_t from = candidate - 1, start = pos;
+            while (start > add_start && from > 0 && base[from - 1] == new[start - 1])
+            {
+                start--;
+                from--;
+            }
+
+            uint32_t len = pos - start + BLOCK_SIZE;
+            while (start + len < new_len && from + len < base_len && base[from + len] == new[start + len])
+            {
+                len++;
+            }
+
+            emit_add(out, new + add_start, start - add_start);
+            emit_copy(out, from, len);
+            pos = add_start = start + len;
+            if (pos + BLOCK_SIZE <= new_len)
+            {
+                h = hash_block(new + pos);
+            }
+            continue;
+        }
+
+        if (pos + BLOCK_SIZE < new_len)
+        {
+            h = (h - new[pos] * top) * HASH_BASE + new[pos + BLOCK_SIZE];
+        }
+        pos++;
+    }
+    emit_add(out, new + add_start, new_len - add_start);
+
+    if (fclose(out) != 0)
+    {
+        perror(argv[3]);
+        return 1;
+    }
+
+    uint32_t base_crc = crc32(crc32(0, Z_NULL, 0), base, base_len);
+    uint32_t new_crc = crc32(crc32(0, Z_NULL, 0), new, new_len);
+    printf("%08x %08x %u\n", base_crc, new_crc, new_len);
+
+    free(table);
+    free(base);
+    free(new);
+    return 0;
+}